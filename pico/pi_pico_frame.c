@@ -0,0 +1,209 @@
+#include <string.h>
+
+#include "pi_pico_frame.h"
+
+// CRC-16/CCITT a byte at a time, the table is 512 bytes of flash on the pico
+static const uint16_t pi_pico_crc_table[256] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+    0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+    0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+    0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+    0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+    0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+    0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+    0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+    0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+    0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+    0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+    0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+    0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+    0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+    0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+    0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+    0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+    0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+    0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+    0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+    0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+    0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+    0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+    0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+    0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+    0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0
+};
+
+/// @brief CRC-16/CCITT, table driven
+/// @param crc 0xFFFF to start, or the CRC so far to carry on
+/// @param data bytes
+/// @param len number of bytes
+/// @return the CRC including data
+uint16_t pi_pico_crc16(uint16_t crc, const uint8_t *data, uint32_t len)
+{
+    for (uint32_t i = 0; i < len; i++)
+        crc = (uint16_t)(crc << 8) ^ pi_pico_crc_table[(uint8_t)(crc >> 8) ^ data[i]];
+    return crc;
+}
+
+/// @brief Builds a frame
+/// @param buf room for PI_PICO_FRAME_SIZE(len) bytes
+/// @param sof PI_PICO_SOF_REQUEST or PI_PICO_SOF_REPLY
+/// @param cmd command
+/// @param seq sequence number
+/// @param status PI_PICO_STATUS_*, 0 for a request
+/// @param payload payload, may be NULL if len is 0
+/// @param len payload bytes, no more than PI_PICO_FRAME_MAX_PAYLOAD
+/// @return frame bytes
+uint32_t pi_pico_frame_build(uint8_t *buf, uint8_t sof, uint8_t cmd, uint8_t seq, uint8_t status,
+                             const uint8_t *payload, uint8_t len)
+{
+    if (len > PI_PICO_FRAME_MAX_PAYLOAD)
+        len = PI_PICO_FRAME_MAX_PAYLOAD;
+
+    buf[0] = sof;
+    buf[1] = cmd;
+    buf[2] = seq;
+    buf[3] = status;
+    buf[4] = len;
+    if (len != 0)
+        memcpy(buf + PI_PICO_FRAME_HEADER, payload, len);
+
+    uint32_t n = PI_PICO_FRAME_HEADER + len;
+    uint16_t crc = pi_pico_crc16(0xFFFF, buf, n);
+    buf[n] = (uint8_t)crc;
+    buf[n + 1] = (uint8_t)(crc >> 8);
+
+    return n + PI_PICO_FRAME_CRC;
+}
+
+/// @brief Checks a frame at the start of a buffer
+/// @param buf bytes received, anything after the frame is padding
+/// @param size bytes in buf
+/// @param sof start of frame expected
+/// @param frame returns the header, with the payload pointing into buf
+/// @return PI_PICO_FRAME_OK, PI_PICO_FRAME_NONE if there's no start of frame, PI_PICO_FRAME_CORRUPT otherwise
+pi_pico_frame_result_t pi_pico_frame_parse(const uint8_t *buf, uint32_t size, uint8_t sof, pi_pico_frame_t *frame)
+{
+    if (size < PI_PICO_FRAME_SIZE(0) || buf[0] != sof)
+        return PI_PICO_FRAME_NONE;
+
+    uint8_t len = buf[4];
+    if (len > PI_PICO_FRAME_MAX_PAYLOAD || size < PI_PICO_FRAME_SIZE(len))
+        return PI_PICO_FRAME_CORRUPT;
+
+    uint32_t n = PI_PICO_FRAME_HEADER + len;
+    uint16_t crc = pi_pico_crc16(0xFFFF, buf, n);
+    if (buf[n] != (uint8_t)crc || buf[n + 1] != (uint8_t)(crc >> 8))
+        return PI_PICO_FRAME_CORRUPT;
+
+    frame->cmd = buf[1];
+    frame->seq = buf[2];
+    frame->status = buf[3];
+    frame->len = len;
+    frame->payload = buf + PI_PICO_FRAME_HEADER;
+
+    return PI_PICO_FRAME_OK;
+}
+
+/// @brief Sets up the slave's side of the protocol
+/// @param slave slave state
+/// @param handler runs the commands
+/// @param ctx passed to the handler
+void pi_pico_slave_init(pi_pico_slave_t *slave, pi_pico_handler_t handler, void *ctx)
+{
+    memset(slave, 0, sizeof(pi_pico_slave_t));
+    slave->handler = handler;
+    slave->ctx = ctx;
+}
+
+/// @brief Takes the request of a whole transaction, once CS has gone high, and builds its reply
+/// @param slave slave state
+/// @param rx bytes received in the transaction
+/// @param len number of bytes
+/// @param reply_len returns the bytes of the reply
+/// @return the reply to stage for the next transaction, valid until the next call
+const uint8_t *pi_pico_slave_request(pi_pico_slave_t *slave, const uint8_t *rx, uint32_t len, uint32_t *reply_len)
+{
+    pi_pico_frame_t req;
+
+    if (pi_pico_frame_parse(rx, len, PI_PICO_SOF_REQUEST, &req) != PI_PICO_FRAME_OK)
+    {
+        // the command and sequence number may well be wrong too, they're only echoed for the log
+        slave->bad_frames++;
+        *reply_len = pi_pico_frame_build(slave->nak, PI_PICO_SOF_REPLY, len > 1 ? rx[1] : 0, len > 2 ? rx[2] : 0,
+                                         PI_PICO_STATUS_BAD_FRAME, NULL, 0);
+        return slave->nak;
+    }
+
+    if (slave->have_last && req.seq == slave->last_seq && req.cmd == slave->last_cmd)
+    {
+        slave->retries++;
+        *reply_len = slave->reply_len;
+        return slave->reply;
+    }
+
+    uint8_t payload[PI_PICO_FRAME_MAX_PAYLOAD];
+    uint8_t payload_len = 0;
+    uint8_t status = slave->handler(slave->ctx, req.cmd, req.payload, req.len, payload, &payload_len);
+
+    slave->requests++;
+    slave->have_last = true;
+    slave->last_cmd = req.cmd;
+    slave->last_seq = req.seq;
+    slave->reply_len = pi_pico_frame_build(slave->reply, PI_PICO_SOF_REPLY, req.cmd, req.seq, status, payload, payload_len);
+
+    *reply_len = slave->reply_len;
+    return slave->reply;
+}
+
+/// @brief Sets up an empty snapshot
+/// @param snap snapshot
+/// @param len bytes in each reading, up to PI_PICO_FRAME_MAX_PAYLOAD
+void pi_pico_snapshot_init(pi_pico_snapshot_t *snap, uint8_t len)
+{
+    memset(snap, 0, sizeof(pi_pico_snapshot_t));
+    snap->len = len <= PI_PICO_FRAME_MAX_PAYLOAD ? len : PI_PICO_FRAME_MAX_PAYLOAD;
+}
+
+/// @brief The buffer for the sampler to fill, not read by anyone until it is published
+/// @param snap snapshot
+/// @return snap->len bytes
+uint8_t *pi_pico_snapshot_back(pi_pico_snapshot_t *snap)
+{
+    uint32_t generation = atomic_load_explicit(&snap->generation, memory_order_relaxed);
+    return snap->data[(generation + 1) & 1];
+}
+
+/// @brief Makes the back buffer the one replies are made from
+/// @param snap snapshot
+void pi_pico_snapshot_publish(pi_pico_snapshot_t *snap)
+{
+    uint32_t generation = atomic_load_explicit(&snap->generation, memory_order_relaxed);
+    atomic_store_explicit(&snap->generation, generation + 1, memory_order_release);
+}
+
+/// @brief Copies the latest reading
+/// @param snap snapshot
+/// @param out room for snap->len bytes
+/// @return bytes copied
+uint8_t pi_pico_snapshot_read(pi_pico_snapshot_t *snap, uint8_t *out)
+{
+    uint32_t before, after;
+
+    // once the sampler publishes, the buffer just copied is its back buffer and may be part written -
+    // any publish while copying means the copy can be torn, so it is taken again
+    do
+    {
+        before = atomic_load_explicit(&snap->generation, memory_order_acquire);
+        memcpy(out, snap->data[before & 1], snap->len);
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&snap->generation, memory_order_relaxed);
+    } while (after != before);
+
+    return snap->len;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// framed protocol between the host and the pico slave, shared by both sides
+//
+// every transaction is full duplex: the host sends a request frame on MOSI while the pico clocks
+// out, on MISO, the reply to the request before it, staged in its TX FIFO as soon as that request
+// came in. So a reply is one transaction behind its request, and a host repeating a read gets one
+// reply per transaction.
+//
+//   byte 0      start of frame, PI_PICO_SOF_REQUEST or PI_PICO_SOF_REPLY
+//   byte 1      command, a reply carries the command it answers
+//   byte 2      sequence number, a reply carries that of the request it answers
+//   byte 3      status, PI_PICO_STATUS_*, 0 in a request
+//   byte 4      payload length, up to PI_PICO_FRAME_MAX_PAYLOAD
+//   payload
+//   CRC-16/CCITT (poly 0x1021, init 0xFFFF) of all of the above, little endian
+//
+// a request repeating the sequence number and command of the last one the pico took is a retry:
+// the pico stages the reply it already has again instead of running the command twice, so any
+// command can be retried, not just the reads. A request that fails its check is answered with
+// PI_PICO_STATUS_BAD_FRAME and not run at all.
+//
+// the pico starts in the one byte command mode of pi_pico_commands.h and stays framed from the
+// first request frame until it is reset
+
+#define PI_PICO_SOF_REQUEST 0xA5
+#define PI_PICO_SOF_REPLY 0x5A
+
+#define PI_PICO_FRAME_HEADER 5
+#define PI_PICO_FRAME_CRC 2
+#define PI_PICO_FRAME_MAX_PAYLOAD 64
+#define PI_PICO_FRAME_SIZE(payload) (PI_PICO_FRAME_HEADER + (payload) + PI_PICO_FRAME_CRC)
+#define PI_PICO_FRAME_MAX PI_PICO_FRAME_SIZE(PI_PICO_FRAME_MAX_PAYLOAD)
+// the host pads every transaction to whole 32 bit words, so the longest is this
+#define PI_PICO_FRAME_PADDED ((PI_PICO_FRAME_MAX + 3) & ~3)
+
+#define PI_PICO_STATUS_OK 0
+#define PI_PICO_STATUS_BAD_FRAME 1 // the request failed its check, send it again
+#define PI_PICO_STATUS_UNKNOWN 2   // the command isn't known
+
+typedef enum {
+    PI_PICO_FRAME_OK = 0,
+    PI_PICO_FRAME_NONE = 1,    // no start of frame - nothing was staged, or the bus is idle
+    PI_PICO_FRAME_CORRUPT = 2  // a start of frame, but a bad length or CRC
+} pi_pico_frame_result_t;
+
+typedef struct
+{
+    uint8_t cmd;
+    uint8_t seq;
+    uint8_t status;
+    uint8_t len;
+    const uint8_t *payload; // points into the buffer parsed
+} pi_pico_frame_t;
+
+// runs a command for the slave, returns a PI_PICO_STATUS_*
+// reply has room for PI_PICO_FRAME_MAX_PAYLOAD bytes, reply_len is set to the bytes used
+typedef uint8_t (*pi_pico_handler_t)(void *ctx, uint8_t cmd, const uint8_t *arg, uint8_t arg_len,
+                                     uint8_t *reply, uint8_t *reply_len);
+
+// the slave's side of the protocol, with the reply last staged and one for bad requests, so a
+// bad request never costs the reply a retry will ask for
+typedef struct
+{
+    pi_pico_handler_t handler;
+    void *ctx;
+
+    uint8_t reply[PI_PICO_FRAME_MAX]; // reply to the last request taken
+    uint32_t reply_len;
+    uint8_t nak[PI_PICO_FRAME_MAX];   // reply to a request that failed its check
+    bool have_last;
+    uint8_t last_cmd;
+    uint8_t last_seq;
+
+    uint32_t requests;   // requests run
+    uint32_t retries;    // requests answered from the staged reply
+    uint32_t bad_frames; // requests that failed their check
+} pi_pico_slave_t;
+
+// the latest encoder reading, double buffered: the sampler fills the back buffer while replies
+// are made from the front one, and publishing swaps them. The sampler may run on the other core,
+// so a reader that finds a reading was published while it copied copies it again
+typedef struct
+{
+    uint8_t data[2][PI_PICO_FRAME_MAX_PAYLOAD];
+    uint8_t len;
+    _Atomic uint32_t generation; // publishes so far, the front buffer is generation & 1
+} pi_pico_snapshot_t;
+
+uint16_t pi_pico_crc16(uint16_t crc, const uint8_t *data, uint32_t len);
+uint32_t pi_pico_frame_build(uint8_t *buf, uint8_t sof, uint8_t cmd, uint8_t seq, uint8_t status,
+                             const uint8_t *payload, uint8_t len);
+pi_pico_frame_result_t pi_pico_frame_parse(const uint8_t *buf, uint32_t size, uint8_t sof, pi_pico_frame_t *frame);
+void pi_pico_slave_init(pi_pico_slave_t *slave, pi_pico_handler_t handler, void *ctx);
+const uint8_t *pi_pico_slave_request(pi_pico_slave_t *slave, const uint8_t *rx, uint32_t len, uint32_t *reply_len);
+void pi_pico_snapshot_init(pi_pico_snapshot_t *snap, uint8_t len);
+uint8_t *pi_pico_snapshot_back(pi_pico_snapshot_t *snap);
+void pi_pico_snapshot_publish(pi_pico_snapshot_t *snap);
+uint8_t pi_pico_snapshot_read(pi_pico_snapshot_t *snap, uint8_t *out);
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// log ring between the pico's cores - the SPI core pushes small fixed size events and never
+// waits, the other core takes them off and does the formatting and the printing over USB, where
+// a stall costs nothing but log lines. One producer and one consumer: each index has a single
+// writer, so plain loads and stores do, and the M0+ has no atomic read-modify-write anyway.
+// When the ring is full, events are dropped and counted, and the count goes out with the next
+// event that makes it
+
+#define PI_PICO_LOG_DEPTH 256 // a power of two
+
+typedef struct
+{
+    uint32_t time_us; // time_us_32() when it happened
+    uint16_t event;   // what happened, the firmware's own numbering
+    uint16_t dropped; // events lost to a full ring just before this one, saturating
+    uint32_t arg;
+} pi_pico_log_entry_t;
+
+typedef struct
+{
+    pi_pico_log_entry_t entries[PI_PICO_LOG_DEPTH];
+    _Atomic uint32_t head; // next to fill, written by the producer
+    _Atomic uint32_t tail; // next to take, written by the consumer
+    uint32_t dropped;      // since the last event pushed, producer only
+    _Atomic uint32_t total_dropped;
+} pi_pico_log_t;
+
+void pi_pico_log_init(pi_pico_log_t *log);
+bool pi_pico_log_push(pi_pico_log_t *log, uint32_t time_us, uint16_t event, uint32_t arg);
+bool pi_pico_log_pop(pi_pico_log_t *log, pi_pico_log_entry_t *entry);
+uint32_t pi_pico_log_pending(pi_pico_log_t *log);
+uint32_t pi_pico_log_dropped(pi_pico_log_t *log);
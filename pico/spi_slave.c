@@ -1,3 +1,4 @@
+#include "hardware/gpio.h"
 #include "hardware/spi.h"
 #include "spi_slave.h"
 
@@ -59,4 +60,48 @@ void spi_slave_write_8_n_blocking(spi_inst_t *spi, unsigned char *data, int len)
             bytesin++;
         }
     }
-}
\ No newline at end of file
+}
+
+// drops whatever is left in the RX FIFO - always, or it would lead the next request - and whatever
+// the master didn't clock out of the TX FIFO. The PL022 has no TX flush of its own, so for that the
+// block is reset and set up again as a mode 1 slave
+void spi_slave_flush(spi_inst_t *spi)
+{
+    while (spi_is_readable(spi))
+        (void)spi_get_hw(spi)->dr;
+
+    if (spi_get_hw(spi)->sr & SPI_SSPSR_TFE_BITS)
+        return;
+
+    spi_deinit(spi);
+    spi_init(spi, 10000 * 1000);
+    spi_set_format(spi, 8, SPI_CPOL_0, SPI_CPHA_1, SPI_MSB_FIRST);
+    spi_set_slave(spi, true);
+}
+
+// serves the rest of a transaction whose first byte has been read: keeps the staged reply going
+// out while the request comes in, until CS goes high - returns the bytes received
+int spi_slave_frame_transaction(spi_inst_t *spi, unsigned int csn_pin, unsigned char first,
+                                const unsigned char *reply, int reply_len, int queued,
+                                unsigned char *rx, int rx_max)
+{
+    int received = 0;
+
+    rx[received++] = first;
+
+    // CS is active low, the FIFO is drained once it has gone high
+    while (!gpio_get(csn_pin) || spi_is_readable(spi))
+    {
+        if (spi_is_readable(spi))
+        {
+            unsigned char in = (unsigned char)spi_get_hw(spi)->dr;
+            if (received < rx_max)
+                rx[received] = in;
+            received++;
+        }
+        if (queued < reply_len && spi_is_writable(spi))
+            spi_get_hw(spi)->dr = (uint32_t)reply[queued++];
+    }
+
+    return received;
+}
@@ -2,4 +2,8 @@
 
 unsigned char spi_slave_read_8_blocking(spi_inst_t *spi);
 void spi_slave_write_8_blocking(spi_inst_t *spi, unsigned char data);
-void spi_slave_write_8_n_blocking(spi_inst_t *spi, unsigned char *data, int len);
\ No newline at end of file
+void spi_slave_write_8_n_blocking(spi_inst_t *spi, unsigned char *data, int len);
+void spi_slave_flush(spi_inst_t *spi);
+int spi_slave_frame_transaction(spi_inst_t *spi, unsigned int csn_pin, unsigned char first,
+                                const unsigned char *reply, int reply_len, int queued,
+                                unsigned char *rx, int rx_max);
@@ -1,11 +1,185 @@
 #include <stdio.h>
+#include <string.h>
 #include "pico/stdlib.h"
 #include "hardware/spi.h"
 #include "hardware/watchdog.h"
 #include "pico/binary_info.h"
+#include "pico/multicore.h"
 
 #include "pi_pico_commands.h"
+#include "pi_pico_frame.h"
+#include "pi_pico_log.h"
 #include "spi_slave.h"
+#include "spi_slave_dma.h"
+
+// time between encoder readings
+#define ENCODER_SAMPLE_US 100
+// time between checks that the SPI core is still going round, each one pets the watchdog if it is
+#define WATCHDOG_CHECK_US 100000
+// longest a reset waits for the log to be printed
+#define RESET_FLUSH_US 100000
+// data ready output to the host, high for DRDY_PULSE_US from each new encoder reading
+#define DRDY_PIN 20
+#define DRDY_PULSE_US 10
+
+// core 0 does nothing but serve SPI, core 1 does everything else - sampling the encoders, petting
+// the watchdog and printing. A printf can stall for milliseconds on USB, and the host would see
+// every one of them as a late reply, so the SPI core only puts events in the log ring
+
+// what the SPI core logs, printed by core 1
+enum
+{
+    LOG_NOP,
+    LOG_RESET_ENCODERS,
+    LOG_READ_SYSTIME,  // arg is the time sent
+    LOG_RESET_PICO,
+    LOG_READ_ENCODERS,
+    LOG_UNKNOWN,       // arg is the command
+    LOG_FRAMED
+};
+
+static uint8_t qdata[32];
+static pi_pico_snapshot_t encoders;
+
+// one producer at a time: the main loop while the commands are one byte, the CS interrupt once
+// they are framed - the main loop logs nothing after handing over to DMA
+static pi_pico_log_t log_ring;
+// passes of the main loop on the SPI core, so core 1 only keeps the watchdog off while it's alive
+static volatile uint32_t heartbeat;
+
+// takes a reading of the encoders into the back buffer and publishes it - the counts are
+// 1..32 until there are encoders to read
+static void sample_encoders(void)
+{
+    uint8_t *back = pi_pico_snapshot_back(&encoders);
+    memcpy(back, qdata, sizeof(qdata));
+    pi_pico_snapshot_publish(&encoders);
+}
+
+static void log_event(uint16_t event, uint32_t arg)
+{
+    pi_pico_log_push(&log_ring, time_us_32(), event, arg);
+}
+
+// gives core 1 a moment to print what led up to a reset, then lets the watchdog bite
+static void __attribute__((noreturn)) reset_pico(void)
+{
+    uint32_t start = time_us_32();
+    while (pi_pico_log_pending(&log_ring) != 0 && time_us_32() - start < RESET_FLUSH_US)
+        tight_loop_contents();
+
+    watchdog_enable(1, 1);
+    watchdog_update();
+    while (1);
+}
+
+static void print_event(const pi_pico_log_entry_t *entry)
+{
+    if (entry->dropped != 0)
+        printf("(%u log events dropped)\n", entry->dropped);
+
+    switch (entry->event)
+    {
+    case LOG_NOP:
+        printf("NOP command received\n");
+        break;
+    case LOG_RESET_ENCODERS:
+        printf("Reset encoders command received\n");
+        break;
+    case LOG_READ_SYSTIME:
+        printf("Read systime command received - sent 0x%8X\n", entry->arg);
+        break;
+    case LOG_RESET_PICO:
+        printf("Reset Pico command received. Waking up watchdog and waiting for it to bite.\n");
+        break;
+    case LOG_READ_ENCODERS:
+        printf("Read encoders command received.\n");
+        break;
+    case LOG_UNKNOWN:
+        printf("Unknown command received: %x\n", entry->arg);
+        break;
+    case LOG_FRAMED:
+        printf("Framed from now on\n");
+        break;
+    }
+}
+
+// housekeeping, on core 1 - one event printed per pass, so a slow printf only holds up the
+// encoder readings by one stall at a time
+static void core1_main(void)
+{
+    uint32_t next_sample = time_us_32() + ENCODER_SAMPLE_US;
+    uint32_t next_check = time_us_32() + WATCHDOG_CHECK_US;
+    uint32_t last_heartbeat = heartbeat;
+    uint32_t drdy_end = 0;
+    bool drdy = false;
+
+    while (true)
+    {
+        uint32_t now = time_us_32();
+        if (drdy && (int32_t)(now - drdy_end) >= 0)
+        {
+            gpio_put(DRDY_PIN, 0);
+            drdy = false;
+        }
+
+        if ((int32_t)(now - next_sample) >= 0)
+        {
+            // the host reads on the rising edge, so the reading is published before it - and a pulse
+            // stretched by a stall is ended first, or the new reading would get no edge of its own
+            gpio_put(DRDY_PIN, 0);
+            sample_encoders();
+            gpio_put(DRDY_PIN, 1);
+            drdy = true;
+            drdy_end = now + DRDY_PULSE_US;
+            next_sample += ENCODER_SAMPLE_US;
+            // after a stall, carry on from now rather than catch up with readings nobody will see
+            if ((int32_t)(now - next_sample) >= 0)
+                next_sample = now + ENCODER_SAMPLE_US;
+        }
+
+        // the SPI core is stuck if it hasn't been round its loop since the last check
+        if ((int32_t)(now - next_check) >= 0)
+        {
+            uint32_t beat = heartbeat;
+            if (beat != last_heartbeat)
+                watchdog_update();
+            last_heartbeat = beat;
+            next_check += WATCHDOG_CHECK_US;
+        }
+
+        pi_pico_log_entry_t entry;
+        if (pi_pico_log_pop(&log_ring, &entry))
+            print_event(&entry);
+    }
+}
+
+// the framed commands - these run in the CS interrupt between transactions, so no printf here
+static uint8_t frame_handler(void *ctx, uint8_t cmd, const uint8_t *arg, uint8_t arg_len, uint8_t *reply, uint8_t *reply_len)
+{
+    switch (cmd)
+    {
+    case CMD_NOP:
+    case CMD_RESET_ENCODERS:
+        return PI_PICO_STATUS_OK;
+    case CMD_READ_SYSTIME:
+    {
+        uint32_t systime = time_us_32();
+        memcpy(reply, &systime, sizeof(systime));
+        *reply_len = sizeof(systime);
+        return PI_PICO_STATUS_OK;
+    }
+    case CMD_READ_ENCODERS:
+        *reply_len = pi_pico_snapshot_read(&encoders, reply);
+        return PI_PICO_STATUS_OK;
+    case CMD_RESET_PICO:
+        log_event(LOG_RESET_PICO, 0);
+        reset_pico();
+    default:
+        log_event(LOG_UNKNOWN, cmd);
+        return PI_PICO_STATUS_UNKNOWN;
+    }
+}
 
 int main()
 {
@@ -23,6 +197,12 @@ int main()
     // Make the SPI pins available to picotool
     bi_decl(bi_4pins_with_func(PICO_DEFAULT_SPI_RX_PIN, PICO_DEFAULT_SPI_TX_PIN, PICO_DEFAULT_SPI_SCK_PIN, PICO_DEFAULT_SPI_CSN_PIN, GPIO_FUNC_SPI));
 
+    // low until the first reading core 1 takes
+    gpio_init(DRDY_PIN);
+    gpio_set_dir(DRDY_PIN, GPIO_OUT);
+    gpio_put(DRDY_PIN, 0);
+    bi_decl(bi_1pin_with_name(DRDY_PIN, "DRDY"));
+
     // let's hold here for 2s to allow the serial monitor to open
     sleep_ms(2000);
  
@@ -30,7 +210,6 @@ int main()
 
     //unsigned char inbuf[3];
     //uint32_t qdata[8] = {0x11223344, 0x55667788, 0x99AABBCC, 0xEEFFFFEE, 0xABCDEF12, 0x3456789A, 0xBCDE0102, 0x03040506};
-    uint8_t qdata[32];
     uint8_t ddata[32];
     for(int cnt = 0; cnt < 32; cnt++)
     {
@@ -52,51 +231,82 @@ int main()
     unsigned char dummywritedata = 0xAA;
     //unsigned char dummyout = 0x99;
 
+    pi_pico_snapshot_init(&encoders, sizeof(qdata));
+    sample_encoders();
+    pi_pico_log_init(&log_ring);
+
+    // framed protocol - from the first request frame on, every transaction is a frame. That one is
+    // served here, the rest by DMA, with the reply to each staged from the CS interrupt
+    static pi_pico_slave_t slave;
+    static spi_slave_dma_t dma;
+    pi_pico_slave_init(&slave, frame_handler, NULL);
+    spi_slave_dma_init(&dma, spi_default, PICO_DEFAULT_SPI_CSN_PIN, &slave);
+    bool framed = false;
+    uint8_t request[PI_PICO_FRAME_PADDED];
+
     watchdog_enable(3000, 1);
+    multicore_launch_core1(core1_main);
 
     while (true)
     {
+        heartbeat++;
 
-        // check if there's something to read
-        if (spi_is_readable(spi_default))
+        // check if there's something to read - once framed, DMA takes care of that
+        if (!framed && spi_is_readable(spi_default))
         {
             command = spi_slave_read_8_blocking(spi_default);
+            if (command == PI_PICO_SOF_REQUEST)
+            {
+                framed = true;
+                int received = spi_slave_frame_transaction(spi_default, PICO_DEFAULT_SPI_CSN_PIN, command, NULL, 0, 0,
+                                                           request, sizeof(request));
+                if (received > (int)sizeof(request))
+                    received = sizeof(request);
+
+                // logged before DMA starts, from then on the CS interrupt is the only producer
+                log_event(LOG_FRAMED, 0);
+                uint32_t reply_len;
+                const uint8_t *reply = pi_pico_slave_request(&slave, request, received, &reply_len);
+                spi_slave_dma_start(&dma, reply, reply_len);
+                continue;
+            }
+
             switch (command)
             {
             case CMD_NOP:
-                printf("NOP command received %d\n", bytesin);
+                log_event(LOG_NOP, 0);
                 break;
             case CMD_RESET_ENCODERS:
-                printf("Reset encoders command received\n");
+                log_event(LOG_RESET_ENCODERS, 0);
                 break;
             case CMD_READ_SYSTIME:
                 uint32_t systime = time_us_32();
                 spi_slave_write_8_n_blocking(spi_default, (uint8_t *)&systime, 4);
-                printf("Read systime command received - sent 0x%8X\n", systime);
+                log_event(LOG_READ_SYSTIME, systime);
                 break;
             case CMD_RESET_PICO:
-                printf("Reset Pico command received. Waking up watchdog and waiting for it to bite.\n");
-                watchdog_enable(1, 1);
-                watchdog_update();
-                while (1);
+                log_event(LOG_RESET_PICO, 0);
+                reset_pico();
                 break;
             case CMD_READ_ENCODERS:
                 //spi_write_blocking(spi_default, (uint8_t *)qdata, 32);
                 //spi_write_read_blocking(spi_default, (uint8_t *)qdata, (uint8_t *)ddata, 32);
                 //spi_write_read_blocking(spi_default, &dummyout, ddata, 1 );
                 //spi_slave_write_8_blocking(spi_default, dummywritedata);
-                spi_slave_write_8_n_blocking(spi_default, qdata, 32);
+                // the reading DRDY announced, not one being taken
+                pi_pico_snapshot_read(&encoders, ddata);
+                spi_slave_write_8_n_blocking(spi_default, ddata, 32);
                 // for(int i = 0; i < 32; i++)
                 // {
                 //     spi_slave_write_8_blocking(spi_default, qdata[i]);
                 // }
                 
                 //printf("Read encoders command received. Wrote %d 0x%x\n", dummywritedata, dummywritedata);
-                printf("Read encoders command received.\n");
+                log_event(LOG_READ_ENCODERS, 0);
                 //dummywritedata++;
                 break;
             default:
-                printf("Unknown command received: %x\n", command);
+                log_event(LOG_UNKNOWN, command);
                 break;
             }
 
@@ -104,9 +314,6 @@ int main()
 
         if(dummywritedata == 0xBB)
             dummywritedata = 0xAA;
-
-        // pet the watchdog
-        watchdog_update();
     }
 
     
@@ -0,0 +1,79 @@
+#include "pico/stdlib.h"
+#include "hardware/dma.h"
+#include "hardware/gpio.h"
+#include "hardware/spi.h"
+
+#include "spi_slave.h"
+#include "spi_slave_dma.h"
+
+// the GPIO interrupt callback has no context of its own
+static spi_slave_dma_t *active;
+
+static void spi_slave_dma_arm(spi_slave_dma_t *s, const unsigned char *reply, int reply_len)
+{
+    // room for the longest padded transaction - anything past it is drained at CS going high
+    dma_channel_set_write_addr(s->rx_dma, s->request, false);
+    dma_channel_set_trans_count(s->rx_dma, sizeof(s->request), true);
+
+    // the reply goes out from the buffer it was built in, the FIFO runs dry after it
+    dma_channel_set_read_addr(s->tx_dma, reply, false);
+    dma_channel_set_trans_count(s->tx_dma, reply_len, true);
+}
+
+static void spi_slave_dma_cs_irq(unsigned int gpio, uint32_t events)
+{
+    spi_slave_dma_t *s = active;
+    if (s == NULL || gpio != s->csn_pin || !(events & GPIO_IRQ_EDGE_RISE))
+        return;
+
+    // the last byte can still be on its way through the RX FIFO
+    while (spi_is_readable(s->spi) && dma_channel_is_busy(s->rx_dma))
+        tight_loop_contents();
+
+    int received = sizeof(s->request) - dma_channel_hw_addr(s->rx_dma)->transfer_count;
+    dma_channel_abort(s->rx_dma);
+    dma_channel_abort(s->tx_dma);
+
+    // nor must what the master sent past the request, or didn't clock out of the last reply, lead the next
+    spi_slave_flush(s->spi);
+
+    uint32_t reply_len;
+    const unsigned char *reply = pi_pico_slave_request(s->slave, s->request, received, &reply_len);
+    spi_slave_dma_arm(s, reply, reply_len);
+    s->transactions++;
+}
+
+// sets up both channels, paced by the SPI's DREQs
+void spi_slave_dma_init(spi_slave_dma_t *s, spi_inst_t *spi, unsigned int csn_pin, pi_pico_slave_t *slave)
+{
+    s->spi = spi;
+    s->csn_pin = csn_pin;
+    s->slave = slave;
+    s->transactions = 0;
+
+    s->rx_dma = dma_claim_unused_channel(true);
+    dma_channel_config rx = dma_channel_get_default_config(s->rx_dma);
+    channel_config_set_transfer_data_size(&rx, DMA_SIZE_8);
+    channel_config_set_dreq(&rx, spi_get_dreq(spi, false));
+    channel_config_set_read_increment(&rx, false);
+    channel_config_set_write_increment(&rx, true);
+    dma_channel_configure(s->rx_dma, &rx, s->request, &spi_get_hw(spi)->dr, 0, false);
+
+    s->tx_dma = dma_claim_unused_channel(true);
+    dma_channel_config tx = dma_channel_get_default_config(s->tx_dma);
+    channel_config_set_transfer_data_size(&tx, DMA_SIZE_8);
+    channel_config_set_dreq(&tx, spi_get_dreq(spi, true));
+    channel_config_set_read_increment(&tx, true);
+    channel_config_set_write_increment(&tx, false);
+    dma_channel_configure(s->tx_dma, &tx, &spi_get_hw(spi)->dr, NULL, 0, false);
+}
+
+// hands the SPI over to DMA, from the end of a transaction served by polling - the reply to it
+// is staged and every transaction after is served from the CS interrupt
+void spi_slave_dma_start(spi_slave_dma_t *s, const unsigned char *reply, int reply_len)
+{
+    active = s;
+    spi_slave_flush(s->spi);
+    spi_slave_dma_arm(s, reply, reply_len);
+    gpio_set_irq_enabled_with_callback(s->csn_pin, GPIO_IRQ_EDGE_RISE, true, spi_slave_dma_cs_irq);
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "hardware/spi.h"
+#include "pi_pico_frame.h"
+
+// framed transactions served by DMA: one channel takes the request from the RX FIFO, another
+// feeds the staged reply to the TX FIFO, and an interrupt on CS going high takes the request,
+// builds the reply to it and rearms both - the core is free for everything else in between
+
+typedef struct
+{
+    spi_inst_t *spi;
+    unsigned int csn_pin;
+    pi_pico_slave_t *slave;
+    int rx_dma;
+    int tx_dma;
+
+    unsigned char request[PI_PICO_FRAME_PADDED];
+    volatile unsigned int transactions;
+} spi_slave_dma_t;
+
+void spi_slave_dma_init(spi_slave_dma_t *s, spi_inst_t *spi, unsigned int csn_pin, pi_pico_slave_t *slave);
+void spi_slave_dma_start(spi_slave_dma_t *s, const unsigned char *reply, int reply_len);
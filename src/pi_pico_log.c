@@ -0,0 +1,70 @@
+#include <string.h>
+
+#include "pi_pico_log.h"
+
+/// @brief Sets up an empty log ring
+/// @param log ring
+void pi_pico_log_init(pi_pico_log_t *log)
+{
+    memset(log, 0, sizeof(pi_pico_log_t));
+}
+
+/// @brief Adds an event, from the producer's core only - never waits
+/// @param log ring
+/// @param time_us time of the event
+/// @param event event number
+/// @param arg event detail
+/// @return true if it went in, false if the ring was full and it was dropped
+bool pi_pico_log_push(pi_pico_log_t *log, uint32_t time_us, uint16_t event, uint32_t arg)
+{
+    uint32_t head = atomic_load_explicit(&log->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&log->tail, memory_order_acquire) >= PI_PICO_LOG_DEPTH)
+    {
+        log->dropped++;
+        atomic_store_explicit(&log->total_dropped, atomic_load_explicit(&log->total_dropped, memory_order_relaxed) + 1,
+                              memory_order_relaxed);
+        return false;
+    }
+
+    pi_pico_log_entry_t *entry = &log->entries[head & (PI_PICO_LOG_DEPTH - 1)];
+    entry->time_us = time_us;
+    entry->event = event;
+    entry->dropped = log->dropped < 0xFFFF ? (uint16_t)log->dropped : 0xFFFF;
+    entry->arg = arg;
+    log->dropped = 0;
+
+    atomic_store_explicit(&log->head, head + 1, memory_order_release);
+
+    return true;
+}
+
+/// @brief Takes the oldest event, from the consumer's core only
+/// @param log ring
+/// @param entry returns the event
+/// @return false if there was none
+bool pi_pico_log_pop(pi_pico_log_t *log, pi_pico_log_entry_t *entry)
+{
+    uint32_t tail = atomic_load_explicit(&log->tail, memory_order_relaxed);
+    if (atomic_load_explicit(&log->head, memory_order_acquire) == tail)
+        return false;
+
+    *entry = log->entries[tail & (PI_PICO_LOG_DEPTH - 1)];
+    atomic_store_explicit(&log->tail, tail + 1, memory_order_release);
+
+    return true;
+}
+
+/// @brief Events waiting to be taken, from either core
+/// @param log ring
+uint32_t pi_pico_log_pending(pi_pico_log_t *log)
+{
+    uint32_t tail = atomic_load_explicit(&log->tail, memory_order_acquire);
+    return atomic_load_explicit(&log->head, memory_order_acquire) - tail;
+}
+
+/// @brief Events dropped so far, readable from either core
+/// @param log ring
+uint32_t pi_pico_log_dropped(pi_pico_log_t *log)
+{
+    return atomic_load_explicit(&log->total_dropped, memory_order_relaxed);
+}
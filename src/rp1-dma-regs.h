@@ -0,0 +1,96 @@
+#pragma once
+
+// RP1 DMA controller - a Synopsys DW AXI DMAC
+// register layout from: https://github.com/raspberrypi/linux/blob/rpi-6.1.y/drivers/dma/dw-axi-dmac/dw-axi-dmac.h
+// base address and handshake numbers from include/dt-bindings/mfd/rp1.h
+// not all of this has been verified on the Pi5 yet
+
+#define RP1_DMA_BASE 0x188000
+#define RP1_DMA_CHANNELS 8
+
+// the RP1 peripherals as addressed by the DMA controller (e.g. SPI0 DR is at 0x40050060)
+#define RP1_PERIPH_BUS_BASE 0x40000000
+#define RP1_PERIPH_BUS_LEN 0x400000
+// host memory as seen from the RP1 through the PCIe inbound window (see dma-ranges in the rp1 device tree)
+#define RP1_HOST_MEM_BUS_BASE 0x1000000000ull
+
+// handshake (DREQ) numbers, tx and rx for each SPI
+#define RP1_DMA_SPI0_TX 13
+#define RP1_DMA_SPI0_RX 14
+#define RP1_DMA_SPI_DREQ_TX(n) (RP1_DMA_SPI0_TX + 2 * (n))
+#define RP1_DMA_SPI_DREQ_RX(n) (RP1_DMA_SPI0_RX + 2 * (n))
+
+/* Common registers */
+#define DMAC_ID 0x000          // DMAC ID
+#define DMAC_COMPVER 0x008     // DMAC component version
+#define DMAC_CFG 0x010         // DMAC configuration
+#define DMAC_CHEN 0x018        // DMAC channel enable, with write enable bits
+#define DMAC_CHSUSP 0x020      // DMAC channel suspend
+#define DMAC_CHABORT 0x028     // DMAC channel abort
+#define DMAC_INTSTATUS 0x030   // DMAC interrupt status
+#define DMAC_COMMON_INTCLEAR 0x038
+#define DMAC_RESET 0x058
+
+/* Bit fields in DMAC_CFG */
+#define DMAC_CFG_EN                 0b00000000000000000000000000000001 // BIT(0)
+#define DMAC_CFG_INT_EN             0b00000000000000000000000000000010 // BIT(1)
+
+/* DMAC_CHEN - the enable bit for a channel is only written if its write enable bit is set */
+#define DMAC_CHEN_EN(ch)            (1u << (ch))
+#define DMAC_CHEN_WE(ch)            (1u << ((ch) + 8))
+
+/* Channel registers, each channel has a block of 0x100 */
+#define DMAC_CH_BASE(ch) (0x100 + (ch) * 0x100)
+#define CH_SAR 0x000           // source address, 64 bit
+#define CH_DAR 0x008           // destination address, 64 bit
+#define CH_BLOCK_TS 0x010      // block size, in items of the source width, minus 1
+#define CH_CTL 0x018           // control, 64 bit (CTL_L / CTL_H)
+#define CH_CTL_H 0x01c
+#define CH_CFG 0x020           // configuration, 64 bit (CFG_L / CFG_H)
+#define CH_CFG_H 0x024
+#define CH_LLP 0x028           // linked list pointer
+#define CH_STATUS 0x030        // status, completed block items in the low word
+#define CH_INTSTATUS_ENA 0x080 // interrupt status enable
+#define CH_INTSTATUS 0x088     // interrupt status
+#define CH_INTSIGNAL_ENA 0x090 // interrupt signal enable
+#define CH_INTCLEAR 0x098      // interrupt clear
+
+/* Bit fields in CH_CTL (low word) */
+//                                     3         2         1
+//                                    10987654321098765432109876543210
+#define CH_CTL_L_SMS                0b00000000000000000000000000000001 // BIT(0) source master select
+#define CH_CTL_L_DMS                0b00000000000000000000000000000100 // BIT(2) destination master select
+#define CH_CTL_L_SINC_FIX           0b00000000000000000000000000010000 // BIT(4) source address not incremented
+#define CH_CTL_L_DINC_FIX           0b00000000000000000000000001000000 // BIT(6) destination address not incremented
+#define CH_CTL_L_SRC_WIDTH_POS 8    // GENMASK(10, 8)
+#define CH_CTL_L_DST_WIDTH_POS 11   // GENMASK(13, 11)
+#define CH_CTL_L_SRC_MSIZE_POS 14   // GENMASK(17, 14)
+#define CH_CTL_L_DST_MSIZE_POS 18   // GENMASK(21, 18)
+#define CH_CTL_L_WIDTH_MASK 0x7
+#define CH_CTL_L_MSIZE_MASK 0xf
+
+/* Bit fields in CH_CTL_H */
+#define CH_CTL_H_IOC_BLKTFR         0b00000100000000000000000000000000 // BIT(26) interrupt on block completion
+#define CH_CTL_H_LLI_LAST           0b01000000000000000000000000000000 // BIT(30)
+#define CH_CTL_H_LLI_VALID          0b10000000000000000000000000000000 // BIT(31)
+
+/* Bit fields in CH_CFG_H */
+#define CH_CFG_H_TT_FC_POS 0        // GENMASK(2, 0) transfer type and flow control
+#define CH_CFG_H_TT_FC_MASK 0x7
+#define CH_CFG_H_HS_SEL_SRC         0b00000000000000000000000000001000 // BIT(3) software handshake on source
+#define CH_CFG_H_HS_SEL_DST         0b00000000000000000000000000010000 // BIT(4) software handshake on destination
+#define CH_CFG_H_SRC_PER_POS 7      // handshake interface of the source peripheral
+#define CH_CFG_H_DST_PER_POS 12     // handshake interface of the destination peripheral
+#define CH_CFG_H_PER_MASK 0x1f
+
+#define DMAC_TT_FC_MEM_TO_MEM 0
+#define DMAC_TT_FC_MEM_TO_PER 1
+#define DMAC_TT_FC_PER_TO_MEM 2
+
+/* Bit fields in CH_INTSTATUS, CH_INTSTATUS_ENA, CH_INTCLEAR */
+#define CH_INT_BLOCK_TFR_DONE       0b00000000000000000000000000000001 // BIT(0)
+#define CH_INT_DMA_TFR_DONE         0b00000000000000000000000000000010 // BIT(1)
+#define CH_INT_ALL                  0xffffffff
+
+// transfer width encoding: 0 = 8 bit, 1 = 16 bit, 2 = 32 bit
+// burst size (MSIZE) encoding: 0 = 1 item, 1 = 4, 2 = 8, 3 = 16, 4 = 32 ...
@@ -0,0 +1,312 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "rp1-dma-regs.h"
+#include "rp1-dma-sim.h"
+
+// DMAC component version reported by the model
+#define SIM_DMAC_VERSION 0x3130312a
+
+// cost of a DMAC register access, same as for the SSI
+#define SIM_DMAC_READ_NS 600
+#define SIM_DMAC_WRITE_NS 40
+
+typedef struct
+{
+    uint64_t sar;
+    uint64_t dar;
+    uint32_t block_ts;
+    uint32_t ctl_l;
+    uint32_t ctl_h;
+    uint32_t cfg_l;
+    uint32_t cfg_h;
+    uint32_t intstatus_ena;
+    uint32_t intstatus;
+    uint32_t intsignal_ena;
+
+    bool enabled;
+    uint32_t done; // items moved in the current block
+} sim_dma_chan_t;
+
+struct rp1_dma_sim
+{
+    rp1_spi_sim_t *ssi;
+    uint32_t cfg;
+    sim_dma_chan_t ch[RP1_DMA_CHANNELS];
+    uint64_t frames; // frames moved between memory and the SSI
+};
+
+static bool sim_is_periph(uint64_t addr)
+{
+    return addr >= RP1_PERIPH_BUS_BASE && addr < RP1_PERIPH_BUS_BASE + RP1_PERIPH_BUS_LEN;
+}
+
+static uint32_t sim_width(uint32_t ctl_l, uint32_t pos)
+{
+    return 1u << ((ctl_l >> pos) & CH_CTL_L_WIDTH_MASK);
+}
+
+static uint32_t sim_load(uint64_t addr, uint32_t width)
+{
+    const void *p = (const void *)(uintptr_t)addr;
+    switch (width)
+    {
+    case 1:
+        return *(const uint8_t *)p;
+    case 2:
+        return *(const uint16_t *)p;
+    default:
+        return *(const uint32_t *)p;
+    }
+}
+
+static void sim_store(uint64_t addr, uint32_t width, uint32_t value)
+{
+    void *p = (void *)(uintptr_t)addr;
+    switch (width)
+    {
+    case 1:
+        *(uint8_t *)p = (uint8_t)value;
+        break;
+    case 2:
+        *(uint16_t *)p = (uint16_t)value;
+        break;
+    default:
+        *(uint32_t *)p = value;
+        break;
+    }
+}
+
+static void sim_chan_service(rp1_dma_sim_t *sim, sim_dma_chan_t *c)
+{
+    uint32_t total = c->block_ts + 1;
+    uint32_t fc = (c->cfg_h >> CH_CFG_H_TT_FC_POS) & CH_CFG_H_TT_FC_MASK;
+    uint32_t width = sim_width(c->ctl_l, fc == DMAC_TT_FC_MEM_TO_PER ? CH_CTL_L_SRC_WIDTH_POS : CH_CTL_L_DST_WIDTH_POS);
+
+    if (fc == DMAC_TT_FC_MEM_TO_PER && sim_is_periph(c->dar))
+    {
+        uint32_t n = rp1_spi_sim_dma_tx_request(sim->ssi, total - c->done);
+        while (n-- > 0)
+        {
+            uint64_t src = c->sar + ((c->ctl_l & CH_CTL_L_SINC_FIX) ? 0 : (uint64_t)c->done * width);
+            rp1_spi_sim_dma_push(sim->ssi, sim_load(src, width));
+            c->done++;
+            sim->frames++;
+        }
+    }
+    else if (fc == DMAC_TT_FC_PER_TO_MEM && sim_is_periph(c->sar))
+    {
+        uint32_t n = rp1_spi_sim_dma_rx_request(sim->ssi, total - c->done);
+        while (n-- > 0)
+        {
+            uint64_t dst = c->dar + ((c->ctl_l & CH_CTL_L_DINC_FIX) ? 0 : (uint64_t)c->done * width);
+            sim_store(dst, width, rp1_spi_sim_dma_pop(sim->ssi));
+            c->done++;
+            sim->frames++;
+        }
+    }
+
+    if (c->done >= total)
+    {
+        c->enabled = false;
+        c->intstatus |= (CH_INT_BLOCK_TFR_DONE | CH_INT_DMA_TFR_DONE) & c->intstatus_ena;
+    }
+}
+
+static void sim_service(void *ctx)
+{
+    rp1_dma_sim_t *sim = (rp1_dma_sim_t *)ctx;
+
+    if (!(sim->cfg & DMAC_CFG_EN))
+        return;
+    for (int i = 0; i < RP1_DMA_CHANNELS; i++)
+    {
+        if (sim->ch[i].enabled)
+            sim_chan_service(sim, &sim->ch[i]);
+    }
+}
+
+/// @brief Creates a DMA controller model and connects it to the handshakes of a simulated SSI
+/// @param ssi simulated SSI the channels will serve
+/// @param sim returns the new model
+/// @return true if successful
+bool rp1_dma_sim_create(rp1_spi_sim_t *ssi, rp1_dma_sim_t **sim)
+{
+    rp1_dma_sim_t *s = (rp1_dma_sim_t *)calloc(1, sizeof(rp1_dma_sim_t));
+    if (s == NULL)
+        return false;
+
+    s->ssi = ssi;
+    rp1_spi_sim_set_dma(ssi, sim_service, s);
+
+    *sim = s;
+
+    return true;
+}
+
+void rp1_dma_sim_destroy(rp1_dma_sim_t *sim)
+{
+    if (sim == NULL)
+        return;
+    rp1_spi_sim_set_dma(sim->ssi, NULL, NULL);
+    free(sim);
+}
+
+uint32_t rp1_dma_sim_read(rp1_dma_sim_t *sim, uint32_t reg)
+{
+    rp1_spi_sim_advance(sim->ssi, SIM_DMAC_READ_NS);
+
+    if (reg >= DMAC_CH_BASE(0) && reg < DMAC_CH_BASE(RP1_DMA_CHANNELS))
+    {
+        sim_dma_chan_t *c = &sim->ch[(reg - DMAC_CH_BASE(0)) / 0x100];
+        switch (reg & 0xff)
+        {
+        case CH_SAR:
+            return (uint32_t)c->sar;
+        case CH_SAR + 4:
+            return (uint32_t)(c->sar >> 32);
+        case CH_DAR:
+            return (uint32_t)c->dar;
+        case CH_DAR + 4:
+            return (uint32_t)(c->dar >> 32);
+        case CH_BLOCK_TS:
+            return c->block_ts;
+        case CH_CTL:
+            return c->ctl_l;
+        case CH_CTL_H:
+            return c->ctl_h;
+        case CH_CFG:
+            return c->cfg_l;
+        case CH_CFG_H:
+            return c->cfg_h;
+        case CH_STATUS:
+            return c->done;
+        case CH_INTSTATUS_ENA:
+            return c->intstatus_ena;
+        case CH_INTSTATUS:
+            return c->intstatus;
+        case CH_INTSIGNAL_ENA:
+            return c->intsignal_ena;
+        default:
+            return 0;
+        }
+    }
+
+    switch (reg)
+    {
+    case DMAC_COMPVER:
+        return SIM_DMAC_VERSION;
+    case DMAC_CFG:
+        return sim->cfg;
+    case DMAC_CHEN:
+    {
+        uint32_t chen = 0;
+        for (int i = 0; i < RP1_DMA_CHANNELS; i++)
+        {
+            if (sim->ch[i].enabled)
+                chen |= DMAC_CHEN_EN(i);
+        }
+        return chen;
+    }
+    case DMAC_INTSTATUS:
+    {
+        uint32_t status = 0;
+        for (int i = 0; i < RP1_DMA_CHANNELS; i++)
+        {
+            if (sim->ch[i].intstatus & sim->ch[i].intsignal_ena)
+                status |= 1u << i;
+        }
+        return status;
+    }
+    default:
+        return 0;
+    }
+}
+
+void rp1_dma_sim_write(rp1_dma_sim_t *sim, uint32_t reg, uint32_t value)
+{
+    rp1_spi_sim_advance(sim->ssi, SIM_DMAC_WRITE_NS);
+
+    if (reg >= DMAC_CH_BASE(0) && reg < DMAC_CH_BASE(RP1_DMA_CHANNELS))
+    {
+        sim_dma_chan_t *c = &sim->ch[(reg - DMAC_CH_BASE(0)) / 0x100];
+        switch (reg & 0xff)
+        {
+        case CH_SAR:
+            c->sar = (c->sar & 0xffffffff00000000ull) | value;
+            break;
+        case CH_SAR + 4:
+            c->sar = (c->sar & 0xffffffffull) | ((uint64_t)value << 32);
+            break;
+        case CH_DAR:
+            c->dar = (c->dar & 0xffffffff00000000ull) | value;
+            break;
+        case CH_DAR + 4:
+            c->dar = (c->dar & 0xffffffffull) | ((uint64_t)value << 32);
+            break;
+        case CH_BLOCK_TS:
+            c->block_ts = value;
+            break;
+        case CH_CTL:
+            c->ctl_l = value;
+            break;
+        case CH_CTL_H:
+            c->ctl_h = value;
+            break;
+        case CH_CFG:
+            c->cfg_l = value;
+            break;
+        case CH_CFG_H:
+            c->cfg_h = value;
+            break;
+        case CH_INTSTATUS_ENA:
+            c->intstatus_ena = value;
+            break;
+        case CH_INTSIGNAL_ENA:
+            c->intsignal_ena = value;
+            break;
+        case CH_INTCLEAR:
+            c->intstatus &= ~value;
+            break;
+        default:
+            break;
+        }
+        return;
+    }
+
+    switch (reg)
+    {
+    case DMAC_CFG:
+        sim->cfg = value & (DMAC_CFG_EN | DMAC_CFG_INT_EN);
+        break;
+    case DMAC_CHEN:
+        for (int i = 0; i < RP1_DMA_CHANNELS; i++)
+        {
+            if (!(value & DMAC_CHEN_WE(i)))
+                continue;
+            bool en = (value & DMAC_CHEN_EN(i)) != 0;
+            if (en && !sim->ch[i].enabled)
+                sim->ch[i].done = 0;
+            sim->ch[i].enabled = en;
+        }
+        break;
+    default:
+        break;
+    }
+
+    // let a newly enabled channel start moving data straight away
+    rp1_spi_sim_advance(sim->ssi, 0);
+}
+
+/// @brief Lets virtual time pass without a register access
+/// @param sim DMA controller model
+/// @param ns nanoseconds to advance
+void rp1_dma_sim_advance(rp1_dma_sim_t *sim, uint64_t ns)
+{
+    rp1_spi_sim_advance(sim->ssi, ns);
+}
+
+uint64_t rp1_dma_sim_frames(rp1_dma_sim_t *sim)
+{
+    return sim->frames;
+}
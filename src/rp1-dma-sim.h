@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "rp1-spi-sim.h"
+
+// software model of the RP1 DW AXI DMA controller, serving one simulated SSI
+//
+// the channels are programmed through the same registers as the hardware (rp1-dma-regs.h).
+// Addresses inside the RP1 peripheral window are taken to be the data register of the
+// attached SSI, anything else is a pointer into host memory (the simulator's buffers use
+// their virtual address as bus address). Register accesses advance the SSI model's clock
+
+typedef struct rp1_dma_sim rp1_dma_sim_t;
+
+bool rp1_dma_sim_create(rp1_spi_sim_t *ssi, rp1_dma_sim_t **sim);
+void rp1_dma_sim_destroy(rp1_dma_sim_t *sim);
+
+uint32_t rp1_dma_sim_read(rp1_dma_sim_t *sim, uint32_t reg);
+void rp1_dma_sim_write(rp1_dma_sim_t *sim, uint32_t reg, uint32_t value);
+void rp1_dma_sim_advance(rp1_dma_sim_t *sim, uint64_t ns);
+uint64_t rp1_dma_sim_frames(rp1_dma_sim_t *sim);
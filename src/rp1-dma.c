@@ -0,0 +1,303 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "rp1-dma.h"
+
+#define RP1_DMA_CACHE_LINE 64
+
+static inline uint32_t rp1_dma_reg_read(rp1_dma_t *dma, uint32_t reg)
+{
+    if (__builtin_expect(dma->sim != NULL, 0))
+        return rp1_dma_sim_read(dma->sim, reg);
+    return *(volatile uint32_t *)(dma->regbase + reg);
+}
+
+static inline void rp1_dma_reg_write(rp1_dma_t *dma, uint32_t reg, uint32_t value)
+{
+    if (__builtin_expect(dma->sim != NULL, 0))
+        rp1_dma_sim_write(dma->sim, reg, value);
+    else
+        *(volatile uint32_t *)(dma->regbase + reg) = value;
+}
+
+/// @brief Creates a DMA controller handle on the RP1
+/// @param rp1 rp1 device
+/// @param channels bitmask of the channels we may use, e.g. RP1_DMA_DEFAULT_CHANNELS
+/// @param dma returns the new handle
+/// @return true if successful
+bool rp1_dma_create(rp1_t *rp1, uint32_t channels, rp1_dma_t **dma)
+{
+    rp1_dma_t *d = (rp1_dma_t *)calloc(1, sizeof(rp1_dma_t));
+    if (d == NULL)
+        return false;
+
+    d->regbase = rp1->rp1_peripherial_base + RP1_DMA_BASE;
+    d->channels_free = channels & ((1u << RP1_DMA_CHANNELS) - 1);
+
+    if (!rp1_dma_buf_alloc(d, RP1_DMA_CACHE_LINE, &d->scratch))
+    {
+        free(d);
+        return false;
+    }
+
+    // the kernel will normally have enabled the controller already
+    uint32_t cfg = rp1_dma_reg_read(d, DMAC_CFG);
+    if (!(cfg & DMAC_CFG_EN))
+        rp1_dma_reg_write(d, DMAC_CFG, cfg | DMAC_CFG_EN);
+
+    *dma = d;
+
+    return true;
+}
+
+/// @brief Creates a DMA controller handle backed by the DMA controller model
+/// @param sim DMA controller model, see rp1-dma-sim.h
+/// @param dma returns the new handle
+/// @return true if successful
+bool rp1_dma_create_sim(rp1_dma_sim_t *sim, rp1_dma_t **dma)
+{
+    rp1_dma_t *d = (rp1_dma_t *)calloc(1, sizeof(rp1_dma_t));
+    if (d == NULL)
+        return false;
+
+    d->regbase = NULL;
+    d->sim = sim;
+    d->channels_free = (1u << RP1_DMA_CHANNELS) - 1;
+
+    if (!rp1_dma_buf_alloc(d, RP1_DMA_CACHE_LINE, &d->scratch))
+    {
+        free(d);
+        return false;
+    }
+
+    rp1_dma_reg_write(d, DMAC_CFG, DMAC_CFG_EN);
+
+    *dma = d;
+
+    return true;
+}
+
+void rp1_dma_destroy(rp1_dma_t *dma)
+{
+    if (dma == NULL)
+        return;
+    rp1_dma_buf_free(dma, &dma->scratch);
+    free(dma);
+}
+
+/// @brief Claims one of the channels we've been given
+/// @param dma DMA handle
+/// @return channel number, or -1 if they are all in use
+int rp1_dma_claim_channel(rp1_dma_t *dma)
+{
+    uint32_t avail = atomic_load_explicit(&dma->channels_free, memory_order_relaxed);
+    while (avail != 0)
+    {
+        // the lowest free channel, unless another thread took it first - then avail is reloaded
+        int ch = __builtin_ctz(avail);
+        if (atomic_compare_exchange_weak_explicit(&dma->channels_free, &avail, avail & ~(1u << ch),
+                                                  memory_order_acquire, memory_order_relaxed))
+            return ch;
+    }
+    return -1;
+}
+
+/// @brief Gives back a channel from rp1_dma_claim_channel()
+/// @param dma DMA handle
+/// @param ch channel number, -1 is ignored
+void rp1_dma_release_channel(rp1_dma_t *dma, int ch)
+{
+    if (ch >= 0 && ch < RP1_DMA_CHANNELS)
+        atomic_fetch_or_explicit(&dma->channels_free, 1u << ch, memory_order_release);
+}
+
+// physical address of a locked page, from /proc/self/pagemap (needs root, as does /dev/mem)
+static bool rp1_dma_virt_to_phys(int fd, void *virt, uint64_t *phys)
+{
+    long pagesize = sysconf(_SC_PAGESIZE);
+    uint64_t entry;
+    off_t offset = ((uintptr_t)virt / pagesize) * sizeof(entry);
+
+    if (pread(fd, &entry, sizeof(entry), offset) != sizeof(entry))
+        return false;
+    // bit 63 - page present, bits 0-54 - page frame number
+    if (!(entry & (1ull << 63)))
+        return false;
+    *phys = (entry & ((1ull << 55) - 1)) * pagesize + ((uintptr_t)virt % pagesize);
+    return true;
+}
+
+/// @brief Allocates a buffer the DMA controller can reach
+/// @param dma DMA handle
+/// @param len length in bytes
+/// @param buf returns the buffer
+/// @return true if successful - on the Pi the buffer has to be physically contiguous, which
+///         normally means it has to fit into a huge page, or a single page without them
+bool rp1_dma_buf_alloc(rp1_dma_t *dma, size_t len, rp1_dma_buf_t *buf)
+{
+    memset(buf, 0, sizeof(rp1_dma_buf_t));
+
+    if (dma->sim != NULL)
+    {
+        // the model uses virtual addresses as bus addresses
+        size_t maplen = (len + RP1_DMA_CACHE_LINE - 1) & ~(size_t)(RP1_DMA_CACHE_LINE - 1);
+        buf->virt = aligned_alloc(RP1_DMA_CACHE_LINE, maplen);
+        if (buf->virt == NULL)
+            return false;
+        memset(buf->virt, 0, maplen);
+        buf->bus = (uint64_t)(uintptr_t)buf->virt;
+        buf->len = len;
+        buf->maplen = maplen;
+        return true;
+    }
+
+    long pagesize = sysconf(_SC_PAGESIZE);
+    size_t maplen = (len + pagesize - 1) & ~(size_t)(pagesize - 1);
+    void *p = mmap(NULL, maplen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_LOCKED | MAP_POPULATE | MAP_HUGETLB, -1, 0);
+    if (p == MAP_FAILED)
+        p = mmap(NULL, maplen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_LOCKED | MAP_POPULATE, -1, 0);
+    if (p == MAP_FAILED)
+        return false;
+
+    int fd = open("/proc/self/pagemap", O_RDONLY);
+    if (fd < 0)
+    {
+        munmap(p, maplen);
+        return false;
+    }
+
+    // check every page follows on from the one before
+    uint64_t first, phys;
+    bool ok = rp1_dma_virt_to_phys(fd, p, &first);
+    for (size_t off = pagesize; ok && off < maplen; off += pagesize)
+        ok = rp1_dma_virt_to_phys(fd, (uint8_t *)p + off, &phys) && (phys == first + off);
+    close(fd);
+
+    if (!ok)
+    {
+        munmap(p, maplen);
+        return false;
+    }
+
+    buf->virt = p;
+    buf->bus = RP1_HOST_MEM_BUS_BASE + first;
+    buf->len = len;
+    buf->maplen = maplen;
+
+    return true;
+}
+
+void rp1_dma_buf_free(rp1_dma_t *dma, rp1_dma_buf_t *buf)
+{
+    if (buf->virt == NULL)
+        return;
+    if (dma->sim != NULL)
+        free(buf->virt);
+    else
+        munmap(buf->virt, buf->maplen);
+    buf->virt = NULL;
+}
+
+// the RP1 is not cache coherent with the A76s, so buffers have to be cleaned before the
+// DMA controller reads them and invalidated before we read what it wrote. 'dc civac' is
+// available at EL0 under linux
+static void rp1_dma_cache_clean_invalidate(void *start, size_t len)
+{
+#if defined(__aarch64__)
+    uintptr_t p = (uintptr_t)start & ~(uintptr_t)(RP1_DMA_CACHE_LINE - 1);
+    uintptr_t end = (uintptr_t)start + len;
+    for (; p < end; p += RP1_DMA_CACHE_LINE)
+        __asm__ volatile("dc civac, %0" : : "r"(p) : "memory");
+    __asm__ volatile("dsb sy" : : : "memory");
+#else
+    (void)start;
+    (void)len;
+    __sync_synchronize();
+#endif
+}
+
+/// @brief Makes CPU writes to a buffer visible to the DMA controller - call before starting a transfer
+void rp1_dma_buf_sync_for_device(rp1_dma_buf_t *buf, size_t offset, size_t len)
+{
+    rp1_dma_cache_clean_invalidate((uint8_t *)buf->virt + offset, len);
+}
+
+/// @brief Makes DMA controller writes to a buffer visible to the CPU - call after a transfer completes
+void rp1_dma_buf_sync_for_cpu(rp1_dma_buf_t *buf, size_t offset, size_t len)
+{
+    rp1_dma_cache_clean_invalidate((uint8_t *)buf->virt + offset, len);
+}
+
+static uint32_t rp1_dma_width_enc(uint8_t width)
+{
+    return width == 4 ? 2 : (width == 2 ? 1 : 0);
+}
+
+static uint32_t rp1_dma_msize_enc(uint8_t burst)
+{
+    uint32_t enc = 0;
+    // 1, 4, 8, 16, 32 ... items
+    if (burst >= 4)
+    {
+        enc = 1;
+        for (uint8_t b = 4; b < burst && enc < CH_CTL_L_MSIZE_MASK; b <<= 1)
+            enc++;
+    }
+    return enc;
+}
+
+/// @brief Programs and enables a single block transfer on a channel
+/// @param dma DMA handle
+/// @param ch channel, from rp1_dma_claim_channel()
+/// @param cfg transfer description
+void rp1_dma_chan_start(rp1_dma_t *dma, int ch, const rp1_dma_chan_cfg_t *cfg)
+{
+    uint32_t base = DMAC_CH_BASE(ch);
+    uint32_t width = rp1_dma_width_enc(cfg->width);
+    uint32_t msize = rp1_dma_msize_enc(cfg->burst);
+
+    uint32_t ctl_l = (width << CH_CTL_L_SRC_WIDTH_POS) | (width << CH_CTL_L_DST_WIDTH_POS) |
+                     (msize << CH_CTL_L_SRC_MSIZE_POS) | (msize << CH_CTL_L_DST_MSIZE_POS);
+    if (cfg->src_fixed)
+        ctl_l |= CH_CTL_L_SINC_FIX;
+    if (cfg->dst_fixed)
+        ctl_l |= CH_CTL_L_DINC_FIX;
+
+    uint32_t cfg_h = ((uint32_t)cfg->flow & CH_CFG_H_TT_FC_MASK) << CH_CFG_H_TT_FC_POS;
+    if (cfg->flow == DMAC_TT_FC_MEM_TO_PER)
+        cfg_h |= ((uint32_t)cfg->dreq & CH_CFG_H_PER_MASK) << CH_CFG_H_DST_PER_POS;
+    else if (cfg->flow == DMAC_TT_FC_PER_TO_MEM)
+        cfg_h |= ((uint32_t)cfg->dreq & CH_CFG_H_PER_MASK) << CH_CFG_H_SRC_PER_POS;
+
+    rp1_dma_reg_write(dma, base + CH_SAR, (uint32_t)cfg->sar);
+    rp1_dma_reg_write(dma, base + CH_SAR + 4, (uint32_t)(cfg->sar >> 32));
+    rp1_dma_reg_write(dma, base + CH_DAR, (uint32_t)cfg->dar);
+    rp1_dma_reg_write(dma, base + CH_DAR + 4, (uint32_t)(cfg->dar >> 32));
+    rp1_dma_reg_write(dma, base + CH_BLOCK_TS, cfg->items - 1);
+    rp1_dma_reg_write(dma, base + CH_CTL, ctl_l);
+    rp1_dma_reg_write(dma, base + CH_CTL_H, CH_CTL_H_LLI_VALID | CH_CTL_H_LLI_LAST);
+    rp1_dma_reg_write(dma, base + CH_CFG, 0); // single contiguous block
+    rp1_dma_reg_write(dma, base + CH_CFG_H, cfg_h);
+    rp1_dma_reg_write(dma, base + CH_INTCLEAR, CH_INT_ALL);
+    rp1_dma_reg_write(dma, base + CH_INTSTATUS_ENA, CH_INT_BLOCK_TFR_DONE | CH_INT_DMA_TFR_DONE);
+
+    rp1_dma_reg_write(dma, DMAC_CHEN, DMAC_CHEN_EN(ch) | DMAC_CHEN_WE(ch));
+}
+
+/// @brief Checks whether the transfer on a channel has completed - one register read
+/// @param dma DMA handle
+/// @param ch channel
+/// @return true once the whole block has been moved
+bool rp1_dma_chan_done(rp1_dma_t *dma, int ch)
+{
+    return (rp1_dma_reg_read(dma, DMAC_CH_BASE(ch) + CH_INTSTATUS) & CH_INT_DMA_TFR_DONE) != 0;
+}
+
+void rp1_dma_chan_abort(rp1_dma_t *dma, int ch)
+{
+    rp1_dma_reg_write(dma, DMAC_CHEN, DMAC_CHEN_WE(ch));
+    rp1_dma_reg_write(dma, DMAC_CH_BASE(ch) + CH_INTCLEAR, CH_INT_ALL);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rp1-regs.h"
+#include "rp1-dma-regs.h"
+#include "rp1-dma-sim.h"
+
+// user space access to the RP1 DMA controller
+// the kernel owns the controller as well, so we only ever touch the channels we've been
+// given in the mask passed to rp1_dma_create() - by default the top two, which the
+// kernel allocates last
+
+#define RP1_DMA_DEFAULT_CHANNELS (DMAC_CHEN_EN(6) | DMAC_CHEN_EN(7))
+
+// memory the DMA controller can reach - locked in RAM and physically contiguous
+typedef struct
+{
+    void *virt;
+    uint64_t bus; // address of the buffer as seen by the RP1
+    size_t len;
+    size_t maplen;
+} rp1_dma_buf_t;
+
+typedef struct
+{
+    volatile void *regbase;
+    struct rp1_dma_sim *sim; // when set, register accesses go to the simulator instead of regbase
+    _Atomic uint32_t channels_free; // bitmask of the channels we may claim - shared by every controller
+                                    // using this handle, so claimed and released without a lock
+    rp1_dma_buf_t scratch;   // source of dummy tx data / sink for discarded rx data
+} rp1_dma_t;
+
+typedef struct
+{
+    uint64_t sar;
+    uint64_t dar;
+    uint32_t items;   // number of items of 'width' bytes
+    uint8_t width;    // 1, 2 or 4 bytes
+    uint8_t burst;    // items per handshake burst, 1, 4, 8, 16 or 32
+    bool src_fixed;   // source address is not incremented
+    bool dst_fixed;   // destination address is not incremented
+    uint8_t flow;     // DMAC_TT_FC_*
+    uint8_t dreq;     // handshake of the peripheral end
+} rp1_dma_chan_cfg_t;
+
+bool rp1_dma_create(rp1_t *rp1, uint32_t channels, rp1_dma_t **dma);
+bool rp1_dma_create_sim(rp1_dma_sim_t *sim, rp1_dma_t **dma);
+void rp1_dma_destroy(rp1_dma_t *dma);
+int rp1_dma_claim_channel(rp1_dma_t *dma);
+void rp1_dma_release_channel(rp1_dma_t *dma, int ch);
+
+bool rp1_dma_buf_alloc(rp1_dma_t *dma, size_t len, rp1_dma_buf_t *buf);
+void rp1_dma_buf_free(rp1_dma_t *dma, rp1_dma_buf_t *buf);
+void rp1_dma_buf_sync_for_device(rp1_dma_buf_t *buf, size_t offset, size_t len);
+void rp1_dma_buf_sync_for_cpu(rp1_dma_buf_t *buf, size_t offset, size_t len);
+
+void rp1_dma_chan_start(rp1_dma_t *dma, int ch, const rp1_dma_chan_cfg_t *cfg);
+bool rp1_dma_chan_done(rp1_dma_t *dma, int ch);
+void rp1_dma_chan_abort(rp1_dma_t *dma, int ch);
@@ -0,0 +1,402 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rp1-gpio-capture.h"
+#include "rp1-spi-io.h"
+
+// samples between looks at the clock while nothing changes, for the end of the capture
+#define RP1_GPIO_CAPTURE_CLOCK_EVERY 256
+// records copied out at a time by rp1_gpio_capture_save()
+#define RP1_GPIO_CAPTURE_SAVE_CHUNK 256
+
+// binary file: this header, then the records as rp1_gpio_edge_t, all little endian
+#define RP1_GPIO_CAPTURE_MAGIC "RP1GPIO1"
+
+/// @brief Creates a capture of the pins of a port - it runs once
+/// @param cfg port, ring size, duration and trigger - copied
+/// @param capture returns the new capture
+/// @return true if successful, false for a bad parameter or out of memory
+bool rp1_gpio_capture_create(const rp1_gpio_capture_config_t *cfg, rp1_gpio_capture_t **capture)
+{
+    if (cfg->port == NULL || cfg->depth == 0 || cfg->depth > (1u << 26) ||
+        cfg->trigger > RP1_GPIO_TRIGGER_EDGE || cfg->pretrigger > RP1_GPIO_CAPTURE_PRETRIGGER)
+        return false;
+
+    rp1_gpio_capture_t *c = (rp1_gpio_capture_t *)aligned_alloc(RP1_GPIO_CAPTURE_CACHE_LINE, sizeof(rp1_gpio_capture_t));
+    if (c == NULL)
+        return false;
+    memset(c, 0, sizeof(rp1_gpio_capture_t));
+
+    c->cfg = *cfg;
+    c->depth = 1;
+    while (c->depth < cfg->depth)
+        c->depth <<= 1;
+
+    // touched now, so the capture doesn't take page faults
+    c->ring = (rp1_gpio_edge_t *)aligned_alloc(RP1_GPIO_CAPTURE_CACHE_LINE, (size_t)c->depth * sizeof(rp1_gpio_edge_t));
+    if (c->ring == NULL)
+    {
+        free(c);
+        return false;
+    }
+    memset(c->ring, 0, (size_t)c->depth * sizeof(rp1_gpio_edge_t));
+    c->cpu = -1;
+
+    *capture = c;
+
+    return true;
+}
+
+void rp1_gpio_capture_destroy(rp1_gpio_capture_t *capture)
+{
+    if (capture == NULL)
+        return;
+    rp1_gpio_capture_stop(capture);
+    free(capture->ring);
+    free(capture);
+}
+
+// adds a record, splitting a run too long for one - false if the ring is full
+static bool rp1_gpio_capture_push(rp1_gpio_capture_t *capture, uint32_t levels, uint64_t now)
+{
+    uint64_t head = atomic_load_explicit(&capture->head, memory_order_relaxed);
+    uint64_t run = 0;
+
+    if (head == 0)
+        atomic_store_explicit(&capture->stats.start_ns, now, memory_order_relaxed);
+    else
+        run = now - capture->last_ns;
+
+    do
+    {
+        if (head - capture->tail_cache >= capture->depth)
+        {
+            capture->tail_cache = atomic_load_explicit(&capture->tail, memory_order_acquire);
+            if (head - capture->tail_cache >= capture->depth)
+                return false;
+        }
+
+        rp1_gpio_edge_t *edge = &capture->ring[head & (capture->depth - 1)];
+        uint32_t part = run > RP1_GPIO_CAPTURE_MAX_RUN ? RP1_GPIO_CAPTURE_MAX_RUN : (uint32_t)run;
+        run -= part;
+        // the levels carry on through a split, the new ones come with the last part
+        edge->levels = run != 0 ? capture->ring[(head - 1) & (capture->depth - 1)].levels & ~RP1_GPIO_CAPTURE_TRIGGER : levels;
+        edge->run_ns = part;
+        atomic_store_explicit(&capture->head, ++head, memory_order_release);
+        rp1_spi_count(&capture->stats.edges, 1);
+    } while (run != 0);
+
+    capture->last_ns = now;
+
+    return true;
+}
+
+static void rp1_gpio_capture_remember(rp1_gpio_capture_t *capture, uint32_t levels, uint64_t now)
+{
+    capture->pre_levels[capture->pre_next] = levels;
+    capture->pre_ns[capture->pre_next] = now;
+    capture->pre_next = (capture->pre_next + 1) % (capture->cfg.pretrigger + 1);
+    if (capture->pre_count < capture->cfg.pretrigger + 1)
+        capture->pre_count++;
+}
+
+static bool rp1_gpio_capture_fires(const rp1_gpio_capture_config_t *cfg, uint32_t levels, uint32_t changed)
+{
+    switch (cfg->trigger)
+    {
+    case RP1_GPIO_TRIGGER_LEVEL:
+        return (levels & cfg->trigger_mask) == (cfg->trigger_levels & cfg->trigger_mask);
+    case RP1_GPIO_TRIGGER_RISING:
+        return (changed & levels & cfg->trigger_mask) != 0;
+    case RP1_GPIO_TRIGGER_FALLING:
+        return (changed & ~levels & cfg->trigger_mask) != 0;
+    case RP1_GPIO_TRIGGER_EDGE:
+        return (changed & cfg->trigger_mask) != 0;
+    default:
+        return true;
+    }
+}
+
+// the trigger has fired on the last change remembered - it and the ones before go in the ring
+static bool rp1_gpio_capture_trigger(rp1_gpio_capture_t *capture)
+{
+    uint32_t slots = capture->cfg.pretrigger + 1;
+    uint32_t first = (capture->pre_next + slots - capture->pre_count) % slots;
+
+    for (uint32_t i = 0; i < capture->pre_count; i++)
+    {
+        uint32_t n = (first + i) % slots;
+        uint32_t levels = capture->pre_levels[n];
+        if (i == capture->pre_count - 1)
+        {
+            levels |= RP1_GPIO_CAPTURE_TRIGGER;
+            atomic_store_explicit(&capture->stats.trigger_ns, capture->pre_ns[n], memory_order_relaxed);
+        }
+        if (!rp1_gpio_capture_push(capture, levels, capture->pre_ns[n]))
+            return false;
+    }
+
+    return true;
+}
+
+/// @brief Runs the capture in the calling thread until its duration is up, the ring is full or it
+///        is stopped from another thread
+/// @param capture capture, not started
+/// @note one read of RIO_NOSYNC_IN per sample, and a look at the clock only when something changes
+void rp1_gpio_capture_run(rp1_gpio_capture_t *capture)
+{
+    const rp1_gpio_capture_config_t *cfg = &capture->cfg;
+    rp1_gpio_port_t *port = cfg->port;
+    uint64_t samples = 1;
+    bool full = false;
+
+    uint32_t prev = rp1_gpio_port_read_nosync(port);
+    uint64_t now = rp1_gpio_port_now_ns(port);
+    bool triggered = false;
+
+    // the levels at the start are the first change, which fires a level trigger that is met already
+    rp1_gpio_capture_remember(capture, prev, now);
+    if (rp1_gpio_capture_fires(cfg, prev, 0))
+    {
+        triggered = true;
+        full = !rp1_gpio_capture_trigger(capture);
+    }
+
+    while (!full && !atomic_load_explicit(&capture->stop, memory_order_relaxed))
+    {
+        uint32_t levels = rp1_gpio_port_read_nosync(port);
+        samples++;
+
+        if (levels == prev)
+        {
+            if (samples % RP1_GPIO_CAPTURE_CLOCK_EVERY != 0)
+                continue;
+            atomic_store_explicit(&capture->stats.samples, samples, memory_order_relaxed);
+            now = rp1_gpio_port_now_ns(port);
+        }
+        else
+        {
+            now = rp1_gpio_port_now_ns(port);
+            uint32_t changed = levels ^ prev;
+            prev = levels;
+
+            if (!triggered)
+            {
+                rp1_gpio_capture_remember(capture, levels, now);
+                if (rp1_gpio_capture_fires(cfg, levels, changed))
+                {
+                    triggered = true;
+                    full = !rp1_gpio_capture_trigger(capture);
+                }
+                continue;
+            }
+            full = !rp1_gpio_capture_push(capture, levels, now);
+        }
+
+        if (triggered && cfg->duration_ns != 0 &&
+            now - atomic_load_explicit(&capture->stats.trigger_ns, memory_order_relaxed) >= cfg->duration_ns)
+            break;
+    }
+
+    atomic_store_explicit(&capture->stats.samples, samples, memory_order_relaxed);
+    atomic_store_explicit(&capture->stats.full, full, memory_order_relaxed);
+    atomic_store_explicit(&capture->stats.end_ns, rp1_gpio_port_now_ns(port), memory_order_relaxed);
+    atomic_store_explicit(&capture->done, true, memory_order_release);
+}
+
+static void *rp1_gpio_capture_thread(void *arg)
+{
+    rp1_gpio_capture_run((rp1_gpio_capture_t *)arg);
+    return NULL;
+}
+
+/// @brief Pins the capture thread to one core, takes effect when it is started
+/// @param capture capture
+/// @param cpu core number, -1 to let it run anywhere - a core of its own keeps the gaps between samples even
+void rp1_gpio_capture_set_cpu(rp1_gpio_capture_t *capture, int cpu)
+{
+    capture->cpu = cpu;
+}
+
+/// @brief Starts the capture thread
+/// @param capture capture, not run before
+/// @return true if the thread was started
+bool rp1_gpio_capture_start(rp1_gpio_capture_t *capture)
+{
+    if (capture->running || atomic_load(&capture->done))
+        return false;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (capture->cpu >= 0)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(capture->cpu, &cpus);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    }
+
+    atomic_store(&capture->stop, false);
+    int res = pthread_create(&capture->thread, &attr, rp1_gpio_capture_thread, capture);
+    pthread_attr_destroy(&attr);
+    if (res != 0)
+        return false;
+    capture->running = true;
+
+    return true;
+}
+
+/// @brief Ends the capture, if it hasn't ended by itself, and waits for the thread
+/// @param capture capture
+void rp1_gpio_capture_stop(rp1_gpio_capture_t *capture)
+{
+    if (!capture->running)
+        return;
+
+    atomic_store(&capture->stop, true);
+    pthread_join(capture->thread, NULL);
+    capture->running = false;
+}
+
+/// @brief Whether the capture has ended - its records may still be waiting to be read
+/// @param capture capture
+bool rp1_gpio_capture_done(rp1_gpio_capture_t *capture)
+{
+    return atomic_load_explicit(&capture->done, memory_order_acquire);
+}
+
+/// @brief Takes the oldest records out of the ring, safe while the capture runs
+/// @param capture capture
+/// @param edges returns the records
+/// @param max room in edges
+/// @return records returned, 0 if there are none waiting
+uint32_t rp1_gpio_capture_read(rp1_gpio_capture_t *capture, rp1_gpio_edge_t *edges, uint32_t max)
+{
+    uint64_t tail = atomic_load_explicit(&capture->tail, memory_order_relaxed);
+    uint64_t available = atomic_load_explicit(&capture->head, memory_order_acquire) - tail;
+    uint32_t n = available < max ? (uint32_t)available : max;
+
+    for (uint32_t i = 0; i < n; i++)
+        edges[i] = capture->ring[(tail + i) & (capture->depth - 1)];
+    atomic_store_explicit(&capture->tail, tail + n, memory_order_release);
+
+    return n;
+}
+
+static bool rp1_gpio_capture_put32(FILE *f, uint32_t v)
+{
+    uint8_t b[4] = {(uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24)};
+    return fwrite(b, 1, sizeof(b), f) == sizeof(b);
+}
+
+static bool rp1_gpio_capture_save_header(rp1_gpio_capture_t *capture, FILE *f, rp1_gpio_capture_format_t format)
+{
+    uint32_t mask = capture->cfg.port->mask;
+    uint64_t start = atomic_load_explicit(&capture->stats.start_ns, memory_order_relaxed);
+
+    if (format == RP1_GPIO_CAPTURE_BINARY)
+    {
+        // magic, pin mask, record size, then the time of the first record as two halves
+        return fwrite(RP1_GPIO_CAPTURE_MAGIC, 1, 8, f) == 8 && rp1_gpio_capture_put32(f, mask) &&
+               rp1_gpio_capture_put32(f, sizeof(rp1_gpio_edge_t)) && rp1_gpio_capture_put32(f, (uint32_t)start) &&
+               rp1_gpio_capture_put32(f, (uint32_t)(start >> 32));
+    }
+
+    // a one character identifier for each pin, from '!', and '~' for the trigger
+    fprintf(f, "$comment rp1 gpio capture, first change at %llu ns $end\n", (unsigned long long)start);
+    fprintf(f, "$timescale 1ns $end\n$scope module rp1 $end\n");
+    for (uint32_t pin = 0; pin < RP1_GPIO_PINS; pin++)
+    {
+        if (mask & (1u << pin))
+            fprintf(f, "$var wire 1 %c gpio%u $end\n", '!' + pin, pin);
+    }
+    fprintf(f, "$var event 1 ~ trigger $end\n$upscope $end\n$enddefinitions $end\n");
+
+    return !ferror(f);
+}
+
+static bool rp1_gpio_capture_save_vcd(rp1_gpio_capture_t *capture, FILE *f, const rp1_gpio_edge_t *edge)
+{
+    uint32_t mask = capture->cfg.port->mask;
+    uint32_t levels = edge->levels & ~RP1_GPIO_CAPTURE_TRIGGER;
+    uint32_t changed = mask;
+
+    if (!capture->saved_any)
+    {
+        fprintf(f, "#0\n$dumpvars\n");
+    }
+    else
+    {
+        capture->saved_ns += edge->run_ns;
+        changed = (levels ^ capture->saved_levels) & mask;
+        if (changed == 0 && !(edge->levels & RP1_GPIO_CAPTURE_TRIGGER))
+            return true; // the end of a split run
+        fprintf(f, "#%llu\n", (unsigned long long)capture->saved_ns);
+    }
+
+    for (uint32_t pin = 0; changed != 0; pin++, changed >>= 1)
+    {
+        if (changed & 1)
+            fprintf(f, "%u%c\n", (levels >> pin) & 1, '!' + pin);
+    }
+    if (!capture->saved_any)
+        fprintf(f, "$end\n");
+    if (edge->levels & RP1_GPIO_CAPTURE_TRIGGER)
+        fprintf(f, "1~\n");
+
+    capture->saved_levels = levels;
+    capture->saved_any = true;
+
+    return !ferror(f);
+}
+
+/// @brief Writes the records waiting in the ring to a file, and takes them out - call it while the
+///        capture runs to stream a capture longer than the ring, and once more when it is done
+/// @param capture capture
+/// @param f file open for writing, every call with the same one and the same format
+/// @param format RP1_GPIO_CAPTURE_BINARY: "RP1GPIO1", the pin mask, the record size and the time of
+///        the first record in ns as a 64 bit number, then the records, all little endian.
+///        RP1_GPIO_CAPTURE_VCD: a value change dump in ns from the first record, with the trigger as an event
+/// @return false if the file couldn't be written
+bool rp1_gpio_capture_save(rp1_gpio_capture_t *capture, FILE *f, rp1_gpio_capture_format_t format)
+{
+    rp1_gpio_edge_t edges[RP1_GPIO_CAPTURE_SAVE_CHUNK];
+    uint32_t n;
+
+    while ((n = rp1_gpio_capture_read(capture, edges, RP1_GPIO_CAPTURE_SAVE_CHUNK)) != 0)
+    {
+        // the header needs the time of the first record
+        if (!capture->header_saved)
+        {
+            if (!rp1_gpio_capture_save_header(capture, f, format))
+                return false;
+            capture->header_saved = true;
+        }
+
+        for (uint32_t i = 0; i < n; i++)
+        {
+            bool ok = format == RP1_GPIO_CAPTURE_BINARY
+                          ? rp1_gpio_capture_put32(f, edges[i].levels) && rp1_gpio_capture_put32(f, edges[i].run_ns)
+                          : rp1_gpio_capture_save_vcd(capture, f, &edges[i]);
+            if (!ok)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+/// @brief Reads the capture counters, safe from any thread while it runs
+/// @param capture capture
+/// @param stats returns the counters
+void rp1_gpio_capture_get_stats(rp1_gpio_capture_t *capture, rp1_gpio_capture_stats_t *stats)
+{
+    stats->samples = atomic_load_explicit(&capture->stats.samples, memory_order_relaxed);
+    stats->edges = atomic_load_explicit(&capture->stats.edges, memory_order_relaxed);
+    stats->start_ns = atomic_load_explicit(&capture->stats.start_ns, memory_order_relaxed);
+    stats->trigger_ns = atomic_load_explicit(&capture->stats.trigger_ns, memory_order_relaxed);
+    stats->end_ns = atomic_load_explicit(&capture->stats.end_ns, memory_order_relaxed);
+    stats->full = atomic_load_explicit(&capture->stats.full, memory_order_relaxed);
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "rp1-gpio.h"
+
+// logic analyser on GPIO bank 0 - a thread of its own reads RIO_NOSYNC_IN back to back, as fast as
+// the PCIe round trips go, and keeps only the changes
+//
+// each change of the port's pins is one record: the new levels, and how long the levels before
+// lasted. A record is taken when a read first sees the change, so its time is good to one read.
+// The records go into a ring allocated up front, with one producer, the capture thread, and one
+// consumer that saves them as they come or after the capture. The capture ends when the ring is
+// full rather than leave a gap in the trace
+//
+// it waits for a trigger first, keeping the last few changes before it so the trace shows what
+// led up to it. The record of the change that fired the trigger is marked with
+// RP1_GPIO_CAPTURE_TRIGGER
+
+#define RP1_GPIO_CAPTURE_CACHE_LINE 64
+// changes kept from before the trigger, at most
+#define RP1_GPIO_CAPTURE_PRETRIGGER 64
+// in the levels of a record, outside the bank
+#define RP1_GPIO_CAPTURE_TRIGGER (1u << 31)
+// a run longer than a record can hold is split, with records that repeat the levels
+#define RP1_GPIO_CAPTURE_MAX_RUN 0xFFFFFFFFu
+
+typedef enum {
+    RP1_GPIO_TRIGGER_NONE,    // start straight away
+    RP1_GPIO_TRIGGER_LEVEL,   // when the pins in the mask are at the given levels
+    RP1_GPIO_TRIGGER_RISING,  // on a rising edge of any pin in the mask
+    RP1_GPIO_TRIGGER_FALLING, // ... a falling edge
+    RP1_GPIO_TRIGGER_EDGE     // ... either
+} rp1_gpio_trigger_t;
+
+typedef enum {
+    RP1_GPIO_CAPTURE_BINARY, // the records as they are, after a header - see rp1_gpio_capture_save()
+    RP1_GPIO_CAPTURE_VCD     // value change dump, for GTKWave, sigrok and the like
+} rp1_gpio_capture_format_t;
+
+typedef struct
+{
+    rp1_gpio_port_t *port;       // pins watched - set them up as inputs, or leave them as they are to watch outputs
+    uint32_t depth;              // records in the ring, rounded up to a power of two
+    uint64_t duration_ns;        // how long to capture after the trigger, 0 until stopped or full
+    rp1_gpio_trigger_t trigger;
+    uint32_t trigger_mask;       // pins the trigger looks at
+    uint32_t trigger_levels;     // their levels, for RP1_GPIO_TRIGGER_LEVEL
+    uint32_t pretrigger;         // changes kept from before the trigger, up to RP1_GPIO_CAPTURE_PRETRIGGER
+} rp1_gpio_capture_config_t;
+
+// one change - 8 bytes, so a million changes is 8MB whatever the sample rate
+typedef struct
+{
+    uint32_t levels; // of all the port's pins from here on, and RP1_GPIO_CAPTURE_TRIGGER
+    uint32_t run_ns; // how long the levels of the record before lasted, 0 for the first
+} rp1_gpio_edge_t;
+
+typedef struct
+{
+    uint64_t samples;    // reads of the pins
+    uint64_t edges;      // records made, the first one and the split runs included
+    uint64_t start_ns;   // time of the first record, on the rp1_gpio_port_now_ns() clock
+    uint64_t trigger_ns; // when the trigger fired, 0 while waiting for it
+    uint64_t end_ns;     // when the capture ended, 0 while it runs
+    bool full;           // it ended because the ring was full
+} rp1_gpio_capture_stats_t;
+
+typedef struct
+{
+    rp1_gpio_capture_config_t cfg;
+    uint32_t depth;
+    rp1_gpio_edge_t *ring;
+
+    _Alignas(RP1_GPIO_CAPTURE_CACHE_LINE) _Atomic uint64_t head; // next record to fill
+    uint64_t tail_cache;
+    _Alignas(RP1_GPIO_CAPTURE_CACHE_LINE) _Atomic uint64_t tail; // next record to consume
+
+    // changes before the trigger with their times, the one that fires it included
+    uint32_t pre_levels[RP1_GPIO_CAPTURE_PRETRIGGER + 1];
+    uint64_t pre_ns[RP1_GPIO_CAPTURE_PRETRIGGER + 1];
+    uint32_t pre_count;
+    uint32_t pre_next;
+
+    // capture thread
+    _Alignas(RP1_GPIO_CAPTURE_CACHE_LINE) pthread_t thread;
+    int cpu;          // core the thread is pinned to, -1 for any
+    bool running;
+    _Atomic bool stop;
+    _Atomic bool done;
+    uint64_t last_ns; // time of the last record
+
+    struct {
+        _Atomic uint64_t samples;
+        _Atomic uint64_t edges;
+        _Atomic uint64_t start_ns;
+        _Atomic uint64_t trigger_ns;
+        _Atomic uint64_t end_ns;
+        _Atomic bool full;
+    } stats;
+
+    // consumer, for rp1_gpio_capture_save()
+    bool header_saved;
+    bool saved_any;        // a record has been saved
+    uint32_t saved_levels; // levels of the last one saved
+    uint64_t saved_ns;     // and its time from the first
+} rp1_gpio_capture_t;
+
+bool rp1_gpio_capture_create(const rp1_gpio_capture_config_t *cfg, rp1_gpio_capture_t **capture);
+void rp1_gpio_capture_destroy(rp1_gpio_capture_t *capture);
+void rp1_gpio_capture_run(rp1_gpio_capture_t *capture);
+void rp1_gpio_capture_set_cpu(rp1_gpio_capture_t *capture, int cpu);
+bool rp1_gpio_capture_start(rp1_gpio_capture_t *capture);
+void rp1_gpio_capture_stop(rp1_gpio_capture_t *capture);
+bool rp1_gpio_capture_done(rp1_gpio_capture_t *capture);
+uint32_t rp1_gpio_capture_read(rp1_gpio_capture_t *capture, rp1_gpio_edge_t *edges, uint32_t max);
+bool rp1_gpio_capture_save(rp1_gpio_capture_t *capture, FILE *f, rp1_gpio_capture_format_t format);
+void rp1_gpio_capture_get_stats(rp1_gpio_capture_t *capture, rp1_gpio_capture_stats_t *stats);
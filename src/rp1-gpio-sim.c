@@ -0,0 +1,230 @@
+#include <stdlib.h>
+
+#include "rp1-regs.h"
+#include "rp1-gpio-sim.h"
+
+// cost of a GPIO register access, same as for the SSI - RIO is across PCIe too
+#define SIM_GPIO_READ_NS 600
+#define SIM_GPIO_WRITE_NS 40
+
+// control register out of reset: no function selected
+#define SIM_GPIO_CTRL_RESET CTRL_MASK_FUNCSEL
+// pad out of reset: output disabled, input enabled
+#define SIM_GPIO_PAD_RESET (PADS_MASK_OD | PADS_MASK_IE)
+
+#define SIM_GPIO_ALIAS_MASK 0x3000
+#define SIM_GPIO_BLOCK_MASK 0xFFF
+
+struct rp1_gpio_sim
+{
+    rp1_spi_sim_t *ssi;
+
+    uint32_t ctrl[RP1_GPIO_SIM_PINS];
+    uint32_t pads[RP1_GPIO_SIM_PINS];
+    uint32_t rio_out;
+    uint32_t rio_oe;
+    uint32_t external; // levels driven from outside
+    uint32_t source_pins;
+    rp1_gpio_sim_source_t source;
+    void *source_ctx;
+
+    uint32_t levels;   // levels on the pins as last worked out
+    uint64_t changed_ns[RP1_GPIO_SIM_PINS];
+    rp1_gpio_sim_stats_t stats;
+};
+
+/// @brief Creates a model of GPIO bank 0
+/// @param ssi SSI model whose clock the accesses advance
+/// @param sim returns the new model
+/// @return true if successful
+bool rp1_gpio_sim_create(rp1_spi_sim_t *ssi, rp1_gpio_sim_t **sim)
+{
+    rp1_gpio_sim_t *s = (rp1_gpio_sim_t *)calloc(1, sizeof(rp1_gpio_sim_t));
+    if (s == NULL)
+        return false;
+
+    s->ssi = ssi;
+    for (int i = 0; i < RP1_GPIO_SIM_PINS; i++)
+    {
+        s->ctrl[i] = SIM_GPIO_CTRL_RESET;
+        s->pads[i] = SIM_GPIO_PAD_RESET;
+    }
+
+    *sim = s;
+
+    return true;
+}
+
+void rp1_gpio_sim_destroy(rp1_gpio_sim_t *sim)
+{
+    free(sim);
+}
+
+// the pins RIO is driving
+static uint32_t sim_driven(rp1_gpio_sim_t *sim)
+{
+    uint32_t driven = 0;
+    for (int i = 0; i < RP1_GPIO_SIM_PINS; i++)
+    {
+        if ((sim->ctrl[i] & CTRL_MASK_FUNCSEL) == CTRL_FUNCSEL_RIO && !(sim->pads[i] & PADS_MASK_OD))
+            driven |= 1u << i;
+    }
+    return driven & sim->rio_oe;
+}
+
+// works out the levels after a change and stamps the pins that moved
+static void sim_update(rp1_gpio_sim_t *sim)
+{
+    uint32_t driven = sim_driven(sim);
+    uint32_t levels = ((sim->rio_out & driven) | (sim->external & ~driven)) & ((1u << RP1_GPIO_SIM_PINS) - 1);
+    uint32_t changed = levels ^ sim->levels;
+    uint64_t now = rp1_spi_sim_now(sim->ssi);
+
+    for (int i = 0; changed != 0; i++, changed >>= 1)
+    {
+        if (changed & 1)
+            sim->changed_ns[i] = now;
+    }
+    sim->levels = levels;
+}
+
+// what the input synchronisers see
+static uint32_t sim_inputs(rp1_gpio_sim_t *sim)
+{
+    uint32_t enabled = 0;
+    for (int i = 0; i < RP1_GPIO_SIM_PINS; i++)
+    {
+        if (sim->pads[i] & PADS_MASK_IE)
+            enabled |= 1u << i;
+    }
+    return sim->levels & enabled;
+}
+
+static uint32_t sim_apply(uint32_t reg, uint32_t alias, uint32_t value)
+{
+    switch (alias)
+    {
+    case RP1_ATOM_XOR_OFFSET:
+        return reg ^ value;
+    case RP1_ATOM_SET_OFFSET:
+        return reg | value;
+    case RP1_ATOM_CLR_OFFSET:
+        return reg & ~value;
+    default:
+        return value;
+    }
+}
+
+// the register an offset lands on, NULL if it isn't one the model has
+static uint32_t *sim_reg(rp1_gpio_sim_t *sim, uint32_t offset)
+{
+    uint32_t block = offset & ~(uint32_t)0xFFFF;
+    uint32_t reg = offset & SIM_GPIO_BLOCK_MASK;
+
+    if (block == RP1_IO_BANK0_BASE && (reg & 7) == 4 && reg / 8 < RP1_GPIO_SIM_PINS)
+        return &sim->ctrl[reg / 8];
+    if (block == RP1_PADS_BANK0_BASE && reg >= PADS_BANK0_GPIO_OFFSET && (reg - PADS_BANK0_GPIO_OFFSET) / 4 < RP1_GPIO_SIM_PINS)
+        return &sim->pads[(reg - PADS_BANK0_GPIO_OFFSET) / 4];
+    if (block == RP1_RIO0_BASE && reg == RIO_OUT_OFFSET)
+        return &sim->rio_out;
+    if (block == RP1_RIO0_BASE && reg == RIO_OE_OFFSET)
+        return &sim->rio_oe;
+    return NULL;
+}
+
+/// @brief Reads a register of the model, advancing virtual time by one PCIe round trip
+/// @param sim model
+/// @param offset offset in the RP1 peripheral window
+/// @return the register, 0 for one the model doesn't have
+uint32_t rp1_gpio_sim_read(rp1_gpio_sim_t *sim, uint32_t offset)
+{
+    rp1_spi_sim_advance(sim->ssi, SIM_GPIO_READ_NS);
+    sim->stats.reads++;
+
+    uint32_t block = offset & ~(uint32_t)0xFFFF;
+    uint32_t reg = offset & SIM_GPIO_BLOCK_MASK;
+    if (block == RP1_RIO0_BASE && (reg == RIO_SYNC_IN_OFFSET || reg == RIO_NOSYNC_IN_OFFSET))
+    {
+        // the pins are sampled as the read completes
+        if (sim->source != NULL)
+        {
+            uint32_t levels = sim->source(sim->source_ctx, rp1_spi_sim_now(sim->ssi));
+            sim->external = (sim->external & ~sim->source_pins) | (levels & sim->source_pins);
+            sim_update(sim);
+        }
+        return sim_inputs(sim);
+    }
+
+    uint32_t *r = sim_reg(sim, offset);
+    return r != NULL ? *r : 0;
+}
+
+/// @brief Writes a register of the model, advancing virtual time by one posted PCIe write
+/// @param sim model
+/// @param offset offset in the RP1 peripheral window, through an atomic alias or not
+/// @param value value, or the mask for an alias
+void rp1_gpio_sim_write(rp1_gpio_sim_t *sim, uint32_t offset, uint32_t value)
+{
+    rp1_spi_sim_advance(sim->ssi, SIM_GPIO_WRITE_NS);
+    sim->stats.writes++;
+
+    uint32_t *r = sim_reg(sim, offset & ~(uint32_t)SIM_GPIO_ALIAS_MASK);
+    if (r == NULL)
+        return;
+    *r = sim_apply(*r, offset & SIM_GPIO_ALIAS_MASK, value);
+    sim_update(sim);
+}
+
+/// @brief Drives a pin from outside, where RIO isn't driving it
+/// @param sim model
+/// @param pin GPIO number
+/// @param level level from now on
+void rp1_gpio_sim_drive(rp1_gpio_sim_t *sim, uint8_t pin, bool level)
+{
+    if (pin >= RP1_GPIO_SIM_PINS)
+        return;
+
+    if (level)
+        sim->external |= 1u << pin;
+    else
+        sim->external &= ~(1u << pin);
+    sim_update(sim);
+}
+
+/// @brief Drives some pins from outside with a signal of their own, looked at whenever the inputs are read
+/// @param sim model
+/// @param pins pins the source drives, bit n for GPIO n
+/// @param source levels of the pins at a time, NULL to leave them where they are
+/// @param ctx passed to source
+void rp1_gpio_sim_set_source(rp1_gpio_sim_t *sim, uint32_t pins, rp1_gpio_sim_source_t source, void *ctx)
+{
+    sim->source_pins = pins;
+    sim->source = source;
+    sim->source_ctx = ctx;
+}
+
+/// @brief The levels on all the pins, as a scope would see them - no time passes
+/// @param sim model
+uint32_t rp1_gpio_sim_levels(rp1_gpio_sim_t *sim)
+{
+    return sim->levels;
+}
+
+/// @brief When a pin last changed level
+/// @param sim model
+/// @param pin GPIO number
+/// @return virtual time in ns, 0 if it never has
+uint64_t rp1_gpio_sim_changed_ns(rp1_gpio_sim_t *sim, uint8_t pin)
+{
+    return pin < RP1_GPIO_SIM_PINS ? sim->changed_ns[pin] : 0;
+}
+
+uint64_t rp1_gpio_sim_now(rp1_gpio_sim_t *sim)
+{
+    return rp1_spi_sim_now(sim->ssi);
+}
+
+void rp1_gpio_sim_get_stats(rp1_gpio_sim_t *sim, rp1_gpio_sim_stats_t *stats)
+{
+    *stats = sim->stats;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "rp1-spi-sim.h"
+
+// software model of GPIO bank 0 of the RP1 - the IO_BANK0 control registers, the pads and RIO
+//
+// registers are addressed by their offset in the RP1 peripheral window, atomic XOR / SET / CLR
+// aliases included, as rp1-regs.h has them. A pin is driven by RIO when its function is RIO, its
+// output enable is set and its pad doesn't disable the output; anything else is driven from
+// outside with rp1_gpio_sim_drive(), or by a source of levels over time. Inputs read 0 where the pad's input enable is clear.
+// Register accesses advance the SSI model's clock, so GPIO and SPI share one timeline
+
+#define RP1_GPIO_SIM_PINS 28
+
+typedef struct rp1_gpio_sim rp1_gpio_sim_t;
+
+// levels driven from outside at a given time, for a signal that changes on its own
+typedef uint32_t (*rp1_gpio_sim_source_t)(void *ctx, uint64_t now_ns);
+
+typedef struct
+{
+    uint64_t reads;  // register reads
+    uint64_t writes; // register writes
+} rp1_gpio_sim_stats_t;
+
+bool rp1_gpio_sim_create(rp1_spi_sim_t *ssi, rp1_gpio_sim_t **sim);
+void rp1_gpio_sim_destroy(rp1_gpio_sim_t *sim);
+
+uint32_t rp1_gpio_sim_read(rp1_gpio_sim_t *sim, uint32_t offset);
+void rp1_gpio_sim_write(rp1_gpio_sim_t *sim, uint32_t offset, uint32_t value);
+
+void rp1_gpio_sim_drive(rp1_gpio_sim_t *sim, uint8_t pin, bool level);
+void rp1_gpio_sim_set_source(rp1_gpio_sim_t *sim, uint32_t pins, rp1_gpio_sim_source_t source, void *ctx);
+uint32_t rp1_gpio_sim_levels(rp1_gpio_sim_t *sim);
+uint64_t rp1_gpio_sim_changed_ns(rp1_gpio_sim_t *sim, uint8_t pin);
+uint64_t rp1_gpio_sim_now(rp1_gpio_sim_t *sim);
+void rp1_gpio_sim_get_stats(rp1_gpio_sim_t *sim, rp1_gpio_sim_stats_t *stats);
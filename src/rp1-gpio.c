@@ -0,0 +1,284 @@
+#include <fcntl.h>
+#include <linux/gpio.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rp1-gpio.h"
+
+#define RP1_GPIO_RIO_OUT (RP1_RIO0_BASE + RIO_OUT_OFFSET)
+#define RP1_GPIO_RIO_OE (RP1_RIO0_BASE + RIO_OE_OFFSET)
+#define RP1_GPIO_RIO_SYNC_IN (RP1_RIO0_BASE + RIO_SYNC_IN_OFFSET)
+#define RP1_GPIO_RIO_NOSYNC_IN (RP1_RIO0_BASE + RIO_NOSYNC_IN_OFFSET)
+
+static inline uint32_t rp1_gpio_reg_read(rp1_gpio_port_t *port, uint32_t offset)
+{
+    if (__builtin_expect(port->sim != NULL, 0))
+        return rp1_gpio_sim_read(port->sim, offset);
+    return *(volatile uint32_t *)(port->regbase + offset);
+}
+
+static inline void rp1_gpio_reg_write(rp1_gpio_port_t *port, uint32_t offset, uint32_t value)
+{
+    if (__builtin_expect(port->sim != NULL, 0))
+        rp1_gpio_sim_write(port->sim, offset, value);
+    else
+        *(volatile uint32_t *)(port->regbase + offset) = value;
+}
+
+static bool rp1_gpio_port_alloc(volatile void *regbase, rp1_gpio_sim_t *sim, uint32_t mask, rp1_gpio_port_t **port)
+{
+    if (mask == 0 || (mask & ~RP1_GPIO_ALL) != 0)
+        return false;
+
+    rp1_gpio_port_t *p = (rp1_gpio_port_t *)calloc(1, sizeof(rp1_gpio_port_t));
+    if (p == NULL)
+        return false;
+
+    p->regbase = regbase;
+    p->sim = sim;
+    p->mask = mask;
+
+    // the one read a port makes of its outputs
+    p->out = rp1_gpio_reg_read(p, RP1_GPIO_RIO_OUT);
+
+    *port = p;
+
+    return true;
+}
+
+/// @brief Creates a port of bank 0 pins - nothing about the pins is changed until they are set up
+/// @param rp1 RP1 instance
+/// @param mask pins of the port, bit n for GPIO n
+/// @param port returns the new port
+/// @return true if successful, false for an empty mask or a pin that isn't in bank 0
+bool rp1_gpio_port_create(rp1_t *rp1, uint32_t mask, rp1_gpio_port_t **port)
+{
+    return rp1_gpio_port_alloc(rp1->rp1_peripherial_base, NULL, mask, port);
+}
+
+/// @brief Creates a port on the GPIO model
+/// @param sim GPIO model, see rp1-gpio-sim.h
+/// @param mask pins of the port, bit n for GPIO n
+/// @param port returns the new port
+/// @return true if successful, false for an empty mask or a pin that isn't in bank 0
+bool rp1_gpio_port_create_sim(rp1_gpio_sim_t *sim, uint32_t mask, rp1_gpio_port_t **port)
+{
+    return rp1_gpio_port_alloc(NULL, sim, mask, port);
+}
+
+void rp1_gpio_port_destroy(rp1_gpio_port_t *port)
+{
+    free(port);
+}
+
+/// @brief Selects a function for some of the port's pins - two posted writes a pin, no readback
+/// @param port port
+/// @param pins pins to change, bit n for GPIO n - those outside the port are left alone
+/// @param funcsel function, e.g. CTRL_FUNCSEL_RIO
+void rp1_gpio_port_set_function(rp1_gpio_port_t *port, uint32_t pins, uint8_t funcsel)
+{
+    pins &= port->mask;
+    for (uint32_t pin = 0; pins != 0; pin++, pins >>= 1)
+    {
+        if (!(pins & 1))
+            continue;
+        uint32_t ctrl = RP1_IO_BANK0_BASE + 8 * pin + 4;
+        rp1_gpio_reg_write(port, ctrl + RP1_ATOM_CLR_OFFSET, CTRL_MASK_FUNCSEL);
+        rp1_gpio_reg_write(port, ctrl + RP1_ATOM_SET_OFFSET, funcsel & CTRL_MASK_FUNCSEL);
+    }
+}
+
+/// @brief Sets and clears bits in the pad controls of some of the port's pins
+/// @param port port
+/// @param pins pins to change, bit n for GPIO n - those outside the port are left alone
+/// @param set pad bits to set, e.g. PADS_MASK_IE
+/// @param clear pad bits to clear, e.g. PADS_MASK_OD
+void rp1_gpio_port_set_pads(rp1_gpio_port_t *port, uint32_t pins, uint32_t set, uint32_t clear)
+{
+    pins &= port->mask;
+    for (uint32_t pin = 0; pins != 0; pin++, pins >>= 1)
+    {
+        if (!(pins & 1))
+            continue;
+        uint32_t pad = RP1_PADS_BANK0_BASE + PADS_BANK0_GPIO_OFFSET + 4 * pin;
+        if (clear != 0)
+            rp1_gpio_reg_write(port, pad + RP1_ATOM_CLR_OFFSET, clear);
+        if (set != 0)
+            rp1_gpio_reg_write(port, pad + RP1_ATOM_SET_OFFSET, set);
+    }
+}
+
+/// @brief Makes some of the port's pins RIO outputs, starting at the given levels without a glitch
+/// @param port port
+/// @param pins pins to set up, bit n for GPIO n
+/// @param levels their levels to start with
+void rp1_gpio_port_outputs(rp1_gpio_port_t *port, uint32_t pins, uint32_t levels)
+{
+    pins &= port->mask;
+    if (pins == 0)
+        return;
+
+    // the level and the output enable are in place before the pad and the function hand the pin over
+    rp1_gpio_port_write(port, pins, levels);
+    rp1_gpio_reg_write(port, RP1_GPIO_RIO_OE + RP1_ATOM_SET_OFFSET, pins);
+    rp1_gpio_port_set_pads(port, pins, PADS_MASK_IE, PADS_MASK_OD);
+    rp1_gpio_port_set_function(port, pins, CTRL_FUNCSEL_RIO);
+}
+
+/// @brief Makes some of the port's pins RIO inputs
+/// @param port port
+/// @param pins pins to set up, bit n for GPIO n
+void rp1_gpio_port_inputs(rp1_gpio_port_t *port, uint32_t pins)
+{
+    pins &= port->mask;
+    if (pins == 0)
+        return;
+
+    rp1_gpio_reg_write(port, RP1_GPIO_RIO_OE + RP1_ATOM_CLR_OFFSET, pins);
+    rp1_gpio_port_set_pads(port, pins, PADS_MASK_IE, PADS_MASK_OD);
+    rp1_gpio_port_set_function(port, pins, CTRL_FUNCSEL_RIO);
+}
+
+/// @brief Drives pins high, all in one write
+/// @param port port
+/// @param pins bit n for GPIO n - those outside the port are left alone
+void rp1_gpio_port_set(rp1_gpio_port_t *port, uint32_t pins)
+{
+    pins &= port->mask;
+    rp1_gpio_reg_write(port, RP1_GPIO_RIO_OUT + RP1_ATOM_SET_OFFSET, pins);
+    port->out |= pins;
+}
+
+/// @brief Drives pins low, all in one write
+/// @param port port
+/// @param pins bit n for GPIO n - those outside the port are left alone
+void rp1_gpio_port_clear(rp1_gpio_port_t *port, uint32_t pins)
+{
+    pins &= port->mask;
+    rp1_gpio_reg_write(port, RP1_GPIO_RIO_OUT + RP1_ATOM_CLR_OFFSET, pins);
+    port->out &= ~pins;
+}
+
+/// @brief Inverts pins, all in one write
+/// @param port port
+/// @param pins bit n for GPIO n - those outside the port are left alone
+void rp1_gpio_port_toggle(rp1_gpio_port_t *port, uint32_t pins)
+{
+    pins &= port->mask;
+    rp1_gpio_reg_write(port, RP1_GPIO_RIO_OUT + RP1_ATOM_XOR_OFFSET, pins);
+    port->out ^= pins;
+}
+
+/// @brief Drives pins to the given levels, high and low together in one write
+/// @param port port
+/// @param pins pins to drive, bit n for GPIO n - those outside the port are left alone
+/// @param levels their new levels
+/// @note the write inverts the pins that differ from the levels the port last drove, see rp1-gpio.h
+void rp1_gpio_port_write(rp1_gpio_port_t *port, uint32_t pins, uint32_t levels)
+{
+    uint32_t diff = (port->out ^ levels) & pins & port->mask;
+    if (diff != 0)
+        rp1_gpio_port_toggle(port, diff);
+}
+
+/// @brief Reads the levels on all of the port's pins in one round trip
+/// @param port port
+/// @return bit n for GPIO n, 0 outside the port and for pins whose pad has its input disabled
+uint32_t rp1_gpio_port_read(rp1_gpio_port_t *port)
+{
+    return rp1_gpio_reg_read(port, RP1_GPIO_RIO_SYNC_IN) & port->mask;
+}
+
+/// @brief Reads the port's pins straight from the pads, without the two synchroniser stages
+/// @param port port
+/// @return bit n for GPIO n, 0 outside the port - a pin changing as it is read may come back either way
+uint32_t rp1_gpio_port_read_nosync(rp1_gpio_port_t *port)
+{
+    return rp1_gpio_reg_read(port, RP1_GPIO_RIO_NOSYNC_IN) & port->mask;
+}
+
+/// @brief The time, on the model's clock for a port on the model
+/// @param port port
+/// @return CLOCK_MONOTONIC in ns, or the model's virtual time
+uint64_t rp1_gpio_port_now_ns(rp1_gpio_port_t *port)
+{
+    if (port->sim != NULL)
+        return rp1_gpio_sim_now(port->sim);
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/// @brief Asks the kernel for the edges on one pin, as events read from a file descriptor
+/// @param chip GPIO character device the pin belongs to, e.g. /dev/gpiochip0
+/// @param pin line number on that chip - GPIO n of bank 0 is line n of the RP1's chip
+/// @param rising report rising edges
+/// @param falling report falling edges
+/// @param fd returns the line request, to wait on with rp1_gpio_edge_wait() and close() when done
+/// @return true if successful - the pin must not be claimed by a driver, and it is an input from now on
+bool rp1_gpio_edge_open(const char *chip, uint8_t pin, bool rising, bool falling, int *fd)
+{
+    if (!rising && !falling)
+        return false;
+
+    int chip_fd = open(chip, O_RDONLY | O_CLOEXEC);
+    if (chip_fd < 0)
+        return false;
+
+    struct gpio_v2_line_request req;
+    memset(&req, 0, sizeof(req));
+    req.offsets[0] = pin;
+    req.num_lines = 1;
+    strncpy(req.consumer, "rp1-gpio", sizeof(req.consumer) - 1);
+    // stamped by the interrupt handler on CLOCK_MONOTONIC, the clock rp1_spi_now_ns() reads
+    req.config.flags = GPIO_V2_LINE_FLAG_INPUT | (rising ? GPIO_V2_LINE_FLAG_EDGE_RISING : 0) |
+                       (falling ? GPIO_V2_LINE_FLAG_EDGE_FALLING : 0);
+    req.event_buffer_size = RP1_GPIO_EDGE_EVENTS;
+
+    int res = ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &req);
+    close(chip_fd);
+    if (res < 0)
+        return false;
+
+    *fd = req.fd;
+
+    return true;
+}
+
+/// @brief Waits for the next edge of one kind from rp1_gpio_edge_open(), taking every edge already queued
+/// @param fd line request
+/// @param rising the edge waited for, rising or else falling - any of the other kind are passed over
+/// @param timeout_ms longest to wait, -1 for ever
+/// @param edge_ns returns when the kernel saw the last edge taken, on CLOCK_MONOTONIC
+/// @param seqno returns the kernel's number for the last edge taken, counting every edge of the line
+///              it reported - opened for the one kind, a gap of more than one from the last means edges missed
+/// @return edges of the kind taken, more than one if some came while nobody was waiting - 0 for none in time
+uint32_t rp1_gpio_edge_wait(int fd, bool rising, int timeout_ms, uint64_t *edge_ns, uint32_t *seqno)
+{
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    if (poll(&pfd, 1, timeout_ms) <= 0)
+        return 0;
+
+    struct gpio_v2_line_event events[RP1_GPIO_EDGE_EVENTS];
+    ssize_t n = read(fd, events, sizeof(events));
+    if (n < (ssize_t)sizeof(events[0]))
+        return 0;
+
+    uint32_t id = rising ? GPIO_V2_LINE_EVENT_RISING_EDGE : GPIO_V2_LINE_EVENT_FALLING_EDGE;
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < (uint32_t)(n / sizeof(events[0])); i++)
+    {
+        if (events[i].id != id)
+            continue;
+        *edge_ns = events[i].timestamp_ns;
+        *seqno = events[i].line_seqno;
+        count++;
+    }
+
+    return count;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "rp1-regs.h"
+#include "rp1-gpio-sim.h"
+
+// a group of bank 0 pins driven and read together through RIO
+//
+// every change is one posted write of a mask to an atomic alias of the RIO output or output enable
+// register, so all the pins in it move on the same clock edge, and all the inputs come back from
+// one read of the synchronised input register. The port keeps its own copy of the levels it has
+// driven, so rp1_gpio_port_write() can set some pins and clear others in one XOR - which only holds
+// while nothing else drives those pins through RIO, e.g. a GPIO chip select of rp1_spi_set_cs_control()
+
+#define RP1_GPIO_PINS 28
+#define RP1_GPIO_ALL ((1u << RP1_GPIO_PINS) - 1)
+// edges the kernel queues for a pin, see rp1_gpio_edge_open()
+#define RP1_GPIO_EDGE_EVENTS 16
+
+typedef struct
+{
+    volatile void *regbase;  // RP1 peripheral window
+    struct rp1_gpio_sim *sim; // when set, register accesses go to the model instead of regbase
+    uint32_t mask;           // pins of the port
+    uint32_t out;            // levels last driven, as RIO_OUT
+} rp1_gpio_port_t;
+
+bool rp1_gpio_port_create(rp1_t *rp1, uint32_t mask, rp1_gpio_port_t **port);
+bool rp1_gpio_port_create_sim(rp1_gpio_sim_t *sim, uint32_t mask, rp1_gpio_port_t **port);
+void rp1_gpio_port_destroy(rp1_gpio_port_t *port);
+void rp1_gpio_port_set_function(rp1_gpio_port_t *port, uint32_t pins, uint8_t funcsel);
+void rp1_gpio_port_set_pads(rp1_gpio_port_t *port, uint32_t pins, uint32_t set, uint32_t clear);
+void rp1_gpio_port_outputs(rp1_gpio_port_t *port, uint32_t pins, uint32_t levels);
+void rp1_gpio_port_inputs(rp1_gpio_port_t *port, uint32_t pins);
+void rp1_gpio_port_set(rp1_gpio_port_t *port, uint32_t pins);
+void rp1_gpio_port_clear(rp1_gpio_port_t *port, uint32_t pins);
+void rp1_gpio_port_toggle(rp1_gpio_port_t *port, uint32_t pins);
+void rp1_gpio_port_write(rp1_gpio_port_t *port, uint32_t pins, uint32_t levels);
+uint32_t rp1_gpio_port_read(rp1_gpio_port_t *port);
+uint32_t rp1_gpio_port_read_nosync(rp1_gpio_port_t *port);
+uint64_t rp1_gpio_port_now_ns(rp1_gpio_port_t *port);
+
+// edges of one pin from the kernel's GPIO character device, for waiting on a pin without
+// polling it - each edge costs an interrupt and a wakeup, tens of microseconds, where a port
+// read notices it within one PCIe round trip but keeps a core busy. The kernel numbers the
+// edges it sees on the line, so edges it had no room to queue still show as a gap in the numbers
+bool rp1_gpio_edge_open(const char *chip, uint8_t pin, bool rising, bool falling, int *fd);
+uint32_t rp1_gpio_edge_wait(int fd, bool rising, int timeout_ms, uint64_t *edge_ns, uint32_t *seqno);
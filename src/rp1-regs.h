@@ -1,5 +1,7 @@
 #pragma once
 
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
@@ -36,6 +38,12 @@
 
 #define CTRL_FUNCSEL_RIO 0x05
 
+#define PADS_MASK_IE      0b00000000000000000000000001000000 // input enable
+#define PADS_MASK_OD      0b00000000000000000000000010000000 // output disable
+
+// clk_sys, which the SSI divides by BAUDR to make SCLK
+#define RP1_CLK_SYS_HZ 200000000
+
 
 
 ////////////////////////////////////////////////////
@@ -58,12 +66,99 @@ typedef struct
     volatile uint32_t *pad;
 } gpio_pin_t;
 
+struct rp1_spi_sim;
+struct rp1_spi_device;
+struct rp1_spi_latency;
+
+// how a transfer waits for frames to come back
+typedef enum {
+    RP1_SPI_WAIT_SPIN,   // poll RXFLR back to back
+    RP1_SPI_WAIT_HYBRID  // sleep until shortly before the frames are due, then poll
+} rp1_spi_wait_t;
+
+// who drives the chip select lines
+typedef enum {
+    RP1_SPI_CS_AUTO,     // the SSI, which releases CS whenever the TX FIFO runs dry
+    RP1_SPI_CS_OVERRIDE, // the SSI with CS_OVERRIDE set, CS follows SER
+    RP1_SPI_CS_GPIO      // the pins are switched to RIO and driven by the driver, as Linux does with cs-gpios
+} rp1_spi_cs_control_t;
+
+typedef struct {
+    uint64_t sleeps;      // times a transfer slept ahead of the predicted arrival of frames
+    uint64_t sleep_ns;    // total time asked to sleep
+    uint64_t spin_ns;     // total time spent polling after waking (hybrid mode only)
+    uint64_t polls;       // RXFLR reads made while waiting for frames
+    uint64_t empty_polls; // of those, reads that found the RX FIFO empty - wasted round trips
+} rp1_spi_wait_stats_t;
+
+// counters kept by every transfer, cheap enough to leave on - see rp1_spi_get_counters()
+typedef struct {
+    uint64_t transfers;      // transfers that completed or failed
+    uint64_t bytes;          // moved by the transfers that completed, frames rounded up to whole bytes
+    uint64_t tx_full_polls;  // TXFLR reads of a transmit only transfer that found no room to refill
+    uint64_t rx_empty_polls; // RXFLR reads that found nothing to read
+    uint64_t timeouts;       // transfers that ended with SPI_TIMEOUT
+    uint64_t tx_overflows;   // ... SPI_TX_OVERFLOW
+    uint64_t rx_overflows;   // ... SPI_RX_OVERFLOW
+    uint64_t rx_underflows;  // ... SPI_RX_UNDERFLOW
+} rp1_spi_counters_t;
+
 typedef struct {
 
     volatile void *regbase;
+    struct rp1_spi_sim *sim;    // when set, register accesses go to the simulator instead of regbase
+    uint8_t spinum;             // which of the SPI controllers this is
     char *txdata;
     char *rxdata;
-    uint8_t txcount;
+    uint32_t txcount;   // frames still to be queued by the transfer in progress
+    uint32_t fifo_len;  // depth of each of the TX and RX FIFOs, in frames
+    bool pack32;        // byte streams may be sent as 32 bit frames
+    uint8_t cs;         // chip select line used by transfers
+    uint8_t ncs;        // chip select lines the controller brings out, see rp1_spi_pins
+    uint32_t cs_mask;   // SER image that selects it
+    rp1_spi_cs_control_t cs_control;
+    bool cs_held;                  // CS asserted across transfers, see rp1_spi_hold_cs()
+    volatile uint32_t *rio_out;    // RIO output register, for GPIO chip selects
+    uint8_t cs_pins[4];            // GPIO of each chip select line
+    int irq_fd;         // interrupt file descriptor (UIO device or eventfd), -1 to poll
+    bool irq_uio;       // irq_fd is a UIO device and has to be re-armed after each interrupt
+    uint32_t rxftlr;    // RXFTLR as last written in interrupt mode
+    uint32_t txftlr;    // TXFTLR as last written in interrupt mode
+    uint8_t bits;       // frame size the controller is set to
+    uint8_t frame_bits; // frame size of the device, which packed byte streams leave the controller
+                        // away from - see rp1_spi_set_frame_packing()
+    rp1_spi_wait_t wait;
+    uint32_t bit_ns;    // SCLK period, from BAUDR
+    uint32_t spin_ns;   // hybrid waits wake this long before the frames are due
+    rp1_spi_wait_stats_t wait_stats;
+
+    // rp1_spi_counters_t as it is kept - only the thread running a transfer writes them, any may read
+    struct {
+        _Atomic uint64_t transfers;
+        _Atomic uint64_t bytes;
+        _Atomic uint64_t tx_full_polls;
+        _Atomic uint64_t rx_empty_polls;
+        _Atomic uint64_t timeouts;
+        _Atomic uint64_t tx_overflows;
+        _Atomic uint64_t rx_overflows;
+        _Atomic uint64_t rx_underflows;
+    } counters;
+    uint64_t reg_reads;  // register accesses, only counted when built with RP1_SPI_COUNT_ACCESSES
+    uint64_t reg_writes;
+    struct rp1_spi_latency *latency; // time of each transfer is recorded here when set, see rp1_spi_set_latency()
+    uint64_t started_ns;             // when the transfer in progress started, kept only for latency
+
+    pthread_mutex_t lock;                 // held for a transaction when the bus is shared, see rp1_spi_lock()
+    const struct rp1_spi_device *device;  // device the controller is set up for, NULL after a direct change
+
+    // images of the configuration registers as last written, so switching between
+    // devices is a handful of posted writes with no readback
+    uint32_t ctrlr0;
+    uint32_t ctrlr1;    // NDF, frames clocked by a receive only or EEPROM read transfer, minus 1
+    uint32_t baudr;
+    uint32_t rx_sample_dly;
+    uint32_t ser;
+    bool enabled;       // SSIENR
 
 } rp1_spi_instance_t;
 
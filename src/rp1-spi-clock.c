@@ -0,0 +1,317 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pi_pico_commands.h"
+#include "rp1-spi-clock.h"
+#include "rp1-spi-io.h"
+
+// below this span of host time the drift can't be told from the jitter of the pairs,
+// and the clocks are taken to run at the same rate
+#define RP1_SPI_CLOCK_MIN_SPAN_NS 100000000ull
+// pairs further than this many rms distances off the first line are dropped
+#define RP1_SPI_CLOCK_REJECT_SIGMA 3.0
+// a pico crystal is well inside this, so a new reading is no further off the line than the
+// drift since the line's reference could take it
+#define RP1_SPI_CLOCK_MAX_PPM 200
+
+/// @brief Creates a clock correlation for a pico
+/// @param device the pico, which answers CMD_READ_SYSTIME with its time_us_32()
+/// @param timeout ms for each exchange, 0 for none
+/// @param clock returns the new clock
+/// @return true if successful
+bool rp1_spi_clock_create(const rp1_spi_device_t *device, uint32_t timeout, rp1_spi_clock_t **clock)
+{
+    rp1_spi_clock_t *c = (rp1_spi_clock_t *)calloc(1, sizeof(rp1_spi_clock_t));
+    if (c == NULL)
+        return false;
+
+    c->device = device;
+    c->timeout = timeout;
+    c->rate = 1.0;
+
+    *clock = c;
+
+    return true;
+}
+
+void rp1_spi_clock_destroy(rp1_spi_clock_t *clock)
+{
+    free(clock);
+}
+
+// least squares line through the pairs marked in use, x and y taken from the first of them
+// returns the number of pairs used
+static uint32_t rp1_spi_clock_line(const rp1_spi_clock_t *clock, const bool *use, uint64_t ref_host, uint64_t ref_device,
+                                   double *a, double *b)
+{
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    double xmin = INFINITY, xmax = -INFINITY;
+    uint32_t n = 0;
+
+    for (uint32_t i = 0; i < clock->count; i++)
+    {
+        if (!use[i])
+            continue;
+        double x = (double)(int64_t)(clock->pairs[i].host_ns - ref_host);
+        double y = (double)(int64_t)(clock->pairs[i].device_ns - ref_device);
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+        xmin = x < xmin ? x : xmin;
+        xmax = x > xmax ? x : xmax;
+        n++;
+    }
+
+    *b = 1.0;
+    if (n > 1 && xmax - xmin >= RP1_SPI_CLOCK_MIN_SPAN_NS)
+        *b = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+    *a = (sy - *b * sx) / n;
+
+    return n;
+}
+
+static double rp1_spi_clock_residual(const rp1_spi_clock_pair_t *pair, uint64_t ref_host, uint64_t ref_device, double a, double b)
+{
+    double x = (double)(int64_t)(pair->host_ns - ref_host);
+    double y = (double)(int64_t)(pair->device_ns - ref_device);
+    return y - (a + b * x);
+}
+
+// fits the line through the window and publishes it
+static void rp1_spi_clock_fit(rp1_spi_clock_t *clock)
+{
+    bool use[RP1_SPI_CLOCK_WINDOW];
+    uint32_t rtts[RP1_SPI_CLOCK_WINDOW];
+    uint32_t n = clock->count;
+
+    // the quicker half of the exchanges - insertion sort, the window is small
+    for (uint32_t i = 0; i < n; i++)
+    {
+        uint32_t rtt = clock->pairs[i].rtt_ns;
+        uint32_t j = i;
+        for (; j > 0 && rtts[j - 1] > rtt; j--)
+            rtts[j] = rtts[j - 1];
+        rtts[j] = rtt;
+    }
+    uint32_t limit = rtts[(n - 1) / 2];
+
+    uint64_t ref_host = 0;
+    uint64_t ref_device = 0;
+    bool ref = false;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        use[i] = clock->pairs[i].rtt_ns <= limit;
+        if (use[i] && !ref)
+        {
+            ref = true;
+            ref_host = clock->pairs[i].host_ns;
+            ref_device = clock->pairs[i].device_ns;
+        }
+    }
+
+    double a, b;
+    uint32_t used = rp1_spi_clock_line(clock, use, ref_host, ref_device, &a, &b);
+
+    double sum = 0;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        if (use[i])
+        {
+            double r = rp1_spi_clock_residual(&clock->pairs[i], ref_host, ref_device, a, b);
+            sum += r * r;
+        }
+    }
+    double rms = sqrt(sum / used);
+
+    // a pair well off the line was most likely delayed on one leg only, fit again without it
+    if (used >= 6 && rms > 0)
+    {
+        uint32_t dropped = 0;
+        for (uint32_t i = 0; i < n; i++)
+        {
+            if (use[i] && fabs(rp1_spi_clock_residual(&clock->pairs[i], ref_host, ref_device, a, b)) > RP1_SPI_CLOCK_REJECT_SIGMA * rms)
+            {
+                use[i] = false;
+                dropped++;
+            }
+        }
+        if (dropped != 0)
+        {
+            used = rp1_spi_clock_line(clock, use, ref_host, ref_device, &a, &b);
+            sum = 0;
+            for (uint32_t i = 0; i < n; i++)
+            {
+                if (use[i])
+                {
+                    double r = rp1_spi_clock_residual(&clock->pairs[i], ref_host, ref_device, a, b);
+                    sum += r * r;
+                }
+            }
+            rms = sqrt(sum / used);
+        }
+    }
+
+    uint32_t seq = atomic_load_explicit(&clock->fit_seq, memory_order_relaxed);
+    atomic_store_explicit(&clock->fit_seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    clock->ref_host_ns = ref_host;
+    clock->ref_device_ns = (double)ref_device + a;
+    clock->rate = b;
+    clock->used = used;
+    clock->residual_ns = rms;
+    atomic_store_explicit(&clock->fit_seq, seq + 2, memory_order_release);
+}
+
+/// @brief Reads the pico's clock once and updates the fit
+/// @param clock clock
+/// @return SPI_OK if successful, SPI_ERROR for a reading too far off the line, which is dropped, otherwise
+///         the status of the failed exchange - the fit is left as it was
+/// @note takes the bus lock, don't call it with the lock held
+spi_status_t rp1_spi_clock_sync(rp1_spi_clock_t *clock)
+{
+    rp1_spi_instance_t *spi = clock->device->spi;
+    uint8_t cmd = CMD_READ_SYSTIME;
+    uint8_t reply[4];
+
+    rp1_spi_lock(spi);
+    spi_status_t res = rp1_spi_device_select(clock->device);
+    uint64_t t0 = rp1_spi_now_ns(spi);
+    if (res == SPI_OK)
+        res = rp1_spi_write_then_read(spi, &cmd, 1, reply, sizeof(reply), clock->timeout);
+    uint64_t t1 = rp1_spi_now_ns(spi);
+    rp1_spi_unlock(spi);
+
+    rp1_spi_count(&clock->syncs, 1);
+    if (res != SPI_OK)
+    {
+        rp1_spi_count(&clock->failures, 1);
+        return res;
+    }
+
+    // the pico sends its uint32_t in memory order, i.e. little endian
+    uint32_t us = (uint32_t)reply[0] | ((uint32_t)reply[1] << 8) | ((uint32_t)reply[2] << 16) | ((uint32_t)reply[3] << 24);
+    uint64_t host_ns = t0 + (t1 - t0) / 2;
+    uint32_t rtt_ns = (uint32_t)(t1 - t0);
+
+    // a wrap takes the count back by nearly all of its range, a small step back is a bad reading
+    uint64_t wraps = clock->wraps;
+    if (clock->count != 0 && us < clock->last_us && clock->last_us - us > (1u << 31))
+        wraps++;
+    // the microsecond count could have ticked over anywhere in the last microsecond
+    uint64_t device_ns = ((wraps << 32) + us) * 1000ull + 500;
+
+    if (clock->count != 0)
+    {
+        double r = (double)device_ns - (clock->ref_device_ns + (double)(int64_t)(host_ns - clock->ref_host_ns) * clock->rate);
+        double limit = rtt_ns + 1000.0 + RP1_SPI_CLOCK_REJECT_SIGMA * clock->residual_ns +
+                       (double)(int64_t)(host_ns - clock->ref_host_ns) * RP1_SPI_CLOCK_MAX_PPM / 1e6;
+        if (fabs(r) > limit)
+        {
+            rp1_spi_count(&clock->rejected, 1);
+            if (++clock->rejects < RP1_SPI_CLOCK_MAX_REJECTS)
+                return SPI_ERROR;
+
+            // nothing fits any more, the pico has most likely restarted
+            clock->count = 0;
+            clock->next = 0;
+            wraps = 0;
+            device_ns = (uint64_t)us * 1000ull + 500;
+        }
+    }
+    clock->rejects = 0;
+    clock->wraps = wraps;
+    clock->last_us = us;
+
+    rp1_spi_clock_pair_t *pair = &clock->pairs[clock->next];
+    pair->host_ns = host_ns;
+    pair->device_ns = device_ns;
+    pair->rtt_ns = rtt_ns;
+
+    clock->next = (clock->next + 1) % RP1_SPI_CLOCK_WINDOW;
+    if (clock->count < RP1_SPI_CLOCK_WINDOW)
+        clock->count++;
+
+    rp1_spi_clock_fit(clock);
+
+    return SPI_OK;
+}
+
+/// @brief Whether there has been a successful exchange to base the conversions on
+/// @param clock clock
+bool rp1_spi_clock_valid(rp1_spi_clock_t *clock)
+{
+    return atomic_load_explicit(&clock->fit_seq, memory_order_acquire) != 0;
+}
+
+// a consistent copy of the fit
+static void rp1_spi_clock_read_fit(rp1_spi_clock_t *clock, uint64_t *ref_host, double *ref_device, double *rate)
+{
+    uint32_t seq;
+    do
+    {
+        seq = atomic_load_explicit(&clock->fit_seq, memory_order_acquire);
+        *ref_host = clock->ref_host_ns;
+        *ref_device = clock->ref_device_ns;
+        *rate = clock->rate;
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1) != 0 || seq != atomic_load_explicit(&clock->fit_seq, memory_order_relaxed));
+}
+
+/// @brief The pico's clock at a given host time
+/// @param clock clock
+/// @param host_ns CLOCK_MONOTONIC time, as from rp1_spi_now_ns()
+/// @return pico time in ns (time_us_32() * 1000, without the wrap), 0 before the first sync
+uint64_t rp1_spi_clock_to_device_ns(rp1_spi_clock_t *clock, uint64_t host_ns)
+{
+    uint64_t ref_host;
+    double ref_device, rate;
+
+    if (!rp1_spi_clock_valid(clock))
+        return 0;
+    rp1_spi_clock_read_fit(clock, &ref_host, &ref_device, &rate);
+
+    return (uint64_t)llround(ref_device + (double)(int64_t)(host_ns - ref_host) * rate);
+}
+
+/// @brief The host time at a given reading of the pico's clock, e.g. one the pico stamped data with
+/// @param clock clock
+/// @param device_ns pico time in ns, as rp1_spi_clock_to_device_ns() returns
+/// @return CLOCK_MONOTONIC time, 0 before the first sync
+uint64_t rp1_spi_clock_to_host_ns(rp1_spi_clock_t *clock, uint64_t device_ns)
+{
+    uint64_t ref_host;
+    double ref_device, rate;
+
+    if (!rp1_spi_clock_valid(clock))
+        return 0;
+    rp1_spi_clock_read_fit(clock, &ref_host, &ref_device, &rate);
+
+    return ref_host + (uint64_t)llround(((double)device_ns - ref_device) / rate);
+}
+
+/// @brief Reports the state of the fit
+/// @param clock clock
+/// @param stats returns the exchange counters, drift, offset and residual
+/// @note the fit itself is only consistent when read from the thread that syncs
+void rp1_spi_clock_get_stats(rp1_spi_clock_t *clock, rp1_spi_clock_stats_t *stats)
+{
+    uint64_t ref_host;
+    double ref_device, rate;
+    uint64_t now = rp1_spi_now_ns(clock->device->spi);
+
+    memset(stats, 0, sizeof(rp1_spi_clock_stats_t));
+    stats->syncs = atomic_load_explicit(&clock->syncs, memory_order_relaxed);
+    stats->failures = atomic_load_explicit(&clock->failures, memory_order_relaxed);
+    stats->rejected = atomic_load_explicit(&clock->rejected, memory_order_relaxed);
+    if (!rp1_spi_clock_valid(clock))
+        return;
+
+    rp1_spi_clock_read_fit(clock, &ref_host, &ref_device, &rate);
+    stats->used = clock->used;
+    stats->window = clock->count;
+    stats->residual_ns = clock->residual_ns;
+    stats->drift_ppm = (rate - 1.0) * 1e6;
+    stats->offset_ns = ref_device + (double)(int64_t)(now - ref_host) * rate - (double)now;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "rp1-spi.h"
+
+// correlation of a pico's time_us_32() clock with the host's CLOCK_MONOTONIC
+//
+// each rp1_spi_clock_sync() reads the pico's clock with CMD_READ_SYSTIME and pairs it with the
+// midpoint of the host time before and after the transaction. A line fitted through the last
+// RP1_SPI_CLOCK_WINDOW pairs gives the offset and drift between the clocks. Pairs with a long
+// round trip are the least certain, so only the quicker half of the window is used, and of
+// those any that sit well off the line are dropped before it is fitted again. A reading too far
+// off the current line to be explained by the round trip and the drift is taken to be a bad one
+// and dropped before it is used for anything - after RP1_SPI_CLOCK_MAX_REJECTS in a row the pico
+// is taken to have restarted, and the window starts again from the next.
+//
+// the pico reads its clock somewhere inside the transaction, not at its midpoint - that error is
+// the same for every exchange at a given SCLK, so it shows as a constant offset, and clocks on
+// several picos read the same way line up with each other to well under a microsecond
+//
+// the fit is published under a sequence lock, so rp1_spi_clock_to_device_ns() and
+// rp1_spi_clock_to_host_ns() can be called from any thread while another syncs
+
+#define RP1_SPI_CLOCK_WINDOW 64
+#define RP1_SPI_CLOCK_MAX_REJECTS 4
+
+typedef struct
+{
+    uint64_t host_ns;   // midpoint of the exchange on CLOCK_MONOTONIC
+    uint64_t device_ns; // pico clock, unwrapped
+    uint32_t rtt_ns;    // how long the exchange took
+} rp1_spi_clock_pair_t;
+
+typedef struct
+{
+    uint64_t syncs;    // exchanges made
+    uint64_t failures; // exchanges that failed on the bus
+    uint64_t rejected; // readings dropped for being off the line
+    uint32_t used;     // pairs the current fit is based on
+    uint32_t window;   // pairs held
+    double drift_ppm;  // pico clock rate against the host's, in parts per million
+    double offset_ns;  // pico clock minus host clock, now
+    double residual_ns; // rms distance of the pairs used from the line
+} rp1_spi_clock_stats_t;
+
+typedef struct
+{
+    const rp1_spi_device_t *device;
+    uint32_t timeout;
+
+    rp1_spi_clock_pair_t pairs[RP1_SPI_CLOCK_WINDOW];
+    uint32_t count;   // pairs held
+    uint32_t next;    // where the next one goes
+    uint64_t wraps;   // time_us_32() wraps every 71 minutes, this counts them
+    uint32_t last_us;
+    uint32_t rejects; // readings dropped in a row
+
+    // the fit - device_ns = ref_device_ns + (host_ns - ref_host_ns) * rate
+    _Atomic uint32_t fit_seq; // odd while the fit is being changed
+    uint64_t ref_host_ns;
+    double ref_device_ns;
+    double rate;
+    uint32_t used;
+    double residual_ns;
+
+    _Atomic uint64_t syncs;
+    _Atomic uint64_t failures;
+    _Atomic uint64_t rejected;
+} rp1_spi_clock_t;
+
+bool rp1_spi_clock_create(const rp1_spi_device_t *device, uint32_t timeout, rp1_spi_clock_t **clock);
+void rp1_spi_clock_destroy(rp1_spi_clock_t *clock);
+spi_status_t rp1_spi_clock_sync(rp1_spi_clock_t *clock);
+bool rp1_spi_clock_valid(rp1_spi_clock_t *clock);
+uint64_t rp1_spi_clock_to_device_ns(rp1_spi_clock_t *clock, uint64_t host_ns);
+uint64_t rp1_spi_clock_to_host_ns(rp1_spi_clock_t *clock, uint64_t device_ns);
+void rp1_spi_clock_get_stats(rp1_spi_clock_t *clock, rp1_spi_clock_stats_t *stats);
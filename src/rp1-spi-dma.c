@@ -0,0 +1,208 @@
+#include <stddef.h>
+
+#include "rp1-spi-dma.h"
+#include "rp1-spi-regs.h"
+#include "rp1-spi-io.h"
+
+// never sleep longer than this between completion checks
+#define RP1_SPI_DMA_MAX_SLEEP_NS 1000000
+
+static void rp1_spi_dma_start_block(rp1_spi_dma_xfer_t *xfer)
+{
+    rp1_dma_t *dma = xfer->dma;
+    uint64_t dr = RP1_PERIPH_BUS_BASE + spi_bases[xfer->spi->spinum] + DW_SPI_DR;
+
+    xfer->block_start = rp1_spi_now_ns(xfer->spi);
+    xfer->block = xfer->len - xfer->offset;
+    if (xfer->block > RP1_SPI_DMA_MAX_BLOCK)
+        xfer->block = RP1_SPI_DMA_MAX_BLOCK;
+
+    // rx is started first so it is waiting when the first frame comes in
+    rp1_dma_chan_cfg_t rx = {
+        .sar = dr,
+        .dar = xfer->rx != NULL ? xfer->rx->bus + xfer->offset : dma->scratch.bus,
+        .items = xfer->block,
+        .width = 1,
+        .burst = RP1_SPI_DMA_BURST,
+        .src_fixed = true,
+        .dst_fixed = xfer->rx == NULL,
+        .flow = DMAC_TT_FC_PER_TO_MEM,
+        .dreq = RP1_DMA_SPI_DREQ_RX(xfer->spi->spinum),
+    };
+    rp1_dma_chan_start(dma, xfer->rxch, &rx);
+
+    rp1_dma_chan_cfg_t tx = {
+        .sar = xfer->tx != NULL ? xfer->tx->bus + xfer->offset : dma->scratch.bus,
+        .dar = dr,
+        .items = xfer->block,
+        .width = 1,
+        .burst = RP1_SPI_DMA_BURST,
+        .src_fixed = xfer->tx == NULL,
+        .dst_fixed = true,
+        .flow = DMAC_TT_FC_MEM_TO_PER,
+        .dreq = RP1_DMA_SPI_DREQ_TX(xfer->spi->spinum),
+    };
+    rp1_dma_chan_start(dma, xfer->txch, &tx);
+}
+
+static void rp1_spi_dma_finish(rp1_spi_dma_xfer_t *xfer, spi_status_t status)
+{
+    rp1_spi_instance_t *spi = xfer->spi;
+
+    rp1_spi_reg_write(spi, DW_SPI_DMACR, 0);
+    if (status != SPI_OK)
+    {
+        rp1_dma_chan_abort(xfer->dma, xfer->txch);
+        rp1_dma_chan_abort(xfer->dma, xfer->rxch);
+        // disabling the controller flushes both fifos
+        rp1_spi_reg_write(spi, DW_SPI_SSIENR, 0);
+        rp1_spi_reg_write(spi, DW_SPI_SSIENR, 1);
+    }
+    else if (xfer->rx != NULL)
+    {
+        rp1_dma_buf_sync_for_cpu(xfer->rx, 0, xfer->len);
+    }
+
+    rp1_dma_release_channel(xfer->dma, xfer->txch);
+    rp1_dma_release_channel(xfer->dma, xfer->rxch);
+    rp1_spi_cs_end(spi);
+    spi->txcount = 0;
+    // the channels only see their own ends of the FIFOs - a frame lost in between shows in RISR
+    if (status == SPI_OK)
+        status = rp1_spi_check_errors(spi);
+    rp1_spi_count_transfer(spi, status, xfer->len);
+    xfer->status = status;
+    rp1_spi_unlock(spi);
+}
+
+/// @brief Starts a full duplex 8-bit transfer moved by DMA and returns straight away
+/// @param spi SPI instance, set up for a device with 8 bit frames
+/// @param dma DMA handle
+/// @param tx bytes to send, or NULL to clock out zeros
+/// @param rx buffer for the bytes received, or NULL to discard them
+/// @param len number of bytes to transfer - tx and rx must be at least this long
+/// @param xfer transfer state, filled in here and kept by the caller until complete
+/// @return SPI_OK if the transfer was started, SPI_BUSY if the SPI or the DMA channels are in use,
+///         SPI_INVALID for a bad length, frames other than 8 bits, or a transfer longer than a block
+///         with the SSI driving CS
+/// @note the bus lock is taken here and held until the transfer ends
+spi_status_t rp1_spi_dma_start(rp1_spi_instance_t *spi, rp1_dma_t *dma, rp1_dma_buf_t *tx, rp1_dma_buf_t *rx, uint32_t len, rp1_spi_dma_xfer_t *xfer)
+{
+    if (len == 0 || (tx != NULL && tx->len < len) || (rx != NULL && rx->len < len))
+        return SPI_INVALID;
+
+    rp1_spi_lock(spi);
+
+    spi_status_t res = SPI_OK;
+    if (spi->txcount != 0)
+        res = SPI_BUSY;
+    // the channels move bytes, one to a FIFO entry
+    else if (spi->frame_bits != 8)
+        res = SPI_INVALID;
+    else if (len > RP1_SPI_DMA_MAX_BLOCK && spi->cs_control == RP1_SPI_CS_AUTO)
+        res = SPI_INVALID;
+    if (res != SPI_OK)
+    {
+        rp1_spi_unlock(spi);
+        return res;
+    }
+
+    xfer->txch = rp1_dma_claim_channel(dma);
+    xfer->rxch = rp1_dma_claim_channel(dma);
+    if (xfer->txch < 0 || xfer->rxch < 0)
+    {
+        rp1_dma_release_channel(dma, xfer->txch);
+        rp1_dma_release_channel(dma, xfer->rxch);
+        rp1_spi_unlock(spi);
+        return SPI_BUSY;
+    }
+
+    xfer->spi = spi;
+    xfer->dma = dma;
+    xfer->tx = tx;
+    xfer->rx = rx;
+    xfer->len = len;
+    xfer->offset = 0;
+    xfer->status = SPI_BUSY;
+    xfer->frame_ns = 8ull * spi->bit_ns;
+
+    rp1_spi_begin_transfer(spi, len);
+
+    if (tx != NULL)
+        rp1_dma_buf_sync_for_device(tx, 0, len);
+    if (rx != NULL)
+        rp1_dma_buf_sync_for_device(rx, 0, len);
+
+    // a receive only or transmit only transfer may have left the controller in another mode, and a
+    // packed one at 32 bit frames
+    uint32_t ctrlr0 = (spi->ctrlr0 & ~(DW_PSSI_CTRLR0_TMOD_MASK | DW_PSSI_CTRLR0_DFS32_MASK)) |
+                      (DW_SPI_CTRLR0_TMOD_TR << 8) | (7u << 16);
+    rp1_spi_apply_config(spi, ctrlr0, spi->ctrlr1, spi->baudr, spi->rx_sample_dly);
+
+    // the tx request is raised once there is room for a burst, and the rx request once a
+    // burst is waiting - the tail of a block is moved with single requests. Unlike the
+    // configuration registers, these may be written with the controller enabled
+    rp1_spi_reg_write(spi, DW_SPI_DMATDLR, spi->fifo_len - RP1_SPI_DMA_BURST);
+    rp1_spi_reg_write(spi, DW_SPI_DMARDLR, RP1_SPI_DMA_BURST - 1);
+    rp1_spi_reg_write(spi, DW_SPI_DMACR, DW_SPI_DMACR_TDMAE | DW_SPI_DMACR_RDMAE);
+
+    // set the CS pin - the clock starts as soon as the DMA puts the first frame in the fifo
+    rp1_spi_cs_begin(spi);
+    rp1_spi_cs_start(spi);
+
+    rp1_spi_dma_start_block(xfer);
+
+    return SPI_OK;
+}
+
+/// @brief Checks on a DMA transfer without blocking - one register read while a block is in progress
+/// @param xfer transfer started with rp1_spi_dma_start()
+/// @return SPI_BUSY while in progress, then the final status of the transfer
+spi_status_t rp1_spi_dma_poll(rp1_spi_dma_xfer_t *xfer)
+{
+    if (xfer->status != SPI_BUSY)
+        return xfer->status;
+
+    // every frame sent produces one received, so the rx channel finishes last
+    if (!rp1_dma_chan_done(xfer->dma, xfer->rxch))
+        return SPI_BUSY;
+
+    xfer->offset += xfer->block;
+    if (xfer->offset < xfer->len)
+    {
+        rp1_spi_dma_start_block(xfer);
+        return SPI_BUSY;
+    }
+
+    rp1_spi_dma_finish(xfer, SPI_OK);
+
+    return xfer->status;
+}
+
+/// @brief Waits for a DMA transfer to complete, sleeping for the time the remaining frames need on the wire
+/// @param xfer transfer started with rp1_spi_dma_start()
+/// @param timeout timeout in ms, 0 to wait forever
+/// @return final status of the transfer, SPI_TIMEOUT if it was aborted
+spi_status_t rp1_spi_dma_wait(rp1_spi_dma_xfer_t *xfer, uint32_t timeout)
+{
+    uint64_t start = rp1_spi_now_ns(xfer->spi);
+
+    while (rp1_spi_dma_poll(xfer) == SPI_BUSY)
+    {
+        if (timeout != 0 && rp1_spi_now_ns(xfer->spi) - start > (uint64_t)timeout * 1000000)
+        {
+            rp1_spi_dma_finish(xfer, SPI_TIMEOUT);
+            break;
+        }
+
+        // sleep until the block should be done on the wire, then check again every few frames
+        uint64_t now = rp1_spi_now_ns(xfer->spi);
+        uint64_t end = xfer->block_start + (uint64_t)xfer->block * xfer->frame_ns;
+        uint64_t sleep = end > now ? end - now : 4 * xfer->frame_ns;
+        if (sleep > RP1_SPI_DMA_MAX_SLEEP_NS)
+            sleep = RP1_SPI_DMA_MAX_SLEEP_NS;
+        rp1_spi_sleep_ns(xfer->spi, sleep > 0 ? sleep : 1000);
+    }
+
+    return xfer->status;
+}
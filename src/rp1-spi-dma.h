@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "rp1-spi.h"
+#include "rp1-dma.h"
+
+// full duplex SPI transfers moved by the RP1 DMA controller
+// the CPU only programs the channels (once per block) and checks for completion
+//
+// a transfer holds the bus lock from rp1_spi_dma_start() until rp1_spi_dma_poll() or
+// rp1_spi_dma_wait() sees it end, so those are called from the thread that started it.
+// Between blocks the TX FIFO runs dry, and an SSI driving its own CS would release it there -
+// a transfer longer than one block needs CS_OVERRIDE or GPIO chip selects, see rp1_spi_set_cs_control()
+
+// largest block we hand to a channel in one go, longer transfers are split
+#define RP1_SPI_DMA_MAX_BLOCK 32768
+// handshake burst, in frames
+#define RP1_SPI_DMA_BURST 8
+
+typedef struct
+{
+    rp1_spi_instance_t *spi;
+    rp1_dma_t *dma;
+    int txch;
+    int rxch;
+    rp1_dma_buf_t *tx;
+    rp1_dma_buf_t *rx;
+    uint32_t len;      // bytes in the whole transfer
+    uint32_t offset;   // bytes in the blocks already completed
+    uint32_t block;    // bytes in the block in progress
+    uint64_t block_start; // when the block in progress was started
+    uint64_t frame_ns;    // time per frame on the wire, for sizing sleeps
+    spi_status_t status;
+} rp1_spi_dma_xfer_t;
+
+spi_status_t rp1_spi_dma_start(rp1_spi_instance_t *spi, rp1_dma_t *dma, rp1_dma_buf_t *tx, rp1_dma_buf_t *rx, uint32_t len, rp1_spi_dma_xfer_t *xfer);
+spi_status_t rp1_spi_dma_poll(rp1_spi_dma_xfer_t *xfer);
+spi_status_t rp1_spi_dma_wait(rp1_spi_dma_xfer_t *xfer, uint32_t timeout);
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "rp1-regs.h"
+#include "rp1-spi.h"
+#include "rp1-spi-latency.h"
+#include "rp1-spi-regs.h"
+#include "rp1-spi-sim.h"
+
+// register access for an SPI instance
+// on the Pi each of these is a single uncached load / store across PCIe to the RP1,
+// for an instance created with rp1_spi_create_sim() they are routed to the model
+// built with RP1_SPI_COUNT_ACCESSES they are also counted, so the bus transactions of a
+// transfer can be measured on the Pi as well
+
+static inline uint32_t rp1_spi_reg_read(rp1_spi_instance_t *spi, uint32_t reg)
+{
+#ifdef RP1_SPI_COUNT_ACCESSES
+    spi->reg_reads++;
+#endif
+    if (__builtin_expect(spi->sim != NULL, 0))
+        return rp1_spi_sim_read(spi->sim, reg);
+    return *(volatile uint32_t *)(spi->regbase + reg);
+}
+
+static inline void rp1_spi_reg_write(rp1_spi_instance_t *spi, uint32_t reg, uint32_t value)
+{
+#ifdef RP1_SPI_COUNT_ACCESSES
+    spi->reg_writes++;
+#endif
+    if (__builtin_expect(spi->sim != NULL, 0))
+        rp1_spi_sim_write(spi->sim, reg, value);
+    else
+        *(volatile uint32_t *)(spi->regbase + reg) = value;
+}
+
+// writes the configuration registers that differ from their images, see rp1-spi.c - for the
+// transfer paths outside it, which must keep the images in step with the controller
+void rp1_spi_apply_config(rp1_spi_instance_t *spi, uint32_t ctrlr0, uint32_t ctrlr1, uint32_t baudr, uint32_t rx_sample_dly);
+
+// reads RISR once a transfer is done, and clears and aborts on a lost frame - see rp1-spi.c
+spi_status_t rp1_spi_check_errors(rp1_spi_instance_t *spi);
+
+// a transfer starts as soon as SER is set and the TX FIFO has data - keep track of what
+// was last written so a transfer knows whether it has to clear it before queuing frames
+static inline void rp1_spi_write_ser(rp1_spi_instance_t *spi, uint32_t value)
+{
+    rp1_spi_reg_write(spi, DW_SPI_SER, value);
+    spi->ser = value;
+}
+
+// chip select handling around a transfer, see rp1_spi_set_cs_control()
+//
+// with the SSI driving CS, SER is what starts the clock: it is held at 0 until the FIFO has been
+// stuffed, as with SER still set from the last transfer the first frame would go out on its own,
+// possibly to another device. A GPIO chip select is asserted up front and doesn't care about SER,
+// so the clock is gated the same way. With CS_OVERRIDE, SER is the CS level - it is set up front
+// and the clock starts with the first frame queued
+
+// drives the CS pin of the selected line through RIO (active low), or the model's line
+static inline void rp1_spi_gpio_cs(rp1_spi_instance_t *spi, bool asserted)
+{
+    if (spi->sim != NULL)
+    {
+        rp1_spi_sim_drive_cs(spi->sim, spi->cs, asserted ? 1 : 0);
+        return;
+    }
+    *(spi->rio_out + (asserted ? RP1_ATOM_CLR_OFFSET : RP1_ATOM_SET_OFFSET) / 4) = 1u << spi->cs_pins[spi->cs];
+}
+
+// before the first frame is queued
+static inline void rp1_spi_cs_begin(rp1_spi_instance_t *spi)
+{
+    if (spi->cs_control == RP1_SPI_CS_OVERRIDE)
+    {
+        if (spi->ser != spi->cs_mask)
+            rp1_spi_write_ser(spi, spi->cs_mask);
+        return;
+    }
+
+    if (spi->ser != 0)
+        rp1_spi_write_ser(spi, 0);
+    if (spi->cs_control == RP1_SPI_CS_GPIO && !spi->cs_held)
+        rp1_spi_gpio_cs(spi, true);
+}
+
+// once the FIFO has been stuffed - the clock starts here
+static inline void rp1_spi_cs_start(rp1_spi_instance_t *spi)
+{
+    if (spi->ser != spi->cs_mask)
+        rp1_spi_write_ser(spi, spi->cs_mask);
+}
+
+// after the last frame has left the shift register, or the transfer was aborted
+// the SSI releases its own CS when the TX FIFO runs dry
+static inline void rp1_spi_cs_end(rp1_spi_instance_t *spi)
+{
+    if (spi->cs_control == RP1_SPI_CS_OVERRIDE)
+        rp1_spi_write_ser(spi, 0);
+    else if (spi->cs_control == RP1_SPI_CS_GPIO && !spi->cs_held)
+        rp1_spi_gpio_cs(spi, false);
+}
+
+// time as seen by the transfer functions - CLOCK_MONOTONIC on the Pi, virtual time in the model
+static inline uint64_t rp1_spi_now_ns(rp1_spi_instance_t *spi)
+{
+    if (spi->sim != NULL)
+        return rp1_spi_sim_now(spi->sim);
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// give up the CPU for a while - with the model, virtual time passes instead
+static inline void rp1_spi_sleep_ns(rp1_spi_instance_t *spi, uint64_t ns)
+{
+    if (spi->sim != NULL)
+    {
+        rp1_spi_sim_advance(spi->sim, ns);
+        return;
+    }
+
+    struct timespec ts;
+    ts.tv_sec = ns / 1000000000ull;
+    ts.tv_nsec = ns % 1000000000ull;
+    nanosleep(&ts, NULL);
+}
+
+// sleep until an absolute time on the rp1_spi_now_ns() clock
+static inline void rp1_spi_sleep_until_ns(rp1_spi_instance_t *spi, uint64_t t)
+{
+    if (spi->sim != NULL)
+    {
+        uint64_t now = rp1_spi_sim_now(spi->sim);
+        if (t > now)
+            rp1_spi_sim_advance(spi->sim, t - now);
+        return;
+    }
+
+    struct timespec ts;
+    ts.tv_sec = t / 1000000000ull;
+    ts.tv_nsec = t % 1000000000ull;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+// counters have a single writer, the thread running the transfer, so a plain load and store
+// will do - no locked read-modify-write in the polling loops
+static inline void rp1_spi_count(_Atomic uint64_t *counter, uint64_t n)
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+// a transfer of len frames is under way
+static inline void rp1_spi_begin_transfer(rp1_spi_instance_t *spi, uint32_t len)
+{
+    spi->txcount = len;
+    if (spi->latency != NULL)
+        spi->started_ns = rp1_spi_now_ns(spi);
+}
+
+// counts a transfer that has ended, and records how long it took
+static inline void rp1_spi_count_transfer(rp1_spi_instance_t *spi, spi_status_t res, uint64_t bytes)
+{
+    rp1_spi_count(&spi->counters.transfers, 1);
+    if (res == SPI_OK)
+        rp1_spi_count(&spi->counters.bytes, bytes);
+    else if (res == SPI_TIMEOUT)
+        rp1_spi_count(&spi->counters.timeouts, 1);
+    else if (res == SPI_TX_OVERFLOW)
+        rp1_spi_count(&spi->counters.tx_overflows, 1);
+    else if (res == SPI_RX_OVERFLOW)
+        rp1_spi_count(&spi->counters.rx_overflows, 1);
+    else if (res == SPI_RX_UNDERFLOW)
+        rp1_spi_count(&spi->counters.rx_underflows, 1);
+
+    if (spi->latency != NULL)
+        rp1_spi_latency_record(spi->latency, rp1_spi_now_ns(spi) - spi->started_ns);
+}
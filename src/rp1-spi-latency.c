@@ -0,0 +1,129 @@
+#include <stdlib.h>
+
+#include "rp1-spi-latency.h"
+
+// values below RP1_SPI_LATENCY_SUB go into a bucket each, above that each power of two
+// is split into RP1_SPI_LATENCY_SUB buckets by the bits below the top one
+static uint32_t latency_bucket(uint64_t ns)
+{
+    if (ns < RP1_SPI_LATENCY_SUB)
+        return (uint32_t)ns;
+
+    uint32_t exp = 63 - __builtin_clzll(ns);
+    if (exp > RP1_SPI_LATENCY_MAX_EXP)
+        return RP1_SPI_LATENCY_BUCKETS - 1;
+
+    uint32_t sub = (uint32_t)(ns >> (exp - RP1_SPI_LATENCY_SUB_BITS)) & (RP1_SPI_LATENCY_SUB - 1);
+    return (exp - RP1_SPI_LATENCY_SUB_BITS + 1) * RP1_SPI_LATENCY_SUB + sub;
+}
+
+// the highest value that falls into a bucket
+static uint64_t latency_bucket_max(uint32_t bucket)
+{
+    if (bucket < RP1_SPI_LATENCY_SUB)
+        return bucket;
+
+    uint32_t exp = bucket / RP1_SPI_LATENCY_SUB + RP1_SPI_LATENCY_SUB_BITS - 1;
+    uint64_t sub = bucket % RP1_SPI_LATENCY_SUB;
+    return ((RP1_SPI_LATENCY_SUB + sub + 1) << (exp - RP1_SPI_LATENCY_SUB_BITS)) - 1;
+}
+
+/// @brief Creates an empty latency histogram
+/// @param latency returns the new histogram
+/// @return true if successful
+bool rp1_spi_latency_create(rp1_spi_latency_t **latency)
+{
+    rp1_spi_latency_t *l = (rp1_spi_latency_t *)calloc(1, sizeof(rp1_spi_latency_t));
+    if (l == NULL)
+        return false;
+
+    rp1_spi_latency_reset(l);
+    *latency = l;
+
+    return true;
+}
+
+void rp1_spi_latency_destroy(rp1_spi_latency_t *latency)
+{
+    free(latency);
+}
+
+/// @brief Empties a histogram - samples recorded at the same time may be lost, but nothing tears
+/// @param latency histogram
+void rp1_spi_latency_reset(rp1_spi_latency_t *latency)
+{
+    for (uint32_t i = 0; i < RP1_SPI_LATENCY_BUCKETS; i++)
+        atomic_store_explicit(&latency->buckets[i], 0, memory_order_relaxed);
+    atomic_store_explicit(&latency->sum_ns, 0, memory_order_relaxed);
+    atomic_store_explicit(&latency->min_ns, UINT64_MAX, memory_order_relaxed);
+    atomic_store_explicit(&latency->max_ns, 0, memory_order_relaxed);
+    atomic_store_explicit(&latency->count, 0, memory_order_relaxed);
+}
+
+/// @brief Adds a sample, safe from any number of threads at once
+/// @param latency histogram
+/// @param ns the sample
+void rp1_spi_latency_record(rp1_spi_latency_t *latency, uint64_t ns)
+{
+    atomic_fetch_add_explicit(&latency->buckets[latency_bucket(ns)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&latency->sum_ns, ns, memory_order_relaxed);
+
+    // min and max only need a CAS while they are being moved, which soon stops happening
+    uint64_t min = atomic_load_explicit(&latency->min_ns, memory_order_relaxed);
+    while (ns < min && !atomic_compare_exchange_weak_explicit(&latency->min_ns, &min, ns,
+                                                              memory_order_relaxed, memory_order_relaxed))
+        ;
+    uint64_t max = atomic_load_explicit(&latency->max_ns, memory_order_relaxed);
+    while (ns > max && !atomic_compare_exchange_weak_explicit(&latency->max_ns, &max, ns,
+                                                              memory_order_relaxed, memory_order_relaxed))
+        ;
+
+    atomic_fetch_add_explicit(&latency->count, 1, memory_order_release);
+}
+
+/// @brief Copies a histogram while samples are still being recorded
+/// @param latency histogram
+/// @param snap returns the copy - its count is the sum of its buckets, so it is self consistent
+///        even if a sample landed halfway through
+void rp1_spi_latency_snapshot(rp1_spi_latency_t *latency, rp1_spi_latency_snapshot_t *snap)
+{
+    snap->count = 0;
+    for (uint32_t i = 0; i < RP1_SPI_LATENCY_BUCKETS; i++)
+    {
+        snap->buckets[i] = atomic_load_explicit(&latency->buckets[i], memory_order_relaxed);
+        snap->count += snap->buckets[i];
+    }
+    snap->sum_ns = atomic_load_explicit(&latency->sum_ns, memory_order_relaxed);
+    snap->min_ns = snap->count != 0 ? atomic_load_explicit(&latency->min_ns, memory_order_relaxed) : 0;
+    snap->max_ns = atomic_load_explicit(&latency->max_ns, memory_order_relaxed);
+}
+
+/// @brief The value below which a given share of the samples fall
+/// @param snap histogram snapshot
+/// @param percentile 0 to 100, e.g. 99.9
+/// @return the top of the bucket holding that sample (capped at the largest sample), 0 for an empty histogram
+uint64_t rp1_spi_latency_percentile(const rp1_spi_latency_snapshot_t *snap, double percentile)
+{
+    if (snap->count == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t)(percentile / 100.0 * snap->count + 0.5);
+    if (rank < 1)
+        rank = 1;
+    if (rank > snap->count)
+        rank = snap->count;
+
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < RP1_SPI_LATENCY_BUCKETS; i++)
+    {
+        seen += snap->buckets[i];
+        if (seen >= rank)
+        {
+            // the last bucket has no top, it holds everything too long for the others
+            uint64_t top = i < RP1_SPI_LATENCY_BUCKETS - 1 ? latency_bucket_max(i) : UINT64_MAX;
+            return top < snap->max_ns ? top : snap->max_ns;
+        }
+    }
+
+    return snap->max_ns;
+}
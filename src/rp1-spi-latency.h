@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// latency histogram, HDR style - log-linear buckets with 16 to each power of two, so any value
+// is known to within about 6%, from 1ns up to several minutes in under 5KB
+//
+// recording is a few relaxed atomic adds and never blocks, so one histogram can be shared by
+// all the threads using a device, and read with rp1_spi_latency_snapshot() while they carry on
+
+#define RP1_SPI_LATENCY_SUB_BITS 4
+#define RP1_SPI_LATENCY_SUB (1u << RP1_SPI_LATENCY_SUB_BITS)
+#define RP1_SPI_LATENCY_MAX_EXP 39 // 2^40 ns, about 18 minutes - longer is counted in the last bucket
+#define RP1_SPI_LATENCY_BUCKETS ((RP1_SPI_LATENCY_MAX_EXP - RP1_SPI_LATENCY_SUB_BITS + 2) * RP1_SPI_LATENCY_SUB)
+
+typedef struct rp1_spi_latency
+{
+    _Atomic uint64_t count;
+    _Atomic uint64_t sum_ns;
+    _Atomic uint64_t min_ns;
+    _Atomic uint64_t max_ns;
+    _Atomic uint64_t buckets[RP1_SPI_LATENCY_BUCKETS];
+} rp1_spi_latency_t;
+
+typedef struct
+{
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint64_t buckets[RP1_SPI_LATENCY_BUCKETS];
+} rp1_spi_latency_snapshot_t;
+
+bool rp1_spi_latency_create(rp1_spi_latency_t **latency);
+void rp1_spi_latency_destroy(rp1_spi_latency_t *latency);
+void rp1_spi_latency_reset(rp1_spi_latency_t *latency);
+void rp1_spi_latency_record(rp1_spi_latency_t *latency, uint64_t ns);
+void rp1_spi_latency_snapshot(rp1_spi_latency_t *latency, rp1_spi_latency_snapshot_t *snap);
+uint64_t rp1_spi_latency_percentile(const rp1_spi_latency_snapshot_t *snap, double percentile);
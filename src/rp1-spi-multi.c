@@ -0,0 +1,128 @@
+#include <stdlib.h>
+
+#include "rp1-spi-multi.h"
+
+// gives the engine a controller and its queue - on failure the controller is still the caller's
+static bool rp1_spi_multi_add(rp1_spi_multi_t *m, uint8_t spinum, rp1_spi_instance_t *spi, uint32_t depth)
+{
+    if (!rp1_spi_queue_create(spi, depth, &m->queues[m->count]))
+        return false;
+    m->spinum[m->count] = spinum;
+    m->spis[m->count] = spi;
+    m->count++;
+
+    return true;
+}
+
+/// @brief Sets up a number of the GPIO capable SPI controllers, each with a transaction queue
+/// @param rp1 RP1 instance
+/// @param mask controllers to use, bit n for SPIn (0 to 5) - SPI0 and SPI4 share pins and can't be used together
+/// @param ncs number of chip selects to set up on each, limited to what the controller brings out
+/// @param depth depth of each transaction queue
+/// @param multi returns the new engine
+/// @return true if successful, false for a bad mask, a controller already set up in rp1->spis, or
+///         one that couldn't be set up
+bool rp1_spi_multi_create(rp1_t *rp1, uint32_t mask, uint8_t ncs, uint32_t depth, rp1_spi_multi_t **multi)
+{
+    if (mask == 0 || mask >= (1u << RP1_SPI_GPIO_COUNT) || (mask & 0x11) == 0x11)
+        return false;
+
+    rp1_spi_multi_t *m = (rp1_spi_multi_t *)calloc(1, sizeof(rp1_spi_multi_t));
+    if (m == NULL)
+        return false;
+    m->rp1 = rp1;
+
+    for (uint8_t n = 0; n < RP1_SPI_GPIO_COUNT; n++)
+    {
+        if (!(mask & (1u << n)))
+            continue;
+
+        // a controller already set up elsewhere isn't ours to take over, or to free with the engine
+        uint8_t cs = ncs < rp1_spi_pins[n].ncs ? ncs : rp1_spi_pins[n].ncs;
+        rp1_spi_instance_t *spi = NULL;
+        if (rp1->spis[n] != NULL || !rp1_spi_setup_pins(rp1, n, cs) || !rp1_spi_create(rp1, n, &spi) ||
+            !rp1_spi_multi_add(m, n, spi, depth))
+        {
+            rp1_spi_destroy(spi);
+            rp1_spi_multi_destroy(m);
+            return false;
+        }
+        rp1->spis[n] = spi;
+    }
+
+    *multi = m;
+
+    return true;
+}
+
+/// @brief Creates an engine over simulated controllers, one model per controller
+/// @param sims simulator instances
+/// @param count number of them, up to RP1_SPI_MULTI_MAX
+/// @param depth depth of each transaction queue
+/// @param multi returns the new engine
+/// @return true if successful
+bool rp1_spi_multi_create_sim(rp1_spi_sim_t **sims, uint8_t count, uint32_t depth, rp1_spi_multi_t **multi)
+{
+    if (count == 0 || count > RP1_SPI_MULTI_MAX)
+        return false;
+
+    rp1_spi_multi_t *m = (rp1_spi_multi_t *)calloc(1, sizeof(rp1_spi_multi_t));
+    if (m == NULL)
+        return false;
+
+    for (uint8_t n = 0; n < count; n++)
+    {
+        rp1_spi_instance_t *spi = NULL;
+        if (!rp1_spi_create_sim(sims[n], &spi) || !rp1_spi_multi_add(m, n, spi, depth))
+        {
+            rp1_spi_destroy(spi);
+            rp1_spi_multi_destroy(m);
+            return false;
+        }
+        spi->spinum = n;
+    }
+
+    *multi = m;
+
+    return true;
+}
+
+void rp1_spi_multi_destroy(rp1_spi_multi_t *multi)
+{
+    if (multi == NULL)
+        return;
+    for (uint8_t i = 0; i < multi->count; i++)
+    {
+        // the rp1 outlives the engine, and mustn't be left pointing at the freed controllers
+        if (multi->rp1 != NULL && multi->rp1->spis[multi->spinum[i]] == multi->spis[i])
+            multi->rp1->spis[multi->spinum[i]] = NULL;
+        rp1_spi_queue_destroy(multi->queues[i]);
+        rp1_spi_destroy(multi->spis[i]);
+    }
+    free(multi);
+}
+
+/// @brief Starts a service thread for each controller
+/// @param multi engine
+/// @param cpus core to pin each controller's thread to (-1 for any), or NULL to leave them all unpinned
+/// @return true if all threads were started
+bool rp1_spi_multi_start(rp1_spi_multi_t *multi, const int *cpus)
+{
+    for (uint8_t i = 0; i < multi->count; i++)
+    {
+        rp1_spi_queue_set_cpu(multi->queues[i], cpus != NULL ? cpus[i] : -1);
+        if (!rp1_spi_queue_start(multi->queues[i]))
+        {
+            rp1_spi_multi_stop(multi);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void rp1_spi_multi_stop(rp1_spi_multi_t *multi)
+{
+    for (uint8_t i = 0; i < multi->count; i++)
+        rp1_spi_queue_stop(multi->queues[i]);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "rp1-regs.h"
+#include "rp1-spi.h"
+#include "rp1-spi-queue.h"
+
+// several SPI controllers driven at once
+//
+// every register read is a PCIe round trip that stalls the core issuing it, so one thread
+// servicing several controllers would be limited to the read rate of one core. Instead each
+// controller gets its own transaction queue (rp1-spi-queue.h) and service thread, optionally
+// pinned to a core, and the round trips of the controllers overlap.
+// Submit to multi->queues[i] for controller multi->spinum[i]
+
+#define RP1_SPI_MULTI_MAX RP1_SPI_GPIO_COUNT
+
+typedef struct
+{
+    rp1_t *rp1; // whose spis[] the controllers are entered in, NULL for models
+    uint8_t count;
+    uint8_t spinum[RP1_SPI_MULTI_MAX];
+    rp1_spi_instance_t *spis[RP1_SPI_MULTI_MAX];
+    rp1_spi_queue_t *queues[RP1_SPI_MULTI_MAX];
+} rp1_spi_multi_t;
+
+bool rp1_spi_multi_create(rp1_t *rp1, uint32_t mask, uint8_t ncs, uint32_t depth, rp1_spi_multi_t **multi);
+bool rp1_spi_multi_create_sim(rp1_spi_sim_t **sims, uint8_t count, uint32_t depth, rp1_spi_multi_t **multi);
+void rp1_spi_multi_destroy(rp1_spi_multi_t *multi);
+bool rp1_spi_multi_start(rp1_spi_multi_t *multi, const int *cpus);
+void rp1_spi_multi_stop(rp1_spi_multi_t *multi);
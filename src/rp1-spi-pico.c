@@ -0,0 +1,246 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "pi_pico_commands.h"
+#include "rp1-spi-pico.h"
+#include "rp1-spi-io.h"
+
+/// @brief Creates a framed link to a pico
+/// @param device the pico, running the framed firmware
+/// @param timeout ms for each transaction, 0 for none
+/// @param pico returns the new link
+/// @return true if successful
+bool rp1_spi_pico_create(const rp1_spi_device_t *device, uint32_t timeout, rp1_spi_pico_t **pico)
+{
+    rp1_spi_pico_t *p = (rp1_spi_pico_t *)calloc(1, sizeof(rp1_spi_pico_t));
+    if (p == NULL)
+        return false;
+
+    p->device = device;
+    p->timeout = timeout;
+    p->retries = RP1_SPI_PICO_RETRIES;
+    p->turnaround_ns = RP1_SPI_PICO_TURNAROUND_NS;
+
+    // a pico that outlived the last run still has its last request - don't start on the same number
+    p->seq = (uint8_t)(rp1_spi_now_ns(device->spi) >> 10);
+
+    *pico = p;
+
+    return true;
+}
+
+void rp1_spi_pico_destroy(rp1_spi_pico_t *pico)
+{
+    free(pico);
+}
+
+/// @brief Sets how many times a reply is asked for again before a call gives up
+/// @param pico link
+/// @param retries transactions after the first, RP1_SPI_PICO_RETRIES to start with
+void rp1_spi_pico_set_retries(rp1_spi_pico_t *pico, uint32_t retries)
+{
+    pico->retries = retries;
+}
+
+/// @brief Sets the least time between the end of one transaction and the start of the next
+/// @param pico link
+/// @param turnaround_ns how long the pico takes to stage a reply, RP1_SPI_PICO_TURNAROUND_NS to start
+///                      with, 0 to go straight on
+void rp1_spi_pico_set_turnaround(rp1_spi_pico_t *pico, uint32_t turnaround_ns)
+{
+    pico->turnaround_ns = turnaround_ns;
+}
+
+// builds a request in tx, padded out so the whole of a reply of reply_len fits - the pico takes
+// the bus as a stream of bytes and ignores anything after a frame
+static uint32_t rp1_spi_pico_request(rp1_spi_pico_t *pico, uint8_t cmd, uint8_t seq, const void *arg, uint8_t arg_len, uint8_t reply_len)
+{
+    uint32_t n = pi_pico_frame_build(pico->tx, PI_PICO_SOF_REQUEST, cmd, seq, 0, (const uint8_t *)arg, arg_len);
+    uint32_t len = PI_PICO_FRAME_SIZE(reply_len);
+    if (len < n)
+        len = n;
+    len = (len + 3) & ~3u;
+    memset(pico->tx + n, 0, len - n);
+
+    return len;
+}
+
+static spi_status_t rp1_spi_pico_exchange(rp1_spi_pico_t *pico, uint32_t len)
+{
+    rp1_spi_instance_t *spi = pico->device->spi;
+
+    // a few microseconds at most, too short to sleep - the model's time only moves when told to
+    if (pico->turnaround_ns != 0)
+    {
+        if (spi->sim != NULL)
+            rp1_spi_sleep_until_ns(spi, pico->ready_ns);
+        else
+            while (rp1_spi_now_ns(spi) < pico->ready_ns)
+                ;
+    }
+
+    // the pico runs 8 bit frames, so rp1_spi_transfer() can pack them four to a FIFO entry
+    rp1_spi_count(&pico->stats.transactions, 1);
+    rp1_spi_lock(spi);
+    spi_status_t res = rp1_spi_device_select(pico->device);
+    if (res == SPI_OK)
+        res = rp1_spi_transfer(spi, pico->tx, pico->rx, len, pico->timeout);
+    rp1_spi_unlock(spi);
+
+    if (pico->turnaround_ns != 0)
+        pico->ready_ns = rp1_spi_now_ns(spi) + pico->turnaround_ns;
+
+    return res;
+}
+
+// sorts out a reply that isn't the one wanted
+static void rp1_spi_pico_bad_reply(rp1_spi_pico_t *pico, pi_pico_frame_result_t res, const pi_pico_frame_t *frame)
+{
+    if (res == PI_PICO_FRAME_OK && frame->status == PI_PICO_STATUS_BAD_FRAME)
+        rp1_spi_count(&pico->stats.naks, 1);
+    else
+        rp1_spi_count(&pico->stats.bad_replies, 1);
+}
+
+/// @brief Runs a command on the pico and waits for its reply, asking again for a corrupt one
+/// @param pico link
+/// @param cmd command, from pi_pico_commands.h
+/// @param arg bytes sent with the command, may be NULL if arg_len is 0
+/// @param arg_len up to PI_PICO_FRAME_MAX_PAYLOAD
+/// @param reply returns the reply
+/// @param reply_len reply bytes expected, up to PI_PICO_FRAME_MAX_PAYLOAD
+/// @return SPI_OK, SPI_INVALID if the pico doesn't know the command or its reply is another length,
+///         SPI_BAD_FRAME if the retries ran out, or the status of a failed transfer
+spi_status_t rp1_spi_pico_call(rp1_spi_pico_t *pico, uint8_t cmd, const void *arg, uint8_t arg_len, void *reply, uint8_t reply_len)
+{
+    if (arg_len > PI_PICO_FRAME_MAX_PAYLOAD || reply_len > PI_PICO_FRAME_MAX_PAYLOAD || (arg_len != 0 && arg == NULL))
+        return SPI_INVALID;
+
+    rp1_spi_count(&pico->stats.calls, 1);
+    pico->polling = false;
+
+    uint8_t seq = pico->seq++;
+    uint32_t len = rp1_spi_pico_request(pico, cmd, seq, arg, arg_len, reply_len);
+
+    // the first transaction delivers the request, and brings back the reply to whatever went before
+    spi_status_t res = rp1_spi_pico_exchange(pico, len);
+    if (res != SPI_OK)
+        return res;
+
+    // each repeat of the request brings back its reply - the pico runs it only the once
+    for (uint32_t attempt = 0; attempt <= pico->retries; attempt++)
+    {
+        if (attempt != 0)
+            rp1_spi_count(&pico->stats.retries, 1);
+
+        res = rp1_spi_pico_exchange(pico, len);
+        if (res != SPI_OK)
+            return res;
+
+        pi_pico_frame_t frame;
+        pi_pico_frame_result_t parsed = pi_pico_frame_parse(pico->rx, len, PI_PICO_SOF_REPLY, &frame);
+        if (parsed == PI_PICO_FRAME_OK && frame.status != PI_PICO_STATUS_BAD_FRAME && frame.seq == seq && frame.cmd == cmd)
+        {
+            if (frame.status != PI_PICO_STATUS_OK || frame.len != reply_len)
+                return SPI_INVALID;
+            memcpy(reply, frame.payload, reply_len);
+            return SPI_OK;
+        }
+        rp1_spi_pico_bad_reply(pico, parsed, &frame);
+    }
+
+    rp1_spi_count(&pico->stats.failures, 1);
+    return SPI_BAD_FRAME;
+}
+
+/// @brief Repeats a read, each transaction sending the next request and bringing back the last reply
+/// @param pico link
+/// @param cmd command, from pi_pico_commands.h - it is run again for every poll and for every retry,
+///        so it must be safe to repeat
+/// @param reply returns the reply to the previous poll, or for the first one, to a request made just now
+/// @param reply_len reply bytes expected, up to PI_PICO_FRAME_MAX_PAYLOAD
+/// @return SPI_OK, SPI_INVALID if the pico doesn't know the command or its reply is another length,
+///         SPI_BAD_FRAME if the retries ran out, or the status of a failed transfer
+spi_status_t rp1_spi_pico_poll(rp1_spi_pico_t *pico, uint8_t cmd, void *reply, uint8_t reply_len)
+{
+    if (reply_len > PI_PICO_FRAME_MAX_PAYLOAD)
+        return SPI_INVALID;
+
+    rp1_spi_count(&pico->stats.calls, 1);
+
+    // nothing under way for this command yet, the first request goes out on its own
+    if (!pico->polling || pico->poll_cmd != cmd || pico->poll_len != reply_len)
+    {
+        pico->poll_seq = pico->seq++;
+        spi_status_t res = rp1_spi_pico_exchange(pico, rp1_spi_pico_request(pico, cmd, pico->poll_seq, NULL, 0, reply_len));
+        if (res != SPI_OK)
+            return res;
+        pico->polling = true;
+        pico->poll_cmd = cmd;
+        pico->poll_len = reply_len;
+    }
+
+    // a reply lost is not asked for again, the next request's reply is fresher anyway
+    for (uint32_t attempt = 0; attempt <= pico->retries; attempt++)
+    {
+        if (attempt != 0)
+            rp1_spi_count(&pico->stats.retries, 1);
+
+        uint8_t seq = pico->seq++;
+        uint32_t len = rp1_spi_pico_request(pico, cmd, seq, NULL, 0, reply_len);
+        spi_status_t res = rp1_spi_pico_exchange(pico, len);
+        if (res != SPI_OK)
+        {
+            pico->polling = false;
+            return res;
+        }
+
+        pi_pico_frame_t frame;
+        pi_pico_frame_result_t parsed = pi_pico_frame_parse(pico->rx, len, PI_PICO_SOF_REPLY, &frame);
+        bool wanted = parsed == PI_PICO_FRAME_OK && frame.status != PI_PICO_STATUS_BAD_FRAME &&
+                      frame.seq == pico->poll_seq && frame.cmd == cmd;
+        pico->poll_seq = seq;
+        if (wanted)
+        {
+            if (frame.status != PI_PICO_STATUS_OK || frame.len != reply_len)
+            {
+                pico->polling = false;
+                return SPI_INVALID;
+            }
+            memcpy(reply, frame.payload, reply_len);
+            return SPI_OK;
+        }
+        rp1_spi_pico_bad_reply(pico, parsed, &frame);
+    }
+
+    rp1_spi_count(&pico->stats.failures, 1);
+    return SPI_BAD_FRAME;
+}
+
+/// @brief Resets the pico, which restarts with its one byte commands - a program done with the link
+///        sends this so that the next one finds the pico as it was at power up
+/// @param pico link
+/// @return SPI_OK once the request is out, or the status of a failed transfer - the pico restarts
+///         without answering, so there is nothing to show it was taken. It is back a moment later,
+///         once the watchdog has restarted it
+spi_status_t rp1_spi_pico_reset(rp1_spi_pico_t *pico)
+{
+    rp1_spi_count(&pico->stats.calls, 1);
+    pico->polling = false;
+
+    // taken when CS goes high, as any request - the reply it brings back is to whatever went before
+    return rp1_spi_pico_exchange(pico, rp1_spi_pico_request(pico, CMD_RESET_PICO, pico->seq++, NULL, 0, 0));
+}
+
+/// @brief Reads the link counters, safe from any thread
+/// @param pico link
+/// @param stats returns the counters
+void rp1_spi_pico_get_stats(rp1_spi_pico_t *pico, rp1_spi_pico_stats_t *stats)
+{
+    stats->calls = atomic_load_explicit(&pico->stats.calls, memory_order_relaxed);
+    stats->transactions = atomic_load_explicit(&pico->stats.transactions, memory_order_relaxed);
+    stats->retries = atomic_load_explicit(&pico->stats.retries, memory_order_relaxed);
+    stats->bad_replies = atomic_load_explicit(&pico->stats.bad_replies, memory_order_relaxed);
+    stats->naks = atomic_load_explicit(&pico->stats.naks, memory_order_relaxed);
+    stats->failures = atomic_load_explicit(&pico->stats.failures, memory_order_relaxed);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pi_pico_frame.h"
+#include "rp1-spi.h"
+
+// the host's end of the framed protocol of pi_pico_frame.h
+//
+// rp1_spi_pico_call() sends a request and repeats it until its reply comes back intact: the pico
+// runs the command once and answers each repeat from the reply it staged, so a corrupt reply
+// costs one more transaction and a corrupt request two. rp1_spi_pico_poll() is for a read made
+// over and over - each transaction carries the next request and the reply to the last, so once
+// under way a reply takes one transaction, and is as old as the time between polls.
+//
+// the pico takes a few microseconds after CS goes high to stage the next reply, and a transaction
+// started before then is lost. A link keeps its transactions RP1_SPI_PICO_TURNAROUND_NS apart to
+// start with - back to back, the host's own time between transfers is less - and
+// rp1_spi_pico_set_turnaround() sets it for other firmware
+//
+// the pico stays framed until it is reset, and a program that leaves it so leaves the next one's
+// command bytes unanswered - rp1_spi_pico_reset() puts it back before the link goes
+//
+// a link is used from one thread at a time, each transaction takes the bus lock on its own
+
+#define RP1_SPI_PICO_RETRIES 3
+// the DMA firmware's time from CS going high to its next reply staged, reset of the SPI block included
+#define RP1_SPI_PICO_TURNAROUND_NS 5000
+
+typedef struct
+{
+    uint64_t calls;        // rp1_spi_pico_call()s and rp1_spi_pico_poll()s
+    uint64_t transactions; // on the bus
+    uint64_t retries;      // transactions repeated for a reply that didn't come back intact
+    uint64_t bad_replies;  // replies that failed their check, or answered the wrong request
+    uint64_t naks;         // requests the pico found corrupt
+    uint64_t failures;     // calls that ran out of retries
+} rp1_spi_pico_stats_t;
+
+typedef struct
+{
+    const rp1_spi_device_t *device;
+    uint32_t timeout;
+    uint32_t retries; // transactions allowed after the first for each reply
+    uint8_t seq;      // next sequence number
+    uint32_t turnaround_ns; // least time from the end of one transaction to the start of the next
+    uint64_t ready_ns;      // when the next one can start
+
+    // rp1_spi_pico_poll() - the request whose reply comes with the next transaction
+    bool polling;
+    uint8_t poll_cmd;
+    uint8_t poll_seq;
+    uint8_t poll_len;
+
+    // a frame padded to whole 32 bit words, so it goes packed when the instance packs frames
+    uint8_t tx[PI_PICO_FRAME_PADDED];
+    uint8_t rx[PI_PICO_FRAME_PADDED];
+
+    struct {
+        _Atomic uint64_t calls;
+        _Atomic uint64_t transactions;
+        _Atomic uint64_t retries;
+        _Atomic uint64_t bad_replies;
+        _Atomic uint64_t naks;
+        _Atomic uint64_t failures;
+    } stats;
+} rp1_spi_pico_t;
+
+bool rp1_spi_pico_create(const rp1_spi_device_t *device, uint32_t timeout, rp1_spi_pico_t **pico);
+void rp1_spi_pico_destroy(rp1_spi_pico_t *pico);
+void rp1_spi_pico_set_retries(rp1_spi_pico_t *pico, uint32_t retries);
+void rp1_spi_pico_set_turnaround(rp1_spi_pico_t *pico, uint32_t turnaround_ns);
+spi_status_t rp1_spi_pico_call(rp1_spi_pico_t *pico, uint8_t cmd, const void *arg, uint8_t arg_len, void *reply, uint8_t reply_len);
+spi_status_t rp1_spi_pico_poll(rp1_spi_pico_t *pico, uint8_t cmd, void *reply, uint8_t reply_len);
+spi_status_t rp1_spi_pico_reset(rp1_spi_pico_t *pico);
+void rp1_spi_pico_get_stats(rp1_spi_pico_t *pico, rp1_spi_pico_stats_t *stats);
@@ -0,0 +1,258 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdlib.h>
+
+#include "rp1-spi-queue.h"
+
+/// @brief Creates a transaction queue for an SPI instance
+/// @param spi SPI instance, from here on only used by the queue's service context
+/// @param depth number of transactions that can be outstanding, rounded up to a power of two
+/// @param queue returns the new queue
+/// @return true if successful
+bool rp1_spi_queue_create(rp1_spi_instance_t *spi, uint32_t depth, rp1_spi_queue_t **queue)
+{
+    if (depth == 0 || depth > (1u << 16))
+        return false;
+
+    rp1_spi_queue_t *q = (rp1_spi_queue_t *)calloc(1, sizeof(rp1_spi_queue_t));
+    if (q == NULL)
+        return false;
+
+    q->depth = 1;
+    while (q->depth < depth)
+        q->depth <<= 1;
+
+    q->sq = (rp1_spi_txn_t *)calloc(q->depth, sizeof(rp1_spi_txn_t));
+    q->sq_ready = (_Atomic uint64_t *)calloc(q->depth, sizeof(_Atomic uint64_t));
+    q->cq = (rp1_spi_completion_t *)calloc(q->depth, sizeof(rp1_spi_completion_t));
+    if (q->sq == NULL || q->sq_ready == NULL || q->cq == NULL)
+    {
+        free(q->sq);
+        free((void *)q->sq_ready);
+        free(q->cq);
+        free(q);
+        return false;
+    }
+
+    q->spi = spi;
+    q->cpu = -1;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->wake, NULL);
+
+    *queue = q;
+
+    return true;
+}
+
+void rp1_spi_queue_destroy(rp1_spi_queue_t *queue)
+{
+    if (queue == NULL)
+        return;
+    rp1_spi_queue_stop(queue);
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->wake);
+    free(queue->sq);
+    free((void *)queue->sq_ready);
+    free(queue->cq);
+    free(queue);
+}
+
+/// @brief Queues a transaction, returning straight away - may be called from any thread
+/// @param queue transaction queue
+/// @param txn transaction, copied - the buffers it points to must stay valid until it completes
+/// @param seq returns the sequence number of the transaction (may be NULL)
+/// @return SPI_OK if queued, SPI_BUSY if depth transactions are already outstanding, SPI_INVALID for a bad transaction
+spi_status_t rp1_spi_queue_submit(rp1_spi_queue_t *queue, const rp1_spi_txn_t *txn, uint64_t *seq)
+{
+    if (txn->len == 0)
+        return SPI_INVALID;
+    if (txn->device == NULL && (txn->bits < 4 || txn->bits > 32 || txn->mode > 3 || txn->cs >= queue->spi->ncs))
+        return SPI_INVALID;
+    if (txn->device != NULL && txn->device->spi != queue->spi)
+        return SPI_INVALID;
+
+    uint64_t head = atomic_load_explicit(&queue->sq_head, memory_order_relaxed);
+    do
+    {
+        // a completion slot has to be free as well as a submission slot, so the
+        // service context never has to wait on the reaper
+        if (head - atomic_load_explicit(&queue->retired, memory_order_acquire) >= queue->depth)
+            return SPI_BUSY;
+    } while (!atomic_compare_exchange_weak_explicit(&queue->sq_head, &head, head + 1,
+                                                    memory_order_acq_rel, memory_order_relaxed));
+
+    queue->sq[head & (queue->depth - 1)] = *txn;
+    atomic_store_explicit(&queue->sq_ready[head & (queue->depth - 1)], head + 1, memory_order_release);
+
+    if (seq != NULL)
+        *seq = head;
+
+    if (atomic_load(&queue->idle))
+    {
+        pthread_mutex_lock(&queue->lock);
+        pthread_cond_signal(&queue->wake);
+        pthread_mutex_unlock(&queue->lock);
+    }
+
+    return SPI_OK;
+}
+
+/// @brief Runs a transaction straight away in the calling thread, holding the bus lock for it
+/// @param spi SPI instance, ignored if the transaction has a device
+/// @param txn transaction - the callback is not called
+/// @return status of the transfer
+spi_status_t rp1_spi_txn_run(rp1_spi_instance_t *spi, const rp1_spi_txn_t *txn)
+{
+    spi_status_t res;
+
+    if (txn->device != NULL)
+        return rp1_spi_device_transfer(txn->device, txn->tx, txn->rx, txn->len, txn->timeout);
+
+    rp1_spi_lock(spi);
+    res = rp1_spi_set_format(spi, txn->bits, txn->mode);
+    if (res == SPI_OK)
+        res = rp1_spi_set_cs(spi, txn->cs);
+    if (res == SPI_OK)
+        res = rp1_spi_transfer_n(spi, txn->tx, txn->rx, txn->len, txn->bits, txn->timeout);
+    rp1_spi_unlock(spi);
+
+    return res;
+}
+
+/// @brief Runs queued transactions back to back in the calling thread
+/// @param queue transaction queue
+/// @param max most transactions to run, 0 for as many as are queued
+/// @return number of transactions run
+uint32_t rp1_spi_queue_poll(rp1_spi_queue_t *queue, uint32_t max)
+{
+    uint32_t count = 0;
+    uint64_t tail = atomic_load_explicit(&queue->sq_tail, memory_order_relaxed);
+
+    while (max == 0 || count < max)
+    {
+        // claimed slots are published in any order, but run in the order they were claimed
+        if (atomic_load_explicit(&queue->sq_ready[tail & (queue->depth - 1)], memory_order_acquire) != tail + 1)
+            break;
+
+        const rp1_spi_txn_t *txn = &queue->sq[tail & (queue->depth - 1)];
+        spi_status_t res = rp1_spi_txn_run(queue->spi, txn);
+
+        if (txn->callback != NULL)
+        {
+            txn->callback(txn, res);
+            atomic_fetch_add_explicit(&queue->retired, 1, memory_order_release);
+        }
+        else
+        {
+            uint64_t cq_head = atomic_load_explicit(&queue->cq_head, memory_order_relaxed);
+            rp1_spi_completion_t *c = &queue->cq[cq_head & (queue->depth - 1)];
+            c->user = txn->user;
+            c->seq = tail;
+            c->status = res;
+            atomic_store_explicit(&queue->cq_head, cq_head + 1, memory_order_release);
+        }
+
+        tail++;
+        atomic_store_explicit(&queue->sq_tail, tail, memory_order_release);
+        count++;
+    }
+
+    return count;
+}
+
+/// @brief Collects completions of transactions that had no callback
+/// @param queue transaction queue
+/// @param completions array to fill
+/// @param max size of the array
+/// @return number of completions returned, in submission order
+uint32_t rp1_spi_queue_reap(rp1_spi_queue_t *queue, rp1_spi_completion_t *completions, uint32_t max)
+{
+    uint32_t count = 0;
+    uint64_t tail = atomic_load_explicit(&queue->cq_tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&queue->cq_head, memory_order_acquire);
+
+    while (tail != head && count < max)
+    {
+        completions[count++] = queue->cq[tail & (queue->depth - 1)];
+        tail++;
+    }
+
+    atomic_store_explicit(&queue->cq_tail, tail, memory_order_release);
+    atomic_fetch_add_explicit(&queue->retired, count, memory_order_release);
+
+    return count;
+}
+
+static void *rp1_spi_queue_thread(void *arg)
+{
+    rp1_spi_queue_t *queue = (rp1_spi_queue_t *)arg;
+
+    while (!atomic_load(&queue->stop))
+    {
+        if (rp1_spi_queue_poll(queue, 0) > 0)
+            continue;
+
+        // nothing to do - sleep until a submission comes in. idle is set before the
+        // final check so a submitter either sees it and signals, or we see its entry
+        pthread_mutex_lock(&queue->lock);
+        atomic_store(&queue->idle, true);
+        if (atomic_load(&queue->sq_tail) == atomic_load(&queue->sq_head) && !atomic_load(&queue->stop))
+            pthread_cond_wait(&queue->wake, &queue->lock);
+        atomic_store(&queue->idle, false);
+        pthread_mutex_unlock(&queue->lock);
+    }
+
+    return NULL;
+}
+
+/// @brief Pins the service thread to one core, takes effect when it is next started
+/// @param queue transaction queue
+/// @param cpu core number, -1 to let it run anywhere
+void rp1_spi_queue_set_cpu(rp1_spi_queue_t *queue, int cpu)
+{
+    queue->cpu = cpu;
+}
+
+/// @brief Starts a service thread that runs transactions as they are submitted
+/// @param queue transaction queue
+/// @return true if the thread was started
+bool rp1_spi_queue_start(rp1_spi_queue_t *queue)
+{
+    if (queue->running)
+        return true;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (queue->cpu >= 0)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(queue->cpu, &cpus);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    }
+
+    atomic_store(&queue->stop, false);
+    int res = pthread_create(&queue->thread, &attr, rp1_spi_queue_thread, queue);
+    pthread_attr_destroy(&attr);
+    if (res != 0)
+        return false;
+    queue->running = true;
+
+    return true;
+}
+
+/// @brief Stops the service thread once it has finished the transaction in progress
+/// @param queue transaction queue
+void rp1_spi_queue_stop(rp1_spi_queue_t *queue)
+{
+    if (!queue->running)
+        return;
+
+    pthread_mutex_lock(&queue->lock);
+    atomic_store(&queue->stop, true);
+    pthread_cond_signal(&queue->wake);
+    pthread_mutex_unlock(&queue->lock);
+
+    pthread_join(queue->thread, NULL);
+    queue->running = false;
+}
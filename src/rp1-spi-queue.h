@@ -0,0 +1,82 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "rp1-spi.h"
+
+// asynchronous transactions on one SPI instance
+//
+// transactions are described by rp1_spi_txn_t and put on a submission ring. They are run
+// back to back, in order, either by a service thread (rp1_spi_queue_start()) or by
+// calling rp1_spi_queue_poll() from a loop of your own. When a transaction completes its
+// callback is called from the service context, or if it has none, a completion is posted
+// to the completion ring to be picked up with rp1_spi_queue_reap().
+// Any number of threads can submit. Only one thread may reap, so threads sharing a queue
+// should use callbacks. Each transaction holds the bus lock while it runs, so the
+// controller can also be used through rp1_spi_device_transfer() at the same time
+
+typedef struct rp1_spi_txn rp1_spi_txn_t;
+typedef void (*rp1_spi_txn_cb_t)(const rp1_spi_txn_t *txn, spi_status_t status);
+
+struct rp1_spi_txn
+{
+    const rp1_spi_device_t *device; // device to talk to, or NULL to use cs / bits / mode below at the current speed
+    const void *tx;            // frames to send, or NULL for zeros (layout as rp1_spi_transfer_n())
+    void *rx;                  // buffer for the frames received, or NULL to discard them
+    uint32_t len;              // number of frames
+    uint8_t cs;                // chip select line
+    uint8_t bits;              // frame size, 4 to 32
+    uint8_t mode;              // SPI mode 0 to 3
+    uint32_t timeout;          // ms, 0 for none
+    rp1_spi_txn_cb_t callback; // called on completion, or NULL to post to the completion ring
+    void *user;                // passed back untouched
+};
+
+typedef struct
+{
+    void *user;
+    uint64_t seq;        // sequence number returned by rp1_spi_queue_submit()
+    spi_status_t status;
+} rp1_spi_completion_t;
+
+typedef struct
+{
+    rp1_spi_instance_t *spi;
+    uint32_t depth; // entries in each ring, a power of two
+
+    // submission ring - written by the submitters, consumed by the service context
+    // a submitter claims a slot by moving sq_head on, and publishes it through sq_ready
+    rp1_spi_txn_t *sq;
+    _Atomic uint64_t *sq_ready; // sequence number + 1 of the transaction in each slot once it is written
+    _Atomic uint64_t sq_head; // next to submit
+    _Atomic uint64_t sq_tail; // next to run
+
+    // completion ring - written by the service context, consumed by the submitter
+    rp1_spi_completion_t *cq;
+    _Atomic uint64_t cq_head; // next to post
+    _Atomic uint64_t cq_tail; // next to reap
+
+    _Atomic uint64_t retired; // transactions completed by callback or reaped
+
+    // service thread
+    pthread_t thread;
+    int cpu; // core the thread is pinned to, -1 for any
+    bool running;
+    _Atomic bool stop;
+    _Atomic bool idle; // service thread is (about to be) asleep waiting for work
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+} rp1_spi_queue_t;
+
+bool rp1_spi_queue_create(rp1_spi_instance_t *spi, uint32_t depth, rp1_spi_queue_t **queue);
+void rp1_spi_queue_destroy(rp1_spi_queue_t *queue);
+spi_status_t rp1_spi_queue_submit(rp1_spi_queue_t *queue, const rp1_spi_txn_t *txn, uint64_t *seq);
+spi_status_t rp1_spi_txn_run(rp1_spi_instance_t *spi, const rp1_spi_txn_t *txn);
+uint32_t rp1_spi_queue_poll(rp1_spi_queue_t *queue, uint32_t max);
+uint32_t rp1_spi_queue_reap(rp1_spi_queue_t *queue, rp1_spi_completion_t *completions, uint32_t max);
+void rp1_spi_queue_set_cpu(rp1_spi_queue_t *queue, int cpu);
+bool rp1_spi_queue_start(rp1_spi_queue_t *queue);
+void rp1_spi_queue_stop(rp1_spi_queue_t *queue);
@@ -0,0 +1,288 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdlib.h>
+
+#include "rp1-spi-sched.h"
+#include "rp1-spi-io.h"
+
+/// @brief Creates a periodic transaction scheduler
+/// @param timebase controller whose clock the deadlines are kept on - on the Pi they all read
+///        CLOCK_MONOTONIC, with the model this is the virtual time of its simulator
+/// @param max_tasks most tasks that will be added
+/// @param sched returns the new scheduler
+/// @return true if successful
+bool rp1_spi_sched_create(rp1_spi_instance_t *timebase, uint32_t max_tasks, rp1_spi_sched_t **sched)
+{
+    if (timebase == NULL || max_tasks == 0)
+        return false;
+
+    rp1_spi_sched_t *s = (rp1_spi_sched_t *)calloc(1, sizeof(rp1_spi_sched_t));
+    if (s == NULL)
+        return false;
+
+    s->tasks = (rp1_spi_sched_task_t *)calloc(max_tasks, sizeof(rp1_spi_sched_task_t));
+    if (s->tasks == NULL)
+    {
+        free(s);
+        return false;
+    }
+
+    s->timebase = timebase;
+    s->max_tasks = max_tasks;
+    s->spin_ns = RP1_SPI_SCHED_SPIN_NS;
+    s->cpu = -1;
+
+    *sched = s;
+
+    return true;
+}
+
+void rp1_spi_sched_destroy(rp1_spi_sched_t *sched)
+{
+    if (sched == NULL)
+        return;
+    rp1_spi_sched_stop(sched);
+    for (uint32_t i = 0; i < sched->count; i++)
+    {
+        rp1_spi_latency_destroy(sched->tasks[i].jitter);
+        rp1_spi_latency_destroy(sched->tasks[i].latency);
+    }
+    free(sched->tasks);
+    free(sched);
+}
+
+/// @brief Adds a periodic transaction, while the scheduler is stopped
+/// @param sched scheduler
+/// @param spi SPI instance, ignored if the transaction has a device
+/// @param txn transaction, copied - its callback is called from the scheduler after each transfer
+/// @param cfg period, offset, deadline and priority
+/// @return task number, for rp1_spi_sched_get_stats(), or -1 if it couldn't be added
+int rp1_spi_sched_add(rp1_spi_sched_t *sched, rp1_spi_instance_t *spi, const rp1_spi_txn_t *txn, const rp1_spi_sched_task_config_t *cfg)
+{
+    if (sched->running || sched->count == sched->max_tasks || cfg->period_ns == 0 ||
+        (txn->device == NULL && spi == NULL))
+        return -1;
+
+    rp1_spi_sched_task_t *task = &sched->tasks[sched->count];
+    if (!rp1_spi_latency_create(&task->jitter))
+        return -1;
+    if (!rp1_spi_latency_create(&task->latency))
+    {
+        rp1_spi_latency_destroy(task->jitter);
+        return -1;
+    }
+
+    task->spi = txn->device != NULL ? txn->device->spi : spi;
+    task->txn = *txn;
+    task->cfg = *cfg;
+    if (task->cfg.deadline_ns == 0)
+        task->cfg.deadline_ns = cfg->period_ns;
+
+    return (int)sched->count++;
+}
+
+/// @brief Sets how long before a release the scheduler stops sleeping and starts spinning
+/// @param sched scheduler
+/// @param spin_ns enough to cover the wakeup latency of the kernel, 0 to rely on the sleep alone
+void rp1_spi_sched_set_spin(rp1_spi_sched_t *sched, uint32_t spin_ns)
+{
+    sched->spin_ns = spin_ns;
+}
+
+/// @brief Pins the scheduler thread to a core and gives it a real time priority, from its next start
+/// @param sched scheduler
+/// @param cpu core number, ideally one kept free with isolcpus, -1 to let it run anywhere
+/// @param rt_priority SCHED_FIFO priority 1 to 99, 0 for the normal scheduler
+void rp1_spi_sched_set_cpu(rp1_spi_sched_t *sched, int cpu, int rt_priority)
+{
+    sched->cpu = cpu;
+    sched->rt_priority = rt_priority;
+}
+
+/// @brief Starts the release grid over from now, leaving the statistics as they are
+/// @param sched scheduler, stopped
+void rp1_spi_sched_reset(rp1_spi_sched_t *sched)
+{
+    sched->epoch_ns = rp1_spi_now_ns(sched->timebase);
+    for (uint32_t i = 0; i < sched->count; i++)
+        sched->tasks[i].release_ns = sched->epoch_ns + sched->tasks[i].cfg.offset_ns;
+}
+
+// sleeps until spin_ns before t and spins the rest of the way - the model's virtual time only
+// moves when it is told to, so there it just sleeps
+static void rp1_spi_sched_wait(rp1_spi_sched_t *sched, uint64_t t)
+{
+    rp1_spi_instance_t *clock = sched->timebase;
+
+    if (clock->sim != NULL)
+    {
+        rp1_spi_sleep_until_ns(clock, t);
+        return;
+    }
+
+    if (t > rp1_spi_now_ns(clock) + sched->spin_ns)
+        rp1_spi_sleep_until_ns(clock, t - sched->spin_ns);
+    while (rp1_spi_now_ns(clock) < t)
+        ;
+}
+
+// the task released next - the earliest, and of those the highest priority
+static rp1_spi_sched_task_t *rp1_spi_sched_next(rp1_spi_sched_t *sched)
+{
+    rp1_spi_sched_task_t *next = &sched->tasks[0];
+
+    for (uint32_t i = 1; i < sched->count; i++)
+    {
+        rp1_spi_sched_task_t *task = &sched->tasks[i];
+        if (task->release_ns < next->release_ns ||
+            (task->release_ns == next->release_ns && task->cfg.priority > next->cfg.priority))
+            next = task;
+    }
+    return next;
+}
+
+// waits for the next release and runs it
+static void rp1_spi_sched_release(rp1_spi_sched_t *sched)
+{
+    rp1_spi_sched_task_t *task = rp1_spi_sched_next(sched);
+    uint64_t period = task->cfg.period_ns;
+
+    rp1_spi_sched_wait(sched, task->release_ns);
+
+    // releases that went by while other tasks ran are not made up for
+    uint64_t start = rp1_spi_now_ns(sched->timebase);
+    if (start >= task->release_ns + period)
+    {
+        uint64_t missed = (start - task->release_ns) / period;
+        task->release_ns += missed * period;
+        rp1_spi_count(&task->skipped, missed);
+    }
+
+    spi_status_t res = rp1_spi_txn_run(task->spi, &task->txn);
+    uint64_t end = rp1_spi_now_ns(sched->timebase);
+
+    rp1_spi_latency_record(task->jitter, start - task->release_ns);
+    rp1_spi_latency_record(task->latency, end - task->release_ns);
+    rp1_spi_count(&task->releases, 1);
+    if (res != SPI_OK)
+        rp1_spi_count(&task->errors, 1);
+    if (end > task->release_ns + task->cfg.deadline_ns)
+        rp1_spi_count(&task->misses, 1);
+
+    if (task->txn.callback != NULL)
+        task->txn.callback(&task->txn, res);
+
+    task->release_ns += period;
+}
+
+/// @brief Runs releases in the calling thread, instead of starting the scheduler thread
+/// @param sched scheduler, stopped
+/// @param releases number of releases to run, of all tasks together
+/// @return number run
+uint32_t rp1_spi_sched_run(rp1_spi_sched_t *sched, uint32_t releases)
+{
+    if (sched->running || sched->count == 0)
+        return 0;
+    if (sched->epoch_ns == 0)
+        rp1_spi_sched_reset(sched);
+
+    for (uint32_t i = 0; i < releases; i++)
+        rp1_spi_sched_release(sched);
+
+    return releases;
+}
+
+static void *rp1_spi_sched_thread(void *arg)
+{
+    rp1_spi_sched_t *sched = (rp1_spi_sched_t *)arg;
+
+    while (!atomic_load_explicit(&sched->stop, memory_order_relaxed))
+        rp1_spi_sched_release(sched);
+
+    return NULL;
+}
+
+/// @brief Starts the scheduler thread, with the first releases offset from now
+/// @param sched scheduler
+/// @return true if the thread was started - check sched->rt for whether it got SCHED_FIFO,
+///         which needs root or CAP_SYS_NICE
+bool rp1_spi_sched_start(rp1_spi_sched_t *sched)
+{
+    if (sched->running)
+        return true;
+    if (sched->count == 0)
+        return false;
+
+    rp1_spi_sched_reset(sched);
+    atomic_store(&sched->stop, false);
+
+    // try for SCHED_FIFO first, and settle for the normal scheduler if not allowed
+    for (int rt = sched->rt_priority > 0 ? 1 : 0; rt >= 0; rt--)
+    {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if (sched->cpu >= 0)
+        {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(sched->cpu, &cpus);
+            pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+        }
+        if (rt)
+        {
+            struct sched_param param = {.sched_priority = sched->rt_priority};
+            pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+            pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+            pthread_attr_setschedparam(&attr, &param);
+        }
+
+        int res = pthread_create(&sched->thread, &attr, rp1_spi_sched_thread, sched);
+        pthread_attr_destroy(&attr);
+        if (res == 0)
+        {
+            sched->rt = rt != 0;
+            sched->running = true;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/// @brief Stops the scheduler thread once the release in progress has completed
+/// @param sched scheduler
+void rp1_spi_sched_stop(rp1_spi_sched_t *sched)
+{
+    if (!sched->running)
+        return;
+
+    atomic_store(&sched->stop, true);
+    pthread_join(sched->thread, NULL);
+    sched->running = false;
+}
+
+/// @brief Reads the statistics of one task, safe from any thread while the scheduler runs
+/// @param sched scheduler
+/// @param task task number from rp1_spi_sched_add()
+/// @param snap room to copy each histogram into on the way, so reading the stats never allocates -
+///             left holding the latency histogram
+/// @param stats returns the counters, and the median, 99th percentile and worst jitter and latency
+void rp1_spi_sched_get_stats(rp1_spi_sched_t *sched, int task, rp1_spi_latency_snapshot_t *snap, rp1_spi_sched_stats_t *stats)
+{
+    rp1_spi_sched_task_t *t = &sched->tasks[task];
+
+    stats->releases = atomic_load_explicit(&t->releases, memory_order_relaxed);
+    stats->misses = atomic_load_explicit(&t->misses, memory_order_relaxed);
+    stats->skipped = atomic_load_explicit(&t->skipped, memory_order_relaxed);
+    stats->errors = atomic_load_explicit(&t->errors, memory_order_relaxed);
+
+    rp1_spi_latency_snapshot(t->jitter, snap);
+    stats->jitter_p50_ns = rp1_spi_latency_percentile(snap, 50);
+    stats->jitter_p99_ns = rp1_spi_latency_percentile(snap, 99);
+    stats->jitter_max_ns = snap->max_ns;
+
+    rp1_spi_latency_snapshot(t->latency, snap);
+    stats->latency_p50_ns = rp1_spi_latency_percentile(snap, 50);
+    stats->latency_p99_ns = rp1_spi_latency_percentile(snap, 99);
+    stats->latency_max_ns = snap->max_ns;
+}
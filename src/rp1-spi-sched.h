@@ -0,0 +1,90 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "rp1-spi.h"
+#include "rp1-spi-queue.h"
+#include "rp1-spi-latency.h"
+
+// periodic transactions on absolute deadlines
+//
+// each task is a transaction (rp1_spi_txn_t) released every period_ns on a fixed grid, so
+// lateness never accumulates. The scheduler sleeps with clock_nanosleep(TIMER_ABSTIME) until
+// spin_ns before the next release and spins from there. Tasks released at the same time run
+// highest priority first, whichever controller they are on, all from one thread that can be
+// pinned to an isolated core and run SCHED_FIFO.
+//
+// for every release the release jitter (how late the transaction started) and the completion
+// latency (release to end of transfer) go into latency histograms. A transaction that ends
+// after its deadline is a miss, and releases that had already passed when it ended are skipped
+// and counted - the grid is never shifted to absorb an overrun
+
+#define RP1_SPI_SCHED_SPIN_NS 50000
+
+typedef struct
+{
+    uint64_t period_ns;
+    uint64_t offset_ns;   // first release, after the scheduler is started
+    uint64_t deadline_ns; // after the release, 0 for the period
+    int priority;         // higher runs first when releases coincide
+} rp1_spi_sched_task_config_t;
+
+typedef struct
+{
+    rp1_spi_instance_t *spi;
+    rp1_spi_txn_t txn;
+    rp1_spi_sched_task_config_t cfg;
+    uint64_t release_ns;          // next release
+    rp1_spi_latency_t *jitter;    // start of transfer - release
+    rp1_spi_latency_t *latency;   // end of transfer - release
+    _Atomic uint64_t releases;
+    _Atomic uint64_t misses;      // ended after the deadline
+    _Atomic uint64_t skipped;     // releases passed over because the task was still running, or the scheduler behind
+    _Atomic uint64_t errors;      // transfers that didn't return SPI_OK
+} rp1_spi_sched_task_t;
+
+typedef struct
+{
+    uint64_t releases;
+    uint64_t misses;
+    uint64_t skipped;
+    uint64_t errors;
+    uint64_t jitter_p50_ns;
+    uint64_t jitter_p99_ns;
+    uint64_t jitter_max_ns;
+    uint64_t latency_p50_ns;
+    uint64_t latency_p99_ns;
+    uint64_t latency_max_ns;
+} rp1_spi_sched_stats_t;
+
+typedef struct
+{
+    rp1_spi_instance_t *timebase; // clock the deadlines are on, see rp1_spi_sched_create()
+    uint32_t count;
+    uint32_t max_tasks;
+    rp1_spi_sched_task_t *tasks;
+    uint32_t spin_ns;
+    uint64_t epoch_ns;            // when the scheduler was started, releases are offset from here
+
+    // scheduler thread
+    pthread_t thread;
+    int cpu;                      // core the thread is pinned to, -1 for any
+    int rt_priority;              // SCHED_FIFO priority, 0 for the normal scheduler
+    bool rt;                      // the thread did get SCHED_FIFO
+    bool running;
+    _Atomic bool stop;
+} rp1_spi_sched_t;
+
+bool rp1_spi_sched_create(rp1_spi_instance_t *timebase, uint32_t max_tasks, rp1_spi_sched_t **sched);
+void rp1_spi_sched_destroy(rp1_spi_sched_t *sched);
+int rp1_spi_sched_add(rp1_spi_sched_t *sched, rp1_spi_instance_t *spi, const rp1_spi_txn_t *txn, const rp1_spi_sched_task_config_t *cfg);
+void rp1_spi_sched_set_spin(rp1_spi_sched_t *sched, uint32_t spin_ns);
+void rp1_spi_sched_set_cpu(rp1_spi_sched_t *sched, int cpu, int rt_priority);
+void rp1_spi_sched_reset(rp1_spi_sched_t *sched);
+uint32_t rp1_spi_sched_run(rp1_spi_sched_t *sched, uint32_t releases);
+bool rp1_spi_sched_start(rp1_spi_sched_t *sched);
+void rp1_spi_sched_stop(rp1_spi_sched_t *sched);
+void rp1_spi_sched_get_stats(rp1_spi_sched_t *sched, int task, rp1_spi_latency_snapshot_t *snap, rp1_spi_sched_stats_t *stats);
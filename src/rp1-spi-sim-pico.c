@@ -0,0 +1,228 @@
+#include <string.h>
+
+#include "pi_pico_commands.h"
+#include "rp1-spi-sim-pico.h"
+
+static uint8_t pico_frame_handler(void *ctx, uint8_t cmd, const uint8_t *arg, uint8_t arg_len, uint8_t *reply, uint8_t *reply_len);
+
+/// @brief Sets up the pico model with the same encoder data as spi_slave_02.c (1..32)
+/// @param pico pico model
+void rp1_spi_sim_pico_init(rp1_spi_sim_pico_t *pico)
+{
+    memset(pico, 0, sizeof(rp1_spi_sim_pico_t));
+    for (int i = 0; i < SIM_PICO_ENCODER_BYTES; i++)
+        pico->encoders[i] = i + 1;
+    pico->drdy_ns = SIM_PICO_DRDY_NS;
+    pi_pico_slave_init(&pico->slave, pico_frame_handler, pico);
+}
+
+/// @brief The pico's time_us_32() at a given simulation time
+/// @param pico pico model
+/// @param now_ns simulation time
+/// @return microsecond counter, wrapping at 32 bits like the pico's
+uint32_t rp1_spi_sim_pico_time_us(rp1_spi_sim_pico_t *pico, uint64_t now_ns)
+{
+    int64_t us = (int64_t)(now_ns / 1000);
+    us += us * pico->drift_ppm / 1000000;
+    return (uint32_t)(us + pico->time_offset_us);
+}
+
+/// @brief The encoder reading staged at a given simulation time
+/// @param pico pico model
+/// @param now_ns simulation time
+/// @return readings since the first, taken at 0 - always 0 without a sample_ns
+uint64_t rp1_spi_sim_pico_reading(rp1_spi_sim_pico_t *pico, uint64_t now_ns)
+{
+    return pico->sample_ns != 0 ? now_ns / pico->sample_ns : 0;
+}
+
+// DRDY, high from each reading after the first until drdy_ns later
+static uint32_t pico_drdy(void *ctx, uint64_t now_ns)
+{
+    rp1_spi_sim_pico_t *pico = (rp1_spi_sim_pico_t *)ctx;
+
+    if (pico->sample_ns == 0 || now_ns < pico->sample_ns || now_ns % pico->sample_ns >= pico->drdy_ns)
+        return 0;
+    return 1u << pico->drdy_pin;
+}
+
+/// @brief Wires the pico's DRDY output to a pin of the GPIO model, on the same clock as the SSI model
+/// @param pico pico model, with a sample_ns
+/// @param gpio GPIO model
+/// @param pin GPIO number
+void rp1_spi_sim_pico_attach_drdy(rp1_spi_sim_pico_t *pico, rp1_gpio_sim_t *gpio, uint8_t pin)
+{
+    pico->drdy_pin = pin;
+    rp1_gpio_sim_set_source(gpio, 1u << pin, pico_drdy, pico);
+}
+
+static void pico_command(rp1_spi_sim_pico_t *pico, uint8_t command, uint64_t now_ns)
+{
+    pico->commands++;
+    pico->resp_pos = 0;
+    pico->resp_len = 0;
+
+    switch (command)
+    {
+    case CMD_NOP:
+    case CMD_RESET_ENCODERS:
+    case CMD_RESET_PICO:
+        break;
+    case CMD_READ_SYSTIME:
+    {
+        // the pico sends its uint32_t in memory order, i.e. little endian
+        uint32_t systime = rp1_spi_sim_pico_time_us(pico, now_ns);
+        memcpy(pico->response, &systime, sizeof(systime));
+        pico->resp_len = sizeof(systime);
+        break;
+    }
+    case CMD_READ_ENCODERS:
+        if (pico->sample_ns != 0)
+        {
+            uint32_t reading = (uint32_t)rp1_spi_sim_pico_reading(pico, now_ns);
+            memcpy(pico->encoders, &reading, sizeof(reading));
+        }
+        memcpy(pico->response, pico->encoders, SIM_PICO_ENCODER_BYTES);
+        pico->resp_len = SIM_PICO_ENCODER_BYTES;
+        break;
+    default:
+        pico->unknown++;
+        break;
+    }
+}
+
+// the commands of pi_pico_commands.h, framed - the same replies as above
+static uint8_t pico_frame_handler(void *ctx, uint8_t cmd, const uint8_t *arg, uint8_t arg_len, uint8_t *reply, uint8_t *reply_len)
+{
+    rp1_spi_sim_pico_t *pico = (rp1_spi_sim_pico_t *)ctx;
+
+    // the firmware restarts there and then, without a reply
+    if (cmd == CMD_RESET_PICO)
+        pico->resetting = true;
+
+    uint32_t unknown = pico->unknown;
+    pico_command(pico, cmd, pico->now_ns);
+    if (pico->unknown != unknown)
+        return PI_PICO_STATUS_UNKNOWN;
+
+    memcpy(reply, pico->response, pico->resp_len);
+    *reply_len = (uint8_t)pico->resp_len;
+    pico->resp_len = 0;
+
+    return PI_PICO_STATUS_OK;
+}
+
+// one byte of a framed transaction - the staged reply goes out while the request comes in,
+// and the pico pads with zeros once it has run out
+static uint8_t pico_frame_byte(rp1_spi_sim_pico_t *pico, uint8_t in)
+{
+    uint32_t pos = pico->pos++;
+    if (pico->lost)
+        return 0;
+    uint8_t out = pos < pico->staged_len ? pico->staged[pos] : 0;
+
+    // a bit flipped on the line, in the request's length byte or the reply's first payload byte
+    if (pico->corrupt_every != 0 && pico->transactions % pico->corrupt_every == 0)
+    {
+        bool request = (pico->transactions / pico->corrupt_every) % 2 != 0;
+        if (request && pos == 4)
+            in ^= 0x10;
+        if (!request && pos == PI_PICO_FRAME_HEADER)
+            out ^= 0x01;
+    }
+
+    if (pos < PI_PICO_FRAME_PADDED)
+        pico->rx[pos] = in;
+
+    return out;
+}
+
+// one byte on the wire - while a reply is pending, incoming bytes are dummies
+// and are discarded, otherwise they are commands, and a request frame switches to framing
+static uint8_t pico_byte(rp1_spi_sim_pico_t *pico, uint8_t in, uint64_t now_ns)
+{
+    if (pico->framed)
+        return pico_frame_byte(pico, in);
+
+    if (pico->resp_pos < pico->resp_len)
+        return pico->response[pico->resp_pos++];
+
+    if (in == PI_PICO_SOF_REQUEST && pico->pos == 0)
+    {
+        pico->framed = true;
+        return pico_frame_byte(pico, in);
+    }
+    pico->pos++;
+
+    pico_command(pico, in, now_ns);
+    return 0;
+}
+
+// in framed mode the request is taken when CS goes high, and the reply is ready to go out
+// turnaround_ns later, as with the firmware's CS interrupt rearming its DMA channels. Before that
+// neither channel is running: nothing goes out, nothing is taken in, and the interrupt for the
+// end of the transaction finds an empty request
+static void pico_select(void *ctx, bool selected, uint64_t now_ns)
+{
+    rp1_spi_sim_pico_t *pico = (rp1_spi_sim_pico_t *)ctx;
+    pico->selected = selected;
+
+    if (selected && pico->framed && pico->released_ns != 0 &&
+        (pico->min_idle_ns == 0 || now_ns - pico->released_ns < pico->min_idle_ns))
+        pico->min_idle_ns = now_ns - pico->released_ns;
+
+    if (selected && pico->framed && now_ns < pico->ready_ns)
+    {
+        pico->lost = true;
+        pico->overruns++;
+    }
+
+    if (!selected && pico->framed && pico->pos != 0)
+    {
+        uint32_t len = pico->pos < PI_PICO_FRAME_PADDED ? pico->pos : PI_PICO_FRAME_PADDED;
+        if (pico->lost)
+            len = 0;
+        else if (pico->corrupt_every != 0 && pico->transactions % pico->corrupt_every == 0)
+            pico->corrupted++;
+        pico->transactions++;
+        pico->now_ns = now_ns;
+        pico->staged = pi_pico_slave_request(&pico->slave, pico->rx, len, &pico->staged_len);
+        pico->ready_ns = now_ns + pico->turnaround_ns;
+        pico->released_ns = now_ns;
+        pico->lost = false;
+    }
+    if (!selected && pico->resetting)
+    {
+        pico->framed = false;
+        pico->resetting = false;
+        pico->staged_len = 0;
+        pi_pico_slave_init(&pico->slave, pico_frame_handler, pico);
+    }
+    pico->pos = 0;
+}
+
+// the pico runs 8 bit frames, wider master frames arrive msb first
+static uint32_t pico_exchange(void *ctx, uint32_t mosi, uint8_t bits, uint64_t now_ns)
+{
+    rp1_spi_sim_pico_t *pico = (rp1_spi_sim_pico_t *)ctx;
+    uint32_t miso = 0;
+
+    for (int shift = bits - 8; shift >= 0; shift -= 8)
+        miso = (miso << 8) | pico_byte(pico, (uint8_t)(mosi >> shift), now_ns);
+
+    return miso;
+}
+
+/// @brief Connects the pico model to a chip select line of the simulator
+/// @param pico pico model
+/// @param sim simulator instance
+/// @param cs chip select line
+void rp1_spi_sim_pico_attach(rp1_spi_sim_pico_t *pico, rp1_spi_sim_t *sim, uint8_t cs)
+{
+    rp1_spi_sim_slave_t slave = {
+        .ctx = pico,
+        .select = pico_select,
+        .exchange = pico_exchange,
+    };
+    rp1_spi_sim_set_slave(sim, cs, &slave);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pi_pico_frame.h"
+#include "rp1-gpio-sim.h"
+#include "rp1-spi-sim.h"
+
+// model of the pico slave in pico/spi_slave_02.c for use with the SSI simulator
+// one command byte in, followed by a fixed length reply clocked out by the master - or, from the
+// first request frame on, the framed protocol of pi_pico_frame.h
+//
+// with sample_ns set it takes a new encoder reading every sample_ns, as the firmware's core 1
+// does, and raises DRDY on a pin of the GPIO model for drdy_ns as each one is staged
+
+#define SIM_PICO_ENCODER_BYTES 32
+// as DRDY_PULSE_US in spi_slave_02.c
+#define SIM_PICO_DRDY_NS 10000
+
+typedef struct
+{
+    uint8_t encoders[SIM_PICO_ENCODER_BYTES]; // reply to CMD_READ_ENCODERS
+    int64_t time_offset_us;                   // time_us_32() when the simulation clock reads 0
+    int32_t drift_ppm;                        // pico crystal error against the host clock
+    uint32_t corrupt_every;                   // flip a bit in every nth framed transaction, in the request
+                                              // and the reply by turns - 0 for a clean line
+    uint32_t turnaround_ns;                   // framed, from CS going high until the next reply is staged -
+                                              // a transaction started sooner is lost, and answered as corrupt
+    uint64_t sample_ns;                       // time between encoder readings, 0 for one reading that never changes -
+                                              // otherwise the first four bytes of the encoders count the readings
+    uint32_t drdy_ns;                         // how long DRDY stays high from each reading
+    uint8_t drdy_pin;                         // GPIO of the model DRDY is wired to, see rp1_spi_sim_pico_attach_drdy()
+
+    // protocol state
+    bool selected;
+    uint8_t response[SIM_PICO_ENCODER_BYTES];
+    uint32_t resp_len;
+    uint32_t resp_pos;
+
+    // framed protocol state
+    bool framed;
+    bool resetting;                 // CMD_RESET_PICO taken, back to command bytes once CS goes high
+    pi_pico_slave_t slave;
+    uint8_t rx[PI_PICO_FRAME_PADDED]; // request of this transaction
+    uint32_t pos;                   // bytes of this transaction so far
+    const uint8_t *staged;          // reply going out in this transaction
+    uint32_t staged_len;
+    uint64_t now_ns;                // for the handler
+    uint64_t ready_ns;              // when the reply staged last will be ready
+    bool lost;                      // this transaction started before it was
+    uint32_t transactions;          // framed transactions
+    uint32_t overruns;              // of those, lost to the turnaround
+    uint64_t released_ns;           // when CS last went high
+    uint64_t min_idle_ns;           // shortest time CS stayed high between framed transactions
+    uint32_t corrupted;             // of those, with a bit flipped
+
+    uint32_t commands; // commands received
+    uint32_t unknown;  // unknown commands received
+} rp1_spi_sim_pico_t;
+
+void rp1_spi_sim_pico_init(rp1_spi_sim_pico_t *pico);
+void rp1_spi_sim_pico_attach(rp1_spi_sim_pico_t *pico, rp1_spi_sim_t *sim, uint8_t cs);
+uint32_t rp1_spi_sim_pico_time_us(rp1_spi_sim_pico_t *pico, uint64_t now_ns);
+void rp1_spi_sim_pico_attach_drdy(rp1_spi_sim_pico_t *pico, rp1_gpio_sim_t *gpio, uint8_t pin);
+uint64_t rp1_spi_sim_pico_reading(rp1_spi_sim_pico_t *pico, uint64_t now_ns);
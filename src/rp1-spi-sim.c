@@ -0,0 +1,652 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rp1-spi-regs.h"
+#include "rp1-spi-sim.h"
+
+// component version as reported by a DW_apb_ssi v4.02a ("402*")
+#define SIM_SSI_VERSION 0x3430322a
+
+// reset value of CTRLR0 - 8 bit frames, motorola spi, mode 0, transmit & receive
+#define SIM_CTRLR0_RESET (7 << 16)
+
+struct rp1_spi_sim
+{
+    rp1_spi_sim_config_t cfg;
+    uint64_t now;    // virtual time in ns
+    uint64_t cursor; // time up to which the shifter has been modelled
+
+    // register file
+    uint32_t ctrlr0;
+    uint32_t ctrlr1;
+    uint32_t ssienr;
+    uint32_t ser;
+    uint32_t baudr;
+    uint32_t txftlr;
+    uint32_t rxftlr;
+    uint32_t imr;
+    uint32_t risr; // sticky bits only (TXOI, RXUI, RXOI, MSTI), the level bits are computed on read
+    uint32_t dmacr;
+    uint32_t dmatdlr;
+    uint32_t dmardlr;
+    uint32_t rx_sample_dly;
+    uint32_t cs_override;
+
+    // fifos
+    uint32_t *txfifo;
+    uint32_t txhead;
+    uint32_t txcount;
+    uint32_t *rxfifo;
+    uint32_t rxhead;
+    uint32_t rxcount;
+
+    // shifter
+    bool active;           // transfer in progress, CS asserted
+    bool shifting;         // a frame is on the wire
+    bool frame_keep;       // the frame on the wire goes into the RX FIFO
+    uint64_t frame_end;
+    uint32_t frame_mosi;
+    uint32_t rx_remaining; // frames left in the receive phase of RO / EEPROM read
+    uint32_t cs_mask;      // SER as latched at the start of the transfer
+    uint32_t cs_level;     // lines asserted at the slaves
+    uint32_t cs_gpio_mask; // lines driven by a GPIO rather than the SSI, see rp1_spi_sim_drive_cs()
+    uint32_t cs_gpio_level;
+
+    rp1_spi_sim_slave_t slaves[RP1_SPI_SIM_MAX_CS];
+    rp1_spi_sim_stats_t stats;
+
+    // attached DMA controller model
+    void (*dma_service)(void *ctx);
+    void *dma_ctx;
+
+    // interrupt line, signalled on an eventfd in place of the RP1's MSI
+    int irq_fd;
+    bool irq_level;
+};
+
+void rp1_spi_sim_default_config(rp1_spi_sim_config_t *cfg)
+{
+    cfg->fifo_depth = 64;
+    cfg->clk_sys_hz = 200000000;
+    cfg->read_cost_ns = 600;
+    cfg->write_cost_ns = 40;
+}
+
+bool rp1_spi_sim_create(const rp1_spi_sim_config_t *cfg, rp1_spi_sim_t **sim)
+{
+    rp1_spi_sim_t *s = (rp1_spi_sim_t *)calloc(1, sizeof(rp1_spi_sim_t));
+    if (s == NULL)
+        return false;
+
+    if (cfg != NULL)
+        s->cfg = *cfg;
+    else
+        rp1_spi_sim_default_config(&s->cfg);
+
+    if (s->cfg.fifo_depth < 2 || s->cfg.fifo_depth > 256 || s->cfg.clk_sys_hz == 0)
+    {
+        free(s);
+        return false;
+    }
+
+    s->txfifo = (uint32_t *)calloc(s->cfg.fifo_depth, sizeof(uint32_t));
+    s->rxfifo = (uint32_t *)calloc(s->cfg.fifo_depth, sizeof(uint32_t));
+    if (s->txfifo == NULL || s->rxfifo == NULL)
+    {
+        rp1_spi_sim_destroy(s);
+        return false;
+    }
+
+    s->ctrlr0 = SIM_CTRLR0_RESET;
+    s->imr = DW_SPI_INT_MASK;
+    s->irq_fd = -1;
+
+    *sim = s;
+
+    return true;
+}
+
+void rp1_spi_sim_destroy(rp1_spi_sim_t *sim)
+{
+    if (sim == NULL)
+        return;
+    free(sim->txfifo);
+    free(sim->rxfifo);
+    free(sim);
+}
+
+/// @brief Connects a device to one of the chip select lines
+/// @param sim simulator instance
+/// @param cs chip select line (bit number in SER)
+/// @param slave device callbacks, copied - NULL disconnects the line
+void rp1_spi_sim_set_slave(rp1_spi_sim_t *sim, uint8_t cs, const rp1_spi_sim_slave_t *slave)
+{
+    if (cs >= RP1_SPI_SIM_MAX_CS)
+        return;
+    if (slave == NULL)
+        memset(&sim->slaves[cs], 0, sizeof(rp1_spi_sim_slave_t));
+    else
+        sim->slaves[cs] = *slave;
+}
+
+static uint8_t sim_frame_bits(rp1_spi_sim_t *sim)
+{
+    return (uint8_t)(((sim->ctrlr0 & DW_PSSI_CTRLR0_DFS32_MASK) >> 16) + 1);
+}
+
+static uint32_t sim_frame_mask(rp1_spi_sim_t *sim)
+{
+    uint8_t bits = sim_frame_bits(sim);
+    return bits >= 32 ? 0xffffffff : (1u << bits) - 1;
+}
+
+static uint32_t sim_tmod(rp1_spi_sim_t *sim)
+{
+    return (sim->ctrlr0 & DW_PSSI_CTRLR0_TMOD_MASK) >> 8;
+}
+
+// the LSB of BAUDR is ignored, and a divisor of 0 stops the clock
+static uint32_t sim_divisor(rp1_spi_sim_t *sim)
+{
+    return sim->baudr & 0xfffe;
+}
+
+static uint64_t sim_frame_ns(rp1_spi_sim_t *sim)
+{
+    return (uint64_t)sim_frame_bits(sim) * sim_divisor(sim) * 1000000000ull / sim->cfg.clk_sys_hz;
+}
+
+// works out the CS level at each slave and tells those that changed
+// the SSI asserts its lines for the duration of a transfer, a line with its CS_OVERRIDE bit set
+// follows SER instead, and a line driven by a GPIO ignores the SSI altogether
+static void sim_update_select(rp1_spi_sim_t *sim, uint64_t t)
+{
+    uint32_t ssi = sim->active ? sim->cs_mask : 0;
+    uint32_t override = sim->ssienr ? sim->ser : 0;
+    uint32_t level = (ssi & ~sim->cs_override) | (override & sim->cs_override);
+    level = (level & ~sim->cs_gpio_mask) | (sim->cs_gpio_level & sim->cs_gpio_mask);
+
+    uint32_t changed = level ^ sim->cs_level;
+    sim->cs_level = level;
+    for (int cs = 0; cs < RP1_SPI_SIM_MAX_CS; cs++)
+    {
+        if ((changed & (1u << cs)) && sim->slaves[cs].select != NULL)
+            sim->slaves[cs].select(sim->slaves[cs].ctx, (level & (1u << cs)) != 0, t);
+    }
+}
+
+static bool sim_can_clock(rp1_spi_sim_t *sim)
+{
+    if (!sim->ssienr || sim->ser == 0 || sim_divisor(sim) == 0)
+        return false;
+    return sim->txcount > 0 || sim->rx_remaining > 0;
+}
+
+static void sim_start_frame(rp1_spi_sim_t *sim, uint64_t t)
+{
+    if (!sim->active)
+    {
+        sim->active = true;
+        sim->cs_mask = sim->ser;
+        if (sim_tmod(sim) == DW_SPI_CTRLR0_TMOD_EPROMREAD)
+            sim->rx_remaining = (sim->ctrlr1 & DW_SPI_NDF_MASK) + 1;
+        sim_update_select(sim, t);
+    }
+
+    uint32_t tmod = sim_tmod(sim);
+    if (sim->txcount > 0 && tmod != DW_SPI_CTRLR0_TMOD_RO)
+    {
+        sim->frame_mosi = sim->txfifo[sim->txhead];
+        sim->txhead = (sim->txhead + 1) % sim->cfg.fifo_depth;
+        sim->txcount--;
+        sim->frame_keep = (tmod == DW_SPI_CTRLR0_TMOD_TR);
+    }
+    else
+    {
+        // receive phase of RO / EEPROM read, the transmit line is held low
+        sim->frame_mosi = 0;
+        sim->frame_keep = true;
+        sim->rx_remaining--;
+    }
+
+    sim->shifting = true;
+    sim->frame_end = t + sim_frame_ns(sim);
+}
+
+static void sim_complete_frame(rp1_spi_sim_t *sim)
+{
+    uint8_t bits = sim_frame_bits(sim);
+    uint32_t mask = sim_frame_mask(sim);
+    uint32_t miso = 0;
+
+    for (int cs = 0; cs < RP1_SPI_SIM_MAX_CS; cs++)
+    {
+        if ((sim->cs_mask & (1u << cs)) && sim->slaves[cs].exchange != NULL)
+        {
+            miso = sim->slaves[cs].exchange(sim->slaves[cs].ctx, sim->frame_mosi & mask, bits, sim->frame_end);
+            break;
+        }
+    }
+
+    if (sim->frame_keep)
+    {
+        if (sim->rxcount == sim->cfg.fifo_depth)
+        {
+            sim->risr |= DW_SPI_INT_RXOI;
+            sim->stats.rx_overflows++;
+        }
+        else
+        {
+            sim->rxfifo[(sim->rxhead + sim->rxcount) % sim->cfg.fifo_depth] = miso & mask;
+            sim->rxcount++;
+        }
+    }
+
+    sim->shifting = false;
+    sim->stats.frames++;
+}
+
+static void sim_update_irq(rp1_spi_sim_t *sim);
+
+// run the shifter up to time 'until'
+static void sim_run(rp1_spi_sim_t *sim, uint64_t until)
+{
+    for (;;)
+    {
+        if (sim->dma_service != NULL)
+            sim->dma_service(sim->dma_ctx);
+
+        if (sim->shifting)
+        {
+            if (sim->frame_end > until)
+                return;
+            sim_complete_frame(sim);
+            sim->cursor = sim->frame_end;
+            sim_update_irq(sim);
+            continue;
+        }
+
+        if (sim_can_clock(sim))
+        {
+            sim_start_frame(sim, sim->cursor);
+            continue;
+        }
+
+        // nothing left to clock - the hardware ends the transfer and releases CS
+        // as soon as the TX FIFO runs dry
+        if (sim->active)
+        {
+            sim->active = false;
+            sim_update_select(sim, sim->cursor);
+        }
+        break;
+    }
+
+    sim->cursor = until;
+    sim_update_irq(sim);
+}
+
+static void sim_flush(rp1_spi_sim_t *sim)
+{
+    sim->active = false;
+    sim->shifting = false;
+    sim->rx_remaining = 0;
+    sim->txhead = sim->txcount = 0;
+    sim->rxhead = sim->rxcount = 0;
+}
+
+static uint32_t sim_sr(rp1_spi_sim_t *sim)
+{
+    uint32_t sr = 0;
+    if (sim->active)
+        sr |= DW_SPI_SR_BUSY;
+    if (sim->txcount < sim->cfg.fifo_depth)
+        sr |= DW_SPI_SR_TF_NOT_FULL;
+    if (sim->txcount == 0)
+        sr |= DW_SPI_SR_TF_EMPT;
+    if (sim->rxcount > 0)
+        sr |= DW_SPI_SR_RF_NOT_EMPT;
+    if (sim->rxcount == sim->cfg.fifo_depth)
+        sr |= DW_SPI_SR_RF_FULL;
+    return sr;
+}
+
+static uint32_t sim_risr(rp1_spi_sim_t *sim)
+{
+    uint32_t risr = sim->risr;
+    if (sim->txcount <= sim->txftlr)
+        risr |= DW_SPI_INT_TXEI;
+    if (sim->rxcount > sim->rxftlr)
+        risr |= DW_SPI_INT_RXFI;
+    return risr;
+}
+
+// the interrupt output is the OR of the unmasked status bits - signal the eventfd on a rising edge
+static void sim_update_irq(rp1_spi_sim_t *sim)
+{
+    bool level = sim->ssienr && (sim_risr(sim) & sim->imr) != 0;
+
+    if (level && !sim->irq_level && sim->irq_fd >= 0)
+    {
+        uint64_t one = 1;
+        if (write(sim->irq_fd, &one, sizeof(one)) != sizeof(one))
+            sim->irq_fd = -1;
+    }
+    sim->irq_level = level;
+}
+
+static uint32_t sim_clear_ints(rp1_spi_sim_t *sim, uint32_t mask)
+{
+    uint32_t was = sim->risr & mask;
+    sim->risr &= ~mask;
+    return was ? 1 : 0;
+}
+
+static uint32_t sim_pop_rx(rp1_spi_sim_t *sim)
+{
+    if (sim->rxcount == 0)
+    {
+        sim->risr |= DW_SPI_INT_RXUI;
+        sim->stats.rx_underflows++;
+        return 0;
+    }
+    uint32_t v = sim->rxfifo[sim->rxhead];
+    sim->rxhead = (sim->rxhead + 1) % sim->cfg.fifo_depth;
+    sim->rxcount--;
+    return v;
+}
+
+static void sim_push_tx(rp1_spi_sim_t *sim, uint32_t value)
+{
+    if (sim_tmod(sim) == DW_SPI_CTRLR0_TMOD_RO)
+    {
+        // in receive only mode a write to DR just kicks off the transfer
+        if (!sim->active && sim->rx_remaining == 0)
+            sim->rx_remaining = (sim->ctrlr1 & DW_SPI_NDF_MASK) + 1;
+        return;
+    }
+
+    if (sim->txcount == sim->cfg.fifo_depth)
+    {
+        sim->risr |= DW_SPI_INT_TXOI;
+        sim->stats.tx_overflows++;
+        return;
+    }
+    sim->txfifo[(sim->txhead + sim->txcount) % sim->cfg.fifo_depth] = value;
+    sim->txcount++;
+}
+
+/// @brief Reads a register of the model, advancing virtual time by one PCIe read
+/// @param sim simulator instance
+/// @param reg register offset (DW_SPI_*)
+/// @return register value
+uint32_t rp1_spi_sim_read(rp1_spi_sim_t *sim, uint32_t reg)
+{
+    sim->now += sim->cfg.read_cost_ns;
+    sim->stats.reads++;
+    sim_run(sim, sim->now);
+
+    // the data register is mirrored over the rest of the block up to RX_SAMPLE_DLY
+    if (reg >= DW_SPI_DR && reg < DW_SPI_RX_SAMPLE_DLY)
+        return sim_pop_rx(sim);
+
+    switch (reg)
+    {
+    case DW_SPI_CTRLR0:
+        return sim->ctrlr0;
+    case DW_SPI_CTRLR1:
+        return sim->ctrlr1;
+    case DW_SPI_SSIENR:
+        return sim->ssienr;
+    case DW_SPI_SER:
+        return sim->ser;
+    case DW_SPI_BAUDR:
+        return sim->baudr;
+    case DW_SPI_TXFTLR:
+        return sim->txftlr;
+    case DW_SPI_RXFTLR:
+        return sim->rxftlr;
+    case DW_SPI_TXFLR:
+        return sim->txcount;
+    case DW_SPI_RXFLR:
+        return sim->rxcount;
+    case DW_SPI_SR:
+        return sim_sr(sim);
+    case DW_SPI_IMR:
+        return sim->imr;
+    case DW_SPI_ISR:
+        return sim_risr(sim) & sim->imr;
+    case DW_SPI_RISR:
+        return sim_risr(sim);
+    case DW_SPI_TXOICR:
+        return sim_clear_ints(sim, DW_SPI_INT_TXOI);
+    case DW_SPI_RXOICR:
+        return sim_clear_ints(sim, DW_SPI_INT_RXOI);
+    case DW_SPI_RXUICR:
+        return sim_clear_ints(sim, DW_SPI_INT_RXUI);
+    case DW_SPI_MSTICR:
+        return sim_clear_ints(sim, DW_SPI_INT_MSTI);
+    case DW_SPI_ICR:
+    {
+        uint32_t was = sim_clear_ints(sim, DW_SPI_INT_TXOI | DW_SPI_INT_RXOI | DW_SPI_INT_RXUI | DW_SPI_INT_MSTI);
+        sim_update_irq(sim);
+        return was;
+    }
+    case DW_SPI_DMACR:
+        return sim->dmacr;
+    case DW_SPI_DMATDLR:
+        return sim->dmatdlr;
+    case DW_SPI_DMARDLR:
+        return sim->dmardlr;
+    case DW_SPI_VERSION:
+        return SIM_SSI_VERSION;
+    case DW_SPI_RX_SAMPLE_DLY:
+        return sim->rx_sample_dly;
+    case DW_SPI_CS_OVERRIDE:
+        return sim->cs_override;
+    default:
+        return 0;
+    }
+}
+
+/// @brief Writes a register of the model, advancing virtual time by one posted PCIe write
+/// @param sim simulator instance
+/// @param reg register offset (DW_SPI_*)
+/// @param value value to write
+void rp1_spi_sim_write(rp1_spi_sim_t *sim, uint32_t reg, uint32_t value)
+{
+    sim->now += sim->cfg.write_cost_ns;
+    sim->stats.writes++;
+    sim_run(sim, sim->now);
+
+    if (reg >= DW_SPI_DR && reg < DW_SPI_RX_SAMPLE_DLY)
+    {
+        sim_push_tx(sim, value);
+        return;
+    }
+
+    switch (reg)
+    {
+    case DW_SPI_CTRLR0:
+    case DW_SPI_CTRLR1:
+    case DW_SPI_BAUDR:
+        // the databook only allows these with the controller disabled, the model
+        // accepts them anyway but counts them so the driver can be checked
+        if (sim->ssienr)
+            sim->stats.cfg_while_enabled++;
+        if (reg == DW_SPI_CTRLR0)
+            sim->ctrlr0 = value;
+        else if (reg == DW_SPI_CTRLR1)
+            sim->ctrlr1 = value & DW_SPI_NDF_MASK;
+        else
+            sim->baudr = value & 0xffff;
+        break;
+    case DW_SPI_SSIENR:
+        sim->ssienr = value & 1;
+        if (!sim->ssienr)
+            sim_flush(sim);
+        break;
+    case DW_SPI_SER:
+        sim->ser = value & ((1u << RP1_SPI_SIM_MAX_CS) - 1);
+        break;
+    case DW_SPI_TXFTLR:
+        // out of range thresholds are not retained, which is how drivers size the fifo
+        if (value < sim->cfg.fifo_depth)
+            sim->txftlr = value;
+        break;
+    case DW_SPI_RXFTLR:
+        if (value < sim->cfg.fifo_depth)
+            sim->rxftlr = value;
+        break;
+    case DW_SPI_IMR:
+        sim->imr = value & DW_SPI_INT_MASK;
+        break;
+    case DW_SPI_DMACR:
+        sim->dmacr = value & (DW_SPI_DMACR_RDMAE | DW_SPI_DMACR_TDMAE);
+        break;
+    case DW_SPI_DMATDLR:
+        if (value < sim->cfg.fifo_depth)
+            sim->dmatdlr = value;
+        break;
+    case DW_SPI_DMARDLR:
+        if (value < sim->cfg.fifo_depth)
+            sim->dmardlr = value;
+        break;
+    case DW_SPI_RX_SAMPLE_DLY:
+        sim->rx_sample_dly = value & 0xff;
+        break;
+    case DW_SPI_CS_OVERRIDE:
+        sim->cs_override = value;
+        break;
+    default:
+        break;
+    }
+
+    // SSIENR, SER and CS_OVERRIDE move the CS lines, a new mask or threshold can raise
+    // the interrupt line straight away
+    sim_update_select(sim, sim->now);
+    sim_update_irq(sim);
+}
+
+/// @brief Takes a chip select line away from the SSI and drives it as a GPIO would
+/// @param sim simulator instance
+/// @param cs chip select line
+/// @param level 1 to assert the line, 0 to release it, -1 to hand it back to the SSI
+void rp1_spi_sim_drive_cs(rp1_spi_sim_t *sim, uint8_t cs, int level)
+{
+    if (cs >= RP1_SPI_SIM_MAX_CS)
+        return;
+
+    // let the shifter catch up, so the frames before the change see the old level
+    sim_run(sim, sim->now);
+    if (level < 0)
+        sim->cs_gpio_mask &= ~(1u << cs);
+    else
+        sim->cs_gpio_mask |= 1u << cs;
+    if (level > 0)
+        sim->cs_gpio_level |= 1u << cs;
+    else
+        sim->cs_gpio_level &= ~(1u << cs);
+    sim_update_select(sim, sim->now);
+}
+
+void rp1_spi_sim_set_dma(rp1_spi_sim_t *sim, void (*service)(void *ctx), void *ctx)
+{
+    sim->dma_service = service;
+    sim->dma_ctx = ctx;
+}
+
+/// @brief Frames the TX handshake asks for
+/// @param sim simulator instance
+/// @param remaining frames the DMA channel still has to move
+/// @return number of frames that can be pushed now - a burst request is raised while TXFLR <= DMATDLR,
+///         and single requests cover the tail of a block shorter than the burst
+uint32_t rp1_spi_sim_dma_tx_request(rp1_spi_sim_t *sim, uint32_t remaining)
+{
+    if (!(sim->dmacr & DW_SPI_DMACR_TDMAE) || !sim->ssienr)
+        return 0;
+    uint32_t room = sim->cfg.fifo_depth - sim->txcount;
+    if (sim->txcount > sim->dmatdlr && room < remaining)
+        return 0;
+    return room < remaining ? room : remaining;
+}
+
+/// @brief Frames the RX handshake has ready
+/// @param sim simulator instance
+/// @param remaining frames the DMA channel still has to move
+/// @return number of frames that can be popped now - a burst request is raised while RXFLR > DMARDLR,
+///         and single requests cover the tail of a block shorter than the burst
+uint32_t rp1_spi_sim_dma_rx_request(rp1_spi_sim_t *sim, uint32_t remaining)
+{
+    if (!(sim->dmacr & DW_SPI_DMACR_RDMAE) || !sim->ssienr || sim->rxcount == 0)
+        return 0;
+    if (sim->rxcount <= sim->dmardlr && sim->rxcount < remaining)
+        return 0;
+    return sim->rxcount < remaining ? sim->rxcount : remaining;
+}
+
+void rp1_spi_sim_dma_push(rp1_spi_sim_t *sim, uint32_t frame)
+{
+    sim_push_tx(sim, frame);
+}
+
+uint32_t rp1_spi_sim_dma_pop(rp1_spi_sim_t *sim)
+{
+    return sim_pop_rx(sim);
+}
+
+/// @brief Signals an eventfd on each rising edge of the interrupt output, as the RP1 raises an MSI
+/// @param sim simulator instance
+/// @param fd eventfd, or -1 to disconnect
+void rp1_spi_sim_set_irq_fd(rp1_spi_sim_t *sim, int fd)
+{
+    sim->irq_fd = fd;
+    sim->irq_level = false;
+    sim_update_irq(sim);
+}
+
+/// @brief Lets virtual time pass until the interrupt output is raised, as a CPU sleeping on the irq would
+/// @param sim simulator instance
+/// @param max_ns most time to let pass
+/// @return true if the interrupt output is high, false if it did not rise within max_ns
+bool rp1_spi_sim_run_to_irq(rp1_spi_sim_t *sim, uint64_t max_ns)
+{
+    uint64_t deadline = sim->now + max_ns;
+
+    while (!sim->irq_level && sim->now < deadline)
+    {
+        // the status bits only change as frames complete - step from one to the next
+        if (!sim->shifting && !sim_can_clock(sim))
+            return false;
+        uint64_t next = sim->shifting ? sim->frame_end : sim->now + sim_frame_ns(sim);
+        sim->now = next < deadline ? next : deadline;
+        sim_run(sim, sim->now);
+    }
+
+    return sim->irq_level;
+}
+
+/// @brief Lets virtual time pass without a register access, e.g. while the driver sleeps
+/// @param sim simulator instance
+/// @param ns nanoseconds to advance
+void rp1_spi_sim_advance(rp1_spi_sim_t *sim, uint64_t ns)
+{
+    sim->now += ns;
+    sim_run(sim, sim->now);
+}
+
+uint64_t rp1_spi_sim_now(rp1_spi_sim_t *sim)
+{
+    return sim->now;
+}
+
+void rp1_spi_sim_get_stats(rp1_spi_sim_t *sim, rp1_spi_sim_stats_t *stats)
+{
+    *stats = sim->stats;
+}
+
+void rp1_spi_sim_reset_stats(rp1_spi_sim_t *sim)
+{
+    memset(&sim->stats, 0, sizeof(rp1_spi_sim_stats_t));
+}
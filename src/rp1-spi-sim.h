@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// software model of one DW APB SSI block as found in the RP1
+//
+// the model sits behind the same register offsets as the hardware (see rp1-spi-regs.h)
+// so the driver in rp1-spi.c runs unmodified against it. Time is virtual - every register
+// access advances the model clock by the configured PCIe cost, and frames are shifted
+// according to BAUDR and the frame size, so throughput and bus transaction counts can
+// be measured on any host without a Pi 5 attached
+
+#define RP1_SPI_SIM_MAX_CS 4
+
+typedef struct rp1_spi_sim rp1_spi_sim_t;
+
+// a device on one of the chip select lines
+// select() is called when the controller asserts / deasserts the CS line,
+// exchange() once per frame with the bits shifted out on MOSI, returning the MISO bits
+typedef struct
+{
+    void *ctx;
+    void (*select)(void *ctx, bool selected, uint64_t now_ns);
+    uint32_t (*exchange)(void *ctx, uint32_t mosi, uint8_t bits, uint64_t now_ns);
+} rp1_spi_sim_slave_t;
+
+typedef struct
+{
+    uint32_t fifo_depth;    // entries in each of the TX and RX FIFOs
+    uint32_t clk_sys_hz;    // clock divided by BAUDR, 200MHz on the Pi5
+    uint32_t read_cost_ns;  // a register read is a full (non-posted) PCIe round trip
+    uint32_t write_cost_ns; // register writes are posted
+} rp1_spi_sim_config_t;
+
+typedef struct
+{
+    uint64_t reads;             // register reads
+    uint64_t writes;            // register writes
+    uint64_t frames;            // frames clocked on the wire
+    uint64_t tx_overflows;      // DR writes with the TX FIFO full
+    uint64_t rx_overflows;      // frames received with the RX FIFO full
+    uint64_t rx_underflows;     // DR reads with the RX FIFO empty
+    uint64_t cfg_while_enabled; // CTRLR0 / CTRLR1 / BAUDR written with SSIENR set
+} rp1_spi_sim_stats_t;
+
+void rp1_spi_sim_default_config(rp1_spi_sim_config_t *cfg);
+bool rp1_spi_sim_create(const rp1_spi_sim_config_t *cfg, rp1_spi_sim_t **sim);
+void rp1_spi_sim_destroy(rp1_spi_sim_t *sim);
+void rp1_spi_sim_set_slave(rp1_spi_sim_t *sim, uint8_t cs, const rp1_spi_sim_slave_t *slave);
+
+uint32_t rp1_spi_sim_read(rp1_spi_sim_t *sim, uint32_t reg);
+void rp1_spi_sim_write(rp1_spi_sim_t *sim, uint32_t reg, uint32_t value);
+
+// DMA handshake, for a DMA controller model attached with rp1_spi_sim_set_dma()
+// service() is called whenever the shifter moves, the model then uses the request
+// functions to see how many frames the SSI will take / has ready and moves them
+void rp1_spi_sim_set_dma(rp1_spi_sim_t *sim, void (*service)(void *ctx), void *ctx);
+uint32_t rp1_spi_sim_dma_tx_request(rp1_spi_sim_t *sim, uint32_t remaining);
+uint32_t rp1_spi_sim_dma_rx_request(rp1_spi_sim_t *sim, uint32_t remaining);
+void rp1_spi_sim_dma_push(rp1_spi_sim_t *sim, uint32_t frame);
+uint32_t rp1_spi_sim_dma_pop(rp1_spi_sim_t *sim);
+
+// chip select lines driven by a GPIO, see rp1_spi_set_cs_control()
+void rp1_spi_sim_drive_cs(rp1_spi_sim_t *sim, uint8_t cs, int level);
+
+// interrupt output, see rp1_spi_enable_irq()
+void rp1_spi_sim_set_irq_fd(rp1_spi_sim_t *sim, int fd);
+bool rp1_spi_sim_run_to_irq(rp1_spi_sim_t *sim, uint64_t max_ns);
+
+void rp1_spi_sim_advance(rp1_spi_sim_t *sim, uint64_t ns);
+uint64_t rp1_spi_sim_now(rp1_spi_sim_t *sim);
+void rp1_spi_sim_get_stats(rp1_spi_sim_t *sim, rp1_spi_sim_stats_t *stats);
+void rp1_spi_sim_reset_stats(rp1_spi_sim_t *sim);
@@ -0,0 +1,366 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rp1-spi-stream.h"
+#include "rp1-spi-io.h"
+
+/// @brief Creates a continuous acquisition of one transaction
+/// @param cfg device, command, reply length and rate - copied, but the command bytes are not
+/// @param depth number of samples the ring holds, rounded up to a power of two
+/// @param stream returns the new stream
+/// @return true if successful, false for a bad parameter or out of memory
+bool rp1_spi_stream_create(const rp1_spi_stream_config_t *cfg, uint32_t depth, rp1_spi_stream_t **stream)
+{
+    if (cfg->device == NULL || cfg->len == 0 || (cfg->cmd_len != 0 && cfg->cmd == NULL) ||
+        depth == 0 || depth > (1u << 20))
+        return false;
+
+    rp1_spi_stream_t *s = (rp1_spi_stream_t *)aligned_alloc(RP1_SPI_STREAM_CACHE_LINE, sizeof(rp1_spi_stream_t));
+    if (s == NULL)
+        return false;
+    memset(s, 0, sizeof(rp1_spi_stream_t));
+
+    s->cfg = *cfg;
+    s->depth = 1;
+    while (s->depth < depth)
+        s->depth <<= 1;
+    s->stride = (sizeof(rp1_spi_sample_t) + cfg->len + RP1_SPI_STREAM_CACHE_LINE - 1) & ~(RP1_SPI_STREAM_CACHE_LINE - 1);
+
+    // one slot more than the ring, for the transactions whose samples are dropped
+    size_t size = (size_t)s->stride * (s->depth + 1);
+    s->slots = (uint8_t *)aligned_alloc(RP1_SPI_STREAM_CACHE_LINE, size);
+    if (s->slots == NULL)
+    {
+        free(s);
+        return false;
+    }
+    memset(s->slots, 0, size);
+    s->cpu = -1;
+
+    *stream = s;
+
+    return true;
+}
+
+void rp1_spi_stream_destroy(rp1_spi_stream_t *stream)
+{
+    if (stream == NULL)
+        return;
+    rp1_spi_stream_stop(stream);
+    free(stream->slots);
+    free(stream);
+}
+
+static inline rp1_spi_sample_t *rp1_spi_stream_slot(rp1_spi_stream_t *stream, uint64_t n)
+{
+    return (rp1_spi_sample_t *)(stream->slots + (size_t)stream->stride * n);
+}
+
+// waits for the start of the next period on a fixed grid - a transaction that overran its
+// period starts the next one straight away, one that overran several skips the periods missed
+static void rp1_spi_stream_wait_period(rp1_spi_stream_t *stream, rp1_spi_instance_t *spi)
+{
+    uint64_t period = stream->cfg.period_ns;
+    uint64_t now = rp1_spi_now_ns(spi);
+
+    if (stream->next_ns == 0)
+    {
+        stream->next_ns = now;
+    }
+    else if (now >= stream->next_ns + period)
+    {
+        uint64_t missed = (now - stream->next_ns) / period;
+        stream->next_ns += missed * period;
+        rp1_spi_count(&stream->stats.late, missed);
+    }
+
+    if (stream->next_ns > now)
+        rp1_spi_sleep_until_ns(spi, stream->next_ns);
+    stream->next_ns += period;
+}
+
+// reads DRDY back to back until it goes ready - an edge, so a line still ready from the last
+// sample is not taken for the next. The time is taken as the read that saw it completes
+static bool rp1_spi_stream_poll_drdy(rp1_spi_stream_t *stream, uint64_t *ready_ns)
+{
+    rp1_gpio_port_t *port = stream->drdy.port;
+    uint32_t pin = 1u << stream->drdy.pin;
+    uint32_t ready = stream->drdy.active_low ? 0 : pin;
+    uint64_t timeout_ns = (uint64_t)stream->cfg.timeout * 1000000;
+    uint64_t deadline = rp1_gpio_port_now_ns(port) + timeout_ns;
+
+    for (uint32_t polls = 1;; polls++)
+    {
+        bool now_ready = (rp1_gpio_port_read(port) & pin) == ready;
+        if (now_ready && !stream->drdy_ready)
+        {
+            stream->drdy_ready = true;
+            *ready_ns = rp1_gpio_port_now_ns(port);
+            return true;
+        }
+        stream->drdy_ready = now_ready;
+
+        if (polls % RP1_SPI_STREAM_DRDY_POLLS == 0)
+        {
+            if (atomic_load_explicit(&stream->stop, memory_order_relaxed))
+                return false;
+            if (timeout_ns != 0 && rp1_gpio_port_now_ns(port) >= deadline)
+                return false;
+        }
+    }
+}
+
+// sleeps until the kernel reports an edge, a slice at a time so a stop is noticed - the kernel's
+// clock is not the model's, so the timeout is counted down in slices rather than read off a clock
+static bool rp1_spi_stream_wait_drdy_event(rp1_spi_stream_t *stream, uint64_t *ready_ns)
+{
+    uint32_t left_ms = stream->cfg.timeout;
+
+    while (!atomic_load_explicit(&stream->stop, memory_order_relaxed))
+    {
+        int slice = RP1_SPI_STREAM_DRDY_SLICE_MS;
+        if (stream->cfg.timeout != 0)
+        {
+            if (left_ms == 0)
+                return false;
+            if (left_ms < (uint32_t)slice)
+                slice = (int)left_ms;
+            left_ms -= slice;
+        }
+
+        // edges numbered between the last one taken and this came while the last transaction ran,
+        // their samples are gone - whether the kernel queued them or had no room left to
+        uint32_t seqno;
+        if (rp1_gpio_edge_wait(stream->drdy.fd, !stream->drdy.active_low, slice, ready_ns, &seqno) != 0)
+        {
+            if (stream->drdy_seqno != 0)
+                rp1_spi_count(&stream->stats.missed, seqno - stream->drdy_seqno - 1);
+            stream->drdy_seqno = seqno;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/// @brief Runs the transaction once in the calling thread, waiting for DRDY or its period first if it has one
+/// @param stream stream, not started
+/// @return true if the sample went into the ring, false if it was dropped because the ring was full,
+///         or DRDY didn't come within the timeout
+bool rp1_spi_stream_acquire(rp1_spi_stream_t *stream)
+{
+    const rp1_spi_device_t *dev = stream->cfg.device;
+    rp1_spi_instance_t *spi = dev->spi;
+    uint64_t ready_ns = 0;
+
+    if (stream->use_drdy)
+    {
+        bool ready = stream->drdy.port != NULL ? rp1_spi_stream_poll_drdy(stream, &ready_ns)
+                                               : rp1_spi_stream_wait_drdy_event(stream, &ready_ns);
+        if (!ready)
+        {
+            // or the thread is being stopped, which isn't the device's doing
+            if (!atomic_load_explicit(&stream->stop, memory_order_relaxed))
+                rp1_spi_count(&stream->stats.timeouts, 1);
+            return false;
+        }
+    }
+    else if (stream->cfg.period_ns != 0)
+    {
+        rp1_spi_stream_wait_period(stream, spi);
+    }
+
+    // the consumer's position is only fetched when the ring looks full from the last one seen
+    uint64_t head = atomic_load_explicit(&stream->head, memory_order_relaxed);
+    if (head - stream->tail_cache >= stream->depth)
+        stream->tail_cache = atomic_load_explicit(&stream->tail, memory_order_acquire);
+    bool room = head - stream->tail_cache < stream->depth;
+
+    rp1_spi_sample_t *sample = rp1_spi_stream_slot(stream, room ? (head & (stream->depth - 1)) : stream->depth);
+    sample->seq = stream->seq++;
+    sample->len = stream->cfg.len;
+    sample->start_ns = rp1_spi_now_ns(spi);
+
+    rp1_spi_lock(spi);
+    spi_status_t res = rp1_spi_device_select(dev);
+    if (res == SPI_OK && stream->cfg.cmd_len != 0)
+        res = rp1_spi_write_then_read(spi, stream->cfg.cmd, stream->cfg.cmd_len, sample->data, stream->cfg.len, stream->cfg.timeout);
+    else if (res == SPI_OK)
+        res = rp1_spi_read(spi, sample->data, stream->cfg.len, stream->cfg.timeout);
+    rp1_spi_unlock(spi);
+
+    sample->end_ns = rp1_spi_now_ns(spi);
+    sample->status = res;
+    sample->device_ns = 0;
+    sample->ready_ns = ready_ns;
+
+    if (stream->use_drdy && stream->drdy.latency != NULL)
+        rp1_spi_latency_record(stream->drdy.latency, sample->end_ns - ready_ns);
+
+    // the clock is synced between samples, once the bus lock has been given back
+    if (stream->clock != NULL)
+    {
+        if (sample->end_ns >= stream->next_sync_ns)
+        {
+            rp1_spi_clock_sync(stream->clock);
+            stream->next_sync_ns = sample->end_ns + stream->sync_ns;
+        }
+        sample->device_ns = rp1_spi_clock_to_device_ns(stream->clock, sample->start_ns + (sample->end_ns - sample->start_ns) / 2);
+    }
+
+    rp1_spi_count(&stream->stats.acquired, 1);
+    if (res != SPI_OK)
+        rp1_spi_count(&stream->stats.errors, 1);
+
+    if (!room)
+    {
+        rp1_spi_count(&stream->stats.dropped, 1);
+        return false;
+    }
+    atomic_store_explicit(&stream->head, head + 1, memory_order_release);
+
+    return true;
+}
+
+static void *rp1_spi_stream_thread(void *arg)
+{
+    rp1_spi_stream_t *stream = (rp1_spi_stream_t *)arg;
+
+    while (!atomic_load_explicit(&stream->stop, memory_order_relaxed))
+        rp1_spi_stream_acquire(stream);
+
+    return NULL;
+}
+
+/// @brief Takes a sample each time the device signals data ready instead of on the period, while stopped
+/// @param stream stream
+/// @param drdy the line and how to watch it, copied - NULL to go back to the period
+/// @return false for a pin outside the port
+/// @note the stream's timeout limits each wait for DRDY as well as each transaction - a wait that
+///       runs out is counted and no sample is taken for it
+bool rp1_spi_stream_set_drdy(rp1_spi_stream_t *stream, const rp1_spi_stream_drdy_t *drdy)
+{
+    if (drdy == NULL)
+    {
+        stream->use_drdy = false;
+        return true;
+    }
+    if (drdy->pin >= RP1_GPIO_PINS || (drdy->port != NULL && !(drdy->port->mask & (1u << drdy->pin))))
+        return false;
+
+    stream->drdy = *drdy;
+    stream->use_drdy = true;
+    // a line already ready may be for a sample read before, so the first taken is at the next edge
+    stream->drdy_ready = true;
+    stream->drdy_seqno = 0;
+
+    return true;
+}
+
+/// @brief Stamps every sample with the device's own clock as well as the host's, while stopped
+/// @param stream stream
+/// @param clock correlation with the device's clock, synced from the acquisition thread from now on - or NULL for none
+/// @param sync_ns time between syncs, each one an extra transaction
+void rp1_spi_stream_set_clock(rp1_spi_stream_t *stream, rp1_spi_clock_t *clock, uint64_t sync_ns)
+{
+    stream->clock = clock;
+    stream->sync_ns = sync_ns;
+    stream->next_sync_ns = 0;
+}
+
+/// @brief Pins the acquisition thread to one core, takes effect when it is next started
+/// @param stream stream
+/// @param cpu core number, -1 to let it run anywhere
+void rp1_spi_stream_set_cpu(rp1_spi_stream_t *stream, int cpu)
+{
+    stream->cpu = cpu;
+}
+
+/// @brief Starts the acquisition thread - the period starts over from now
+/// @param stream stream
+/// @return true if the thread was started
+bool rp1_spi_stream_start(rp1_spi_stream_t *stream)
+{
+    if (stream->running)
+        return true;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (stream->cpu >= 0)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(stream->cpu, &cpus);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    }
+
+    stream->next_ns = 0;
+    atomic_store(&stream->stop, false);
+    int res = pthread_create(&stream->thread, &attr, rp1_spi_stream_thread, stream);
+    pthread_attr_destroy(&attr);
+    if (res != 0)
+        return false;
+    stream->running = true;
+
+    return true;
+}
+
+/// @brief Stops the acquisition thread once the transaction in progress has completed
+/// @param stream stream
+void rp1_spi_stream_stop(rp1_spi_stream_t *stream)
+{
+    if (!stream->running)
+        return;
+
+    atomic_store(&stream->stop, true);
+    pthread_join(stream->thread, NULL);
+    stream->running = false;
+    // so rp1_spi_stream_acquire() can wait for DRDY again
+    atomic_store(&stream->stop, false);
+}
+
+/// @brief Number of samples waiting to be consumed
+/// @param stream stream
+/// @return samples that can be read with rp1_spi_stream_peek()
+uint32_t rp1_spi_stream_available(rp1_spi_stream_t *stream)
+{
+    uint64_t head = atomic_load_explicit(&stream->head, memory_order_acquire);
+    return (uint32_t)(head - atomic_load_explicit(&stream->tail, memory_order_relaxed));
+}
+
+/// @brief Looks at a waiting sample where it is in the ring
+/// @param stream stream
+/// @param i 0 for the oldest sample waiting, up to rp1_spi_stream_available() - 1
+/// @return the sample, valid until it is released, or NULL if there is no such sample
+const rp1_spi_sample_t *rp1_spi_stream_peek(rp1_spi_stream_t *stream, uint32_t i)
+{
+    uint64_t tail = atomic_load_explicit(&stream->tail, memory_order_relaxed);
+    if (atomic_load_explicit(&stream->head, memory_order_acquire) - tail <= i)
+        return NULL;
+    return rp1_spi_stream_slot(stream, (tail + i) & (stream->depth - 1));
+}
+
+/// @brief Hands the oldest samples back to the acquisition, once they have been read
+/// @param stream stream
+/// @param count number of samples, no more than are available
+void rp1_spi_stream_release(rp1_spi_stream_t *stream, uint32_t count)
+{
+    uint32_t available = rp1_spi_stream_available(stream);
+    uint64_t tail = atomic_load_explicit(&stream->tail, memory_order_relaxed);
+    atomic_store_explicit(&stream->tail, tail + (count < available ? count : available), memory_order_release);
+}
+
+/// @brief Reads the acquisition counters, safe from any thread while the stream runs
+/// @param stream stream
+/// @param stats returns the counters
+void rp1_spi_stream_get_stats(rp1_spi_stream_t *stream, rp1_spi_stream_stats_t *stats)
+{
+    stats->acquired = atomic_load_explicit(&stream->stats.acquired, memory_order_relaxed);
+    stats->dropped = atomic_load_explicit(&stream->stats.dropped, memory_order_relaxed);
+    stats->errors = atomic_load_explicit(&stream->stats.errors, memory_order_relaxed);
+    stats->late = atomic_load_explicit(&stream->stats.late, memory_order_relaxed);
+    stats->timeouts = atomic_load_explicit(&stream->stats.timeouts, memory_order_relaxed);
+    stats->missed = atomic_load_explicit(&stream->stats.missed, memory_order_relaxed);
+}
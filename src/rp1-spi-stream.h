@@ -0,0 +1,128 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "rp1-gpio.h"
+#include "rp1-spi.h"
+#include "rp1-spi-clock.h"
+
+// continuous acquisition - one transaction repeated by a thread of its own, back to back or at a
+// fixed rate, with the replies going into a ring of samples
+//
+// the ring has one producer, the acquisition thread, and one consumer. The consumer reads samples
+// in place with rp1_spi_stream_peek() and hands them back with rp1_spi_stream_release(), so
+// nothing is copied. Neither side ever waits for the other: when the consumer falls behind and
+// the ring is full, new samples are dropped and counted, and the gap shows in the sequence numbers
+//
+// instead of a period the stream can follow a data ready line (DRDY) from the device, and start
+// the transaction as soon as the line says there is a new sample. It is watched either by
+// reading the pin through RIO_SYNC_IN back to back - a PCIe round trip from the edge to the
+// transfer starting, with a core kept busy - or by waiting on an edge event from the kernel
+
+#define RP1_SPI_STREAM_CACHE_LINE 64
+// reads of DRDY between looks at the clock and at being stopped
+#define RP1_SPI_STREAM_DRDY_POLLS 256
+// longest an edge event wait blocks before looking at being stopped
+#define RP1_SPI_STREAM_DRDY_SLICE_MS 100
+
+typedef struct
+{
+    const rp1_spi_device_t *device; // device to talk to
+    const uint8_t *cmd;             // command sent ahead of each reply, as rp1_spi_write_then_read()
+    uint32_t cmd_len;               // 0 to just read
+    uint32_t len;                   // reply bytes per sample
+    uint64_t period_ns;             // time from the start of one transaction to the next, 0 for back to back
+    uint32_t timeout;               // ms for each transaction, 0 for none
+} rp1_spi_stream_config_t;
+
+// a data ready line, see rp1_spi_stream_set_drdy()
+typedef struct
+{
+    rp1_gpio_port_t *port;      // port with the pin, to poll it - NULL to wait on fd instead
+    int fd;                     // edge events of the pin from rp1_gpio_edge_open() for the active edge only,
+                                // when there is no port
+    uint8_t pin;                // GPIO number
+    bool active_low;            // data is ready on a falling edge, as with most ADCs - a rising one otherwise
+    rp1_spi_latency_t *latency; // when set, the time from DRDY to the end of each transaction is recorded here
+} rp1_spi_stream_drdy_t;
+
+// a slot of the ring, padded to a whole number of cache lines
+typedef struct
+{
+    uint64_t seq;        // acquisition number - one missing means a sample was dropped
+    uint64_t start_ns;   // rp1_spi_now_ns() as the transaction started
+    uint64_t end_ns;     // and as it completed
+    uint64_t device_ns;  // the device's clock at the midpoint, when the stream has one - see rp1_spi_stream_set_clock()
+    uint64_t ready_ns;   // when DRDY went ready, 0 without one
+    spi_status_t status;
+    uint32_t len;        // bytes in data
+    uint8_t data[];
+} rp1_spi_sample_t;
+
+typedef struct
+{
+    uint64_t acquired; // transactions run
+    uint64_t dropped;  // samples lost because the ring was full
+    uint64_t errors;   // transactions that didn't return SPI_OK, their samples are still delivered
+    uint64_t late;     // periods skipped because a transaction overran its slot
+    uint64_t timeouts; // waits for DRDY that ran out, no transaction is run for them
+    uint64_t missed;   // DRDY edges that came while a transaction ran - only edge events show them
+} rp1_spi_stream_stats_t;
+
+typedef struct
+{
+    rp1_spi_stream_config_t cfg;
+    uint32_t depth;   // slots in the ring, a power of two
+    uint32_t stride;  // bytes from one slot to the next
+    uint8_t *slots;
+
+    // producer and consumer positions each in a cache line of their own, and the producer
+    // keeps its own copy of the consumer's so it only reads the shared one when the ring looks full
+    _Alignas(RP1_SPI_STREAM_CACHE_LINE) _Atomic uint64_t head; // next slot to fill
+    uint64_t tail_cache;
+    uint64_t seq;                                              // next acquisition number
+    _Alignas(RP1_SPI_STREAM_CACHE_LINE) _Atomic uint64_t tail; // next slot to consume
+
+    _Alignas(RP1_SPI_STREAM_CACHE_LINE) struct {
+        _Atomic uint64_t acquired;
+        _Atomic uint64_t dropped;
+        _Atomic uint64_t errors;
+        _Atomic uint64_t late;
+        _Atomic uint64_t timeouts;
+        _Atomic uint64_t missed;
+    } stats;
+
+    // acquisition thread
+    pthread_t thread;
+    int cpu;          // core the thread is pinned to, -1 for any
+    bool running;
+    _Atomic bool stop;
+    uint64_t next_ns; // start of the next period
+
+    // device clock, kept in step from the acquisition thread
+    rp1_spi_clock_t *clock;
+    uint64_t sync_ns;      // time between clock syncs
+    uint64_t next_sync_ns;
+
+    // data ready line, in place of the period
+    bool use_drdy;
+    rp1_spi_stream_drdy_t drdy;
+    bool drdy_ready; // the line was ready when last read, so the next edge is still to come
+    uint32_t drdy_seqno; // kernel's number for the last edge event taken, 0 for none yet
+} rp1_spi_stream_t;
+
+bool rp1_spi_stream_create(const rp1_spi_stream_config_t *cfg, uint32_t depth, rp1_spi_stream_t **stream);
+void rp1_spi_stream_destroy(rp1_spi_stream_t *stream);
+bool rp1_spi_stream_acquire(rp1_spi_stream_t *stream);
+bool rp1_spi_stream_set_drdy(rp1_spi_stream_t *stream, const rp1_spi_stream_drdy_t *drdy);
+void rp1_spi_stream_set_clock(rp1_spi_stream_t *stream, rp1_spi_clock_t *clock, uint64_t sync_ns);
+void rp1_spi_stream_set_cpu(rp1_spi_stream_t *stream, int cpu);
+bool rp1_spi_stream_start(rp1_spi_stream_t *stream);
+void rp1_spi_stream_stop(rp1_spi_stream_t *stream);
+uint32_t rp1_spi_stream_available(rp1_spi_stream_t *stream);
+const rp1_spi_sample_t *rp1_spi_stream_peek(rp1_spi_stream_t *stream, uint32_t i);
+void rp1_spi_stream_release(rp1_spi_stream_t *stream, uint32_t count);
+void rp1_spi_stream_get_stats(rp1_spi_stream_t *stream, rp1_spi_stream_stats_t *stats);
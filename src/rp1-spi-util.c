@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include "rp1-spi-util.h"
+#include "rp1-spi-io.h"
 
 //#include "rp1-spi-regs.h"
 //#include "rp1-spi.h"
@@ -14,13 +15,13 @@ void dump_all_spi_regs(rp1_spi_instance_t *spi, const char *msg) {
     printf("\n%sSPI register dump: %s%s\n", boldblue, normal, msg);    
 
     for(int i=DW_SPI_CTRLR0;i<=DW_SPI_CS_OVERRIDE;i+=4) {
-        printf("spi @ %x: %x\n", i, *(uint32_t*)(spi->regbase + i));
+        printf("spi @ %x: %x\n", i, rp1_spi_reg_read(spi, i));
     }
 }
 
 void dump_sr_msg(rp1_spi_instance_t *spi, const char *msg) {
     printf("\n%sStatus register dump: %s%s\n", boldblue, normal, msg);
-    dump_sr(*(volatile uint32_t *)(spi->regbase + DW_SPI_SR));
+    dump_sr(rp1_spi_reg_read(spi, DW_SPI_SR));
 }
 
 void dump_sr(uint32_t sr) {
@@ -37,7 +38,7 @@ void dump_sr(uint32_t sr) {
 
 void dump_risr_msg(rp1_spi_instance_t *spi, const char *msg) {
     printf("\n%sRISR dump: %s%s\n", boldblue, msg, normal);
-    dump_risr(*(volatile uint32_t *)(spi->regbase + DW_SPI_RISR));
+    dump_risr(rp1_spi_reg_read(spi, DW_SPI_RISR));
 }
 void dump_risr(uint32_t reg_risr) {
 
@@ -53,7 +54,7 @@ void dump_risr(uint32_t reg_risr) {
 
 void dump_ctrlr0_msg(rp1_spi_instance_t *spi, const char *msg) {
     printf("\n%sCTRLR0 dump: %s%s\n", boldblue, msg, normal);
-    dump_ctrlr0(*(volatile uint32_t *)(spi->regbase + DW_SPI_CTRLR0));
+    dump_ctrlr0(rp1_spi_reg_read(spi, DW_SPI_CTRLR0));
 }
 void dump_ctrlr0(uint32_t reg_ctrlr0) {
     printf("ctrlr0: %x\n", reg_ctrlr0);
@@ -3,10 +3,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
 
 #include "rp1-regs.h"
 #include "rp1-spi.h"
 #include "rp1-spi-regs.h"
+#include "rp1-spi-io.h"
+
+// a single byte takes microseconds - if it hasn't gone in this long the clock has stopped
+#define RP1_SPI_WRITE_TIMEOUT_MS 100
 
 const uint32_t spi_bases[] = {
     RP1_SPI0_BASE,
@@ -20,6 +27,123 @@ const uint32_t spi_bases[] = {
     RP1_SPI8_BASE
 };
 
+// from the RP1 pin function table - SPI0 and SPI1 are on function 0, SPI2 - SPI5 on function 8
+// SPI0 and SPI4 share GPIO 8-11, so only one of the two can be used at a time
+const rp1_spi_pins_t rp1_spi_pins[RP1_SPI_GPIO_COUNT] = {
+    {.funcsel = 0, .miso = 9, .mosi = 10, .sclk = 11, .ncs = 2, .cs = {8, 7}},
+    {.funcsel = 0, .miso = 19, .mosi = 20, .sclk = 21, .ncs = 3, .cs = {18, 17, 16}},
+    {.funcsel = 8, .miso = 1, .mosi = 2, .sclk = 3, .ncs = 1, .cs = {0}},
+    {.funcsel = 8, .miso = 5, .mosi = 6, .sclk = 7, .ncs = 1, .cs = {4}},
+    {.funcsel = 8, .miso = 9, .mosi = 10, .sclk = 11, .ncs = 1, .cs = {8}},
+    {.funcsel = 8, .miso = 13, .mosi = 14, .sclk = 15, .ncs = 1, .cs = {12}},
+};
+
+static void rp1_spi_setup_pin(rp1_t *rp1, uint8_t pin, uint8_t funcsel, bool input)
+{
+    volatile uint32_t *ctrl = (volatile uint32_t *)(rp1->gpio_base + 8 * pin + 4);
+    volatile uint32_t *pad = (volatile uint32_t *)(rp1->pads_base + PADS_BANK0_GPIO_OFFSET + pin * 4);
+
+    // the atomic aliases change the fields without a read-modify-write
+    *(ctrl + RP1_ATOM_CLR_OFFSET / 4) = CTRL_MASK_FUNCSEL;
+    *(ctrl + RP1_ATOM_SET_OFFSET / 4) = funcsel;
+    *(pad + RP1_ATOM_CLR_OFFSET / 4) = PADS_MASK_OD;
+    if (input)
+        *(pad + RP1_ATOM_SET_OFFSET / 4) = PADS_MASK_IE;
+}
+
+/// @brief Hands a controller's pins to it, see rp1_spi_pins
+/// @param rp1 RP1 instance
+/// @param spinum controller, 0 to 5
+/// @param ncs number of chip selects to set up, from CS0 up
+/// @return true if successful, false if the controller isn't brought out or has fewer chip selects
+bool rp1_spi_setup_pins(rp1_t *rp1, uint8_t spinum, uint8_t ncs)
+{
+    if (spinum >= RP1_SPI_GPIO_COUNT || ncs > rp1_spi_pins[spinum].ncs)
+        return false;
+
+    const rp1_spi_pins_t *p = &rp1_spi_pins[spinum];
+    rp1_spi_setup_pin(rp1, p->miso, p->funcsel, true);
+    rp1_spi_setup_pin(rp1, p->mosi, p->funcsel, false);
+    rp1_spi_setup_pin(rp1, p->sclk, p->funcsel, false);
+    for (uint8_t i = 0; i < ncs; i++)
+        rp1_spi_setup_pin(rp1, p->cs[i], p->funcsel, false);
+
+    return true;
+}
+
+// the fifo depth is a synthesis parameter of the DW SSI, find it the same way the
+// linux driver does: TXFTLR only retains values below the depth of the fifo
+static uint32_t rp1_spi_probe_fifo_len(rp1_spi_instance_t *spi)
+{
+    uint32_t fifo;
+
+    for (fifo = 1; fifo < 256; fifo++)
+    {
+        rp1_spi_reg_write(spi, DW_SPI_TXFTLR, fifo);
+        if (rp1_spi_reg_read(spi, DW_SPI_TXFTLR) != fifo)
+            break;
+    }
+    rp1_spi_reg_write(spi, DW_SPI_TXFTLR, 0);
+
+    // could not size the fifo - assume the smallest the IP allows
+    return (fifo == 1) ? 2 : fifo;
+}
+
+/// @brief Reloads the driver's images of the configuration registers from the controller
+/// @param spi SPI instance
+/// @note only needed after writing CTRLR0, CTRLR1, BAUDR, SER or RX_SAMPLE_DLY other than through this driver
+void rp1_spi_read_config(rp1_spi_instance_t *spi)
+{
+    spi->ctrlr0 = rp1_spi_reg_read(spi, DW_SPI_CTRLR0);
+    spi->ctrlr1 = rp1_spi_reg_read(spi, DW_SPI_CTRLR1);
+    spi->baudr = rp1_spi_reg_read(spi, DW_SPI_BAUDR);
+    spi->rx_sample_dly = rp1_spi_reg_read(spi, DW_SPI_RX_SAMPLE_DLY);
+    spi->ser = rp1_spi_reg_read(spi, DW_SPI_SER);
+    spi->enabled = rp1_spi_reg_read(spi, DW_SPI_SSIENR) & 1;
+
+    spi->bits = ((spi->ctrlr0 & DW_PSSI_CTRLR0_DFS32_MASK) >> 16) + 1;
+    spi->frame_bits = spi->bits;
+    spi->bit_ns = (uint32_t)((uint64_t)(spi->baudr & 0xfffe) * 1000000000ull / RP1_CLK_SYS_HZ);
+    spi->device = NULL;
+}
+
+// writes the configuration registers that differ from their images, under one SSIENR disable
+// which also leaves the controller enabled
+void rp1_spi_apply_config(rp1_spi_instance_t *spi, uint32_t ctrlr0, uint32_t ctrlr1, uint32_t baudr, uint32_t rx_sample_dly)
+{
+    if (ctrlr0 == spi->ctrlr0 && ctrlr1 == spi->ctrlr1 && baudr == spi->baudr &&
+        rx_sample_dly == spi->rx_sample_dly && spi->enabled)
+        return;
+
+    rp1_spi_reg_write(spi, DW_SPI_SSIENR, 0);
+    if (ctrlr0 != spi->ctrlr0)
+        rp1_spi_reg_write(spi, DW_SPI_CTRLR0, ctrlr0);
+    if (ctrlr1 != spi->ctrlr1)
+        rp1_spi_reg_write(spi, DW_SPI_CTRLR1, ctrlr1);
+    if (baudr != spi->baudr)
+        rp1_spi_reg_write(spi, DW_SPI_BAUDR, baudr);
+    if (rx_sample_dly != spi->rx_sample_dly)
+        rp1_spi_reg_write(spi, DW_SPI_RX_SAMPLE_DLY, rx_sample_dly);
+    rp1_spi_reg_write(spi, DW_SPI_SSIENR, 1);
+
+    spi->enabled = true;
+    spi->ctrlr0 = ctrlr0;
+    spi->ctrlr1 = ctrlr1;
+    spi->baudr = baudr;
+    spi->rx_sample_dly = rx_sample_dly;
+    spi->bits = ((ctrlr0 & DW_PSSI_CTRLR0_DFS32_MASK) >> 16) + 1;
+    spi->bit_ns = (uint32_t)((uint64_t)(baudr & 0xfffe) * 1000000000ull / RP1_CLK_SYS_HZ);
+}
+
+// sets the transfer mode, frame size and (for RO / EEPROM read) number of frames for the next transfer
+// these are left as they are afterwards, so back to back transfers of one kind cost nothing here
+static void rp1_spi_set_transfer_mode(rp1_spi_instance_t *spi, uint32_t tmod, uint8_t bits, uint32_t ndf)
+{
+    uint32_t ctrlr0 = (spi->ctrlr0 & ~(DW_PSSI_CTRLR0_TMOD_MASK | DW_PSSI_CTRLR0_DFS32_MASK)) |
+                      (tmod << 8) | ((uint32_t)(bits - 1) << 16);
+    rp1_spi_apply_config(spi, ctrlr0, ndf, spi->baudr, spi->rx_sample_dly);
+}
+
 bool rp1_spi_create(rp1_t *rp1, uint8_t spinum, rp1_spi_instance_t **spi)
 {
 
@@ -28,180 +152,1060 @@ bool rp1_spi_create(rp1_t *rp1, uint8_t spinum, rp1_spi_instance_t **spi)
         return false;
 
     s->regbase = rp1->rp1_peripherial_base + spi_bases[spinum];
+    s->spinum = spinum;
+    // the others have no pins, only the SSI's own chip selects
+    s->ncs = spinum < RP1_SPI_GPIO_COUNT ? rp1_spi_pins[spinum].ncs : RP1_SPI_MAX_CS;
+    s->txdata = (char *)0x0;
+    s->rxdata = (char *)0x0;
+    s->txcount = 0x0;
+    s->irq_fd = -1;
+    s->cs_mask = 1u << 0;
+    pthread_mutex_init(&s->lock, NULL);
+    s->fifo_len = rp1_spi_probe_fifo_len(s);
+    rp1_spi_read_config(s);
+
+    *spi = s;
+
+    return true;
+}
+
+/// @brief Creates an SPI instance backed by the SSI simulator rather than the RP1
+/// @param sim simulator instance, see rp1-spi-sim.h
+/// @param spi returns the new instance
+/// @return true if successful
+bool rp1_spi_create_sim(rp1_spi_sim_t *sim, rp1_spi_instance_t **spi)
+{
+
+    rp1_spi_instance_t *s = (rp1_spi_instance_t *)calloc(1, sizeof(rp1_spi_instance_t));
+    if (s == NULL)
+        return false;
+
+    s->regbase = NULL;
+    s->sim = sim;
+    s->ncs = RP1_SPI_MAX_CS;
     s->txdata = (char *)0x0;
     s->rxdata = (char *)0x0;
     s->txcount = 0x0;
+    s->irq_fd = -1;
+    s->cs_mask = 1u << 0;
+    pthread_mutex_init(&s->lock, NULL);
+    s->fifo_len = rp1_spi_probe_fifo_len(s);
+    rp1_spi_read_config(s);
 
     *spi = s;
 
     return true;
 }
 
+/// @brief Frees an instance from rp1_spi_create() or rp1_spi_create_sim() - the controller is left as it is
+/// @param spi SPI instance, with no transfer in progress and the bus lock free
+void rp1_spi_destroy(rp1_spi_instance_t *spi)
+{
+    if (spi == NULL)
+        return;
+    pthread_mutex_destroy(&spi->lock);
+    free(spi);
+}
+
 
-/// @brief Writes 8 bits of data to the SPI bus, blocking until it can write and until the write is complete
+/// @brief Writes 8 bits of data to the SPI bus, blocking until the write is complete
 /// @param spi SPI instance
 /// @param data 8 bits of data to write (unsigned char)
-/// @return SPI_OK if successful - note it does not return if busy - it waits until the SPI is not busy
+/// @return SPI_OK if successful, SPI_BUSY if another transfer is in progress, SPI_TIMEOUT if the
+///         byte was not sent within RP1_SPI_WRITE_TIMEOUT_MS
 spi_status_t rp1_spi_write_8_blocking(rp1_spi_instance_t *spi, uint8_t data)
 {
+    return rp1_spi_write(spi, &data, 1, RP1_SPI_WRITE_TIMEOUT_MS);
+}
+
+// how frames are laid out in the caller's buffers
+typedef enum {
+    FRAMES_8,         // one byte per frame
+    FRAMES_16,        // one uint16_t per frame
+    FRAMES_32,        // one uint32_t per frame
+    FRAMES_PACKED_32  // a byte stream carried four bytes to a 32 bit frame, msb (first byte) first on the wire
+} rp1_spi_layout_t;
 
-    // wait until the spi is not busy
-    while(*(volatile uint32_t *)(spi->regbase + DW_SPI_SR) & DW_SPI_SR_BUSY)
+static inline uint32_t rp1_spi_load_frame(const void *buf, uint32_t i, rp1_spi_layout_t layout)
+{
+    if (buf == NULL)
+        return 0;
+    switch (layout)
+    {
+    case FRAMES_8:
+        return ((const uint8_t *)buf)[i];
+    case FRAMES_16:
+        return ((const uint16_t *)buf)[i];
+    case FRAMES_32:
+        return ((const uint32_t *)buf)[i];
+    default:
     {
-        ;
+        uint32_t word;
+        memcpy(&word, (const uint8_t *)buf + 4 * i, 4);
+        return __builtin_bswap32(word);
+    }
     }
+}
 
-    spi->txdata = &data;
-    
-    // spin until we can write to the fifo
-    while(!(*(volatile uint32_t *)(spi->regbase + DW_SPI_SR) & DW_SPI_SR_TF_NOT_FULL))
+static inline void rp1_spi_store_frame(void *buf, uint32_t i, rp1_spi_layout_t layout, uint32_t frame)
+{
+    if (buf == NULL)
+        return;
+    switch (layout)
+    {
+    case FRAMES_8:
+        ((uint8_t *)buf)[i] = (uint8_t)frame;
+        break;
+    case FRAMES_16:
+        ((uint16_t *)buf)[i] = (uint16_t)frame;
+        break;
+    case FRAMES_32:
+        ((uint32_t *)buf)[i] = frame;
+        break;
+    default:
     {
-       ;
+        uint32_t word = __builtin_bswap32(frame);
+        memcpy((uint8_t *)buf + 4 * i, &word, 4);
+        break;
     }
+    }
+}
 
-    // set the CS pin
-    *(volatile uint32_t *)(spi->regbase + DW_SPI_SER) = 1 <<0;
+/// @brief Sleeps on an interrupt file descriptor while waiting for the FIFOs, instead of spinning on the registers
+/// @param spi SPI instance
+/// @param fd a UIO device bound to the SSI interrupt (e.g. opened from /dev/uioN), or an eventfd
+///        connected with rp1_spi_sim_set_irq_fd() when running against the model
+/// @param uio true for a UIO device, which reads 4 byte counts and is re-armed by writing 1
+/// @return true if successful
+bool rp1_spi_enable_irq(rp1_spi_instance_t *spi, int fd, bool uio)
+{
+    if (fd < 0 || spi->txcount != 0)
+        return false;
 
-    // put the data into the fifo
-    *(volatile uint8_t *)(spi->regbase + DW_SPI_DR) = data;
+    // the interrupt is only unmasked while a transfer waits for it
+    rp1_spi_reg_write(spi, DW_SPI_IMR, 0);
+    spi->irq_fd = fd;
+    spi->irq_uio = uio;
+    spi->rxftlr = rp1_spi_reg_read(spi, DW_SPI_RXFTLR);
+    spi->txftlr = rp1_spi_reg_read(spi, DW_SPI_TXFTLR);
 
-    // we now need to pull exactly one byte out of the fifo which would
-    // have been clocked in when we wrote the data    
-    
-    while( (!*(volatile uint32_t *)(spi->regbase + DW_SPI_SR) & DW_SPI_SR_RF_NOT_EMPT) || (*(volatile uint32_t *)(spi->regbase + DW_SPI_SR) & DW_SPI_SR_BUSY))   // check if there is data to read (check status register for Read Fifo Not Empty)
+    if (uio)
     {
-        ;
+        int32_t on = 1;
+        if (write(fd, &on, sizeof(on)) != sizeof(on))
+        {
+            spi->irq_fd = -1;
+            return false;
+        }
     }
-    /*uint8_t discard = */*(volatile uint8_t *)(spi->regbase + DW_SPI_DR);
-    //printf("write_8 - discarded: %d\n", discard);
 
-    return SPI_OK;
+    return true;
 }
 
+/// @brief Goes back to polling the FIFO levels, the file descriptor is left open
+/// @param spi SPI instance
+void rp1_spi_disable_irq(rp1_spi_instance_t *spi)
+{
+    spi->irq_fd = -1;
+}
 
-/// @brief Reads a number of 8-bit bytes from the SPI bus, blocking until the read is complete
+// sleep until the SSI raises its interrupt
+// returns false if the deadline (0 for none) passed first
+static bool rp1_spi_wait_irq(rp1_spi_instance_t *spi, uint64_t deadline)
+{
+    uint64_t now = rp1_spi_now_ns(spi);
+    if (deadline != 0 && now >= deadline)
+        return false;
+
+    // the model only moves when it is accessed, so run it to the interrupt it is waiting
+    // for - which signals the eventfd - rather than block on a clock that has stopped
+    if (spi->sim != NULL)
+        return rp1_spi_sim_run_to_irq(spi->sim, deadline != 0 ? deadline - now : 1000000000ull);
+
+    // round up, poll() would otherwise spin for the last millisecond
+    int timeout_ms = deadline != 0 ? (int)((deadline - now + 999999) / 1000000) : -1;
+    struct pollfd pfd = {.fd = spi->irq_fd, .events = POLLIN};
+    int res = poll(&pfd, 1, timeout_ms);
+    if (res == 0)
+        return rp1_spi_now_ns(spi) < deadline;
+    if (res != 1)
+        return true;
+
+    if (spi->irq_uio)
+    {
+        int32_t count;
+        int32_t on = 1;
+        if (read(spi->irq_fd, &count, sizeof(count)) == sizeof(count))
+            (void)!write(spi->irq_fd, &on, sizeof(on));
+    }
+    else
+    {
+        uint64_t count;
+        (void)!read(spi->irq_fd, &count, sizeof(count));
+    }
+
+    return true;
+}
+
+// gives up on the transfer in progress - disabling the controller stops the clock,
+// empties both FIFOs and releases CS
+static void rp1_spi_abort(rp1_spi_instance_t *spi)
+{
+    rp1_spi_reg_write(spi, DW_SPI_SSIENR, 0);
+    rp1_spi_reg_write(spi, DW_SPI_SSIENR, 1);
+    spi->txcount = 0;
+}
+
+// one RISR read at the end of a transfer tells whether any frame was lost on the way
+spi_status_t rp1_spi_check_errors(rp1_spi_instance_t *spi)
+{
+    uint32_t risr = rp1_spi_reg_read(spi, DW_SPI_RISR);
+    if (!(risr & (DW_SPI_INT_TXOI | DW_SPI_INT_RXOI | DW_SPI_INT_RXUI)))
+        return SPI_OK;
+
+    // clear them for the next transfer, whatever is left in the FIFOs is no good either
+    rp1_spi_reg_read(spi, DW_SPI_ICR);
+    rp1_spi_abort(spi);
+
+    if (risr & DW_SPI_INT_RXOI)
+        return SPI_RX_OVERFLOW;
+    if (risr & DW_SPI_INT_TXOI)
+        return SPI_TX_OVERFLOW;
+    return SPI_RX_UNDERFLOW;
+}
+
+/// @brief Chooses how transfers wait for frames to come back from the slave
 /// @param spi SPI instance
-/// @param data buffer to read into
-/// @param len number of bytes to read
-/// @param timeout timeout in ms - not yet implemented
-/// @return 
-spi_status_t rp1_spi_read_8_n_blocking(rp1_spi_instance_t *spi, uint8_t *data, uint32_t len, uint32_t timeout)
+/// @param wait RP1_SPI_WAIT_SPIN to poll continuously, or RP1_SPI_WAIT_HYBRID to sleep until
+///        shortly before the frames are due - predicted from BAUDR, the frame size and the frames queued
+/// @param spin_ns how long before the predicted arrival a hybrid wait wakes up, to cover the
+///        scheduler's wakeup latency (50-100us is typical without an RT kernel)
+void rp1_spi_set_wait(rp1_spi_instance_t *spi, rp1_spi_wait_t wait, uint32_t spin_ns)
 {
-    if (spi->txcount != 0)
-        return SPI_BUSY;
-    if (len == 0)
-        return SPI_INVALID;
-   spi->txcount = len;
-
-    // how this works
-    // 1. We stuff the TX FIFO with dummy data (zeros, but can be anything you want) until it is full,
-    //    or we have stuffed the number of bytes we want to read (we write in order to generate the 
-    //    clock pulses to the slave, which sends us data to read)
-    // 2. We then set the CS pin to active transmission
-    // 3. We then continue to feed the TX FIFO with dummy data until we have sent all the bytes 
-    //    we want to send, if we didn't manage them all in step 1
-    // 4. As we are feeding the TX FIFO with dummy data, we are clocking out data from the slave
-    //    which we read from the RX fifo and discard
-    // 5. Once we have sent all the data, we then read the RX FIFO until it is empty, and store the data
-    //    in the buffer we were passed
-    // 6. The CS pin is turned off by the hardware when the last bit is clocked out
-
-    // pre-stuff the TX buffer with dummy data
-    while((*(volatile uint32_t *)(spi->regbase + DW_SPI_SR) & DW_SPI_SR_TF_NOT_FULL) && (spi->txcount > 0))
-    {
-        *(volatile uint8_t *)(spi->regbase + DW_SPI_DR) = (uint8_t)0x00;
-        spi->txcount--;
-    }
-    
-    // set the CS pin - since we have pre-stuffed data, the clock should start here
-    // note the behaviour of te CS pin (active low, or high) is determined by the hardware
-    // and the GPIO / PAD settings, but default is active low
-    *(volatile uint32_t *)(spi->regbase + DW_SPI_SER) = 1 << 0;  // TODO - fix this to use the correct CS pin
-    
-    int inbyte = 0;
-    // keep loading data into the tx fifo and also see if we have anything to read in the rx fifo
-    while((*(volatile uint32_t *)(spi->regbase + DW_SPI_SR) & DW_SPI_SR_TF_NOT_FULL) && (spi->txcount > 0))
-    {
-        *(volatile uint8_t *)(spi->regbase + DW_SPI_DR) = (uint8_t)0x00;
-        spi->txcount--;
-        // check if there is data to read (check status register for Read Fifo Not Empty)
-        if(*(volatile uint32_t *)(spi->regbase + DW_SPI_SR) & DW_SPI_SR_RF_NOT_EMPT)
+    spi->wait = wait;
+    spi->spin_ns = spin_ns;
+}
+
+/// @brief Returns the wait statistics since the last reset
+/// @param spi SPI instance
+/// @param stats returns the statistics
+/// @param reset true to zero them afterwards
+void rp1_spi_get_wait_stats(rp1_spi_instance_t *spi, rp1_spi_wait_stats_t *stats, bool reset)
+{
+    *stats = spi->wait_stats;
+    if (reset)
+        memset(&spi->wait_stats, 0, sizeof(rp1_spi_wait_stats_t));
+}
+
+/// @brief Reads the transfer counters, safe to call from any thread while transfers are running
+/// @param spi SPI instance
+/// @param counters returns the counters - they only ever go up, take the difference of two
+///        readings for the activity in between
+void rp1_spi_get_counters(rp1_spi_instance_t *spi, rp1_spi_counters_t *counters)
+{
+    counters->transfers = atomic_load_explicit(&spi->counters.transfers, memory_order_relaxed);
+    counters->bytes = atomic_load_explicit(&spi->counters.bytes, memory_order_relaxed);
+    counters->tx_full_polls = atomic_load_explicit(&spi->counters.tx_full_polls, memory_order_relaxed);
+    counters->rx_empty_polls = atomic_load_explicit(&spi->counters.rx_empty_polls, memory_order_relaxed);
+    counters->timeouts = atomic_load_explicit(&spi->counters.timeouts, memory_order_relaxed);
+    counters->tx_overflows = atomic_load_explicit(&spi->counters.tx_overflows, memory_order_relaxed);
+    counters->rx_overflows = atomic_load_explicit(&spi->counters.rx_overflows, memory_order_relaxed);
+    counters->rx_underflows = atomic_load_explicit(&spi->counters.rx_underflows, memory_order_relaxed);
+}
+
+/// @brief Records the time of every transfer on a controller, from the first register write to the
+///        last, in a latency histogram
+/// @param spi SPI instance
+/// @param latency histogram from rp1_spi_latency_create(), or NULL to stop - it can be shared with
+///        other controllers, and read with rp1_spi_latency_snapshot() at any time
+/// @note costs two clock reads per transfer while set, call it between transfers
+void rp1_spi_set_latency(rp1_spi_instance_t *spi, rp1_spi_latency_t *latency)
+{
+    spi->latency = latency;
+}
+
+// the clock is read once every this many polls that found nothing to do, which keeps
+// clock_gettime() out of the common case of a poll finding frames
+#define RP1_SPI_TIMEOUT_CHECK 16
+
+// hybrid wait - sleeps until spin_ns before 'frames' more frames will have gone over the wire
+// returns the time it woke, for the spin statistics
+static uint64_t rp1_spi_sleep_frames(rp1_spi_instance_t *spi, uint32_t frames, uint64_t deadline)
+{
+    uint64_t now = rp1_spi_now_ns(spi);
+    uint64_t due = now + (uint64_t)frames * spi->bit_ns * spi->bits;
+    if (deadline != 0 && due > deadline)
+        due = deadline;
+
+    if (due > now + spi->spin_ns)
+    {
+        rp1_spi_sleep_until_ns(spi, due - spi->spin_ns);
+        spi->wait_stats.sleeps++;
+        spi->wait_stats.sleep_ns += due - spi->spin_ns - now;
+    }
+    return rp1_spi_now_ns(spi);
+}
+
+// waits for 'want' frames in the RX FIFO, the last of them 'frames' frames of wire time away,
+// and returns the RXFLR that was read in *rxflr
+// when spinning a single read is made, which may find the FIFO empty - the caller polls again
+static spi_status_t rp1_spi_wait_rx(rp1_spi_instance_t *spi, uint32_t want, uint32_t frames, uint64_t deadline, uint32_t *idle, uint32_t *rxflr)
+{
+    bool hybrid = spi->irq_fd < 0 && spi->wait == RP1_SPI_WAIT_HYBRID;
+    uint64_t woke = 0;
+    spi_status_t res = SPI_OK;
+
+    if (spi->irq_fd >= 0)
+    {
+        // RXFI is raised when the RX FIFO holds more than RXFTLR frames
+        if (spi->rxftlr != want - 1)
         {
-            data[inbyte] = *(volatile uint8_t *)(spi->regbase + DW_SPI_DR);
-            inbyte++;
+            spi->rxftlr = want - 1;
+            rp1_spi_reg_write(spi, DW_SPI_RXFTLR, spi->rxftlr);
         }
+        if (!rp1_spi_wait_irq(spi, deadline))
+            return SPI_TIMEOUT;
+    }
+    else if (hybrid)
+    {
+        woke = rp1_spi_sleep_frames(spi, frames, deadline);
     }
 
-    // read the remaining bytes from the buffer
-    while(inbyte < len)
+    *rxflr = rp1_spi_reg_read(spi, DW_SPI_RXFLR);
+    spi->wait_stats.polls++;
+    while (*rxflr == 0)
     {
-        // check if there is data to read (check status register for Read Fifo Not Empty)
-        if(*(volatile uint32_t *)(spi->regbase + DW_SPI_SR) & DW_SPI_SR_RF_NOT_EMPT)
+        spi->wait_stats.empty_polls++;
+        rp1_spi_count(&spi->counters.rx_empty_polls, 1);
+        if (deadline != 0 && (++*idle % RP1_SPI_TIMEOUT_CHECK) == 0 && rp1_spi_now_ns(spi) >= deadline)
+        {
+            res = SPI_TIMEOUT;
+            break;
+        }
+        // after a hybrid sleep there is nothing to do but poll
+        if (!hybrid)
+            break;
+        *rxflr = rp1_spi_reg_read(spi, DW_SPI_RXFLR);
+        spi->wait_stats.polls++;
+    }
+    if (hybrid)
+        spi->wait_stats.spin_ns += rp1_spi_now_ns(spi) - woke;
+
+    return res;
+}
+
+// masks the interrupt again, then aborts a transfer that failed or checks one that completed for lost frames -
+// len frames of 'bits' bits were to be moved, for the counters
+static spi_status_t rp1_spi_end_transfer(rp1_spi_instance_t *spi, spi_status_t res, uint32_t len, uint8_t bits)
+{
+    if (spi->irq_fd >= 0)
+        rp1_spi_reg_write(spi, DW_SPI_IMR, 0);
+
+    if (res != SPI_OK)
+    {
+        rp1_spi_abort(spi);
+        rp1_spi_cs_end(spi);
+    }
+    else
+    {
+        spi->txcount = 0;
+        rp1_spi_cs_end(spi);
+        res = rp1_spi_check_errors(spi);
+    }
+
+    rp1_spi_count_transfer(spi, res, (uint64_t)len * ((bits + 7) / 8));
+    return res;
+}
+
+// full duplex transfer of len frames of 'bits' bits
+// only the first tx_len frames are taken from tx, zeros are sent after them, and the first
+// rx_skip frames received are dropped - a command and its reply go out as one stream
+//
+// how this works
+// every frame written to the TX FIFO produces exactly one frame in the RX FIFO, so the
+// number of frames 'in flight' (sent but not yet read back) is an upper bound on both the
+// TX FIFO level and the RX FIFO level. Topping the TX FIFO up to fifo_len frames in flight
+// can therefore never overflow either fifo, and needs no status read at all. Each register
+// read is a full PCIe round trip to the RP1, so per pass we read RXFLR once and then pull
+// exactly that many frames without looking at SR again. The TX FIFO is refilled for as long
+// as there is data left, so the transfer can be any length
+//
+// in interrupt mode RXFTLR is set to half the frames in flight (all of them at the tail), and
+// the thread sleeps until RXFI says they have arrived. Receiving them is also what makes room
+// in the TX FIFO, so RXFI is the only interrupt needed
+//
+// a hybrid wait does the same without an interrupt: the frames clock out back to back, so
+// once the TX FIFO has been topped up the time the next half of them will be back is known.
+// The thread sleeps until spin_ns before then and polls from there
+//
+// a slave can't stall the clock, but a stopped clock (BAUDR 0), a disabled controller or an
+// RO / EEPROM transfer that never starts can leave frames missing forever - timeout (in ms,
+// 0 for none) bounds the wait, after which the transfer is aborted
+static spi_status_t rp1_spi_transfer_frames(rp1_spi_instance_t *spi, const void *tx, uint32_t tx_len, void *rx, uint32_t rx_skip,
+                                            uint32_t len, rp1_spi_layout_t layout, uint8_t bits, uint32_t timeout)
+{
+    uint32_t sent = 0;
+    uint32_t received = 0;
+    uint32_t idle = 0;
+    uint64_t deadline = timeout != 0 ? rp1_spi_now_ns(spi) + (uint64_t)timeout * 1000000ull : 0;
+    spi_status_t res = SPI_OK;
+
+    rp1_spi_set_transfer_mode(spi, DW_SPI_CTRLR0_TMOD_TR, bits, spi->ctrlr1);
+    rp1_spi_begin_transfer(spi, len);
+    if (spi->irq_fd >= 0)
+        rp1_spi_reg_write(spi, DW_SPI_IMR, DW_SPI_INT_RXFI);
+
+    rp1_spi_cs_begin(spi);
+
+    while (received < len)
+    {
+        if (sent < len)
+        {
+            uint32_t room = spi->fifo_len - (sent - received);
+            if (room > len - sent)
+                room = len - sent;
+
+            while (room-- > 0)
+            {
+                rp1_spi_reg_write(spi, DW_SPI_DR, sent < tx_len ? rp1_spi_load_frame(tx, sent, layout) : 0);
+                sent++;
+            }
+            spi->txcount = len - sent;
+
+            // set the CS pin - since we have pre-stuffed data, the clock should start here
+            // note the behaviour of the CS pin (active low, or high) is determined by the hardware
+            // and the GPIO / PAD settings, but default is active low
+            rp1_spi_cs_start(spi);
+        }
+
+        // wait for half the frames in flight, or all of them at the tail - unless CS is held in
+        // software, when the FIFO running dry costs nothing but the gap, and a full FIFO per
+        // wakeup halves the wakeups
+        uint32_t in_flight = sent - received;
+        uint32_t batch = spi->cs_control == RP1_SPI_CS_AUTO ? spi->fifo_len / 2 : spi->fifo_len;
+        uint32_t want = (in_flight > batch && sent < len) ? batch : in_flight;
+        uint32_t rxflr;
+
+        res = rp1_spi_wait_rx(spi, want, want, deadline, &idle, &rxflr);
+        if (res != SPI_OK)
+            break;
+
+        while (rxflr-- > 0)
+        {
+            uint32_t frame = rp1_spi_reg_read(spi, DW_SPI_DR);
+            if (received >= rx_skip)
+                rp1_spi_store_frame(rx, received - rx_skip, layout, frame);
+            received++;
+        }
+    }
+
+    return rp1_spi_end_transfer(spi, res, len, bits);
+}
+
+// receive only (cmd_len 0) or EEPROM read (cmd_len command frames, then len frames received) transfer
+//
+// in both modes the controller clocks NDF + 1 frames by itself once started - a single DR write
+// kicks off a receive only transfer, and an EEPROM read goes over to receiving as soon as the
+// command frames queued ahead of it have gone out, in the same CS assertion. Nothing is written
+// per frame received, which halves the register accesses of a full duplex read, and MOSI stays idle
+//
+// the flip side is that there is no flow control: up to fifo_len frames are always received
+// intact, more only if they are read out faster than they come in - if not, the transfer ends
+// with SPI_RX_OVERFLOW
+static spi_status_t rp1_spi_receive_frames(rp1_spi_instance_t *spi, const void *cmd, uint32_t cmd_len, void *rx, uint32_t len, rp1_spi_layout_t layout, uint8_t bits, uint32_t timeout)
+{
+    uint32_t received = 0;
+    uint32_t idle = 0;
+    uint32_t ahead = cmd_len; // frames on the wire before the first one received
+    uint64_t deadline = timeout != 0 ? rp1_spi_now_ns(spi) + (uint64_t)timeout * 1000000ull : 0;
+    spi_status_t res = SPI_OK;
+
+    rp1_spi_set_transfer_mode(spi, cmd_len != 0 ? DW_SPI_CTRLR0_TMOD_EPROMREAD : DW_SPI_CTRLR0_TMOD_RO, bits, len - 1);
+    rp1_spi_begin_transfer(spi, len);
+    if (spi->irq_fd >= 0)
+        rp1_spi_reg_write(spi, DW_SPI_IMR, DW_SPI_INT_RXFI);
+
+    rp1_spi_cs_begin(spi);
+
+    // the whole command is queued before the clock starts, an EEPROM read switches to
+    // receiving the moment the TX FIFO runs dry
+    if (cmd_len == 0)
+        rp1_spi_reg_write(spi, DW_SPI_DR, 0);
+    for (uint32_t i = 0; i < cmd_len; i++)
+        rp1_spi_reg_write(spi, DW_SPI_DR, rp1_spi_load_frame(cmd, i, layout));
+    rp1_spi_cs_start(spi);
+
+    while (received < len)
+    {
+        uint32_t remaining = len - received;
+        uint32_t want = remaining > spi->fifo_len ? spi->fifo_len / 2 : remaining;
+        uint32_t rxflr;
+
+        res = rp1_spi_wait_rx(spi, want, ahead + want, deadline, &idle, &rxflr);
+        if (res != SPI_OK)
+            break;
+        ahead = 0;
+
+        while (rxflr-- > 0)
+        {
+            rp1_spi_store_frame(rx, received, layout, rp1_spi_reg_read(spi, DW_SPI_DR));
+            received++;
+        }
+        spi->txcount = len - received;
+    }
+
+    return rp1_spi_end_transfer(spi, res, len, bits);
+}
+
+// transmit only transfer of len frames
+//
+// nothing comes back, so there is no read per frame as in a full duplex transfer - TXFLR is read
+// once per refill instead. In interrupt mode TXEI wakes the thread when the TX FIFO is down to half
+// (empty at the tail). The transfer is over once the FIFO is empty and SR says the last frame has
+// left the shift register
+static spi_status_t rp1_spi_send_frames(rp1_spi_instance_t *spi, const void *tx, uint32_t len, rp1_spi_layout_t layout, uint8_t bits, uint32_t timeout)
+{
+    uint32_t sent = 0;
+    uint32_t level = 0;
+    uint32_t idle = 0;
+    bool irq = spi->irq_fd >= 0;
+    bool hybrid = !irq && spi->wait == RP1_SPI_WAIT_HYBRID;
+    uint64_t deadline = timeout != 0 ? rp1_spi_now_ns(spi) + (uint64_t)timeout * 1000000ull : 0;
+    spi_status_t res = SPI_OK;
+
+    rp1_spi_set_transfer_mode(spi, DW_SPI_CTRLR0_TMOD_TO, bits, spi->ctrlr1);
+    rp1_spi_begin_transfer(spi, len);
+    rp1_spi_cs_begin(spi);
+
+    while (res == SPI_OK && (sent < len || level > 0))
+    {
+        uint32_t room = spi->fifo_len - level;
+        if (room > len - sent)
+            room = len - sent;
+
+        while (room-- > 0)
+        {
+            rp1_spi_reg_write(spi, DW_SPI_DR, rp1_spi_load_frame(tx, sent, layout));
+            sent++;
+            level++;
+        }
+        spi->txcount = len - sent;
+
+        rp1_spi_cs_start(spi);
+
+        // refill once the FIFO is down to half, or wait for it to empty at the tail - or
+        // every time, if CS is held in software and a gap doesn't matter
+        uint32_t target = (sent < len && spi->cs_control == RP1_SPI_CS_AUTO) ? spi->fifo_len / 2 : 0;
+        uint64_t woke = 0;
+
+        if (irq)
         {
-            data[inbyte] = *(volatile uint8_t *)(spi->regbase + DW_SPI_DR);
-            inbyte++;
+            // TXEI is raised when the TX FIFO holds TXFTLR frames or fewer - it is unmasked
+            // once the FIFO has been filled, so it doesn't go off straight away
+            if (spi->txftlr != target)
+            {
+                spi->txftlr = target;
+                rp1_spi_reg_write(spi, DW_SPI_TXFTLR, spi->txftlr);
+            }
+            rp1_spi_reg_write(spi, DW_SPI_IMR, DW_SPI_INT_TXEI);
+            if (!rp1_spi_wait_irq(spi, deadline))
+            {
+                res = SPI_TIMEOUT;
+                break;
+            }
+            rp1_spi_reg_write(spi, DW_SPI_IMR, 0);
         }
+        else if (hybrid)
+        {
+            woke = rp1_spi_sleep_frames(spi, level - target, deadline);
+        }
+
+        level = rp1_spi_reg_read(spi, DW_SPI_TXFLR);
+        spi->wait_stats.polls++;
+        while (level > target)
+        {
+            spi->wait_stats.empty_polls++;
+            rp1_spi_count(&spi->counters.tx_full_polls, 1);
+            if (deadline != 0 && (++idle % RP1_SPI_TIMEOUT_CHECK) == 0 && rp1_spi_now_ns(spi) >= deadline)
+            {
+                res = SPI_TIMEOUT;
+                break;
+            }
+            if (!hybrid)
+                break;
+            level = rp1_spi_reg_read(spi, DW_SPI_TXFLR);
+            spi->wait_stats.polls++;
+        }
+        if (hybrid)
+            spi->wait_stats.spin_ns += rp1_spi_now_ns(spi) - woke;
     }
 
+    // the FIFO is empty, the last frame is still on its way out
+    while (res == SPI_OK && (rp1_spi_reg_read(spi, DW_SPI_SR) & DW_SPI_SR_BUSY))
+    {
+        if (deadline != 0 && (++idle % RP1_SPI_TIMEOUT_CHECK) == 0 && rp1_spi_now_ns(spi) >= deadline)
+            res = SPI_TIMEOUT;
+    }
+
+    return rp1_spi_end_transfer(spi, res, len, bits);
+}
+
+/// @brief Lets byte stream transfers use 32 bit frames where the length allows
+/// @param spi SPI instance
+/// @param enable true if the slave doesn't care about frame boundaries (e.g. the pico in mode 1),
+///        which cuts the register accesses per byte by about four
+/// @note the controller has to be disabled to change the frame size, so it is left at 32 bits after
+///       a packed transfer, and only set back to the device's frame size by a transfer that needs it
+void rp1_spi_set_frame_packing(rp1_spi_instance_t *spi, bool enable)
+{
+    spi->pack32 = enable;
+}
+
+/// @brief Selects the chip select line used by the following transfers
+/// @param spi SPI instance
+/// @param cs chip select line, below the number the controller brings out
+/// @return SPI_OK if successful, SPI_INVALID for a line the controller doesn't have - a GPIO chip
+///         select would otherwise drive whatever pin its unset entry names
+spi_status_t rp1_spi_set_cs(rp1_spi_instance_t *spi, uint8_t cs)
+{
+    if (cs >= spi->ncs)
+        return SPI_INVALID;
+
+    spi->cs = cs;
+    spi->cs_mask = 1u << spi->cs;
+    spi->device = NULL;
+
     return SPI_OK;
 }
 
-spi_status_t rp1_spi_read_32_n(rp1_spi_instance_t *spi, uint32_t *data, uint32_t len, uint32_t timeout)
+// a CS pin as a RIO output - released (high) before it is switched over, so it doesn't glitch
+static void rp1_spi_setup_cs_gpio(rp1_t *rp1, uint8_t pin)
+{
+    *(rp1->rio_out + RP1_ATOM_SET_OFFSET / 4) = 1u << pin;
+    *(rp1->rio_output_enable + RP1_ATOM_SET_OFFSET / 4) = 1u << pin;
+    rp1_spi_setup_pin(rp1, pin, CTRL_FUNCSEL_RIO, false);
+}
+
+/// @brief Chooses who drives the chip selects
+/// @param spi SPI instance
+/// @param rp1 RP1 instance, needed to move the pins to or from RIO - NULL with the simulator
+/// @param control RP1_SPI_CS_AUTO to leave CS to the SSI, which releases it whenever the TX FIFO runs
+///        dry. RP1_SPI_CS_OVERRIDE to set CS_OVERRIDE so CS follows SER, or RP1_SPI_CS_GPIO to drive
+///        the CS pins through RIO - with either of these CS is held from the first frame to the last
+///        however long the transfer. Disabling the controller, which every change of transfer mode,
+///        frame size or speed needs, also releases CS under CS_OVERRIDE, so only a GPIO chip select
+///        can be held across transfers with rp1_spi_hold_cs()
+/// @return true if successful, false if a transfer is in progress, CS is held, or the pins can't be set up
+/// @note CS_OVERRIDE is a DW SSI option that hasn't been verified on the RP1 - GPIO chip selects are
+///       what the Linux driver uses on the Pi 5
+bool rp1_spi_set_cs_control(rp1_spi_instance_t *spi, rp1_t *rp1, rp1_spi_cs_control_t control)
+{
+    if (spi->txcount != 0 || spi->cs_held || control > RP1_SPI_CS_GPIO)
+        return false;
+
+    bool gpio = control == RP1_SPI_CS_GPIO || spi->cs_control == RP1_SPI_CS_GPIO;
+    if (gpio && spi->sim == NULL && (rp1 == NULL || spi->spinum >= RP1_SPI_GPIO_COUNT))
+        return false;
+
+    // nothing may be left selected by SER under the new scheme
+    rp1_spi_write_ser(spi, 0);
+
+    if (spi->sim != NULL)
+    {
+        for (uint8_t cs = 0; cs < RP1_SPI_MAX_CS; cs++)
+            rp1_spi_sim_drive_cs(spi->sim, cs, control == RP1_SPI_CS_GPIO ? 0 : -1);
+    }
+    else if (gpio)
+    {
+        const rp1_spi_pins_t *p = &rp1_spi_pins[spi->spinum];
+        for (uint8_t cs = 0; cs < p->ncs; cs++)
+        {
+            spi->cs_pins[cs] = p->cs[cs];
+            if (control == RP1_SPI_CS_GPIO)
+                rp1_spi_setup_cs_gpio(rp1, p->cs[cs]);
+            else
+                rp1_spi_setup_pin(rp1, p->cs[cs], p->funcsel, false);
+        }
+        spi->rio_out = rp1->rio_out;
+    }
+
+    rp1_spi_reg_write(spi, DW_SPI_CS_OVERRIDE, control == RP1_SPI_CS_OVERRIDE ? (1u << RP1_SPI_MAX_CS) - 1 : 0);
+    spi->cs_control = control;
+
+    return true;
+}
+
+/// @brief Holds CS asserted across the following transfers until released, so that to the device
+///        they are one
+/// @param spi SPI instance
+/// @param hold true to assert CS and keep it, false to release it
+/// @return SPI_OK if successful, SPI_BUSY if a transfer is in progress, SPI_INVALID unless the chip
+///         selects are GPIOs, see rp1_spi_set_cs_control()
+/// @note take the bus lock for as long as CS is held when the controller is shared
+spi_status_t rp1_spi_hold_cs(rp1_spi_instance_t *spi, bool hold)
+{
+    if (spi->txcount != 0)
+        return SPI_BUSY;
+    if (spi->cs_control != RP1_SPI_CS_GPIO)
+        return SPI_INVALID;
+    if (hold == spi->cs_held)
+        return SPI_OK;
+
+    if (hold)
+    {
+        rp1_spi_cs_begin(spi);
+        spi->cs_held = true;
+    }
+    else
+    {
+        spi->cs_held = false;
+        rp1_spi_cs_end(spi);
+    }
+
+    return SPI_OK;
+}
+
+/// @brief Sets the frame size and SPI mode, only touching the controller if they change
+/// @param spi SPI instance
+/// @param bits frame size, 4 to 32 bits
+/// @param mode SPI mode 0 to 3 (bit 0 = CPHA, bit 1 = CPOL)
+/// @return SPI_OK if successful, SPI_BUSY if a transfer is in progress, SPI_INVALID for a bad size or mode
+spi_status_t rp1_spi_set_format(rp1_spi_instance_t *spi, uint8_t bits, uint8_t mode)
+{
+    if (spi->txcount != 0)
+        return SPI_BUSY;
+    if (bits < 4 || bits > 32 || mode > 3)
+        return SPI_INVALID;
+
+    uint32_t ctrlr0 = (spi->ctrlr0 & ~(DW_PSSI_CTRLR0_DFS32_MASK | DW_PSSI_CTRLR0_MODE_MASK)) |
+                      ((uint32_t)(bits - 1) << 16) | ((uint32_t)mode << 6);
+    rp1_spi_apply_config(spi, ctrlr0, spi->ctrlr1, spi->baudr, spi->rx_sample_dly);
+    spi->frame_bits = bits;
+    spi->device = NULL;
+
+    return SPI_OK;
+}
+
+/// @brief Makes a device profile - the register images for talking to one device, computed once
+/// @param dev profile to fill in, treat it as read only afterwards
+/// @param spi controller the device is on
+/// @param cfg chip select, mode, frame size, speed and sample delay of the device
+/// @return true if successful, false for a bad parameter
+bool rp1_spi_device_init(rp1_spi_device_t *dev, rp1_spi_instance_t *spi, const rp1_spi_device_config_t *cfg)
+{
+    if (cfg->cs >= spi->ncs || cfg->mode > 3 || cfg->bits < 4 || cfg->bits > 32 || cfg->hz == 0)
+        return false;
+
+    // the LSB of BAUDR is ignored, so the divisor is even and at least 2
+    uint32_t div = (RP1_CLK_SYS_HZ + cfg->hz - 1) / cfg->hz;
+    div = (div + 1) & ~1u;
+    if (div < 2)
+        div = 2;
+    if (div > 0xfffe)
+        return false;
+
+    dev->spi = spi;
+    dev->cs = cfg->cs;
+    dev->bits = cfg->bits;
+
+    // motorola SPI, transmit & receive
+    dev->ctrlr0 = ((uint32_t)(cfg->bits - 1) << 16) | ((uint32_t)cfg->mode << 6) |
+                  (DW_SPI_CTRLR0_TMOD_TR << 8) | (DW_SPI_CTRLR0_FRF_MOTO_SPI << 4);
+    dev->baudr = div;
+    dev->ser = 1u << cfg->cs;
+    dev->rx_sample_dly = cfg->rx_sample_dly;
+    dev->latency = NULL;
+
+    return true;
+}
+
+/// @brief Takes the bus for a transaction, when several threads share a controller
+/// @param spi SPI instance
+void rp1_spi_lock(rp1_spi_instance_t *spi)
+{
+    pthread_mutex_lock(&spi->lock);
+}
+
+void rp1_spi_unlock(rp1_spi_instance_t *spi)
+{
+    pthread_mutex_unlock(&spi->lock);
+}
+
+/// @brief Sets the controller up for a device - only the registers that differ are written, and
+///        nothing at all if it is already set up for it
+/// @param dev device
+/// @return SPI_OK if successful, SPI_BUSY if a transfer is in progress
+/// @note the caller must hold the bus lock if the controller is shared
+spi_status_t rp1_spi_device_select(const rp1_spi_device_t *dev)
+{
+    rp1_spi_instance_t *spi = dev->spi;
+
+    if (spi->device == dev)
+        return SPI_OK;
+    if (spi->txcount != 0)
+        return SPI_BUSY;
+
+    // the transfer mode is set by each transfer, keep whichever the last one left
+    uint32_t ctrlr0 = (dev->ctrlr0 & ~DW_PSSI_CTRLR0_TMOD_MASK) | (spi->ctrlr0 & DW_PSSI_CTRLR0_TMOD_MASK);
+    rp1_spi_apply_config(spi, ctrlr0, spi->ctrlr1, dev->baudr, dev->rx_sample_dly);
+    spi->cs = dev->cs;
+    spi->cs_mask = dev->ser;
+    spi->frame_bits = dev->bits;
+    spi->device = dev;
+
+    return SPI_OK;
+}
+
+/// @brief Full duplex transfer with a device, safe to call from several threads at once
+/// @param dev device
+/// @param tx frames to send, see rp1_spi_transfer_n(), or NULL to clock out zeros
+/// @param rx buffer for the frames received, or NULL to discard them
+/// @param len number of frames to transfer
+/// @param timeout timeout in ms, 0 to wait for as long as it takes
+/// @return as rp1_spi_transfer_n()
+spi_status_t rp1_spi_device_transfer(const rp1_spi_device_t *dev, const void *tx, void *rx, uint32_t len, uint32_t timeout)
+{
+    rp1_spi_instance_t *spi = dev->spi;
+    uint64_t start = dev->latency != NULL ? rp1_spi_now_ns(spi) : 0;
+
+    rp1_spi_lock(spi);
+    spi_status_t res = rp1_spi_device_select(dev);
+    if (res == SPI_OK)
+        res = rp1_spi_transfer_n(spi, tx, rx, len, dev->bits, timeout);
+    rp1_spi_unlock(spi);
+
+    if (dev->latency != NULL)
+        rp1_spi_latency_record(dev->latency, rp1_spi_now_ns(spi) - start);
+
+    return res;
+}
+
+/// @brief Full duplex transfer of any number of bytes, keeping both FIFOs serviced until done
+/// @param spi SPI instance
+/// @param tx bytes to send, or NULL to clock out zeros
+/// @param rx buffer for the bytes received, or NULL to discard them
+/// @param len number of bytes to transfer
+/// @param timeout timeout in ms, 0 to wait for as long as it takes
+/// @return SPI_OK if successful, SPI_BUSY if another transfer is in progress, SPI_INVALID if len is 0,
+///         SPI_TIMEOUT if the transfer was aborted, SPI_TX_OVERFLOW / SPI_RX_OVERFLOW / SPI_RX_UNDERFLOW if frames were lost
+spi_status_t rp1_spi_transfer(rp1_spi_instance_t *spi, const uint8_t *tx, uint8_t *rx, uint32_t len, uint32_t timeout)
 {
     if (spi->txcount != 0)
         return SPI_BUSY;
     if (len == 0)
         return SPI_INVALID;
 
-    //todo: implement timeout
+    // a quarter of the DR accesses of 8 bit frames
+    if (spi->pack32 && (len % 4) == 0)
+        return rp1_spi_transfer_frames(spi, tx, len / 4, rx, 0, len / 4, FRAMES_PACKED_32, 32, timeout);
 
-   
-    spi->txcount = len;
+    return rp1_spi_transfer_frames(spi, tx, len, rx, 0, len, FRAMES_8, spi->frame_bits, timeout);
+}
 
-    // set the frame size to 32 bits
-    *(volatile uint32_t *)(spi->regbase + DW_SPI_CTRLR0) = ((*(volatile uint32_t *)(spi->regbase + DW_SPI_CTRLR0)) | DW_PSSI_CTRLR0_DFS32_MASK | DW_PSSI_CTRLR0_DFS_MASK);
+/// @brief Full duplex transfer of frames of any size, the controller must already be set to that size
+/// @param spi SPI instance
+/// @param tx frames to send - uint8_t for up to 8 bits, uint16_t up to 16, otherwise uint32_t - or NULL to clock out zeros
+/// @param rx buffer for the frames received, same layout as tx, or NULL to discard them
+/// @param len number of frames to transfer
+/// @param bits frame size, see rp1_spi_set_format()
+/// @param timeout timeout in ms, 0 to wait for as long as it takes
+/// @return SPI_OK if successful, SPI_BUSY if another transfer is in progress, SPI_INVALID if len is 0,
+///         SPI_TIMEOUT if the transfer was aborted, SPI_TX_OVERFLOW / SPI_RX_OVERFLOW / SPI_RX_UNDERFLOW if frames were lost
+spi_status_t rp1_spi_transfer_n(rp1_spi_instance_t *spi, const void *tx, void *rx, uint32_t len, uint8_t bits, uint32_t timeout)
+{
+    if (bits <= 8)
+        return rp1_spi_transfer(spi, (const uint8_t *)tx, (uint8_t *)rx, len, timeout);
 
-    // pre-stuff the TX buffer with dummy data
-    while((*(volatile uint32_t *)(spi->regbase + DW_SPI_SR) & DW_SPI_SR_TF_NOT_FULL) && (spi->txcount > 0))
+    if (spi->txcount != 0)
+        return SPI_BUSY;
+    if (len == 0)
+        return SPI_INVALID;
+
+    return rp1_spi_transfer_frames(spi, tx, len, rx, 0, len, bits <= 16 ? FRAMES_16 : FRAMES_32, spi->frame_bits, timeout);
+}
+
+/// @brief Sends bytes in transmit only mode - the controller receives nothing, so there is
+///        no read back per byte as in rp1_spi_transfer()
+/// @param spi SPI instance
+/// @param tx bytes to send
+/// @param len number of bytes to send
+/// @param timeout timeout in ms, 0 to wait for as long as it takes
+/// @return as rp1_spi_transfer()
+spi_status_t rp1_spi_write(rp1_spi_instance_t *spi, const uint8_t *tx, uint32_t len, uint32_t timeout)
+{
+    if (spi->txcount != 0)
+        return SPI_BUSY;
+    if (len == 0 || tx == NULL)
+        return SPI_INVALID;
+
+    if (!spi->pack32 || (len % 4) != 0)
+        return rp1_spi_send_frames(spi, tx, len, FRAMES_8, spi->frame_bits, timeout);
+
+    return rp1_spi_send_frames(spi, tx, len / 4, FRAMES_PACKED_32, 32, timeout);
+}
+
+/// @brief Receives bytes in receive only mode - the controller clocks them in by itself, with no
+///        dummy bytes written and MOSI idle
+/// @param spi SPI instance
+/// @param rx buffer for the bytes received
+/// @param len number of bytes to receive
+/// @param timeout timeout in ms, 0 to wait for as long as it takes
+/// @return as rp1_spi_transfer()
+/// @note a receive only transfer can't be throttled, so a read longer than the RX FIFO is split into
+///       FIFO sized transfers with a GPIO chip select held, or otherwise made full duplex with zeros
+///       sent instead - the same on the wire
+spi_status_t rp1_spi_read(rp1_spi_instance_t *spi, uint8_t *rx, uint32_t len, uint32_t timeout)
+{
+    if (spi->txcount != 0)
+        return SPI_BUSY;
+    if (len == 0 || rx == NULL)
+        return SPI_INVALID;
+
+    bool packed = spi->pack32 && (len % 4) == 0;
+    uint32_t per_frame = packed ? 4 : 1;
+    uint32_t frames = len / per_frame;
+    if (frames > spi->fifo_len && spi->cs_control != RP1_SPI_CS_GPIO)
+        return rp1_spi_transfer(spi, NULL, rx, len, timeout);
+
+    // with a GPIO chip select a long read is a run of receive only transfers of a FIFO full each
+    bool hold = frames > spi->fifo_len && !spi->cs_held;
+    if (hold)
+        rp1_spi_hold_cs(spi, true);
+
+    spi_status_t res = SPI_OK;
+    uint32_t chunk;
+    for (uint32_t done = 0; res == SPI_OK && done < frames; done += chunk)
     {
-        *(volatile uint32_t *)(spi->regbase + DW_SPI_DR) = (uint32_t)0x00;
-        spi->txcount--;
+        chunk = frames - done < spi->fifo_len ? frames - done : spi->fifo_len;
+        res = rp1_spi_receive_frames(spi, NULL, 0, rx + done * per_frame, chunk,
+                                     packed ? FRAMES_PACKED_32 : FRAMES_8, packed ? 32 : spi->frame_bits, timeout);
     }
 
+    if (hold)
+        rp1_spi_hold_cs(spi, false);
+
+    return res;
+}
+
+/// @brief Sends a command and reads the reply in one transaction, in EEPROM read mode - the
+///        controller goes from sending the command straight to clocking in the reply, with CS
+///        held throughout and no dummy bytes written
+/// @param spi SPI instance
+/// @param cmd command bytes, at most one TX FIFO full
+/// @param cmd_len number of command bytes
+/// @param rx buffer for the reply
+/// @param len number of bytes in the reply, up to 65536
+/// @param timeout timeout in ms, 0 to wait for as long as it takes
+/// @return as rp1_spi_transfer(), SPI_INVALID for a command longer than the FIFO
+/// @note the reply is not throttled - up to a FIFO full is always received intact, longer replies
+///       fail with SPI_RX_OVERFLOW if the bytes come in faster than they can be read out
+/// @note with CS_OVERRIDE the clock starts with the first command frame, so a command of several
+///       frames has to reach the FIFO before the first has gone out - rp1_spi_write_then_read() doesn't
+///       rely on that
+spi_status_t rp1_spi_command_read(rp1_spi_instance_t *spi, const uint8_t *cmd, uint32_t cmd_len, uint8_t *rx, uint32_t len, uint32_t timeout)
+{
+    if (spi->txcount != 0)
+        return SPI_BUSY;
+    if (cmd == NULL || cmd_len == 0 || rx == NULL || len == 0)
+        return SPI_INVALID;
 
-    // set the CS pin
-    *(volatile uint32_t *)(spi->regbase + DW_SPI_SER) = 1 <<0;
-    
-    int indw = 0;
-    // now load the dummy data into the TX FIFO to start the clock
-    while((*(volatile uint32_t *)(spi->regbase + DW_SPI_SR) & DW_SPI_SR_TF_NOT_FULL) && (spi->txcount > 0))
+    bool packed = spi->pack32 && (cmd_len % 4) == 0 && (len % 4) == 0;
+    if (packed)
     {
-        *(volatile uint32_t *)(spi->regbase + DW_SPI_DR) = (uint32_t)0x00;
-        spi->txcount--;
-        // check if there is data to read (check status register for Read Fifo Not Empty)
-        if(*(volatile uint32_t *)(spi->regbase + DW_SPI_SR) & DW_SPI_SR_RF_NOT_EMPT)
-        {
-            data[indw] = *(volatile uint32_t *)(spi->regbase + DW_SPI_DR);
-            indw++;
-        }
-    
+        cmd_len /= 4;
+        len /= 4;
     }
+    if (cmd_len > spi->fifo_len || len > DW_SPI_NDF_MASK + 1)
+        return SPI_INVALID;
 
-    // read the remaining dwords from the buffer
-    while(indw < len)
+    if (!packed)
+        return rp1_spi_receive_frames(spi, cmd, cmd_len, rx, len, FRAMES_8, spi->frame_bits, timeout);
+
+    return rp1_spi_receive_frames(spi, cmd, cmd_len, rx, len, FRAMES_PACKED_32, 32, timeout);
+}
+
+/// @brief Sends a command and reads its reply in one transaction, CS held from the first command
+///        byte to the last reply byte
+/// @param spi SPI instance
+/// @param tx command bytes
+/// @param tx_len number of command bytes
+/// @param rx buffer for the reply
+/// @param rx_len number of bytes in the reply
+/// @param timeout timeout in ms, 0 to wait for as long as it takes
+/// @return as rp1_spi_transfer()
+/// @note when both fit in the FIFOs this is an EEPROM read, see rp1_spi_command_read(), followed by
+///       receive only transfers for a longer reply with a GPIO chip select. Otherwise the command and
+///       the zeros that clock in the reply are streamed as one full duplex transfer, and exactly tx_len
+///       bytes received while the command goes out are dropped
+spi_status_t rp1_spi_write_then_read(rp1_spi_instance_t *spi, const uint8_t *tx, uint32_t tx_len, uint8_t *rx, uint32_t rx_len, uint32_t timeout)
+{
+    if (spi->txcount != 0)
+        return SPI_BUSY;
+    if (tx == NULL || tx_len == 0 || rx == NULL || rx_len == 0)
+        return SPI_INVALID;
+
+    bool packed = spi->pack32 && (tx_len % 4) == 0 && (rx_len % 4) == 0;
+    uint32_t per_frame = packed ? 4 : 1;
+    uint32_t tx_frames = tx_len / per_frame;
+    bool eeprom = tx_frames <= spi->fifo_len && (spi->cs_control != RP1_SPI_CS_OVERRIDE || tx_frames == 1);
+
+    if (eeprom && rx_len / per_frame <= spi->fifo_len)
+        return rp1_spi_command_read(spi, tx, tx_len, rx, rx_len, timeout);
+
+    if (eeprom && spi->cs_control == RP1_SPI_CS_GPIO)
     {
-        // check if there is data to read (check status register for Read Fifo Not Empty)
-        if(*(volatile uint32_t *)(spi->regbase + DW_SPI_SR) & DW_SPI_SR_RF_NOT_EMPT)
-        {
-            data[indw] = *(volatile uint32_t *)(spi->regbase + DW_SPI_DR);
-            indw++;
-        }
+        // the first FIFO full of the reply comes with the command, the rest in receive only
+        // transfers with CS still held
+        uint32_t first = spi->fifo_len * per_frame;
+        bool hold = !spi->cs_held;
+        if (hold)
+            rp1_spi_hold_cs(spi, true);
+
+        spi_status_t res = rp1_spi_command_read(spi, tx, tx_len, rx, first, timeout);
+        if (res == SPI_OK)
+            res = rp1_spi_read(spi, rx + first, rx_len - first, timeout);
+
+        if (hold)
+            rp1_spi_hold_cs(spi, false);
+        return res;
     }
 
+    if (!packed)
+        return rp1_spi_transfer_frames(spi, tx, tx_len, rx, tx_len, tx_len + rx_len, FRAMES_8, spi->frame_bits, timeout);
+
+    return rp1_spi_transfer_frames(spi, tx, tx_len / 4, rx, tx_len / 4, (tx_len + rx_len) / 4, FRAMES_PACKED_32, 32, timeout);
+}
+
+/// @brief Reads a number of 8-bit bytes from the SPI bus, blocking until the read is complete
+/// @param spi SPI instance
+/// @param data buffer to read into
+/// @param len number of bytes to read
+/// @param timeout timeout in ms, 0 to wait for as long as it takes
+/// @return as rp1_spi_transfer()
+spi_status_t rp1_spi_read_8_n_blocking(rp1_spi_instance_t *spi, uint8_t *data, uint32_t len, uint32_t timeout)
+{
+    return rp1_spi_read(spi, data, len, timeout);
+}
+
+spi_status_t rp1_spi_read_32_n(rp1_spi_instance_t *spi, uint32_t *data, uint32_t len, uint32_t timeout)
+{
+    if (spi->txcount != 0)
+        return SPI_BUSY;
+    if (len == 0)
+        return SPI_INVALID;
+
+    // the frame size is 32 bits for this read, the next transfer sets the device's back if it needs it
+    spi_status_t res;
+    if (len <= spi->fifo_len)
+        res = rp1_spi_receive_frames(spi, NULL, 0, data, len, FRAMES_32, 32, timeout);
+    else
+        res = rp1_spi_transfer_frames(spi, NULL, 0, data, 0, len, FRAMES_32, 32, timeout);
+
     // turn off the CS pin
-    *(volatile uint32_t *)(spi->regbase + DW_SPI_SER) = 0x00;
+    if (!spi->cs_held)
+        rp1_spi_write_ser(spi, 0x00);
 
-    return SPI_OK;
+    return res;
 }
 
 spi_status_t rp1_spi_purge_rx_fifo(rp1_spi_instance_t *spi, int* dwordspurged)
@@ -213,10 +1217,10 @@ spi_status_t rp1_spi_purge_rx_fifo(rp1_spi_instance_t *spi, int* dwordspurged)
     uint32_t temp;
 
     // read the remaining dwords from the buffer
-    while((*(volatile uint32_t *)(spi->regbase + DW_SPI_SR)) & DW_SPI_SR_RF_NOT_EMPT)
+    while(rp1_spi_reg_read(spi, DW_SPI_SR) & DW_SPI_SR_RF_NOT_EMPT)
     {
         // check if there is data to read (check status register for Read Fifo Not Empty)
-        temp = *(volatile uint32_t *)(spi->regbase + DW_SPI_DR);
+        temp = rp1_spi_reg_read(spi, DW_SPI_DR);
         readcount++;
     }
 
@@ -3,6 +3,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include "rp1-regs.h"
+#include "rp1-spi-latency.h"
+#include "rp1-spi-sim.h"
 
 // only six of the nine SPI peripherals are available on the gpio
 // these are:
@@ -10,18 +12,91 @@
 // see 3.11 Function Select in the RP1 datasheet (2024-Feb)
 // https://datasheets.raspberrypi.com/rp1/rp1-peripherals.pdf
 
+extern const uint32_t spi_bases[];
+
+#define RP1_SPI_GPIO_COUNT 6
+#define RP1_SPI_MAX_CS 4
+
+// where a controller's signals come out on GPIO bank 0
+typedef struct
+{
+    uint8_t funcsel; // function select value for all of its pins
+    uint8_t miso;
+    uint8_t mosi;
+    uint8_t sclk;
+    uint8_t ncs;     // number of hardware chip selects brought out
+    uint8_t cs[RP1_SPI_MAX_CS];
+} rp1_spi_pins_t;
+
+extern const rp1_spi_pins_t rp1_spi_pins[RP1_SPI_GPIO_COUNT];
+
 typedef enum {
     SPI_OK = 0,
     SPI_ERROR = 1,
     SPI_BUSY = 2,
     SPI_TIMEOUT = 3,
-    SPI_INVALID = 4
+    SPI_INVALID = 4,
+    SPI_TX_OVERFLOW = 5,  // a frame was written to a full TX FIFO and lost (TXOI)
+    SPI_RX_OVERFLOW = 6,  // a frame arrived at a full RX FIFO and was lost (RXOI)
+    SPI_RX_UNDERFLOW = 7, // DR was read with the RX FIFO empty (RXUI)
+    SPI_BAD_FRAME = 8     // a framed reply failed its check every time it was asked for, see rp1-spi-pico.h
 } spi_status_t;
 
 
+// a device on one chip select of a controller, with its own mode, frame size and speed
+typedef struct
+{
+    uint8_t cs;
+    uint8_t mode;          // 0 to 3
+    uint8_t bits;          // frame size, 4 to 32
+    uint32_t hz;           // SCLK rate, rounded down to an even divisor of clk_sys
+    uint8_t rx_sample_dly; // clk_sys cycles to delay sampling MISO by, for long lines or slow slaves
+} rp1_spi_device_config_t;
+
+// device profile - the register images for a device, computed once by rp1_spi_device_init()
+// several devices can share a controller, from any number of threads - transfers through
+// rp1_spi_device_transfer() or a transaction queue hold the bus lock for their duration
+typedef struct rp1_spi_device
+{
+    rp1_spi_instance_t *spi;
+    uint8_t cs;
+    uint8_t bits;
+    uint32_t ctrlr0;
+    uint32_t baudr;
+    uint32_t ser;
+    uint32_t rx_sample_dly;
+    rp1_spi_latency_t *latency; // when set, the time of each rp1_spi_device_transfer() is recorded here,
+                                // waiting for the bus included - NULL from rp1_spi_device_init()
+} rp1_spi_device_t;
 
 bool rp1_spi_create(rp1_t *rp1, uint8_t spinum, rp1_spi_instance_t **spi);
+bool rp1_spi_create_sim(rp1_spi_sim_t *sim, rp1_spi_instance_t **spi);
+void rp1_spi_destroy(rp1_spi_instance_t *spi);
+void rp1_spi_read_config(rp1_spi_instance_t *spi);
+bool rp1_spi_setup_pins(rp1_t *rp1, uint8_t spinum, uint8_t ncs);
+void rp1_spi_set_frame_packing(rp1_spi_instance_t *spi, bool enable);
+bool rp1_spi_enable_irq(rp1_spi_instance_t *spi, int fd, bool uio);
+void rp1_spi_disable_irq(rp1_spi_instance_t *spi);
+void rp1_spi_set_wait(rp1_spi_instance_t *spi, rp1_spi_wait_t wait, uint32_t spin_ns);
+void rp1_spi_get_wait_stats(rp1_spi_instance_t *spi, rp1_spi_wait_stats_t *stats, bool reset);
+void rp1_spi_get_counters(rp1_spi_instance_t *spi, rp1_spi_counters_t *counters);
+void rp1_spi_set_latency(rp1_spi_instance_t *spi, rp1_spi_latency_t *latency);
+spi_status_t rp1_spi_set_cs(rp1_spi_instance_t *spi, uint8_t cs);
+bool rp1_spi_set_cs_control(rp1_spi_instance_t *spi, rp1_t *rp1, rp1_spi_cs_control_t control);
+spi_status_t rp1_spi_hold_cs(rp1_spi_instance_t *spi, bool hold);
+spi_status_t rp1_spi_set_format(rp1_spi_instance_t *spi, uint8_t bits, uint8_t mode);
+bool rp1_spi_device_init(rp1_spi_device_t *dev, rp1_spi_instance_t *spi, const rp1_spi_device_config_t *cfg);
+void rp1_spi_lock(rp1_spi_instance_t *spi);
+void rp1_spi_unlock(rp1_spi_instance_t *spi);
+spi_status_t rp1_spi_device_select(const rp1_spi_device_t *dev);
+spi_status_t rp1_spi_device_transfer(const rp1_spi_device_t *dev, const void *tx, void *rx, uint32_t len, uint32_t timeout);
 spi_status_t rp1_spi_write_8_blocking(rp1_spi_instance_t *spi, uint8_t data);
+spi_status_t rp1_spi_transfer(rp1_spi_instance_t *spi, const uint8_t *tx, uint8_t *rx, uint32_t len, uint32_t timeout);
+spi_status_t rp1_spi_transfer_n(rp1_spi_instance_t *spi, const void *tx, void *rx, uint32_t len, uint8_t bits, uint32_t timeout);
+spi_status_t rp1_spi_write(rp1_spi_instance_t *spi, const uint8_t *tx, uint32_t len, uint32_t timeout);
+spi_status_t rp1_spi_read(rp1_spi_instance_t *spi, uint8_t *rx, uint32_t len, uint32_t timeout);
+spi_status_t rp1_spi_command_read(rp1_spi_instance_t *spi, const uint8_t *cmd, uint32_t cmd_len, uint8_t *rx, uint32_t len, uint32_t timeout);
+spi_status_t rp1_spi_write_then_read(rp1_spi_instance_t *spi, const uint8_t *tx, uint32_t tx_len, uint8_t *rx, uint32_t rx_len, uint32_t timeout);
 spi_status_t rp1_spi_read_8_n_blocking(rp1_spi_instance_t *spi, uint8_t *data, uint32_t len, uint32_t timeout);
 spi_status_t rp1_spi_read_32_n(rp1_spi_instance_t *spi, uint32_t *data, uint32_t len, uint32_t timeout);
 spi_status_t rp1_spi_purge_rx_fifo(rp1_spi_instance_t *spi, int* dwordspurged);
@@ -0,0 +1,1410 @@
+/*
+    Microbenchmark of the SPI transfer paths against the simulated SSI
+    2024 March
+    Praktronics
+    GPL3
+
+    counts the PCIe register transactions per payload byte for each transfer path,
+    which is what limits the effective rate on the Pi, not SCLK
+
+    /rpi5-rp1-spi/build/bin $ ./rpi5-rp1-spi-bench
+
+*/
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <linux/gpio.h>
+
+#include "rp1-spi.h"
+#include "rp1-spi-regs.h"
+#include "rp1-spi-io.h"
+#include "rp1-spi-sim.h"
+#include "rp1-spi-multi.h"
+#include "rp1-spi-dma.h"
+#include "rp1-dma-sim.h"
+#include "rp1-spi-stream.h"
+#include "rp1-spi-sched.h"
+#include "rp1-spi-clock.h"
+#include "rp1-spi-pico.h"
+#include "rp1-spi-sim-pico.h"
+#include "rp1-gpio.h"
+#include "rp1-gpio-sim.h"
+#include "rp1-gpio-capture.h"
+#include "pi_pico_commands.h"
+#include "pi_pico_log.h"
+
+// 20MHz SCLK, as used with the pico
+#define BENCH_BAUDR 10
+// and a slow device, 1MHz
+#define BENCH_BAUDR_SLOW 200
+// hybrid waits wake up this long before frames are due
+#define BENCH_SPIN_NS 20000
+// transactions per controller in the multi-controller run
+#define BENCH_MULTI_TXNS 32
+#define BENCH_MULTI_LEN 4096
+// samples taken by each continuous acquisition run
+#define BENCH_STREAM_SAMPLES 20000
+// releases run by the scheduler
+#define BENCH_SCHED_RELEASES 5000
+// clock syncs with each pico, about 5ms apart so the window spans over 100ms
+#define BENCH_CLOCK_SYNCS 200
+// encoder reads in each framed protocol run
+#define BENCH_FRAME_READS 2000
+// events through the pico's log ring
+#define BENCH_LOG_EVENTS 1000000
+// pops between the slow consumer's sleeps, each about as long as a USB stall
+#define BENCH_LOG_SLOW_EVERY 64
+// updates of a group of GPIO
+#define BENCH_GPIO_OPS 10000
+// the SPI0 pins, watched by the capture
+#define BENCH_CAPTURE_CS 8
+#define BENCH_CAPTURE_MISO 9
+#define BENCH_CAPTURE_MOSI 10
+#define BENCH_CAPTURE_SCLK 11
+// the bus is idle for this long before the first transaction
+#define BENCH_CAPTURE_IDLE_NS 1000000
+// the pico's DRDY, from its GP20
+#define BENCH_DRDY_PIN 25
+// its encoder readings, as often as the firmware takes them
+#define BENCH_DRDY_SAMPLE_NS 100000
+// readings in each run
+#define BENCH_DRDY_READINGS 2000
+
+// the slave echoes each frame back inverted, so the data can be checked
+static uint32_t echo_exchange(void *ctx, uint32_t mosi, uint8_t bits, uint64_t now_ns)
+{
+    return ~mosi;
+}
+
+// the read loop as it was before the streaming engine - two or three SR reads per byte,
+// and it only works for transfers that fit in the fifo
+static spi_status_t legacy_read_8_n(rp1_spi_instance_t *spi, uint8_t *data, uint32_t len)
+{
+    uint32_t txcount = len;
+
+    while ((rp1_spi_reg_read(spi, DW_SPI_SR) & DW_SPI_SR_TF_NOT_FULL) && (txcount > 0))
+    {
+        rp1_spi_reg_write(spi, DW_SPI_DR, 0x00);
+        txcount--;
+    }
+
+    rp1_spi_reg_write(spi, DW_SPI_SER, 1 << 0);
+
+    uint32_t inbyte = 0;
+    while ((rp1_spi_reg_read(spi, DW_SPI_SR) & DW_SPI_SR_TF_NOT_FULL) && (txcount > 0))
+    {
+        rp1_spi_reg_write(spi, DW_SPI_DR, 0x00);
+        txcount--;
+        if (rp1_spi_reg_read(spi, DW_SPI_SR) & DW_SPI_SR_RF_NOT_EMPT)
+        {
+            data[inbyte] = (uint8_t)rp1_spi_reg_read(spi, DW_SPI_DR);
+            inbyte++;
+        }
+    }
+
+    while (inbyte < len)
+    {
+        if (rp1_spi_reg_read(spi, DW_SPI_SR) & DW_SPI_SR_RF_NOT_EMPT)
+        {
+            data[inbyte] = (uint8_t)rp1_spi_reg_read(spi, DW_SPI_DR);
+            inbyte++;
+        }
+    }
+
+    return SPI_OK;
+}
+
+typedef enum {
+    PATH_LEGACY,
+    PATH_TRANSFER_8,
+    PATH_TRANSFER_PACKED32,
+    PATH_TRANSFER_IRQ,
+    PATH_TRANSFER_HYBRID
+} bench_path_t;
+
+static const char *path_names[] = {"legacy-sr-poll", "transfer-8", "transfer-packed32", "transfer-8-irq", "transfer-8-hybrid"};
+
+static bool bench_one(bench_path_t path, uint32_t baudr, uint32_t len, uint8_t *tx, uint8_t *rx)
+{
+    rp1_spi_sim_t *sim;
+    rp1_spi_instance_t *spi;
+
+    if (!rp1_spi_sim_create(NULL, &sim))
+        return false;
+    rp1_spi_sim_slave_t slave = {.exchange = echo_exchange};
+    rp1_spi_sim_set_slave(sim, 0, &slave);
+    if (!rp1_spi_create_sim(sim, &spi))
+        return false;
+
+    rp1_spi_device_config_t cfg = {.cs = 0, .mode = 1, .bits = 8, .hz = RP1_CLK_SYS_HZ / baudr};
+    rp1_spi_device_t dev;
+    if (!rp1_spi_device_init(&dev, spi, &cfg))
+        return false;
+    rp1_spi_device_select(&dev);
+    rp1_spi_set_frame_packing(spi, path == PATH_TRANSFER_PACKED32);
+
+    // the interrupt path sleeps on an eventfd that the model signals
+    int irq_fd = -1;
+    if (path == PATH_TRANSFER_IRQ)
+    {
+        irq_fd = eventfd(0, 0);
+        if (irq_fd < 0)
+            return false;
+        rp1_spi_sim_set_irq_fd(sim, irq_fd);
+        rp1_spi_enable_irq(spi, irq_fd, false);
+    }
+    if (path == PATH_TRANSFER_HYBRID)
+        rp1_spi_set_wait(spi, RP1_SPI_WAIT_HYBRID, BENCH_SPIN_NS);
+
+    memset(rx, 0, len);
+    rp1_spi_sim_reset_stats(sim);
+    uint64_t start = rp1_spi_sim_now(sim);
+
+    spi_status_t res;
+    if (path == PATH_LEGACY)
+        res = legacy_read_8_n(spi, rx, len);
+    else
+        res = rp1_spi_transfer(spi, tx, rx, len, 0);
+
+    uint64_t elapsed = rp1_spi_sim_now(sim) - start;
+    rp1_spi_sim_stats_t stats;
+    rp1_spi_sim_get_stats(sim, &stats);
+
+    // the legacy loop only sends zeros
+    bool ok = (res == SPI_OK);
+    for (uint32_t i = 0; ok && i < len; i++)
+        ok = rx[i] == (uint8_t)~(path == PATH_LEGACY ? 0 : tx[i]);
+
+    printf("%-18s %5.1f %7u %9.3f %9.3f %11.1f %8.3f %s\n", path_names[path], 200.0 / baudr, len,
+           (double)stats.reads / len, (double)stats.writes / len,
+           elapsed / 1000.0, len * 1000.0 / elapsed, ok ? "ok" : "BAD DATA");
+
+    if (path == PATH_TRANSFER_HYBRID)
+    {
+        rp1_spi_wait_stats_t wait;
+        rp1_spi_get_wait_stats(spi, &wait, false);
+        printf("%-18s sleeps %llu (%.1f us), spinning %.1f us, empty polls %llu of %llu\n", "",
+               (unsigned long long)wait.sleeps, wait.sleep_ns / 1000.0, wait.spin_ns / 1000.0,
+               (unsigned long long)wait.empty_polls, (unsigned long long)wait.polls);
+    }
+
+    if (irq_fd >= 0)
+        close(irq_fd);
+    rp1_spi_destroy(spi);
+    rp1_spi_sim_destroy(sim);
+
+    return ok;
+}
+
+// the echo slave, counting the times it was selected
+typedef struct
+{
+    uint32_t selects;
+} bench_dma_slave_t;
+
+static void bench_dma_select(void *ctx, bool selected, uint64_t now_ns)
+{
+    if (selected)
+        ((bench_dma_slave_t *)ctx)->selects++;
+}
+
+static const char *cs_names[] = {"auto", "override", "gpio"};
+
+// a transfer moved by the DMA controller model, with each way of driving CS - the data must come
+// back whole, under one select. Longer than a block, the SSI can't keep its own CS asserted
+// between blocks, so that transfer must be refused; so must frames other than 8 bits
+static bool bench_dma(rp1_spi_cs_control_t control, uint8_t bits, uint32_t len, const uint8_t *tx)
+{
+    rp1_spi_sim_t *sim;
+    rp1_dma_sim_t *dma_sim;
+    rp1_spi_instance_t *spi;
+    rp1_dma_t *dma;
+    rp1_dma_buf_t txbuf, rxbuf;
+
+    if (!rp1_spi_sim_create(NULL, &sim) || !rp1_dma_sim_create(sim, &dma_sim))
+        return false;
+    bench_dma_slave_t counts = {0};
+    rp1_spi_sim_slave_t slave = {.ctx = &counts, .select = bench_dma_select, .exchange = echo_exchange};
+    rp1_spi_sim_set_slave(sim, 0, &slave);
+    if (!rp1_spi_create_sim(sim, &spi) || !rp1_dma_create_sim(dma_sim, &dma) ||
+        !rp1_dma_buf_alloc(dma, len, &txbuf) || !rp1_dma_buf_alloc(dma, len, &rxbuf))
+        return false;
+
+    rp1_spi_device_config_t cfg = {.cs = 0, .mode = 1, .bits = bits, .hz = RP1_CLK_SYS_HZ / BENCH_BAUDR};
+    rp1_spi_device_t dev;
+    if (!rp1_spi_device_init(&dev, spi, &cfg) || !rp1_spi_set_cs_control(spi, NULL, control) ||
+        rp1_spi_device_select(&dev) != SPI_OK)
+        return false;
+
+    memcpy(txbuf.virt, tx, len);
+    uint64_t start = rp1_spi_sim_now(sim);
+
+    rp1_spi_dma_xfer_t xfer;
+    spi_status_t res = rp1_spi_dma_start(spi, dma, &txbuf, &rxbuf, len, &xfer);
+    if (res == SPI_OK)
+        res = rp1_spi_dma_wait(&xfer, 1000);
+
+    uint64_t elapsed = rp1_spi_sim_now(sim) - start;
+
+    bool refused = bits != 8 || (len > RP1_SPI_DMA_MAX_BLOCK && control == RP1_SPI_CS_AUTO);
+    bool ok;
+    if (refused)
+    {
+        ok = res == SPI_INVALID && counts.selects == 0;
+    }
+    else
+    {
+        ok = res == SPI_OK && counts.selects == 1;
+        const uint8_t *rx = (const uint8_t *)rxbuf.virt;
+        for (uint32_t i = 0; ok && i < len; i++)
+            ok = rx[i] == (uint8_t)~tx[i];
+    }
+
+    printf("%-18s %4u %7u %7u %11.1f %8.3f %s\n", cs_names[control], bits, len, counts.selects, elapsed / 1000.0,
+           refused ? 0.0 : len * 1000.0 / elapsed, !ok ? "BAD DATA" : refused ? "refused" : "ok");
+
+    rp1_dma_buf_free(dma, &txbuf);
+    rp1_dma_buf_free(dma, &rxbuf);
+    rp1_dma_destroy(dma);
+    rp1_spi_destroy(spi);
+    rp1_dma_sim_destroy(dma_sim);
+    rp1_spi_sim_destroy(sim);
+
+    return ok;
+}
+
+// CMD_READ_ENCODERS and its 32 byte reply from the pico model, either as a command write
+// followed by a read, or as one write_then_read transaction
+static bool bench_command(bool single)
+{
+    rp1_spi_sim_t *sim;
+    rp1_spi_instance_t *spi;
+    rp1_spi_sim_pico_t pico;
+
+    if (!rp1_spi_sim_create(NULL, &sim))
+        return false;
+    rp1_spi_sim_pico_init(&pico);
+    rp1_spi_sim_pico_attach(&pico, sim, 0);
+    if (!rp1_spi_create_sim(sim, &spi))
+        return false;
+
+    rp1_spi_device_config_t cfg = {.cs = 0, .mode = 1, .bits = 8, .hz = 10000000};
+    rp1_spi_device_t dev;
+    if (!rp1_spi_device_init(&dev, spi, &cfg))
+        return false;
+    rp1_spi_device_select(&dev);
+
+    uint8_t cmd = CMD_READ_ENCODERS;
+    uint8_t reply[SIM_PICO_ENCODER_BYTES];
+    memset(reply, 0, sizeof(reply));
+    rp1_spi_sim_reset_stats(sim);
+    uint64_t start = rp1_spi_sim_now(sim);
+
+    spi_status_t res;
+    if (single)
+    {
+        res = rp1_spi_write_then_read(spi, &cmd, 1, reply, sizeof(reply), 0);
+    }
+    else
+    {
+        res = rp1_spi_write_8_blocking(spi, cmd);
+        if (res == SPI_OK)
+            res = rp1_spi_read_8_n_blocking(spi, reply, sizeof(reply), 0);
+    }
+
+    uint64_t elapsed = rp1_spi_sim_now(sim) - start;
+    rp1_spi_sim_stats_t stats;
+    rp1_spi_sim_get_stats(sim, &stats);
+
+    bool ok = (res == SPI_OK) && memcmp(reply, pico.encoders, sizeof(reply)) == 0;
+    printf("%-18s %7llu %7llu %11.1f %s\n", single ? "write_then_read" : "write, read",
+           (unsigned long long)stats.reads, (unsigned long long)stats.writes, elapsed / 1000.0, ok ? "ok" : "BAD DATA");
+
+    rp1_spi_destroy(spi);
+    rp1_spi_sim_destroy(sim);
+
+    return ok;
+}
+
+// CMD_READ_ENCODERS repeated by an acquisition thread while this one consumes the samples
+// every sample taken is either consumed or counted as dropped, and the data must be intact
+// the model runs faster than real time, so a consumer that can't keep up is to be expected
+static bool bench_stream(uint64_t period_ns)
+{
+    rp1_spi_sim_t *sim;
+    rp1_spi_instance_t *spi;
+    rp1_spi_sim_pico_t pico;
+    rp1_spi_stream_t *stream;
+
+    if (!rp1_spi_sim_create(NULL, &sim))
+        return false;
+    rp1_spi_sim_pico_init(&pico);
+    rp1_spi_sim_pico_attach(&pico, sim, 0);
+    if (!rp1_spi_create_sim(sim, &spi))
+        return false;
+
+    rp1_spi_device_config_t cfg = {.cs = 0, .mode = 1, .bits = 8, .hz = 10000000};
+    rp1_spi_device_t dev;
+    if (!rp1_spi_device_init(&dev, spi, &cfg))
+        return false;
+
+    uint8_t cmd = CMD_READ_ENCODERS;
+    rp1_spi_stream_config_t scfg = {.device = &dev, .cmd = &cmd, .cmd_len = 1, .len = SIM_PICO_ENCODER_BYTES, .period_ns = period_ns};
+    if (!rp1_spi_stream_create(&scfg, 64, &stream) || !rp1_spi_stream_start(stream))
+        return false;
+
+    bool ok = true;
+    uint64_t consumed = 0;
+    uint64_t next_seq = 0;
+    uint64_t gaps = 0;
+    uint64_t start = rp1_spi_sim_now(sim);
+    rp1_spi_stream_stats_t stats = {0};
+
+    while (stats.acquired < BENCH_STREAM_SAMPLES || rp1_spi_stream_available(stream) != 0)
+    {
+        if (stats.acquired >= BENCH_STREAM_SAMPLES)
+            rp1_spi_stream_stop(stream);
+
+        uint32_t n = rp1_spi_stream_available(stream);
+        for (uint32_t i = 0; i < n; i++)
+        {
+            const rp1_spi_sample_t *sample = rp1_spi_stream_peek(stream, i);
+            ok &= sample->status == SPI_OK && memcmp(sample->data, pico.encoders, SIM_PICO_ENCODER_BYTES) == 0;
+            gaps += sample->seq - next_seq;
+            next_seq = sample->seq + 1;
+            consumed++;
+        }
+        rp1_spi_stream_release(stream, n);
+        rp1_spi_stream_get_stats(stream, &stats);
+        if (n == 0)
+            sched_yield();
+    }
+    rp1_spi_stream_stop(stream);
+    rp1_spi_stream_get_stats(stream, &stats);
+    uint64_t elapsed = rp1_spi_sim_now(sim) - start;
+
+    // samples dropped after the last one consumed leave no gap behind them
+    gaps += stats.acquired - next_seq;
+    ok &= consumed + stats.dropped == stats.acquired && gaps == stats.dropped;
+
+    printf("%-18s %9.1f %8llu %8llu %8llu %10.1f %s\n", period_ns != 0 ? "periodic" : "back to back", period_ns / 1000.0,
+           (unsigned long long)consumed, (unsigned long long)stats.dropped, (unsigned long long)stats.late,
+           stats.acquired * 1e9 / elapsed, ok ? "ok" : "BAD DATA");
+
+    rp1_spi_stream_destroy(stream);
+    rp1_spi_destroy(spi);
+    rp1_spi_sim_destroy(sim);
+
+    return ok;
+}
+
+// encoders read at 10kHz from the pico on CS0, and a 256 byte block at 1kHz from a device on CS1
+// run with and without the block, which holds up some of the encoder reads
+static bool bench_sched(bool block)
+{
+    rp1_spi_sim_t *sim;
+    rp1_spi_instance_t *spi;
+    rp1_spi_sim_pico_t pico;
+    rp1_spi_sched_t *sched;
+
+    if (!rp1_spi_sim_create(NULL, &sim))
+        return false;
+    rp1_spi_sim_pico_init(&pico);
+    rp1_spi_sim_pico_attach(&pico, sim, 0);
+    rp1_spi_sim_slave_t slave = {.exchange = echo_exchange};
+    rp1_spi_sim_set_slave(sim, 1, &slave);
+    if (!rp1_spi_create_sim(sim, &spi) || !rp1_spi_sched_create(spi, 2, &sched))
+        return false;
+
+    rp1_spi_device_config_t pico_cfg = {.cs = 0, .mode = 1, .bits = 8, .hz = 10000000};
+    rp1_spi_device_config_t block_cfg = {.cs = 1, .mode = 0, .bits = 8, .hz = 10000000};
+    rp1_spi_device_t pico_dev, block_dev;
+    rp1_spi_device_init(&pico_dev, spi, &pico_cfg);
+    rp1_spi_device_init(&block_dev, spi, &block_cfg);
+
+    // the command, then zeros to clock the reply in
+    uint8_t cmd[1 + SIM_PICO_ENCODER_BYTES] = {CMD_READ_ENCODERS};
+    uint8_t reply[1 + SIM_PICO_ENCODER_BYTES];
+    uint8_t block_rx[256];
+    rp1_spi_txn_t encoders = {.device = &pico_dev, .tx = cmd, .rx = reply, .len = sizeof(cmd)};
+    rp1_spi_txn_t bulk = {.device = &block_dev, .rx = block_rx, .len = sizeof(block_rx)};
+    rp1_spi_sched_task_config_t encoders_cfg = {.period_ns = 100000, .priority = 2};
+    rp1_spi_sched_task_config_t bulk_cfg = {.period_ns = 1000000, .offset_ns = 30000, .priority = 1};
+
+    bool ok = rp1_spi_sched_add(sched, NULL, &encoders, &encoders_cfg) == 0;
+    if (block)
+        ok &= rp1_spi_sched_add(sched, NULL, &bulk, &bulk_cfg) == 1;
+    rp1_spi_sched_run(sched, BENCH_SCHED_RELEASES);
+    ok &= memcmp(reply + 1, pico.encoders, SIM_PICO_ENCODER_BYTES) == 0;
+
+    // one snapshot for every task's histograms
+    rp1_spi_latency_snapshot_t snap;
+    for (uint32_t i = 0; i < sched->count; i++)
+    {
+        rp1_spi_sched_stats_t stats;
+        rp1_spi_sched_get_stats(sched, (int)i, &snap, &stats);
+        ok &= stats.errors == 0;
+        printf("%-18s %8llu %6llu %7llu %9.1f %9.1f %9.1f %9.1f %s\n", i == 0 ? "encoders 10kHz" : "block 1kHz",
+               (unsigned long long)stats.releases, (unsigned long long)stats.misses, (unsigned long long)stats.skipped,
+               stats.jitter_p99_ns / 1000.0, stats.jitter_max_ns / 1000.0,
+               stats.latency_p99_ns / 1000.0, stats.latency_max_ns / 1000.0, ok ? "ok" : "BAD DATA");
+    }
+
+    rp1_spi_sched_destroy(sched);
+    rp1_spi_destroy(spi);
+    rp1_spi_sim_destroy(sim);
+
+    return ok;
+}
+
+// two picos on one bus, their crystals off by different amounts, each synced in turn every
+// 5ms or so. The drift found should match the model's, and both clocks converted from the same
+// host time should land on what the picos read then - give or take the constant midpoint bias
+static bool bench_clock(void)
+{
+    rp1_spi_sim_t *sim;
+    rp1_spi_instance_t *spi;
+    rp1_spi_sim_pico_t picos[2];
+    rp1_spi_device_t devs[2];
+    rp1_spi_clock_t *clocks[2];
+    const int32_t drift[2] = {40, -25};
+    const int64_t offset[2] = {123456789, 3000000};
+
+    if (!rp1_spi_sim_create(NULL, &sim))
+        return false;
+    if (!rp1_spi_create_sim(sim, &spi))
+        return false;
+    for (int i = 0; i < 2; i++)
+    {
+        rp1_spi_sim_pico_init(&picos[i]);
+        picos[i].drift_ppm = drift[i];
+        picos[i].time_offset_us = offset[i];
+        rp1_spi_sim_pico_attach(&picos[i], sim, (uint8_t)i);
+
+        rp1_spi_device_config_t cfg = {.cs = (uint8_t)i, .mode = 1, .bits = 8, .hz = 10000000};
+        if (!rp1_spi_device_init(&devs[i], spi, &cfg) || !rp1_spi_clock_create(&devs[i], 10, &clocks[i]))
+            return false;
+    }
+
+    // the spacing varies a little, so the microsecond ticks fall at different points of the exchanges
+    // halfway through, one reading from the first pico comes back 2ms behind - it must be dropped,
+    // not taken for a wrap of its clock
+    srand(1);
+    bool ok = true;
+    for (uint32_t n = 0; n < BENCH_CLOCK_SYNCS; n++)
+    {
+        for (int i = 0; i < 2; i++)
+        {
+            bool glitch = i == 0 && n == BENCH_CLOCK_SYNCS / 2;
+            picos[i].time_offset_us -= glitch ? 2000 : 0;
+            ok &= rp1_spi_clock_sync(clocks[i]) == (glitch ? SPI_ERROR : SPI_OK);
+            picos[i].time_offset_us += glitch ? 2000 : 0;
+        }
+        rp1_spi_sim_advance(sim, 4500000 + (uint64_t)(rand() % 1000000));
+    }
+
+    uint64_t now = rp1_spi_sim_now(sim);
+    double error[2];
+    for (int i = 0; i < 2; i++)
+    {
+        rp1_spi_clock_stats_t stats;
+        rp1_spi_clock_get_stats(clocks[i], &stats);
+
+        // the pico's count is the microsecond it is in, its clock is halfway through that
+        uint64_t truth = rp1_spi_sim_pico_time_us(&picos[i], now) * 1000ull + 500;
+        error[i] = (double)(int64_t)(rp1_spi_clock_to_device_ns(clocks[i], now) - truth);
+        ok &= stats.failures == 0 && stats.rejected == (i == 0 ? 1 : 0) && stats.drift_ppm > drift[i] - 2 && stats.drift_ppm < drift[i] + 2 &&
+              error[i] > -5000 && error[i] < 5000;
+
+        printf("pico on CS%d        %8d %8.2f %6u %9.1f %9.1f\n", i, drift[i], stats.drift_ppm,
+               stats.used, stats.residual_ns, error[i]);
+    }
+    // the bias is the same for both, so it drops out between them
+    ok &= error[0] - error[1] > -1000 && error[0] - error[1] < 1000;
+    printf("%-18s %8s %8s %6s %9s %9.1f %s\n", "CS0 against CS1", "", "", "", "", error[0] - error[1], ok ? "ok" : "BAD FIT");
+
+    for (int i = 0; i < 2; i++)
+        rp1_spi_clock_destroy(clocks[i]);
+    rp1_spi_destroy(spi);
+    rp1_spi_sim_destroy(sim);
+
+    return ok;
+}
+
+typedef enum
+{
+    FRAME_LEGACY,
+    FRAME_CALL,
+    FRAME_POLL
+} bench_frame_t;
+
+static const char *frame_names[] = {"command byte", "framed call", "framed poll"};
+
+// the encoders read over and over, with the one byte command and with each framed read, on a clean
+// line and with every nth transaction corrupted - the framed reads must come back intact every time
+// the model takes the firmware's turnaround to stage each reply, gap is the host's wait for it between
+// transactions - with a gap shorter than that every transaction is expected to overrun, and be lost
+static bool bench_frame(bench_frame_t mode, uint32_t hz, uint32_t corrupt_every, uint32_t gap_ns)
+{
+    rp1_spi_sim_t *sim;
+    rp1_spi_instance_t *spi;
+    rp1_spi_sim_pico_t pico;
+    rp1_spi_pico_t *link;
+
+    if (!rp1_spi_sim_create(NULL, &sim))
+        return false;
+    rp1_spi_sim_pico_init(&pico);
+    pico.corrupt_every = corrupt_every;
+    pico.turnaround_ns = RP1_SPI_PICO_TURNAROUND_NS;
+    rp1_spi_sim_pico_attach(&pico, sim, 0);
+    if (!rp1_spi_create_sim(sim, &spi))
+        return false;
+
+    rp1_spi_device_config_t cfg = {.cs = 0, .mode = 1, .bits = 8, .hz = hz};
+    rp1_spi_device_t dev;
+    if (!rp1_spi_device_init(&dev, spi, &cfg) || rp1_spi_device_select(&dev) != SPI_OK ||
+        !rp1_spi_pico_create(&dev, 10, &link))
+        return false;
+    rp1_spi_pico_set_turnaround(link, gap_ns);
+    rp1_spi_set_frame_packing(spi, true);
+
+    bool ok = true;
+    uint32_t lost = 0;
+    uint8_t cmd = CMD_READ_ENCODERS;
+    uint8_t data[SIM_PICO_ENCODER_BYTES];
+    uint64_t start = rp1_spi_sim_now(sim);
+    for (uint32_t i = 0; i < BENCH_FRAME_READS; i++)
+    {
+        spi_status_t res;
+        memset(data, 0, sizeof(data));
+        if (mode == FRAME_LEGACY)
+            res = rp1_spi_write_then_read(spi, &cmd, 1, data, sizeof(data), 10);
+        else if (mode == FRAME_CALL)
+            res = rp1_spi_pico_call(link, cmd, NULL, 0, data, sizeof(data));
+        else
+            res = rp1_spi_pico_poll(link, cmd, data, sizeof(data));
+        if (res == SPI_BAD_FRAME)
+            lost++;
+        else
+            ok &= res == SPI_OK && memcmp(data, pico.encoders, sizeof(data)) == 0;
+    }
+    uint64_t elapsed = rp1_spi_sim_now(sim) - start;
+
+    // reset, the pico must take command bytes again - a reset request of its own corrupted or
+    // overrun is not taken, as with the firmware
+    if (mode != FRAME_LEGACY && corrupt_every == 0 && gap_ns >= RP1_SPI_PICO_TURNAROUND_NS)
+    {
+        memset(data, 0, sizeof(data));
+        ok &= rp1_spi_pico_reset(link) == SPI_OK && !pico.framed;
+        ok &= rp1_spi_write_then_read(spi, &cmd, 1, data, sizeof(data), 10) == SPI_OK &&
+              memcmp(data, pico.encoders, sizeof(data)) == 0;
+    }
+
+    // a reply may only go missing when transactions came too quickly for the pico, and then all do
+    rp1_spi_pico_stats_t stats;
+    rp1_spi_pico_get_stats(link, &stats);
+    bool overrun = mode != FRAME_LEGACY && gap_ns < RP1_SPI_PICO_TURNAROUND_NS;
+    ok &= (pico.corrupted != 0) == (corrupt_every != 0);
+    if (overrun)
+        ok &= lost == BENCH_FRAME_READS && pico.overruns != 0;
+    else
+        ok &= lost == 0;
+
+    printf("%-18s %4u %6u %5.1f %5.1f %5.1f %8u %8u %6u %8llu %7llu %7llu %8.2f %s\n", frame_names[mode], hz / 1000000, corrupt_every,
+           pico.turnaround_ns / 1000.0, gap_ns / 1000.0, pico.min_idle_ns / 1000.0, pico.corrupted, pico.overruns, lost,
+           (unsigned long long)stats.transactions, (unsigned long long)stats.retries, (unsigned long long)stats.naks,
+           elapsed / 1000.0 / BENCH_FRAME_READS, !ok ? "BAD DATA" : overrun ? "expected overrun" : "ok");
+
+    rp1_spi_pico_destroy(link);
+    rp1_spi_destroy(spi);
+    rp1_spi_sim_destroy(sim);
+
+    return ok;
+}
+
+static uint64_t wall_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+typedef enum {
+    GPIO_PER_PIN,     // one write a pin, as pin_on() / pin_off()
+    GPIO_TOGGLE,      // the whole group through the XOR alias
+    GPIO_WRITE,       // a count on the group, some pins up and some down in the one write
+    GPIO_READ_PER_PIN,
+    GPIO_READ
+} bench_gpio_t;
+
+static const char *gpio_names[] = {"per pin", "port toggle", "port write", "read per pin", "port read"};
+static const uint8_t gpio_pins[] = {17, 27, 22, 23};
+
+// four pins changed or read together on the GPIO model - the skew is the time between the first
+// pin of the group changing and the last, or for the reads, between the first and last sample
+static bool bench_gpio(bench_gpio_t mode)
+{
+    rp1_spi_sim_t *clock;
+    rp1_gpio_sim_t *sim;
+    rp1_gpio_port_t *port;
+    uint32_t mask = 0;
+    const uint32_t n = sizeof(gpio_pins);
+
+    for (uint32_t i = 0; i < n; i++)
+        mask |= 1u << gpio_pins[i];
+
+    if (!rp1_spi_sim_create(NULL, &clock) || !rp1_gpio_sim_create(clock, &sim) ||
+        !rp1_gpio_port_create_sim(sim, mask, &port))
+        return false;
+
+    bool reads = mode >= GPIO_READ_PER_PIN;
+    if (reads)
+        rp1_gpio_port_inputs(port, mask);
+    else
+        rp1_gpio_port_outputs(port, mask, 0);
+
+    bool ok = true;
+    uint64_t skew = 0;
+    rp1_gpio_sim_stats_t before, after;
+    rp1_gpio_sim_get_stats(sim, &before);
+    uint64_t start = rp1_gpio_sim_now(sim);
+
+    for (uint32_t op = 1; op <= BENCH_GPIO_OPS; op++)
+    {
+        // the pins spell out the count, all four changing on the odd ones in the toggle modes
+        uint32_t levels = 0;
+        for (uint32_t i = 0; i < n; i++)
+        {
+            bool bit = mode == GPIO_WRITE || reads ? (op >> i) & 1 : op & 1;
+            levels |= (uint32_t)bit << gpio_pins[i];
+        }
+
+        uint64_t first = UINT64_MAX, last = 0;
+        if (reads)
+        {
+            for (uint32_t i = 0; i < n; i++)
+                rp1_gpio_sim_drive(sim, gpio_pins[i], (levels >> gpio_pins[i]) & 1);
+
+            uint32_t seen = 0;
+            if (mode == GPIO_READ)
+            {
+                first = last = rp1_gpio_sim_now(sim);
+                seen = rp1_gpio_port_read(port);
+            }
+            else
+            {
+                for (uint32_t i = 0; i < n; i++)
+                {
+                    uint64_t t = rp1_gpio_sim_now(sim);
+                    first = t < first ? t : first;
+                    last = t;
+                    seen |= rp1_gpio_port_read(port) & (1u << gpio_pins[i]);
+                }
+            }
+            ok &= seen == levels;
+        }
+        else
+        {
+            uint32_t was = rp1_gpio_sim_levels(sim);
+            if (mode == GPIO_PER_PIN)
+            {
+                for (uint32_t i = 0; i < n; i++)
+                {
+                    uint32_t bit = 1u << gpio_pins[i];
+                    if (levels & bit)
+                        rp1_gpio_port_set(port, bit);
+                    else
+                        rp1_gpio_port_clear(port, bit);
+                }
+            }
+            else if (mode == GPIO_TOGGLE)
+            {
+                rp1_gpio_port_toggle(port, mask);
+            }
+            else
+            {
+                rp1_gpio_port_write(port, mask, levels);
+            }
+
+            uint32_t now = rp1_gpio_sim_levels(sim);
+            ok &= (now & mask) == levels;
+            for (uint32_t i = 0; i < n; i++)
+            {
+                if (!((was ^ now) & (1u << gpio_pins[i])))
+                    continue;
+                uint64_t t = rp1_gpio_sim_changed_ns(sim, gpio_pins[i]);
+                first = t < first ? t : first;
+                last = t > last ? t : last;
+            }
+        }
+        if (last > first && last - first > skew)
+            skew = last - first;
+    }
+
+    uint64_t elapsed = rp1_gpio_sim_now(sim) - start;
+    rp1_gpio_sim_get_stats(sim, &after);
+    uint64_t accesses = after.reads - before.reads + after.writes - before.writes;
+
+    printf("%-18s %5u %10.2f %8.1f %9.3f %8llu %s\n", gpio_names[mode], n, (double)accesses / BENCH_GPIO_OPS,
+           (double)elapsed / BENCH_GPIO_OPS, BENCH_GPIO_OPS * 1000.0 / elapsed, (unsigned long long)skew,
+           ok ? "ok" : "BAD DATA");
+
+    rp1_gpio_port_destroy(port);
+    rp1_gpio_sim_destroy(sim);
+    rp1_spi_sim_destroy(clock);
+
+    return ok;
+}
+
+// 16 bit transactions in mode 0 at 250kHz, one every period - all the changes on a 500ns grid, and
+// the ones on different pins either together or at least 1us apart
+typedef struct
+{
+    uint64_t t0;     // the first transaction starts
+    uint64_t period;
+} bench_bus_t;
+
+static uint32_t bench_bus_levels(void *ctx, uint64_t now_ns)
+{
+    const bench_bus_t *bus = (const bench_bus_t *)ctx;
+
+    uint32_t levels = 1u << BENCH_CAPTURE_CS;
+    if (now_ns < bus->t0)
+        return levels;
+
+    uint64_t frame = (now_ns - bus->t0) / bus->period;
+    uint64_t ft = (now_ns - bus->t0) % bus->period;
+    if (ft >= 66000)
+        return levels;
+
+    levels = 0;
+    if (ft >= 1000 && ft < 65000)
+    {
+        uint32_t bit = (uint32_t)(ft - 1000) / 4000;
+        uint32_t word = (uint32_t)(frame * 0x9D + 0x35A7) & 0xFFFF;
+        if ((word >> (15 - bit)) & 1)
+            levels |= 1u << BENCH_CAPTURE_MOSI;
+        if ((ft - 1000) % 4000 >= 2000)
+            levels |= 1u << BENCH_CAPTURE_SCLK;
+    }
+    return levels;
+}
+
+typedef struct
+{
+    const char *name;
+    rp1_gpio_trigger_t trigger;
+    uint32_t trigger_mask;
+    uint32_t trigger_levels;
+    uint32_t pretrigger;
+    uint64_t trigger_ns;  // when the bus meets the trigger condition first
+    uint64_t period_ns;   // between transactions
+    uint64_t duration_ns;
+    rp1_gpio_capture_format_t format;
+} bench_capture_t;
+
+// a capture of the SPI0 pins against the model, streamed to a file from this thread as it runs -
+// every record must match the bus at its time, and no change of the bus may be missing
+static bool bench_capture(const bench_capture_t *b)
+{
+    rp1_spi_sim_t *clock;
+    rp1_gpio_sim_t *sim;
+    rp1_gpio_port_t *port;
+    rp1_gpio_capture_t *capture;
+    uint32_t mask = (1u << BENCH_CAPTURE_CS) | (1u << BENCH_CAPTURE_MISO) | (1u << BENCH_CAPTURE_MOSI) | (1u << BENCH_CAPTURE_SCLK);
+    bench_bus_t bus = {.t0 = BENCH_CAPTURE_IDLE_NS, .period = b->period_ns};
+
+    if (!rp1_spi_sim_create(NULL, &clock) || !rp1_gpio_sim_create(clock, &sim) ||
+        !rp1_gpio_port_create_sim(sim, mask, &port))
+        return false;
+    rp1_gpio_port_inputs(port, mask);
+    rp1_gpio_sim_set_source(sim, mask, bench_bus_levels, &bus);
+
+    rp1_gpio_capture_config_t cfg = {.port = port, .depth = 1u << 16, .duration_ns = b->duration_ns, .trigger = b->trigger,
+                                     .trigger_mask = b->trigger_mask, .trigger_levels = b->trigger_levels,
+                                     .pretrigger = b->pretrigger};
+    FILE *f = tmpfile();
+    if (f == NULL || !rp1_gpio_capture_create(&cfg, &capture) || !rp1_gpio_capture_start(capture))
+        return false;
+
+    bool ok = true;
+    while (!rp1_gpio_capture_done(capture))
+    {
+        ok &= rp1_gpio_capture_save(capture, f, b->format);
+        sched_yield();
+    }
+    rp1_gpio_capture_stop(capture);
+    ok &= rp1_gpio_capture_save(capture, f, b->format);
+
+    rp1_gpio_capture_stats_t stats;
+    rp1_gpio_capture_get_stats(capture, &stats);
+    long size = ftell(f);
+    rewind(f);
+
+    // the file back, checked against the bus
+    uint64_t records = 0, triggers = 0;
+    if (b->format == RP1_GPIO_CAPTURE_BINARY)
+    {
+        uint8_t header[24];
+        ok &= fread(header, 1, sizeof(header), f) == sizeof(header) && memcmp(header, "RP1GPIO1", 8) == 0;
+        uint64_t t = stats.start_ns;
+        rp1_gpio_edge_t edge;
+        while (fread(&edge, sizeof(edge), 1, f) == 1)
+        {
+            t += edge.run_ns;
+            ok &= (edge.levels & ~RP1_GPIO_CAPTURE_TRIGGER) == bench_bus_levels(&bus, t);
+            if (edge.levels & RP1_GPIO_CAPTURE_TRIGGER)
+            {
+                triggers++;
+                ok &= t == stats.trigger_ns;
+            }
+            records++;
+        }
+    }
+    else
+    {
+        // one timestamp for every record after the first
+        char line[128];
+        while (fgets(line, sizeof(line), f) != NULL)
+        {
+            if (line[0] == '#' && strcmp(line, "#0\n") != 0)
+                records++;
+            if (strcmp(line, "1~\n") == 0)
+                triggers++;
+        }
+        records++;
+    }
+    fclose(f);
+
+    // the changes the bus made over the capture, stepping finer than any two of them are apart
+    uint64_t changes = 1;
+    uint32_t was = bench_bus_levels(&bus, stats.start_ns);
+    for (uint64_t t = stats.start_ns + 250; t <= stats.end_ns; t += 250)
+    {
+        uint32_t levels = bench_bus_levels(&bus, t);
+        changes += levels != was;
+        was = levels;
+    }
+    ok &= records == stats.edges && records == changes && triggers == 1 && !stats.full;
+
+    // a trigger fires on the first read after the bus meets it
+    if (b->trigger != RP1_GPIO_TRIGGER_NONE)
+        ok &= stats.trigger_ns >= b->trigger_ns && stats.trigger_ns < b->trigger_ns + 1000;
+
+    uint64_t elapsed = stats.end_ns - stats.start_ns;
+    printf("%-18s %8.3f %9llu %8llu %6.2f %10ld %8.1f %s\n", b->name, elapsed / 1e9, (unsigned long long)stats.samples,
+           (unsigned long long)stats.edges, stats.samples * 1000.0 / (stats.end_ns - stats.start_ns + 1), size,
+           stats.samples * 4.0 / size, ok ? "ok" : "BAD DATA");
+
+    rp1_gpio_capture_destroy(capture);
+    rp1_gpio_port_destroy(port);
+    rp1_gpio_sim_destroy(sim);
+    rp1_spi_sim_destroy(clock);
+
+    return ok;
+}
+
+typedef enum {
+    DRDY_BACK_TO_BACK, // CMD_READ_ENCODERS as often as the bus allows
+    DRDY_PERIODIC,     // as often as the pico takes readings, out of step with it
+    DRDY_POLLED,       // on DRDY, polled through RIO_SYNC_IN
+    DRDY_THREAD        // the same, from the acquisition thread
+} bench_drdy_t;
+
+// the pico's encoders read without DRDY and with it - each reading carries its number, which
+// says whether it was read before, was missed, and how old it was by the end of the read
+static bool bench_drdy(bench_drdy_t mode)
+{
+    static const char *names[] = {"back to back", "periodic", "DRDY", "DRDY, thread"};
+    rp1_spi_sim_t *sim;
+    rp1_spi_instance_t *spi;
+    rp1_spi_sim_pico_t pico;
+    rp1_gpio_sim_t *gpio;
+    rp1_gpio_port_t *port;
+    rp1_spi_stream_t *stream;
+    rp1_spi_latency_t *latency;
+    rp1_spi_latency_t *age;
+
+    if (!rp1_spi_sim_create(NULL, &sim) || !rp1_gpio_sim_create(sim, &gpio) ||
+        !rp1_gpio_port_create_sim(gpio, 1u << BENCH_DRDY_PIN, &port) || !rp1_spi_create_sim(sim, &spi) ||
+        !rp1_spi_latency_create(&latency) || !rp1_spi_latency_create(&age))
+        return false;
+    rp1_spi_sim_pico_init(&pico);
+    pico.sample_ns = BENCH_DRDY_SAMPLE_NS;
+    rp1_spi_sim_pico_attach(&pico, sim, 0);
+    rp1_spi_sim_pico_attach_drdy(&pico, gpio, BENCH_DRDY_PIN);
+    rp1_gpio_port_inputs(port, 1u << BENCH_DRDY_PIN);
+
+    rp1_spi_device_config_t cfg = {.cs = 0, .mode = 1, .bits = 8, .hz = 10000000};
+    rp1_spi_device_t dev;
+    if (!rp1_spi_device_init(&dev, spi, &cfg))
+        return false;
+
+    uint8_t cmd = CMD_READ_ENCODERS;
+    rp1_spi_stream_config_t scfg = {.device = &dev, .cmd = &cmd, .cmd_len = 1, .len = SIM_PICO_ENCODER_BYTES,
+                                    .period_ns = mode == DRDY_PERIODIC ? BENCH_DRDY_SAMPLE_NS : 0, .timeout = 10};
+    rp1_spi_stream_drdy_t drdy = {.port = port, .fd = -1, .pin = BENCH_DRDY_PIN, .latency = latency};
+    // room for the whole run, so the thread's samples are all there to check however late this thread gets to them
+    if (!rp1_spi_stream_create(&scfg, 2 * BENCH_DRDY_READINGS, &stream) || (mode >= DRDY_POLLED && !rp1_spi_stream_set_drdy(stream, &drdy)))
+        return false;
+
+    // the periodic reads start halfway through a reading, where reads out of step land on average
+    rp1_spi_sim_advance(sim, BENCH_DRDY_SAMPLE_NS * 3 / 2 - rp1_spi_sim_now(sim) % BENCH_DRDY_SAMPLE_NS);
+    uint64_t start = rp1_spi_sim_now(sim);
+    uint64_t end = start + BENCH_DRDY_READINGS * BENCH_DRDY_SAMPLE_NS;
+    if (mode == DRDY_THREAD && !rp1_spi_stream_start(stream))
+        return false;
+
+    bool ok = true;
+    bool first = true;
+    uint32_t last = 0;
+    uint64_t next_seq = 0;
+    uint64_t gaps = 0;
+    uint64_t readings = 0, repeats = 0, missed = 0, busy = 0;
+    rp1_spi_stream_stats_t stats = {0};
+
+    // a sample is counted before it is published, so the thread is stopped before the ring is drained for the last time
+    while (mode == DRDY_THREAD ? stream->running || rp1_spi_stream_available(stream) != 0 : rp1_spi_sim_now(sim) < end)
+    {
+        if (mode != DRDY_THREAD)
+            rp1_spi_stream_acquire(stream);
+        else if (stats.acquired >= BENCH_DRDY_READINGS)
+            rp1_spi_stream_stop(stream);
+
+        uint32_t n = rp1_spi_stream_available(stream);
+        for (uint32_t i = 0; i < n; i++)
+        {
+            const rp1_spi_sample_t *sample = rp1_spi_stream_peek(stream, i);
+            uint32_t reading;
+            memcpy(&reading, sample->data, sizeof(reading));
+            ok &= sample->status == SPI_OK && memcmp(sample->data + 4, pico.encoders + 4, SIM_PICO_ENCODER_BYTES - 4) == 0;
+
+            // with DRDY each transaction is for the next reading, whether or not its sample was dropped
+            if (mode >= DRDY_POLLED && !first)
+                ok &= reading - last == sample->seq - (next_seq - 1);
+            gaps += sample->seq - next_seq;
+
+            if (!first && reading == last)
+                repeats++;
+            else
+                readings++;
+            if (!first && reading > last + 1)
+                missed += reading - last - 1;
+            first = false;
+            last = reading;
+            next_seq = sample->seq + 1;
+
+            busy += sample->end_ns - sample->start_ns;
+            rp1_spi_latency_record(age, sample->end_ns - (uint64_t)reading * BENCH_DRDY_SAMPLE_NS);
+
+            // DRDY seen within a read of going high, and the reading it announced read
+            if (mode >= DRDY_POLLED)
+                ok &= sample->ready_ns / BENCH_DRDY_SAMPLE_NS == reading && sample->ready_ns % BENCH_DRDY_SAMPLE_NS < 1000;
+        }
+        rp1_spi_stream_release(stream, n);
+        rp1_spi_stream_get_stats(stream, &stats);
+        if (mode == DRDY_THREAD && n == 0)
+            sched_yield();
+    }
+    rp1_spi_stream_stop(stream);
+    rp1_spi_stream_get_stats(stream, &stats);
+    uint64_t elapsed = rp1_spi_sim_now(sim) - start;
+
+    // with DRDY every reading is read once - the only gaps are samples the consumer let the ring drop,
+    // and those dropped after the last one consumed leave no gap behind them
+    gaps += stats.acquired - next_seq;
+    ok &= gaps == stats.dropped;
+    if (mode >= DRDY_POLLED)
+        ok &= repeats == 0 && stats.timeouts == 0;
+
+    rp1_spi_latency_snapshot_t ages, lat;
+    rp1_spi_latency_snapshot(age, &ages);
+    rp1_spi_latency_snapshot(latency, &lat);
+    printf("%-18s %6llu %8llu %7llu %6llu %6.2f %6.1f %8.1f %8.1f", names[mode], (unsigned long long)stats.acquired,
+           (unsigned long long)readings, (unsigned long long)repeats, (unsigned long long)missed,
+           (double)stats.acquired / readings, busy * 100.0 / elapsed, rp1_spi_latency_percentile(&ages, 50) / 1000.0,
+           ages.max_ns / 1000.0);
+    if (mode >= DRDY_POLLED)
+        printf(" %8.1f %8.1f", rp1_spi_latency_percentile(&lat, 99) / 1000.0, lat.max_ns / 1000.0);
+    else
+        printf(" %8s %8s", "-", "-");
+    printf(" %s\n", ok ? "ok" : "BAD DATA");
+
+    rp1_spi_stream_destroy(stream);
+    rp1_spi_latency_destroy(latency);
+    rp1_spi_latency_destroy(age);
+    rp1_gpio_port_destroy(port);
+    rp1_gpio_sim_destroy(gpio);
+    rp1_spi_destroy(spi);
+    rp1_spi_sim_destroy(sim);
+
+    return ok;
+}
+
+// DRDY as edge events, written to a pipe the way the kernel reports them on a line request for
+// the active edge. Each batch is the edges queued by the time the stream waits - 3, 7, 8 and 9
+// the kernel had no room for, 5 came while a transaction ran - then one edge of the other kind,
+// which isn't data ready and must run out the wait
+static bool bench_drdy_events(bool active_low)
+{
+    static const uint32_t batches[][2] = {{1, 0}, {2, 0}, {4, 0}, {5, 6}, {10, 0}, {11, 0}};
+    const uint32_t nbatches = sizeof(batches) / sizeof(batches[0]);
+    const uint64_t expect_missed = 5;
+    rp1_spi_sim_t *sim;
+    rp1_spi_instance_t *spi;
+    rp1_spi_sim_pico_t pico;
+    rp1_spi_stream_t *stream;
+    int fds[2];
+
+    if (!rp1_spi_sim_create(NULL, &sim) || !rp1_spi_create_sim(sim, &spi) || pipe(fds) != 0)
+        return false;
+    rp1_spi_sim_pico_init(&pico);
+    rp1_spi_sim_pico_attach(&pico, sim, 0);
+
+    rp1_spi_device_config_t cfg = {.cs = 0, .mode = 1, .bits = 8, .hz = 10000000};
+    rp1_spi_device_t dev;
+    if (!rp1_spi_device_init(&dev, spi, &cfg))
+        return false;
+    uint8_t cmd = CMD_READ_ENCODERS;
+    rp1_spi_stream_config_t scfg = {.device = &dev, .cmd = &cmd, .cmd_len = 1, .len = SIM_PICO_ENCODER_BYTES, .timeout = 10};
+    rp1_spi_stream_drdy_t drdy = {.port = NULL, .fd = fds[0], .pin = BENCH_DRDY_PIN, .active_low = active_low};
+    if (!rp1_spi_stream_create(&scfg, 16, &stream) || !rp1_spi_stream_set_drdy(stream, &drdy))
+        return false;
+
+    uint32_t active = active_low ? GPIO_V2_LINE_EVENT_FALLING_EDGE : GPIO_V2_LINE_EVENT_RISING_EDGE;
+    uint32_t other = active_low ? GPIO_V2_LINE_EVENT_RISING_EDGE : GPIO_V2_LINE_EVENT_FALLING_EDGE;
+    bool ok = true;
+    uint32_t events = 0;
+    for (uint32_t b = 0; b <= nbatches; b++)
+    {
+        // stamped on the model's clock, so the time from DRDY to the end of the read is real
+        struct gpio_v2_line_event ev[2];
+        uint32_t n = 0;
+        memset(ev, 0, sizeof(ev));
+        for (uint32_t i = 0; b < nbatches && i < 2 && batches[b][i] != 0; i++, n++)
+        {
+            ev[n].timestamp_ns = rp1_spi_sim_now(sim) + n;
+            ev[n].id = active;
+            ev[n].offset = BENCH_DRDY_PIN;
+            ev[n].seqno = ev[n].line_seqno = batches[b][i];
+        }
+        if (b == nbatches)
+        {
+            ev[n].timestamp_ns = rp1_spi_sim_now(sim);
+            ev[n].id = other;
+            ev[n].offset = BENCH_DRDY_PIN;
+            n++;
+        }
+        if (write(fds[1], ev, n * sizeof(ev[0])) != (ssize_t)(n * sizeof(ev[0])))
+            return false;
+        events += n;
+
+        // the sample is for the last edge of the batch
+        bool taken = rp1_spi_stream_acquire(stream);
+        ok &= taken == (b < nbatches);
+        if (taken)
+        {
+            const rp1_spi_sample_t *sample = rp1_spi_stream_peek(stream, 0);
+            ok &= sample->status == SPI_OK && sample->ready_ns == ev[n - 1].timestamp_ns;
+            rp1_spi_stream_release(stream, 1);
+        }
+    }
+
+    rp1_spi_stream_stats_t stats;
+    rp1_spi_stream_get_stats(stream, &stats);
+    ok &= stats.acquired == nbatches && stats.missed == expect_missed && stats.timeouts == 1;
+
+    printf("%-18s %6u %8llu %6llu %8llu %s\n", active_low ? "falling" : "rising", events, (unsigned long long)stats.acquired,
+           (unsigned long long)stats.missed, (unsigned long long)stats.timeouts, ok ? "ok" : "BAD DATA");
+
+    rp1_spi_stream_destroy(stream);
+    close(fds[0]);
+    close(fds[1]);
+    rp1_spi_destroy(spi);
+    rp1_spi_sim_destroy(sim);
+
+    return ok;
+}
+
+typedef struct
+{
+    pi_pico_log_t log;
+    _Atomic bool done;
+} bench_log_t;
+
+// the pico's SPI core - numbered events in bursts of half the ring, whether or not there is room
+static void *bench_log_producer(void *arg)
+{
+    bench_log_t *b = (bench_log_t *)arg;
+
+    for (uint32_t i = 0; i < BENCH_LOG_EVENTS; i++)
+    {
+        pi_pico_log_push(&b->log, i * 3, (uint16_t)i, i);
+        if (i % (PI_PICO_LOG_DEPTH / 2) == PI_PICO_LOG_DEPTH / 2 - 1)
+            sched_yield();
+    }
+    atomic_store(&b->done, true);
+
+    return NULL;
+}
+
+// the log ring of the pico firmware, built for the host with a thread each side - every event
+// must come out once and in order, and every gap must be counted, in the ring and in the next event
+static bool bench_log(bool slow)
+{
+    static bench_log_t b;
+    pthread_t thread;
+
+    pi_pico_log_init(&b.log);
+    atomic_store(&b.done, false);
+
+    uint64_t t0 = wall_ns();
+    if (pthread_create(&thread, NULL, bench_log_producer, &b) != 0)
+        return false;
+
+    bool ok = true;
+    uint32_t next = 0;
+    uint64_t popped = 0;
+    pi_pico_log_entry_t entry;
+    while (true)
+    {
+        // done is read first, so nothing pushed before it was set can be missed
+        bool done = atomic_load(&b.done);
+        if (!pi_pico_log_pop(&b.log, &entry))
+        {
+            if (done)
+                break;
+            sched_yield();
+            continue;
+        }
+
+        uint32_t gap = entry.arg - next;
+        ok &= entry.arg >= next && entry.dropped == (gap < 0xFFFF ? gap : 0xFFFF) &&
+              entry.event == (uint16_t)entry.arg && entry.time_us == entry.arg * 3;
+        next = entry.arg + 1;
+        popped++;
+
+        if (slow && popped % BENCH_LOG_SLOW_EVERY == 0)
+            nanosleep(&(struct timespec){.tv_nsec = 1000000}, NULL);
+    }
+    pthread_join(thread, NULL);
+    uint64_t wall = wall_ns() - t0;
+
+    uint32_t dropped = pi_pico_log_dropped(&b.log);
+    ok &= popped + dropped == BENCH_LOG_EVENTS && pi_pico_log_pending(&b.log) == 0;
+
+    printf("%-18s %8u %8llu %8u %9.1f %s\n", slow ? "slow consumer" : "log ring", BENCH_LOG_EVENTS,
+           (unsigned long long)popped, dropped, BENCH_LOG_EVENTS * 1000.0 / wall, ok ? "ok" : "BAD DATA");
+
+    return ok;
+}
+
+// every controller has its own model, so the virtual times are independent - the aggregate
+// is the bytes moved over the longest of them. Wall time shows whether the host kept up
+static bool bench_multi(uint8_t count, const uint8_t *tx, uint8_t *rx)
+{
+    rp1_spi_sim_t *sims[RP1_SPI_MULTI_MAX];
+    rp1_spi_multi_t *multi;
+    rp1_spi_sim_slave_t slave = {.exchange = echo_exchange};
+    int cpus[RP1_SPI_MULTI_MAX];
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    bool ok = true;
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        if (!rp1_spi_sim_create(NULL, &sims[i]))
+            return false;
+        rp1_spi_sim_set_slave(sims[i], 0, &slave);
+        cpus[i] = (int)(i % (ncpu > 0 ? ncpu : 1));
+    }
+    if (!rp1_spi_multi_create_sim(sims, count, BENCH_MULTI_TXNS, &multi))
+        return false;
+
+    uint64_t start[RP1_SPI_MULTI_MAX];
+    rp1_spi_device_t devs[RP1_SPI_MULTI_MAX];
+    rp1_spi_device_config_t cfg = {.cs = 0, .mode = 0, .bits = 8, .hz = RP1_CLK_SYS_HZ / BENCH_BAUDR};
+    for (uint8_t i = 0; i < count; i++)
+    {
+        rp1_spi_instance_t *spi = multi->spis[i];
+        rp1_spi_device_init(&devs[i], spi, &cfg);
+        rp1_spi_set_frame_packing(spi, true);
+        start[i] = rp1_spi_sim_now(sims[i]);
+    }
+
+    uint64_t t0 = wall_ns();
+    rp1_spi_multi_start(multi, cpus);
+
+    // each controller gets its own slice of rx
+    for (uint32_t n = 0; n < BENCH_MULTI_TXNS; n++)
+    {
+        for (uint8_t i = 0; i < count; i++)
+        {
+            rp1_spi_txn_t txn = {.device = &devs[i], .tx = tx, .rx = rx + (size_t)i * BENCH_MULTI_LEN, .len = BENCH_MULTI_LEN};
+            rp1_spi_queue_submit(multi->queues[i], &txn, NULL);
+        }
+    }
+
+    rp1_spi_completion_t done[BENCH_MULTI_TXNS];
+    for (uint8_t i = 0; i < count; i++)
+    {
+        uint32_t reaped = 0;
+        while (reaped < BENCH_MULTI_TXNS)
+        {
+            uint32_t n = rp1_spi_queue_reap(multi->queues[i], done, BENCH_MULTI_TXNS);
+            for (uint32_t j = 0; j < n; j++)
+                ok &= done[j].status == SPI_OK;
+            reaped += n;
+            if (n == 0)
+                sched_yield();
+        }
+    }
+    uint64_t wall = wall_ns() - t0;
+    rp1_spi_multi_stop(multi);
+
+    uint64_t longest = 0;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        uint64_t elapsed = rp1_spi_sim_now(sims[i]) - start[i];
+        if (elapsed > longest)
+            longest = elapsed;
+        for (uint32_t j = 0; ok && j < BENCH_MULTI_LEN; j++)
+            ok = rx[(size_t)i * BENCH_MULTI_LEN + j] == (uint8_t)~tx[j];
+    }
+
+    double bytes = (double)count * BENCH_MULTI_TXNS * BENCH_MULTI_LEN;
+    printf("%-18s %5u %9.3f %9.3f %s\n", "multi-packed32", count, bytes * 1000.0 / longest, bytes * 1000.0 / wall, ok ? "ok" : "BAD DATA");
+
+    rp1_spi_multi_destroy(multi);
+    for (uint8_t i = 0; i < count; i++)
+        rp1_spi_sim_destroy(sims[i]);
+
+    return ok;
+}
+
+int main(void)
+{
+    const uint32_t lens[] = {4, 32, 64, 256, 4096, 65536};
+    uint8_t *tx = malloc(65536);
+    uint8_t *rx = malloc(65536);
+    bool ok = true;
+
+    if (tx == NULL || rx == NULL)
+        return 1;
+    for (int i = 0; i < 65536; i++)
+        tx[i] = (uint8_t)(i * 13 + 7);
+
+    printf("simulated SSI, SCLK %d MHz, line rate %.3f MB/s\n\n", 200 / BENCH_BAUDR, 200.0 / BENCH_BAUDR / 8);
+    printf("%-18s %5s %7s %9s %9s %11s %8s\n", "path", "MHz", "bytes", "reads/B", "writes/B", "time us", "MB/s");
+
+    for (int p = PATH_LEGACY; p <= PATH_TRANSFER_HYBRID; p++)
+    {
+        for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++)
+        {
+            // the legacy loop hangs on anything longer than the fifo
+            if (p == PATH_LEGACY && lens[i] > 64)
+                continue;
+            ok &= bench_one((bench_path_t)p, BENCH_BAUDR, lens[i], tx, rx);
+        }
+    }
+
+    // at a low SCLK a spinning transfer spends nearly all of its round trips on an empty FIFO
+    printf("\n");
+    for (int p = PATH_TRANSFER_8; p <= PATH_TRANSFER_HYBRID; p++)
+    {
+        if (p != PATH_TRANSFER_PACKED32)
+            ok &= bench_one((bench_path_t)p, BENCH_BAUDR_SLOW, 4096, tx, rx);
+    }
+
+    // moved by the DMA controller, within one block and across several
+    printf("\n%-18s %4s %7s %7s %11s %8s\n", "dma, CS", "bits", "bytes", "selects", "time us", "MB/s");
+    ok &= bench_dma(RP1_SPI_CS_AUTO, 8, 4096, tx);
+    ok &= bench_dma(RP1_SPI_CS_AUTO, 16, 4096, tx);
+    for (int c = RP1_SPI_CS_AUTO; c <= RP1_SPI_CS_GPIO; c++)
+        ok &= bench_dma((rp1_spi_cs_control_t)c, 8, 65536, tx);
+
+    // a command byte and the pico's reply
+    printf("\n%-18s %7s %7s %11s\n", "CMD_READ_ENCODERS", "reads", "writes", "time us");
+    ok &= bench_command(false);
+    ok &= bench_command(true);
+
+    // the same, repeated by an acquisition thread into a ring
+    printf("\n%-18s %9s %8s %8s %8s %10s\n", "CMD_READ_ENCODERS", "period us", "samples", "dropped", "late", "taken/s");
+    ok &= bench_stream(0);
+    ok &= bench_stream(100000);
+
+    // on a fixed period, with release jitter and deadline misses
+    printf("\n%-18s %8s %6s %7s %9s %9s %9s %9s\n", "task, times in us", "releases", "misses", "skipped",
+           "jit p99", "jit max", "lat p99", "lat max");
+    ok &= bench_sched(false);
+    ok &= bench_sched(true);
+
+    // the pico's clock, as seen from the host
+    printf("\n%-18s %8s %8s %6s %9s %9s\n", "clock, times in ns", "ppm", "fit ppm", "pairs", "residual", "error");
+    ok &= bench_clock();
+
+    // the encoders, framed and checked, on a clean line and a noisy one
+    printf("\n%-18s %4s %6s %5s %5s %5s %8s %8s %6s %8s %7s %7s %8s\n", "CMD_READ_ENCODERS", "MHz", "1 in n", "turn", "gap",
+           "idle", "corrupt", "overruns", "lost", "txns", "retries", "naks", "us/read");
+    ok &= bench_frame(FRAME_LEGACY, 10000000, 0, 0);
+    for (int m = FRAME_CALL; m <= FRAME_POLL; m++)
+    {
+        ok &= bench_frame((bench_frame_t)m, 10000000, 0, RP1_SPI_PICO_TURNAROUND_NS);
+        ok &= bench_frame((bench_frame_t)m, 10000000, 20, RP1_SPI_PICO_TURNAROUND_NS);
+    }
+
+    // back to back at the top SCLK, against the time the pico's CS interrupt takes to rearm its DMA
+    ok &= bench_frame(FRAME_POLL, 25000000, 0, 0);
+    ok &= bench_frame(FRAME_POLL, 25000000, 0, RP1_SPI_PICO_TURNAROUND_NS);
+    ok &= bench_frame(FRAME_POLL, 25000000, 20, RP1_SPI_PICO_TURNAROUND_NS);
+
+    // the pico's log, from the SPI core to the one that prints
+    printf("\n%-18s %8s %8s %8s %9s\n", "log events", "pushed", "popped", "dropped", "Mev/s");
+    ok &= bench_log(false);
+    ok &= bench_log(true);
+
+    // a group of outputs changed and a group of inputs read, a pin at a time and as a port
+    printf("\n%-18s %5s %10s %8s %9s %8s\n", "gpio", "pins", "access/op", "ns/op", "Mop/s", "skew ns");
+    for (int m = GPIO_PER_PIN; m <= GPIO_READ; m++)
+        ok &= bench_gpio((bench_gpio_t)m);
+
+    // the SPI0 pins captured as edges, against raw samples of 4 bytes
+    const bench_capture_t captures[] = {
+        {"free run", RP1_GPIO_TRIGGER_NONE, 0, 0, 0, 0, 100000, 20000000, RP1_GPIO_CAPTURE_BINARY},
+        {"CS falling", RP1_GPIO_TRIGGER_FALLING, 1u << BENCH_CAPTURE_CS, 0, 16, BENCH_CAPTURE_IDLE_NS, 100000, 20000000, RP1_GPIO_CAPTURE_BINARY},
+        {"CS low, SCLK high", RP1_GPIO_TRIGGER_LEVEL, (1u << BENCH_CAPTURE_CS) | (1u << BENCH_CAPTURE_SCLK),
+         1u << BENCH_CAPTURE_SCLK, 4, BENCH_CAPTURE_IDLE_NS + 3000, 100000, 20000000, RP1_GPIO_CAPTURE_VCD},
+        {"2s, 1kHz", RP1_GPIO_TRIGGER_FALLING, 1u << BENCH_CAPTURE_CS, 0, 0, BENCH_CAPTURE_IDLE_NS, 1000000, 2000000000, RP1_GPIO_CAPTURE_BINARY},
+    };
+    printf("\n%-18s %8s %9s %8s %6s %10s %8s\n", "capture, trigger", "s", "samples", "edges", "MS/s", "file", "vs raw");
+    for (size_t i = 0; i < sizeof(captures) / sizeof(captures[0]); i++)
+        ok &= bench_capture(&captures[i]);
+
+    // the encoders read when the pico says there is a new reading, against guessing when
+    printf("\n%-18s %6s %8s %7s %6s %6s %6s %8s %8s %8s %8s\n", "encoders, us", "txns", "readings", "repeats", "missed",
+           "txn/rd", "bus %", "age p50", "age max", "rdy p99", "rdy max");
+    for (int m = DRDY_BACK_TO_BACK; m <= DRDY_THREAD; m++)
+        ok &= bench_drdy((bench_drdy_t)m);
+
+    // the same line as the kernel's edge events, missed edges told by their numbers
+    printf("\n%-18s %6s %8s %6s %8s\n", "DRDY events, edge", "events", "samples", "missed", "timeouts");
+    ok &= bench_drdy_events(true);
+    ok &= bench_drdy_events(false);
+
+    // one queue and service thread per controller
+    printf("\n%-18s %5s %9s %9s\n", "path", "spis", "MB/s", "wall MB/s");
+    for (uint8_t n = 1; n <= RP1_SPI_MULTI_MAX; n++)
+        ok &= bench_multi(n, tx, rx);
+
+    free(tx);
+    free(rx);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,149 @@
+/*
+    Checks of the pico's log ring, pi_pico_log.h, run on the host
+    2024 March
+    Praktronics
+    GPL3
+
+    the firmware's core 0 can't afford to find out on the bench that the ring loses or reorders
+    events, so the edge cases are checked here: filling it, wrapping round it and round the 32 bit
+    indices, counting what a full ring drops and saturating that count in the entry
+
+    /rpi5-rp1-spi/build/bin $ ./rpi5-rp1-spi-logtest
+
+    prints one line per check and exits 1 if any failed
+
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "pi_pico_log.h"
+
+static bool check(const char *name, bool ok)
+{
+    printf("%-44s %s\n", name, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+// pops one event and compares it with what was pushed as number n
+static bool pop_expect(pi_pico_log_t *log, uint32_t n, uint16_t dropped)
+{
+    pi_pico_log_entry_t entry;
+    return pi_pico_log_pop(log, &entry) && entry.time_us == n * 10 && entry.event == (uint16_t)n &&
+           entry.arg == ~n && entry.dropped == dropped;
+}
+
+static bool push_n(pi_pico_log_t *log, uint32_t n)
+{
+    return pi_pico_log_push(log, n * 10, (uint16_t)n, ~n);
+}
+
+// events pushed and taken in uneven batches, several times round the ring
+static bool test_order(uint32_t start)
+{
+    pi_pico_log_t log;
+    pi_pico_log_init(&log);
+    atomic_store(&log.head, start);
+    atomic_store(&log.tail, start);
+
+    bool ok = true;
+    uint32_t pushed = 0;
+    uint32_t popped = 0;
+    for (uint32_t batch = 1; pushed < 5 * PI_PICO_LOG_DEPTH + 7; batch = batch * 3 % (PI_PICO_LOG_DEPTH - 1) + 1)
+    {
+        for (uint32_t i = 0; i < batch; i++)
+            ok &= push_n(&log, pushed++);
+        ok &= pi_pico_log_pending(&log) == pushed - popped;
+        while (popped < pushed)
+            ok &= pop_expect(&log, popped++, 0);
+    }
+
+    pi_pico_log_entry_t entry;
+    return ok && !pi_pico_log_pop(&log, &entry) && pi_pico_log_dropped(&log) == 0;
+}
+
+// a full ring takes no more, and gives back everything it did take
+static bool test_full(void)
+{
+    pi_pico_log_t log;
+    pi_pico_log_init(&log);
+
+    bool ok = true;
+    for (uint32_t n = 0; n < PI_PICO_LOG_DEPTH; n++)
+        ok &= push_n(&log, n);
+    ok &= pi_pico_log_pending(&log) == PI_PICO_LOG_DEPTH;
+    ok &= !push_n(&log, PI_PICO_LOG_DEPTH);
+    ok &= pi_pico_log_pending(&log) == PI_PICO_LOG_DEPTH && pi_pico_log_dropped(&log) == 1;
+
+    for (uint32_t n = 0; n < PI_PICO_LOG_DEPTH; n++)
+        ok &= pop_expect(&log, n, 0);
+
+    return ok && pi_pico_log_pending(&log) == 0;
+}
+
+// events dropped go out with the next one that makes it, and only with that one
+static bool test_drops(void)
+{
+    pi_pico_log_t log;
+    pi_pico_log_init(&log);
+
+    bool ok = true;
+    uint32_t n = 0;
+    uint32_t total = 0;
+    for (uint32_t drops = 1; drops <= 3; drops++)
+    {
+        uint32_t first = n;
+        for (uint32_t i = 0; i < PI_PICO_LOG_DEPTH; i++)
+            ok &= push_n(&log, n++);
+        for (uint32_t i = 0; i < drops; i++)
+            ok &= !push_n(&log, n);
+        total += drops;
+
+        // what went in before the drops knows nothing of them
+        while (first < n)
+            ok &= pop_expect(&log, first++, 0);
+
+        ok &= push_n(&log, n) && push_n(&log, n + 1);
+        ok &= pop_expect(&log, n, (uint16_t)drops);
+        ok &= pop_expect(&log, n + 1, 0);
+        n += 2;
+    }
+
+    return ok && pi_pico_log_dropped(&log) == total;
+}
+
+// the count in an entry stops at 0xFFFF, the running total doesn't
+static bool test_saturation(void)
+{
+    pi_pico_log_t log;
+    pi_pico_log_init(&log);
+
+    bool ok = true;
+    for (uint32_t n = 0; n < PI_PICO_LOG_DEPTH; n++)
+        ok &= push_n(&log, n);
+    for (uint32_t i = 0; i < 0x10005; i++)
+        ok &= !push_n(&log, PI_PICO_LOG_DEPTH);
+
+    pi_pico_log_entry_t entry;
+    while (pi_pico_log_pop(&log, &entry))
+        ;
+    ok &= push_n(&log, PI_PICO_LOG_DEPTH) && push_n(&log, PI_PICO_LOG_DEPTH + 1);
+    ok &= pop_expect(&log, PI_PICO_LOG_DEPTH, 0xFFFF);
+    ok &= pop_expect(&log, PI_PICO_LOG_DEPTH + 1, 0);
+
+    return ok && pi_pico_log_dropped(&log) == 0x10005;
+}
+
+int main()
+{
+    bool ok = true;
+
+    ok &= check("order, batches round the ring", test_order(0));
+    ok &= check("order, across the 32 bit index wrap", test_order(UINT32_MAX - 2 * PI_PICO_LOG_DEPTH - 3));
+    ok &= check("full ring", test_full());
+    ok &= check("dropped events counted in the next entry", test_drops());
+    ok &= check("dropped count saturating at 0xFFFF", test_saturation());
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,573 @@
+/*
+    Benchmark suite of the SPI transfer APIs, on the Pi or against the simulated SSI
+    2024 March
+    Praktronics
+    GPL3
+
+    runs each transfer API over a matrix of lengths, frame sizes, baud divisors and chip
+    select strategies, and writes one CSV row per case: throughput, p50 / p99 / p999 latency,
+    CPU time and register accesses per byte. Keep the output of a release and pass it back
+    with --baseline to have any case that got slower, or needs more bus transactions, reported
+
+    /rpi5-rp1-spi/build/bin $ ./rpi5-rp1-spi-suite > sim.csv
+    /rpi5-rp1-spi/build/bin $ sudo ./rpi5-rp1-spi-suite --hw --loopback > pi.csv
+    /rpi5-rp1-spi/build/bin $ ./rpi5-rp1-spi-suite --baseline sim.csv --tolerance 2
+
+    options
+    --hw                 run on SPI0 (or --spi n) of the RP1 instead of the model, needs root
+    --loopback           MOSI is wired to MISO, check what comes back on the Pi
+    --api a,b            transfer, write, read, write_then_read
+    --bits 8,16,32       frame sizes - the byte APIs run 32 as packed frames and skip 16
+    --len 1,4096         lengths in bytes
+    --baudr 4,10,200     divisors of the 200MHz clk_sys
+    --cs auto,override,gpio
+    --wait spin|hybrid
+    --iterations n       calls per case, otherwise enough for about --budget bytes (1MiB)
+    --baseline file      compare with an earlier run, exit 4 on a regression (1 if a case failed)
+    --tolerance pct      allowed change before a case counts as a regression, 5 by default
+
+    latency and throughput are in virtual time for the model, CPU time is always the host's
+    register accesses are counted by the driver itself (RP1_SPI_COUNT_ACCESSES), so they are
+    the same on the Pi
+
+*/
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "rp1-regs.h"
+#include "rp1-spi.h"
+#include "rp1-spi-io.h"
+#include "rp1-spi-sim.h"
+#include "rp1-spi-latency.h"
+
+#define SUITE_MAX_LEN 65536
+#define SUITE_MAX_VALUES 16
+#define SUITE_SPIN_NS 20000
+#define SUITE_TIMEOUT_MS 1000
+
+typedef enum {
+    API_TRANSFER,
+    API_WRITE,
+    API_READ,
+    API_WRITE_THEN_READ,
+    API_COUNT
+} suite_api_t;
+
+static const char *api_names[] = {"transfer", "write", "read", "write_then_read"};
+static const char *cs_names[] = {"auto", "override", "gpio"};
+static const char *wait_names[] = {"spin", "hybrid"};
+
+// a list of values for one axis of the matrix
+typedef struct
+{
+    uint32_t count;
+    uint32_t values[SUITE_MAX_VALUES];
+} suite_axis_t;
+
+typedef struct
+{
+    suite_axis_t apis;
+    suite_axis_t bits;
+    suite_axis_t lens;
+    suite_axis_t baudrs;
+    suite_axis_t cs;
+    rp1_spi_wait_t wait;
+    uint32_t iterations;
+    uint32_t budget;
+    bool hw;
+    bool loopback;
+    uint8_t spinum;
+} suite_options_t;
+
+// what the case runs against - a fresh model for every case, or the one controller on the Pi
+typedef struct
+{
+    rp1_t *rp1;
+    rp1_spi_sim_t *sim;
+    rp1_spi_instance_t *spi;
+} suite_target_t;
+
+typedef struct
+{
+    char key[96];
+    double mbps;
+    double reads_per_byte;
+    double writes_per_byte;
+} suite_baseline_row_t;
+
+typedef struct
+{
+    uint32_t count;
+    suite_baseline_row_t *rows;
+} suite_baseline_t;
+
+// the slave echoes each frame back inverted, so the data can be checked
+static uint32_t echo_exchange(void *ctx, uint32_t mosi, uint8_t bits, uint64_t now_ns)
+{
+    return ~mosi;
+}
+
+static uint64_t cpu_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static bool parse_axis(suite_axis_t *axis, char *arg, const char **names, uint32_t nnames)
+{
+    axis->count = 0;
+    for (char *tok = strtok(arg, ","); tok != NULL; tok = strtok(NULL, ","))
+    {
+        if (axis->count == SUITE_MAX_VALUES)
+            return false;
+
+        uint32_t i = 0;
+        if (names != NULL)
+        {
+            while (i < nnames && strcmp(tok, names[i]) != 0)
+                i++;
+            if (i == nnames)
+                return false;
+        }
+        else
+        {
+            char *end;
+            i = (uint32_t)strtoul(tok, &end, 0);
+            if (*end != '\0')
+                return false;
+        }
+        axis->values[axis->count++] = i;
+    }
+    return axis->count > 0;
+}
+
+static void set_axis(suite_axis_t *axis, const uint32_t *values, uint32_t count)
+{
+    memcpy(axis->values, values, count * sizeof(uint32_t));
+    axis->count = count;
+}
+
+static void *map_rp1(void)
+{
+    int fd = open("/dev/mem", O_RDWR | O_SYNC);
+    if (fd == -1)
+        return NULL;
+
+    void *mapped = mmap(0, RP1_BAR1_LEN, PROT_READ | PROT_WRITE, MAP_SHARED, fd, RP1_BAR1);
+    close(fd);
+
+    return mapped == MAP_FAILED ? NULL : mapped;
+}
+
+static void close_hw(suite_target_t *target)
+{
+    rp1_spi_destroy(target->spi);
+    if (target->rp1 != NULL)
+        munmap((void *)target->rp1->rp1_peripherial_base, RP1_BAR1_LEN);
+    free(target->rp1);
+    target->spi = NULL;
+    target->rp1 = NULL;
+}
+
+static bool open_hw(suite_target_t *target, uint8_t spinum)
+{
+    void *base = map_rp1();
+    if (base == NULL)
+        return false;
+
+    rp1_t *r = (rp1_t *)calloc(1, sizeof(rp1_t));
+    if (r == NULL)
+    {
+        munmap(base, RP1_BAR1_LEN);
+        return false;
+    }
+
+    r->rp1_peripherial_base = base;
+    r->gpio_base = base + RP1_IO_BANK0_BASE;
+    r->pads_base = base + RP1_PADS_BANK0_BASE;
+    r->rio_out = (volatile uint32_t *)(base + RP1_RIO0_BASE + RIO_OUT_OFFSET);
+    r->rio_output_enable = (volatile uint32_t *)(base + RP1_RIO0_BASE + RIO_OE_OFFSET);
+    r->rio_nosync_in = (volatile uint32_t *)(base + RP1_RIO0_BASE + RIO_NOSYNC_IN_OFFSET);
+    target->rp1 = r;
+
+    if (!rp1_spi_setup_pins(r, spinum, 1) || !rp1_spi_create(r, spinum, &target->spi))
+    {
+        close_hw(target);
+        return false;
+    }
+    return true;
+}
+
+static bool open_sim(suite_target_t *target)
+{
+    rp1_spi_sim_slave_t slave = {.exchange = echo_exchange};
+
+    if (!rp1_spi_sim_create(NULL, &target->sim))
+        return false;
+    rp1_spi_sim_set_slave(target->sim, 0, &slave);
+
+    return rp1_spi_create_sim(target->sim, &target->spi);
+}
+
+static void close_sim(suite_target_t *target)
+{
+    rp1_spi_destroy(target->spi);
+    rp1_spi_sim_destroy(target->sim);
+    target->spi = NULL;
+    target->sim = NULL;
+}
+
+// one call of the API under test, len bytes on the wire in frames of 'bits'
+static spi_status_t run_api(rp1_spi_instance_t *spi, suite_api_t api, uint8_t bits, const uint8_t *tx, uint8_t *rx, uint32_t len)
+{
+    uint32_t cmd_len = bits / 8;
+
+    switch (api)
+    {
+    case API_TRANSFER:
+        return rp1_spi_transfer_n(spi, tx, rx, len / (bits / 8), bits, SUITE_TIMEOUT_MS);
+    case API_WRITE:
+        return rp1_spi_write(spi, tx, len, SUITE_TIMEOUT_MS);
+    case API_READ:
+        return rp1_spi_read(spi, rx, len, SUITE_TIMEOUT_MS);
+    case API_WRITE_THEN_READ:
+        return rp1_spi_write_then_read(spi, tx, cmd_len, rx, len - cmd_len, SUITE_TIMEOUT_MS);
+    default:
+        return SPI_INVALID;
+    }
+}
+
+// what came back from the echo slave, or a loopback - nothing can be checked on an open bus,
+// and what MOSI does during a receive only transfer is up to the controller
+static bool check_rx(const suite_options_t *opt, suite_api_t api, uint8_t bits, const uint8_t *tx, const uint8_t *rx, uint32_t len)
+{
+    if (api == API_WRITE || (opt->hw && (!opt->loopback || api != API_TRANSFER)))
+        return true;
+
+    uint32_t rx_len = api == API_WRITE_THEN_READ ? len - bits / 8 : len;
+    for (uint32_t i = 0; i < rx_len; i++)
+    {
+        uint8_t sent = api == API_TRANSFER ? tx[i] : 0;
+        if (rx[i] != (opt->hw ? sent : (uint8_t)~sent))
+            return false;
+    }
+    return true;
+}
+
+// the cases where the axis values don't make sense together
+static bool case_valid(suite_api_t api, uint8_t bits, uint32_t len)
+{
+    if (len % (bits / 8) != 0)
+        return false;
+    // the byte APIs can only use 32 bit frames, by packing
+    if (api != API_TRANSFER && bits == 16)
+        return false;
+    // a command, and at least one byte of reply
+    if (api == API_WRITE_THEN_READ && len <= bits / 8)
+        return false;
+    return true;
+}
+
+static void case_key(char *key, size_t size, const char *target, suite_api_t api, uint8_t bits, uint32_t len,
+                     uint32_t baudr, rp1_spi_cs_control_t cs, rp1_spi_wait_t wait)
+{
+    snprintf(key, size, "%s,%s,%u,%u,%u,%s,%s", target, api_names[api], bits, len, baudr, cs_names[cs], wait_names[wait]);
+}
+
+static bool run_case(const suite_options_t *opt, suite_target_t *target, rp1_spi_latency_t *latency,
+                     suite_api_t api, uint8_t bits, uint32_t len, uint32_t baudr, rp1_spi_cs_control_t cs,
+                     const uint8_t *tx, uint8_t *rx, const suite_baseline_t *baseline, double tolerance, bool *regressed)
+{
+    if (!opt->hw && !open_sim(target))
+        return false;
+
+    rp1_spi_instance_t *spi = target->spi;
+    bool ok = true;
+
+    // the byte APIs move 32 bit frames by packing bytes into them
+    rp1_spi_device_config_t cfg = {.cs = 0, .mode = 0, .bits = (api == API_TRANSFER) ? bits : 8, .hz = RP1_CLK_SYS_HZ / baudr};
+    rp1_spi_device_t dev;
+    if (!rp1_spi_set_cs_control(spi, target->rp1, cs) || !rp1_spi_device_init(&dev, spi, &cfg) ||
+        rp1_spi_device_select(&dev) != SPI_OK)
+    {
+        fprintf(stderr, "unable to set up %s / %s\n", api_names[api], cs_names[cs]);
+        ok = false;
+        goto done;
+    }
+    rp1_spi_set_frame_packing(spi, api != API_TRANSFER && bits == 32);
+    rp1_spi_set_wait(spi, opt->wait, SUITE_SPIN_NS);
+
+    uint32_t iterations = opt->iterations;
+    if (iterations == 0)
+    {
+        iterations = opt->budget / len;
+        iterations = iterations < 10 ? 10 : iterations > 1000 ? 1000 : iterations;
+    }
+
+    // one call first, so the transfer mode and frame size are already set for the measured ones -
+    // rx is cleared before it, so a call that never writes it can't pass on what an earlier case left
+    memset(rx, 0, len);
+    uint32_t failed = 0;
+    uint32_t bad = 0;
+    if (run_api(spi, api, bits, tx, rx, len) != SPI_OK)
+        failed++;
+
+    rp1_spi_latency_reset(latency);
+    uint64_t reads = spi->reg_reads;
+    uint64_t writes = spi->reg_writes;
+    uint64_t cpu = cpu_ns();
+    uint64_t start = rp1_spi_now_ns(spi);
+
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        uint64_t t = rp1_spi_now_ns(spi);
+        spi_status_t res = run_api(spi, api, bits, tx, rx, len);
+        rp1_spi_latency_record(latency, rp1_spi_now_ns(spi) - t);
+
+        if (res != SPI_OK)
+            failed++;
+        else if (!check_rx(opt, api, bits, tx, rx, len))
+            bad++;
+    }
+
+    uint64_t elapsed = rp1_spi_now_ns(spi) - start;
+    cpu = cpu_ns() - cpu;
+    reads = spi->reg_reads - reads;
+    writes = spi->reg_writes - writes;
+
+    rp1_spi_latency_snapshot_t snap;
+    rp1_spi_latency_snapshot(latency, &snap);
+
+    double bytes = (double)len * iterations;
+    double mbps = elapsed != 0 ? bytes * 1000.0 / elapsed : 0;
+    char key[96];
+    case_key(key, sizeof(key), opt->hw ? "hw" : "sim", api, bits, len, baudr, cs, opt->wait);
+    ok = failed == 0 && bad == 0;
+
+    printf("%s,%u,%s,%.3f,%llu,%llu,%llu,%llu,%.1f,%.4f,%.4f\n", key, iterations,
+           failed != 0 ? "failed" : bad != 0 ? "bad_data" : "ok", mbps,
+           (unsigned long long)rp1_spi_latency_percentile(&snap, 50),
+           (unsigned long long)rp1_spi_latency_percentile(&snap, 99),
+           (unsigned long long)rp1_spi_latency_percentile(&snap, 99.9),
+           (unsigned long long)snap.max_ns, (double)cpu / iterations,
+           reads / bytes, writes / bytes);
+
+    // bus transactions are exact, throughput is allowed the tolerance
+    for (uint32_t i = 0; i < baseline->count; i++)
+    {
+        const suite_baseline_row_t *b = &baseline->rows[i];
+        if (strcmp(b->key, key) != 0)
+            continue;
+
+        double limit = 1.0 + tolerance / 100.0;
+        if (reads / bytes > b->reads_per_byte * limit + 1e-9 || writes / bytes > b->writes_per_byte * limit + 1e-9 ||
+            mbps * limit < b->mbps)
+        {
+            fprintf(stderr, "regression %s: %.3f MB/s (was %.3f), reads/B %.4f (was %.4f), writes/B %.4f (was %.4f)\n",
+                    key, mbps, b->mbps, reads / bytes, b->reads_per_byte, writes / bytes, b->writes_per_byte);
+            *regressed = true;
+        }
+        break;
+    }
+
+done:
+    if (opt->hw)
+        rp1_spi_set_cs_control(spi, target->rp1, RP1_SPI_CS_AUTO);
+    else
+        close_sim(target);
+
+    return ok;
+}
+
+// rows of an earlier run, keyed on the case columns
+static bool load_baseline(const char *path, suite_baseline_t *baseline)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return false;
+
+    char line[256];
+    uint32_t capacity = 0;
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        // the key is the first seven columns
+        char *p = line;
+        for (int i = 0; i < 7 && p != NULL; i++)
+        {
+            p = strchr(p, ',');
+            if (p != NULL)
+                p++;
+        }
+        if (line[0] == '#' || strncmp(line, "target,", 7) == 0 || p == NULL)
+            continue;
+
+        suite_baseline_row_t row;
+        size_t keylen = (size_t)(p - line - 1);
+        if (keylen >= sizeof(row.key))
+            continue;
+        memcpy(row.key, line, keylen);
+        row.key[keylen] = '\0';
+
+        unsigned iterations;
+        char status[16];
+        unsigned long long p50, p99, p999, max;
+        double cpu;
+        if (sscanf(p, "%u,%15[^,],%lf,%llu,%llu,%llu,%llu,%lf,%lf,%lf", &iterations, status, &row.mbps,
+                   &p50, &p99, &p999, &max, &cpu, &row.reads_per_byte, &row.writes_per_byte) != 10)
+            continue;
+
+        if (baseline->count == capacity)
+        {
+            capacity = capacity != 0 ? capacity * 2 : 256;
+            suite_baseline_row_t *rows = realloc(baseline->rows, capacity * sizeof(suite_baseline_row_t));
+            if (rows == NULL)
+                break;
+            baseline->rows = rows;
+        }
+        baseline->rows[baseline->count++] = row;
+    }
+
+    fclose(f);
+    return true;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [--hw [--spi n] [--loopback]] [--api list] [--bits list] [--len list] [--baudr list]\n"
+                    "       [--cs list] [--wait spin|hybrid] [--iterations n] [--budget bytes]\n"
+                    "       [--baseline file.csv [--tolerance pct]]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    static const uint32_t default_apis[] = {API_TRANSFER, API_WRITE, API_READ, API_WRITE_THEN_READ};
+    static const uint32_t default_bits[] = {8, 16, 32};
+    static const uint32_t default_lens[] = {1, 4, 16, 64, 256, 1024, 4096, 16384, 65536};
+    static const uint32_t default_baudrs[] = {4, 10, 200};
+    static const uint32_t default_cs[] = {RP1_SPI_CS_AUTO, RP1_SPI_CS_OVERRIDE, RP1_SPI_CS_GPIO};
+
+    suite_options_t opt = {.wait = RP1_SPI_WAIT_SPIN, .budget = 1 << 20};
+    suite_baseline_t baseline = {0};
+    double tolerance = 5.0;
+    bool args_ok = true;
+
+    set_axis(&opt.apis, default_apis, sizeof(default_apis) / sizeof(uint32_t));
+    set_axis(&opt.bits, default_bits, sizeof(default_bits) / sizeof(uint32_t));
+    set_axis(&opt.lens, default_lens, sizeof(default_lens) / sizeof(uint32_t));
+    set_axis(&opt.baudrs, default_baudrs, sizeof(default_baudrs) / sizeof(uint32_t));
+    set_axis(&opt.cs, default_cs, sizeof(default_cs) / sizeof(uint32_t));
+
+    for (int i = 1; i < argc && args_ok; i++)
+    {
+        const char *arg = argv[i];
+        char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (strcmp(arg, "--hw") == 0)
+            opt.hw = true;
+        else if (strcmp(arg, "--loopback") == 0)
+            opt.loopback = true;
+        else if (value == NULL)
+            args_ok = false;
+        else
+        {
+            i++;
+            if (strcmp(arg, "--spi") == 0)
+                opt.spinum = (uint8_t)atoi(value);
+            else if (strcmp(arg, "--api") == 0)
+                args_ok = parse_axis(&opt.apis, value, api_names, API_COUNT);
+            else if (strcmp(arg, "--bits") == 0)
+                args_ok = parse_axis(&opt.bits, value, NULL, 0);
+            else if (strcmp(arg, "--len") == 0)
+                args_ok = parse_axis(&opt.lens, value, NULL, 0);
+            else if (strcmp(arg, "--baudr") == 0)
+                args_ok = parse_axis(&opt.baudrs, value, NULL, 0);
+            else if (strcmp(arg, "--cs") == 0)
+                args_ok = parse_axis(&opt.cs, value, cs_names, 3);
+            else if (strcmp(arg, "--wait") == 0)
+            {
+                suite_axis_t wait;
+                args_ok = parse_axis(&wait, value, wait_names, 2) && wait.count == 1;
+                opt.wait = (rp1_spi_wait_t)wait.values[0];
+            }
+            else if (strcmp(arg, "--iterations") == 0)
+                opt.iterations = (uint32_t)atoi(value);
+            else if (strcmp(arg, "--budget") == 0)
+                opt.budget = (uint32_t)atoi(value);
+            else if (strcmp(arg, "--tolerance") == 0)
+                tolerance = atof(value);
+            else if (strcmp(arg, "--baseline") == 0)
+            {
+                if (!load_baseline(value, &baseline))
+                {
+                    fprintf(stderr, "unable to read %s\n", value);
+                    return 2;
+                }
+            }
+            else
+                args_ok = false;
+        }
+    }
+
+    for (uint32_t i = 0; args_ok && i < opt.bits.count; i++)
+        args_ok = opt.bits.values[i] == 8 || opt.bits.values[i] == 16 || opt.bits.values[i] == 32;
+    for (uint32_t i = 0; args_ok && i < opt.lens.count; i++)
+        args_ok = opt.lens.values[i] >= 1 && opt.lens.values[i] <= SUITE_MAX_LEN;
+    for (uint32_t i = 0; args_ok && i < opt.baudrs.count; i++)
+        args_ok = opt.baudrs.values[i] >= 2 && opt.baudrs.values[i] <= 0xfffe;
+    if (!args_ok)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    suite_target_t target = {0};
+    if (opt.hw && !open_hw(&target, opt.spinum))
+    {
+        fprintf(stderr, "unable to open SPI%u, run as root on a Pi 5\n", opt.spinum);
+        return 3;
+    }
+
+    rp1_spi_latency_t *latency;
+    uint8_t *tx = malloc(SUITE_MAX_LEN);
+    uint8_t *rx = malloc(SUITE_MAX_LEN);
+    if (tx == NULL || rx == NULL || !rp1_spi_latency_create(&latency))
+        return 1;
+    for (int i = 0; i < SUITE_MAX_LEN; i++)
+        tx[i] = (uint8_t)(i * 13 + 7);
+
+    printf("target,api,bits,bytes,baudr,cs,wait,iterations,status,mbps,p50_ns,p99_ns,p999_ns,max_ns,cpu_ns,reads_per_byte,writes_per_byte\n");
+
+    bool ok = true;
+    bool regressed = false;
+    for (uint32_t a = 0; a < opt.apis.count; a++)
+        for (uint32_t b = 0; b < opt.bits.count; b++)
+            for (uint32_t l = 0; l < opt.lens.count; l++)
+                for (uint32_t d = 0; d < opt.baudrs.count; d++)
+                    for (uint32_t c = 0; c < opt.cs.count; c++)
+                    {
+                        suite_api_t api = (suite_api_t)opt.apis.values[a];
+                        uint8_t bits = (uint8_t)opt.bits.values[b];
+                        if (!case_valid(api, bits, opt.lens.values[l]))
+                            continue;
+                        ok &= run_case(&opt, &target, latency, api, bits, opt.lens.values[l], opt.baudrs.values[d],
+                                       (rp1_spi_cs_control_t)opt.cs.values[c], tx, rx, &baseline, tolerance, &regressed);
+                    }
+
+    rp1_spi_latency_destroy(latency);
+    if (opt.hw)
+        close_hw(&target);
+    free(baseline.rows);
+    free(tx);
+    free(rx);
+
+    return !ok ? 1 : regressed ? 4 : 0;
+}
@@ -15,6 +15,9 @@
     run with sudo or as root
     /rpi5-rp1-spi/build/bin $ sudo ./rpi5-rp1-spi
 
+    or against the simulated SSI and pico (no Pi or root needed)
+    /rpi5-rp1-spi/build/bin $ ./rpi5-rp1-spi --sim
+
 */
 
 
@@ -22,6 +25,7 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <fcntl.h>
 #include <time.h>
@@ -30,6 +34,13 @@
 #include "rp1-spi.h"
 #include "rp1-spi-regs.h"
 #include "rp1-spi-util.h"
+#include "rp1-spi-io.h"
+#include "rp1-spi-sim.h"
+#include "rp1-spi-sim-pico.h"
+#include "rp1-spi-pico.h"
+#include "rp1-spi-stream.h"
+#include "rp1-gpio.h"
+#include "rp1-gpio-sim.h"
 #include "pi_pico_commands.h"
 
 void delay_ms(int milliseconds)
@@ -201,79 +212,119 @@ void pin_off(rp1_t *rp1, uint8_t pin)
 
 const uint8_t pins[] = {17, 27, 22, 23};
 
+// the pico's data ready output, from its GP20
+#define DRDY_PIN 25
+// how often the pico takes an encoder reading
+#define DRDY_SAMPLE_NS 100000
+
 void setup_spi_pins(rp1_t *rp1){
 
-    create_pin_2(8, rp1, 0x00);     // CS0
-    create_pin_2(9, rp1, 0x00);     // MISO
-    create_pin_2(10, rp1, 0x00);    // MOSI
-    create_pin_2(11, rp1, 0x00);    // SCLK
+    // GPIO 8 CS0, 9 MISO, 10 MOSI, 11 SCLK
+    rp1_spi_setup_pins(rp1, 0, 1);
 
 }
 
-int main(void)
+int main(int argc, char **argv)
 {
 
     int i, j;
 
-    /////////////////////////////////////////////////////////
-    // RP1
-
-    // get the peripheral base address
-    void *base = mapgpio(RP1_BAR1, RP1_BAR1_LEN);
-    if (base == NULL) {
-        printf("unable to map base\n");
-        return 4;
-    } 
+    bool use_sim = (argc > 1 && strcmp(argv[1], "--sim") == 0);
+    rp1_spi_sim_t *sim = NULL;
+    rp1_spi_sim_pico_t pico;
+    rp1_gpio_sim_t *gpio_sim = NULL;
+    rp1_t *rp1 = NULL;
+    rp1_spi_instance_t *spi;
 
-    // create a rp1 device
-    printf("creating rp1\n");
-    rp1_t *rp1;
-    if (!create_rp1(&rp1, base))
+    if (use_sim)
     {
-        printf("unable to create rp1\n");
-        return 2;
-    }
+        /////////////////////////////////////////////////////////
+        // simulated SSI with the pico model on CS0
+
+        printf("creating simulated spi\n");
+        if (!rp1_spi_sim_create(NULL, &sim))
+        {
+            printf("unable to create simulator\n");
+            return 2;
+        }
+        rp1_spi_sim_pico_init(&pico);
+        rp1_spi_sim_pico_attach(&pico, sim, 0);
+
+        // and its DRDY, on the same clock
+        if (!rp1_gpio_sim_create(sim, &gpio_sim))
+        {
+            printf("unable to create simulated gpio\n");
+            return 2;
+        }
+        pico.sample_ns = DRDY_SAMPLE_NS;
+        rp1_spi_sim_pico_attach_drdy(&pico, gpio_sim, DRDY_PIN);
 
-    /////////////////////////////////////////////////////////
-    // GPIO
-    /*
-    printf("creating pins\n");
-
-    for(i=0;i<4;i++) {
-        if(!create_pin(pins[i], rp1)) {
-            printf("unable to create pin %d\n", pins[i]);
-            return 3;
-        };
-        pin_enable_output(pins[i], rp1);
+        if (!rp1_spi_create_sim(sim, &spi))
+        {
+            printf("unable to create spi\n");
+            return 5;
+        }
     }
-
-    for (int i = 1; i < 1; i++)
+    else
     {
-        delay_ms(500);
-        for(j=0;j<4;j++) {
-            pin_on(rp1, pins[j]);
-            delay_ms(100);
+        /////////////////////////////////////////////////////////
+        // RP1
+
+        // get the peripheral base address
+        void *base = mapgpio(RP1_BAR1, RP1_BAR1_LEN);
+        if (base == NULL) {
+            printf("unable to map base\n");
+            return 4;
+        } 
+
+        // create a rp1 device
+        printf("creating rp1\n");
+        if (!create_rp1(&rp1, base))
+        {
+            printf("unable to create rp1\n");
+            return 2;
         }
 
-        delay_ms(500);
+        /////////////////////////////////////////////////////////
+        // GPIO
+        /*
+        printf("creating pins\n");
+
+        for(i=0;i<4;i++) {
+            if(!create_pin(pins[i], rp1)) {
+                printf("unable to create pin %d\n", pins[i]);
+                return 3;
+            };
+            pin_enable_output(pins[i], rp1);
+        }
 
-        for(j=0;j<4;j++) {
-            pin_off(rp1, pins[j]);
-            delay_ms(100);
-        }        
-    }
-    */
-    
-    
-    /////////////////////////////////////////////////////////
-    // SPI
+        for (int i = 1; i < 1; i++)
+        {
+            delay_ms(500);
+            for(j=0;j<4;j++) {
+                pin_on(rp1, pins[j]);
+                delay_ms(100);
+            }
 
-    // create a spi instance
-    rp1_spi_instance_t *spi;
-    if (!rp1_spi_create(rp1, 0, &spi))
-    {
-        printf("unable to create spi\n");
-        return 5;
+            delay_ms(500);
+
+            for(j=0;j<4;j++) {
+                pin_off(rp1, pins[j]);
+                delay_ms(100);
+            }        
+        }
+        */
+
+
+        /////////////////////////////////////////////////////////
+        // SPI
+
+        // create a spi instance
+        if (!rp1_spi_create(rp1, 0, &spi))
+        {
+            printf("unable to create spi\n");
+            return 5;
+        }
     }
 
     // see if we can dump the spi registers
@@ -282,43 +333,35 @@ int main(void)
     dump_ctrlr0_msg(spi, "Just after spi created");
     dump_sr_msg(spi, "Just after spi created");
 
-    // disable the SPI
-    *(volatile uint32_t *)(spi->regbase + DW_SPI_SSIENR) = 0x0;
-
-    printf("setting up the pins for SPI0\n");
-    setup_spi_pins(rp1);
-
-    // set the speed - this is the divisor from 200MHz in the RPi5
-    *(volatile uint32_t *)(spi->regbase + DW_SPI_BAUDR) = 20;
-    printf("\nbaudr: %d MHz\n", 200/(*(volatile uint32_t *)(spi->regbase + DW_SPI_BAUDR)));
+    if (rp1 != NULL)
+    {
+        printf("setting up the pins for SPI0\n");
+        setup_spi_pins(rp1);
+    }
 
-    // set mode - CPOL = 0, CPHA = 1 (Mode 1)
-    printf("Setting SPI to Mode 1\n");
-    // read control
-    uint32_t reg_ctrlr0 = *(volatile uint32_t *)(spi->regbase + DW_SPI_CTRLR0);
-    printf("ctrlr0 before setting: %x\n", reg_ctrlr0);
-    reg_ctrlr0 |= DW_PSSI_CTRLR0_SCPHA;
-    // update the control reg
-    *(volatile uint32_t *)(spi->regbase + DW_SPI_CTRLR0) = reg_ctrlr0;
-    reg_ctrlr0 = *(volatile uint32_t *)(spi->regbase + DW_SPI_CTRLR0);
-    printf("ctrlr0 after setting (might be the same as before if mode was already set): %x\n", reg_ctrlr0);
+    // the pico on CS0: mode 1 (CPOL = 0, CPHA = 1), 8 bit frames, 10MHz
+    // the profile holds the register values, selecting it writes them with the SPI disabled
+    // and enables it again
+    rp1_spi_device_config_t pico_cfg = {.cs = 0, .mode = 1, .bits = 8, .hz = 10000000};
+    rp1_spi_device_t pico_dev;
+    if (!rp1_spi_device_init(&pico_dev, spi, &pico_cfg))
+    {
+        printf("bad device settings\n");
+        return 5;
+    }
+    rp1_spi_device_select(&pico_dev);
+    printf("\nbaudr: %d MHz\n", RP1_CLK_SYS_HZ / 1000000 / pico_dev.baudr);
 
     // clear interrupts by reading the interrupt status register
-    uint32_t reg_icr = *(volatile uint32_t *)(spi->regbase + DW_SPI_ICR);
+    uint32_t reg_icr = rp1_spi_reg_read(spi, DW_SPI_ICR);
     printf("icr: %x\n", reg_icr);
-    // read ISR
-    
+
     dump_risr_msg(spi, "After clearing interrupts");
     dump_sr_msg(spi, "After clearing interrupts");
     dump_ctrlr0_msg(spi, "SPI has been set up");
 
-
-    // mask off interrupts
-    // uint32_t reg_imr = *(volatile uint32_t *)(spi->regbase + DW_SPI_IMR);
-    // *(volatile uint32_t *)(spi->regbase + DW_SPI_IMR) = reg_imr & 0xFFFFFF00;
-
-    // enable the SPI
-    *(volatile uint32_t *)(spi->regbase + DW_SPI_SSIENR) = 0x1;
+    // the pico treats the replies as a byte stream, so they can be read in 32 bit frames
+    rp1_spi_set_frame_packing(spi, true);
     
     // let's try and get 'ecoder data'
     printf("Reading data from the pico\n");
@@ -327,26 +370,10 @@ int main(void)
     
     uint8_t data[32];
     uint8_t command = CMD_READ_ENCODERS;
-    
-    spi_status_t res = rp1_spi_write_8_blocking(spi, command);
-    if(res != SPI_OK) {
-        printf("error sending command\n");
-        return 6;
-    }
 
-    printf("command sent\n");
-    dump_sr_msg(spi, "After sending command");
-    
-    // sometimes (particularly at low baud rates), data appears in the
-    // RF fifo, even if it was empty after the last write we made
-    // (see the code for rp1_spi_write_8_blocking() for more info)
-    // my workaround for this is to do a check and just clear the
-    // rx fifo again - it returns the number of dwords purged
-    int purgecount = 0;
-    res = rp1_spi_purge_rx_fifo(spi, &purgecount);
-    if(purgecount > 0 ) printf("%spurged %d dwords%s\n", "\033[1;31m", purgecount, "\033[0m");   
-
-    res = rp1_spi_read_8_n_blocking(spi, (uint8_t *)data, 32, 1000);
+    // the command and the reply are one transaction - CS stays asserted throughout and
+    // nothing is left in the rx fifo afterwards
+    spi_status_t res = rp1_spi_write_then_read(spi, &command, 1, data, 32, 1000);
     if(res != SPI_OK) {
         printf("error reading data\n");
         return 7;
@@ -366,12 +393,8 @@ int main(void)
     // get the system clock from the pico
     printf("Reading system time from the pico\n");
     uint32_t picotime;
-    res = rp1_spi_write_8_blocking(spi, CMD_READ_SYSTIME);
-    if(res != SPI_OK) {
-        printf("error sending command\n");
-        return 6;
-    }
-    res = rp1_spi_read_8_n_blocking(spi, (uint8_t *)&picotime, 4, 1000);
+    command = CMD_READ_SYSTIME;
+    res = rp1_spi_write_then_read(spi, &command, 1, (uint8_t *)&picotime, 4, 1000);
     if(res != SPI_OK) {
         printf("error reading data\n");
         return 7;
@@ -379,6 +402,89 @@ int main(void)
 
     printf("picotime: 0x%8X\n", picotime);
 
+    // the encoders again, each read as soon as the pico raises DRDY for a new reading
+    printf("Reading encoders on DRDY (GPIO%d)\n", DRDY_PIN);
+    rp1_gpio_port_t *drdy_port;
+    rp1_spi_stream_t *stream;
+    rp1_spi_latency_t *drdy_latency;
+    command = CMD_READ_ENCODERS;
+    rp1_spi_stream_config_t stream_cfg = {.device = &pico_dev, .cmd = &command, .cmd_len = 1, .len = 32, .timeout = 100};
+    bool made = sim != NULL ? rp1_gpio_port_create_sim(gpio_sim, 1u << DRDY_PIN, &drdy_port)
+                            : rp1_gpio_port_create(rp1, 1u << DRDY_PIN, &drdy_port);
+    if (!made || !rp1_spi_latency_create(&drdy_latency) || !rp1_spi_stream_create(&stream_cfg, 16, &stream))
+    {
+        printf("unable to set up DRDY reads\n");
+        return 5;
+    }
+    rp1_gpio_port_inputs(drdy_port, 1u << DRDY_PIN);
+    rp1_spi_stream_drdy_t drdy = {.port = drdy_port, .fd = -1, .pin = DRDY_PIN, .latency = drdy_latency};
+    rp1_spi_stream_set_drdy(stream, &drdy);
+
+    for (i = 0; i < 10 && rp1_spi_stream_acquire(stream); i++)
+        rp1_spi_stream_release(stream, 1);
+
+    rp1_spi_stream_stats_t stream_stats;
+    rp1_spi_stream_get_stats(stream, &stream_stats);
+    if (stream_stats.timeouts != 0)
+    {
+        // firmware from before DRDY, or the pin not wired
+        printf("no DRDY from the pico\n");
+    }
+    else
+    {
+        rp1_spi_latency_snapshot_t snap;
+        rp1_spi_latency_snapshot(drdy_latency, &snap);
+        printf("readings: %llu, DRDY to data p50: %.1f us, max: %.1f us\n", (unsigned long long)snap.count,
+               rp1_spi_latency_percentile(&snap, 50) / 1000.0, snap.max_ns / 1000.0);
+    }
+    rp1_spi_stream_destroy(stream);
+    rp1_spi_latency_destroy(drdy_latency);
+    rp1_gpio_port_destroy(drdy_port);
+
+    // the same again, framed and checked - the first request frame switches the pico over, and it
+    // is reset before the link goes so that the next run finds it taking command bytes again
+    printf("Reading encoders from the pico, framed\n");
+    rp1_spi_pico_t *link;
+    if (!rp1_spi_pico_create(&pico_dev, 1000, &link))
+    {
+        printf("unable to create the framed link\n");
+        return 5;
+    }
+    res = rp1_spi_pico_call(link, CMD_READ_ENCODERS, NULL, 0, data, 32);
+    if (res == SPI_OK)
+        res = rp1_spi_pico_call(link, CMD_READ_SYSTIME, NULL, 0, (uint8_t *)&picotime, 4);
+    if(res != SPI_OK) {
+        printf("error reading framed data: %d\n", res);
+        rp1_spi_pico_reset(link);
+        rp1_spi_pico_destroy(link);
+        return 7;
+    }
+    printf("data[0]: %d, data[31]: %d, picotime: 0x%8X\n", data[0], data[31], picotime);
+
+    rp1_spi_pico_stats_t link_stats;
+    rp1_spi_pico_get_stats(link, &link_stats);
+    printf("framed calls: %llu, transactions: %llu, retries: %llu\n", (unsigned long long)link_stats.calls,
+           (unsigned long long)link_stats.transactions, (unsigned long long)link_stats.retries);
+    if (rp1_spi_pico_reset(link) != SPI_OK)
+        printf("unable to reset the pico, it stays framed until powered off\n");
+    rp1_spi_pico_destroy(link);
+
+    rp1_spi_counters_t counters;
+    rp1_spi_get_counters(spi, &counters);
+    printf("transfers: %llu, bytes: %llu, empty polls: %llu, timeouts: %llu, overflows: %llu\n",
+           (unsigned long long)counters.transfers, (unsigned long long)counters.bytes,
+           (unsigned long long)(counters.rx_empty_polls + counters.tx_full_polls), (unsigned long long)counters.timeouts,
+           (unsigned long long)(counters.tx_overflows + counters.rx_overflows + counters.rx_underflows));
+
+    if (sim != NULL)
+    {
+        rp1_spi_sim_stats_t stats;
+        rp1_spi_sim_get_stats(sim, &stats);
+        printf("simulated time: %llu ns, register reads: %llu, writes: %llu, frames: %llu\n",
+               (unsigned long long)rp1_spi_sim_now(sim), (unsigned long long)stats.reads,
+               (unsigned long long)stats.writes, (unsigned long long)stats.frames);
+    }
+
     printf("done\n");
 
     return 0;